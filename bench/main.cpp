@@ -0,0 +1,738 @@
+// A program which runs a fixed set of benchmarks, to catch performance regressions: instruction throughput on synthetic
+// loops and on an exerciser (plus any CP/M binary named on the command line, such as ZEXDOC.COM), block instructions,
+// BDOS file I/O via the disk, building the disk's directory, and terminal output. Each benchmark is run several times
+// (see --repeats), keeping the best and median times. The results go to stdout as JSON, with a summary on stderr.
+//
+// The machine options (e.g. --engine, --cpu and --fast) apply to the benchmarks which run Z80 code, whose disk is a
+// scratch directory. Logging is off unless --loglevel says otherwise, since otherwise that is what would be measured.
+
+#include <zcpm/builder/builder.hpp>
+#include <zcpm/core/disk.hpp>
+#include <zcpm/core/diskgeometry.hpp>
+#include <zcpm/core/log.hpp>
+#include <zcpm/core/processor.hpp>
+#include <zcpm/core/snapshot.hpp>
+#include <zcpm/core/system.hpp>
+#include <zcpm/terminal/batch.hpp>
+#include <zcpm/terminal/plain.hpp>
+#include <zcpm/terminal/televideo.hpp>
+#include <zcpm/terminal/terminal.hpp>
+#include <zcpm/terminal/type.hpp>
+#include <zcpm/terminal/vt100.hpp>
+
+#include <boost/log/trivial.hpp>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    namespace fs = std::filesystem;
+
+    using Clock = std::chrono::steady_clock;
+
+    double seconds_since(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    struct Result
+    {
+        std::string name;
+        std::string unit; // What 'work' counts
+        uint64_t work;    // How much is done by each run
+        double best_s;
+        double median_s;
+        std::vector<std::pair<std::string, std::string>> extra; // Further members for the JSON, already formatted
+    };
+
+    // Run something several times, returning the best and median of the times that it reports
+    std::pair<double, double> measure(int repeats, const std::function<double()>& run)
+    {
+        std::vector<double> seconds;
+        for (auto i = 0; i < std::max(repeats, 1); ++i)
+        {
+            seconds.push_back(run());
+        }
+        std::sort(seconds.begin(), seconds.end());
+        return { seconds.front(), seconds[seconds.size() / 2] };
+    }
+
+    // A program to run at 0100, and how much it does in the benchmark's terms. They end by jumping to 0000.
+    struct Program
+    {
+        std::string name;
+        std::string unit;
+        uint64_t work;
+        bool z80_only; // Else it also runs as 8080 code
+        std::vector<uint8_t> code;
+        uint16_t result_address{ 0 }; // Where it leaves a 16-bit result, if it does so
+    };
+
+    // An 8080-compatible loop of simple loads and arithmetic
+    Program loop_program()
+    {
+        const uint16_t passes = 20000;
+        return { .name = "cpu.loop",
+                 .unit = "instructions",
+                 .work = 1 + uint64_t{ passes } * (1 + 256 * 8 + 4) + 1,
+                 .z80_only = false,
+                 .code = {
+                     0x11, passes & 0xFF, passes >> 8, // 0100 LD DE,passes
+                     0x06, 0x00,                       // 0103 LD B,0
+                     0x78,                             // 0105 LD A,B
+                     0x81,                             // 0106 ADD A,C
+                     0x4F,                             // 0107 LD C,A
+                     0xAD,                             // 0108 XOR L
+                     0x6F,                             // 0109 LD L,A
+                     0x23,                             // 010A INC HL
+                     0x05,                             // 010B DEC B
+                     0xC2, 0x05, 0x01,                 // 010C JP NZ,0105
+                     0x1B,                             // 010F DEC DE
+                     0x7A,                             // 0110 LD A,D
+                     0xB3,                             // 0111 OR E
+                     0xC2, 0x03, 0x01,                 // 0112 JP NZ,0103
+                     0xC3, 0x00, 0x00,                 // 0115 JP 0000
+                 } };
+    }
+
+    // A loop of Z80-only instructions: indexed addressing, bit rotations, DJNZ and JR
+    Program z80_loop_program()
+    {
+        const uint16_t passes = 20000;
+        return { .name = "cpu.loop_z80",
+                 .unit = "instructions",
+                 .work = 1 + uint64_t{ passes } * (1 + 256 * 6 + 5) + 1,
+                 .z80_only = true,
+                 .code = {
+                     0x11, passes & 0xFF, passes >> 8, // 0100 LD DE,passes
+                     0x06, 0x00,                       // 0103 LD B,0
+                     0xDD, 0x21, 0x00, 0x20,           // 0105 LD IX,2000
+                     0xDD, 0x7E, 0x00,                 // 0109 LD A,(IX+0)
+                     0x81,                             // 010C ADD A,C
+                     0xDD, 0x77, 0x01,                 // 010D LD (IX+1),A
+                     0xCB, 0x11,                       // 0110 RL C
+                     0xDD, 0x23,                       // 0112 INC IX
+                     0x10, 0xF3,                       // 0114 DJNZ 0109
+                     0x1B,                             // 0116 DEC DE
+                     0x7A,                             // 0117 LD A,D
+                     0xB3,                             // 0118 OR E
+                     0x20, 0xE8,                       // 0119 JR NZ,0103
+                     0xC3, 0x00, 0x00,                 // 011B JP 0000
+                 } };
+    }
+
+    // In the style of ZEXDOC: a set of 8080-compatible ALU operations applied to every combination of two operands,
+    // with each result and its flags folded into a checksum (left at 0140). A change to the checksum means a change to
+    // the emulation, rather than just to its speed.
+    Program exerciser_program()
+    {
+        const uint8_t passes = 16;
+        return { .name = "cpu.exerciser",
+                 .unit = "instructions",
+                 .work = 1 + uint64_t{ passes } * (1 + 256 * (1 + 256 * (17 + 15 + 2) + 2) + 4) + 2,
+                 .z80_only = false,
+                 .code = {
+                     0x21, 0x00, 0x00,               // 0100 LD HL,0
+                     0x16, 0x00,                     // 0103 LD D,0
+                     0x1E, 0x00,                     // 0105 LD E,0
+                     0x7A, 0x83, 0xF5,               // 0107 LD A,D / ADD A,E / PUSH AF
+                     0x7A, 0x9B, 0xF5,               // 010A LD A,D / SBC A,E / PUSH AF
+                     0x7A, 0xA3, 0x27, 0xF5,         // 010D LD A,D / AND E / DAA / PUSH AF
+                     0x7A, 0xAB, 0x17, 0xF5,         // 0111 LD A,D / XOR E / RLA / PUSH AF
+                     0x7A, 0xBB, 0xF5,               // 0115 LD A,D / CP E / PUSH AF
+                     0xC1, 0x29, 0x09,               // 0118 POP BC / ADD HL,HL / ADD HL,BC
+                     0xC1, 0x29, 0x09,               // 011B (likewise, for each of the five results)
+                     0xC1, 0x29, 0x09,               // 011E
+                     0xC1, 0x29, 0x09,               // 0121
+                     0xC1, 0x29, 0x09,               // 0124
+                     0x1C,                           // 0127 INC E
+                     0xC2, 0x07, 0x01,               // 0128 JP NZ,0107
+                     0x14,                           // 012B INC D
+                     0xC2, 0x05, 0x01,               // 012C JP NZ,0105
+                     0x3A, 0x3F, 0x01,               // 012F LD A,(013F)
+                     0x3D,                           // 0132 DEC A
+                     0x32, 0x3F, 0x01,               // 0133 LD (013F),A
+                     0xC2, 0x03, 0x01,               // 0136 JP NZ,0103
+                     0x22, 0x40, 0x01,               // 0139 LD (0140),HL
+                     0xC3, 0x00, 0x00,               // 013C JP 0000
+                     passes,                         // 013F Passes still to go
+                     0x00, 0x00,                     // 0140 Checksum
+                 },
+                 .result_address = 0x0140 };
+    }
+
+    // LDIR or CPIR over 16K at a time (CPIR looks for a byte which isn't there, so each goes the whole way)
+    Program block_program(bool compare)
+    {
+        const uint16_t passes = 60000;
+        const uint16_t length = 0x4000;
+        Program result{ .name = compare ? "cpu.cpir" : "cpu.ldir",
+                        .unit = "bytes",
+                        .work = uint64_t{ passes } * length,
+                        .z80_only = true,
+                        .code = {} };
+        if (compare)
+        {
+            result.code = {
+                0x21, 0x00, 0x20,                 // 0100 LD HL,2000
+                0x01, 0x00, length >> 8,          // 0103 LD BC,length
+                0x3E, 0xFF,                       // 0106 LD A,FF
+                0xED, 0xB1,                       // 0108 CPIR
+                0x2A, 0x19, 0x01,                 // 010A LD HL,(0119)
+                0x2B,                             // 010D DEC HL
+                0x22, 0x19, 0x01,                 // 010E LD (0119),HL
+                0x7C,                             // 0111 LD A,H
+                0xB5,                             // 0112 OR L
+                0xC2, 0x00, 0x01,                 // 0113 JP NZ,0100
+                0xC3, 0x00, 0x00,                 // 0116 JP 0000
+                passes & 0xFF, passes >> 8,       // 0119 Passes still to go
+            };
+        }
+        else
+        {
+            result.code = {
+                0x21, 0x00, 0x20,                 // 0100 LD HL,2000
+                0x11, 0x00, 0x60,                 // 0103 LD DE,6000
+                0x01, 0x00, length >> 8,          // 0106 LD BC,length
+                0xED, 0xB0,                       // 0109 LDIR
+                0x2A, 0x1A, 0x01,                 // 010B LD HL,(011A)
+                0x2B,                             // 010E DEC HL
+                0x22, 0x1A, 0x01,                 // 010F LD (011A),HL
+                0x7C,                             // 0112 LD A,H
+                0xB5,                             // 0113 OR L
+                0xC2, 0x00, 0x01,                 // 0114 JP NZ,0100
+                0xC3, 0x00, 0x00,                 // 0117 JP 0000
+                passes & 0xFF, passes >> 8,       // 011A Passes still to go
+            };
+        }
+        return result;
+    }
+
+    // The file which the BDOS benchmarks write and read: BENCH.DAT, of this many records
+    const uint16_t FileRecords = 2048;
+
+    std::vector<uint8_t> file_fcb()
+    {
+        std::vector<uint8_t> fcb{ 0x00, 'B', 'E', 'N', 'C', 'H', ' ', ' ', ' ', 'D', 'A', 'T' };
+        fcb.resize(36);
+        return fcb;
+    }
+
+    // Write BENCH.DAT a record at a time (after deleting it, if it's already there)
+    Program write_file_program()
+    {
+        Program result{ .name = "bdos.write_sequential",
+                        .unit = "records",
+                        .work = FileRecords,
+                        .z80_only = false,
+                        .code = {
+                            0x0E, 0x13,                               // 0100 LD C,19 (delete file)
+                            0x11, 0x31, 0x01,                         // 0102 LD DE,0131
+                            0xCD, 0x05, 0x00,                         // 0105 CALL 0005
+                            0x0E, 0x16,                               // 0108 LD C,22 (make file)
+                            0x11, 0x31, 0x01,                         // 010A LD DE,0131
+                            0xCD, 0x05, 0x00,                         // 010D CALL 0005
+                            0x0E, 0x15,                               // 0110 LD C,21 (write sequential)
+                            0x11, 0x31, 0x01,                         // 0112 LD DE,0131
+                            0xCD, 0x05, 0x00,                         // 0115 CALL 0005
+                            0x2A, 0x2F, 0x01,                         // 0118 LD HL,(012F)
+                            0x2B,                                     // 011B DEC HL
+                            0x22, 0x2F, 0x01,                         // 011C LD (012F),HL
+                            0x7C,                                     // 011F LD A,H
+                            0xB5,                                     // 0120 OR L
+                            0xC2, 0x10, 0x01,                         // 0121 JP NZ,0110
+                            0x0E, 0x10,                               // 0124 LD C,16 (close file)
+                            0x11, 0x31, 0x01,                         // 0126 LD DE,0131
+                            0xCD, 0x05, 0x00,                         // 0129 CALL 0005
+                            0xC3, 0x00, 0x00,                         // 012C JP 0000
+                            FileRecords & 0xFF, FileRecords >> 8,     // 012F Records still to go
+                        } };
+        const auto fcb = file_fcb(); // 0131
+        result.code.insert(result.code.end(), fcb.begin(), fcb.end());
+        return result;
+    }
+
+    // Read BENCH.DAT a record at a time, from start to end
+    Program read_file_program()
+    {
+        Program result{ .name = "bdos.read_sequential",
+                        .unit = "records",
+                        .work = FileRecords,
+                        .z80_only = false,
+                        .code = {
+                            0x0E, 0x0F,                               // 0100 LD C,15 (open file)
+                            0x11, 0x21, 0x01,                         // 0102 LD DE,0121
+                            0xCD, 0x05, 0x00,                         // 0105 CALL 0005
+                            0x0E, 0x14,                               // 0108 LD C,20 (read sequential)
+                            0x11, 0x21, 0x01,                         // 010A LD DE,0121
+                            0xCD, 0x05, 0x00,                         // 010D CALL 0005
+                            0x2A, 0x1F, 0x01,                         // 0110 LD HL,(011F)
+                            0x2B,                                     // 0113 DEC HL
+                            0x22, 0x1F, 0x01,                         // 0114 LD (011F),HL
+                            0x7C,                                     // 0117 LD A,H
+                            0xB5,                                     // 0118 OR L
+                            0xC2, 0x08, 0x01,                         // 0119 JP NZ,0108
+                            0xC3, 0x00, 0x00,                         // 011C JP 0000
+                            FileRecords & 0xFF, FileRecords >> 8,     // 011F Records still to go
+                        } };
+        const auto fcb = file_fcb(); // 0121
+        result.code.insert(result.code.end(), fcb.begin(), fcb.end());
+        return result;
+    }
+
+    // Read as many records of BENCH.DAT, in a scattered order which visits each of them once
+    Program read_random_program()
+    {
+        const uint8_t mask = (FileRecords - 1) >> 8;
+        Program result{ .name = "bdos.read_random",
+                        .unit = "records",
+                        .work = FileRecords,
+                        .z80_only = false,
+                        .code = {
+                            0x0E, 0x0F,                               // 0100 LD C,15 (open file)
+                            0x11, 0x34, 0x01,                         // 0102 LD DE,0134
+                            0xCD, 0x05, 0x00,                         // 0105 CALL 0005
+                            0x2A, 0x32, 0x01,                         // 0108 LD HL,(0132)
+                            0x11, 0x01, 0x03,                         // 010B LD DE,0301 (an odd stride)
+                            0x19,                                     // 010E ADD HL,DE
+                            0x7C,                                     // 010F LD A,H
+                            0xE6, mask,                               // 0110 AND mask
+                            0x67,                                     // 0112 LD H,A
+                            0x22, 0x32, 0x01,                         // 0113 LD (0132),HL
+                            0x22, 0x55, 0x01,                         // 0116 LD (0155),HL (the FCB's R0 and R1)
+                            0x0E, 0x21,                               // 0119 LD C,33 (read random)
+                            0x11, 0x34, 0x01,                         // 011B LD DE,0134
+                            0xCD, 0x05, 0x00,                         // 011E CALL 0005
+                            0x2A, 0x30, 0x01,                         // 0121 LD HL,(0130)
+                            0x2B,                                     // 0124 DEC HL
+                            0x22, 0x30, 0x01,                         // 0125 LD (0130),HL
+                            0x7C,                                     // 0128 LD A,H
+                            0xB5,                                     // 0129 OR L
+                            0xC2, 0x08, 0x01,                         // 012A JP NZ,0108
+                            0xC3, 0x00, 0x00,                         // 012D JP 0000
+                            FileRecords & 0xFF, FileRecords >> 8,     // 0130 Records still to go
+                            0x00, 0x00,                               // 0132 The last record read
+                        } };
+        const auto fcb = file_fcb(); // 0134
+        result.code.insert(result.code.end(), fcb.begin(), fcb.end());
+        return result;
+    }
+
+    // Runs programs, each on a fresh machine which starts from the same booted state and whose disk is the scratch
+    // directory
+    class Machines final
+    {
+    public:
+        Machines(const zcpm::MachineOptions& options, const fs::path& directory)
+            : m_options(options), m_config(options.config)
+        {
+            m_config.bdos_sym.clear();
+            m_config.disk_root = directory.string();
+            m_config.disk_image.clear();
+            m_config.directory_index.clear();
+            fs::create_directories(directory);
+
+            auto booting = m_options;
+            booting.config = m_config;
+            booting.snapshot_file.clear();
+            auto p_machine = zcpm::boot_machine(
+                booting,
+                std::make_unique<zcpm::terminal::Batch>(m_options.rows, m_options.columns, "/dev/null", "/dev/null"));
+            if (!p_machine)
+            {
+                throw std::runtime_error("Failed to boot");
+            }
+            m_snapshot = p_machine->m_hardware.save_snapshot();
+        }
+
+        // Returns how long the program took to run, not counting setting up the machine. 'load' gets the program
+        // ready to run, and 'inspect' can look at what it left behind.
+        double run(const std::function<void(zcpm::System&)>& load,
+                   const std::function<void(const zcpm::System&, uint64_t cycles)>& inspect)
+        {
+            zcpm::System machine(
+                std::make_unique<zcpm::terminal::Batch>(m_options.rows, m_options.columns, "/dev/null", "/dev/null"),
+                m_config);
+            machine.m_hardware.restore_snapshot(m_snapshot);
+            machine.forget_disk_login();
+            load(machine);
+
+            const auto cycles = machine.m_hardware.m_processor->get_cycle_count();
+            const auto start = Clock::now();
+            machine.run();
+            const auto seconds = seconds_since(start);
+            inspect(machine, machine.m_hardware.m_processor->get_cycle_count() - cycles);
+            return seconds;
+        }
+
+    private:
+        const zcpm::MachineOptions& m_options;
+        zcpm::Config m_config;
+        zcpm::Snapshot m_snapshot;
+    };
+
+    void add_cycles(Result& result, uint64_t cycles)
+    {
+        // Fast mode doesn't count cycles
+        if (cycles > 0)
+        {
+            result.extra.emplace_back("cycles", fmt::format("{:d}", cycles));
+            result.extra.emplace_back("emulated_mhz",
+                                      fmt::format("{:.3f}", static_cast<double>(cycles) / result.best_s / 1e6));
+        }
+    }
+
+    Result bench_program(Machines& machines, const Program& program, int repeats)
+    {
+        // The block instructions work on 2000-9FFF, which starts out clear
+        const std::vector<uint8_t> clear(0x8000, 0x00);
+        uint64_t cycles = 0;
+        uint16_t checksum = 0;
+        const auto [best, median] = measure(repeats, [&]() {
+            return machines.run(
+                [&](zcpm::System& machine) {
+                    machine.m_hardware.copy_to_ram(clear.data(), clear.size(), 0x2000);
+                    machine.m_hardware.copy_to_ram(program.code.data(), program.code.size(), 0x0100);
+                    machine.load_fcb({});
+                    machine.reset();
+                },
+                [&](const zcpm::System& machine, uint64_t elapsed) {
+                    cycles = elapsed;
+                    checksum = machine.m_hardware.read_word(program.result_address);
+                });
+        });
+
+        Result result{ .name = program.name,
+                       .unit = program.unit,
+                       .work = program.work,
+                       .best_s = best,
+                       .median_s = median,
+                       .extra = {} };
+        add_cycles(result, cycles);
+        if (program.result_address != 0)
+        {
+            result.extra.emplace_back("checksum", fmt::format("\"{:04X}\"", checksum));
+        }
+        return result;
+    }
+
+    // A CP/M binary from the host, such as an instruction exerciser
+    Result bench_binary(Machines& machines,
+                        const std::string& binary,
+                        const std::vector<std::string>& arguments,
+                        int repeats)
+    {
+        uint64_t cycles = 0;
+        const auto [best, median] = measure(repeats, [&]() {
+            return machines.run(
+                [&](zcpm::System& machine) {
+                    if (!zcpm::load_program(machine, binary, arguments))
+                    {
+                        throw std::runtime_error("Can't load " + binary);
+                    }
+                },
+                [&](const zcpm::System&, uint64_t elapsed) { cycles = elapsed; });
+        });
+
+        Result result{ .name = "program." + fs::path(binary).filename().string(),
+                       .unit = "runs",
+                       .work = 1,
+                       .best_s = best,
+                       .median_s = median,
+                       .extra = {} };
+        add_cycles(result, cycles);
+        return result;
+    }
+
+    // Build the disk's directory from a host directory of the specified number of (tiny) files. The geometry is the
+    // largest that the BIOS can describe, with 8192 directory entries, so that most of them are used; the files which
+    // don't fit are still examined.
+    Result bench_directory(const zcpm::Config& config, const fs::path& directory, size_t files, int repeats)
+    {
+        fs::create_directories(directory);
+        for (size_t i = 0; i < files; ++i)
+        {
+            std::ofstream(directory / fmt::format("F{:05d}.DAT", i)) << 'x';
+        }
+
+        auto behaviour = config;
+        behaviour.disk_root = directory.string();
+        behaviour.disk_image.clear();
+        behaviour.directory_index.clear();
+        behaviour.flush_interval_ms = 0;
+        behaviour.disk_geometry = { .spt = 0x0080, .bsh = 0x07, .dsm = 0x3FFF, .drm = 0x1FFF, .off = 0x0000 };
+
+        size_t entries = 0;
+        const auto [best, median] = measure(repeats, [&]() {
+            const auto start = Clock::now();
+            const zcpm::Disk disk(behaviour);
+            const auto seconds = seconds_since(start);
+            entries = disk.size();
+            return seconds;
+        });
+
+        Result result{ .name = fmt::format("disk.directory_{:d}", files),
+                       .unit = "files",
+                       .work = files,
+                       .best_s = best,
+                       .median_s = median,
+                       .extra = {} };
+        result.extra.emplace_back("entries", fmt::format("{:d}", entries));
+        return result;
+    }
+
+    // While one of these exists, the standard input and output are /dev/null, so that a terminal can be driven without
+    // the host's terminal, and its output thrown away
+    class NullConsole final
+    {
+    public:
+        NullConsole() : m_stdin(::dup(STDIN_FILENO)), m_stdout(::dup(STDOUT_FILENO))
+        {
+            std::cout.flush();
+            std::fflush(stdout);
+            const auto null = ::open("/dev/null", O_RDWR);
+            if ((m_stdin < 0) || (m_stdout < 0) || (null < 0))
+            {
+                throw std::runtime_error("Can't open /dev/null");
+            }
+            ::dup2(null, STDIN_FILENO);
+            ::dup2(null, STDOUT_FILENO);
+            ::close(null);
+        }
+
+        NullConsole(const NullConsole&) = delete;
+        NullConsole& operator=(const NullConsole&) = delete;
+        NullConsole(NullConsole&&) = delete;
+        NullConsole& operator=(NullConsole&&) = delete;
+
+        ~NullConsole()
+        {
+            std::cout.flush();
+            std::fflush(stdout);
+            ::dup2(m_stdin, STDIN_FILENO);
+            ::dup2(m_stdout, STDOUT_FILENO);
+            ::close(m_stdin);
+            ::close(m_stdout);
+        }
+
+    private:
+        int m_stdin;
+        int m_stdout;
+    };
+
+    // A screenful of text, each row placed by cursor addressing where the terminal has that, with every fourth row
+    // highlighted and the rest of each row cleared
+    std::string screen_text(zcpm::terminal::Type type, int rows, int columns)
+    {
+        std::string result;
+        for (auto row = 0; row < rows; ++row)
+        {
+            std::string text;
+            for (auto column = 0; column < columns - 8; ++column)
+            {
+                text += ((column % 8) == 7) ? ' ' : static_cast<char>('A' + (row + column) % 26);
+            }
+            const auto highlight = (row % 4) == 0;
+            switch (type)
+            {
+            case zcpm::terminal::Type::VT100:
+                result += fmt::format("\033[{:d};1H{}{}{}\033[K",
+                                      row + 1,
+                                      highlight ? "\033[7m" : "",
+                                      text,
+                                      highlight ? "\033[0m" : "");
+                break;
+            case zcpm::terminal::Type::TELEVIDEO:
+                result += fmt::format("\033={}{}{}{}{}\033T",
+                                      static_cast<char>(' ' + row),
+                                      ' ',
+                                      highlight ? "\033(" : "",
+                                      text,
+                                      highlight ? "\033)" : "");
+                break;
+            default: result += text + "\r\n"; break;
+            }
+        }
+        return result;
+    }
+
+    // Print a few megabytes through Terminal::print (ANSI rather than ncurses for the screen-based terminals, which
+    // have no host terminal to draw on)
+    Result bench_terminal(zcpm::terminal::Type type, std::string_view name, int rows, int columns, int repeats)
+    {
+        const auto text = screen_text(type, rows, columns);
+        const auto screens = 0x400000 / text.size();
+        const auto [best, median] = measure(repeats, [&]() {
+            const NullConsole null_console;
+            std::unique_ptr<zcpm::terminal::Terminal> p_terminal;
+            switch (type)
+            {
+            case zcpm::terminal::Type::VT100:
+                p_terminal = std::make_unique<zcpm::terminal::Vt100>(rows, columns, "", false);
+                break;
+            case zcpm::terminal::Type::TELEVIDEO:
+                p_terminal = std::make_unique<zcpm::terminal::Televideo>(rows, columns, "", false);
+                break;
+            default: p_terminal = std::make_unique<zcpm::terminal::Plain>(rows, columns, false); break;
+            }
+
+            const auto start = Clock::now();
+            for (size_t i = 0; i < screens; ++i)
+            {
+                for (const auto ch : text)
+                {
+                    p_terminal->print(ch);
+                }
+            }
+            return seconds_since(start);
+        });
+
+        return { .name = fmt::format("terminal.{}", name),
+                 .unit = "bytes",
+                 .work = screens * text.size(),
+                 .best_s = best,
+                 .median_s = median,
+                 .extra = {} };
+    }
+
+    std::string_view engine_name(zcpm::Engine engine)
+    {
+        switch (engine)
+        {
+        case zcpm::Engine::INTERPRETER: return "INTERPRETER";
+        case zcpm::Engine::BLOCK_CACHE: return "BLOCKCACHE";
+        case zcpm::Engine::TRANSLATE: return "TRANSLATE";
+        }
+        return "?";
+    }
+
+    void write_json(std::ostream& os, const zcpm::MachineOptions& options, const std::vector<Result>& results)
+    {
+        os << "{\n";
+        os << fmt::format(R"(  "config": {{"engine":"{}","cpu":"{}","fast":{},"lazy_flags":{},"memcheck":{},)"
+                          R"("native_bdos":{},"repeats":{:d}}},)"
+                          "\n",
+                          engine_name(options.config.engine),
+                          (options.config.cpu == zcpm::Cpu::Z80) ? "Z80" : "8080",
+                          options.config.fast,
+                          options.config.lazy_flags,
+                          options.config.memcheck,
+                          options.config.native_bdos,
+                          std::max(options.repeats, 1));
+        os << "  \"benchmarks\": [";
+        auto first = true;
+        for (const auto& result : results)
+        {
+            std::string extra;
+            for (const auto& [key, value] : result.extra)
+            {
+                extra += fmt::format(",\"{}\":{}", key, value);
+            }
+            os << (first ? "\n    " : ",\n    ")
+               << fmt::format(R"({{"name":"{}","unit":"{}","work":{:d},"best_s":{:.6f},"median_s":{:.6f},)"
+                              R"("rate":{:.1f}{}}})",
+                              result.name,
+                              result.unit,
+                              result.work,
+                              result.best_s,
+                              result.median_s,
+                              static_cast<double>(result.work) / result.best_s,
+                              extra);
+            first = false;
+        }
+        os << "\n  ]\n";
+        os << "}\n";
+    }
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const auto options = zcpm::parse_command_line(argc, argv, false, zcpm::log::Level::none);
+    if (!options)
+    {
+        return EXIT_FAILURE;
+    }
+
+    const auto directory = fs::temp_directory_path() / fmt::format("zcpm-bench-{:d}", ::getpid());
+    std::vector<Result> results;
+    auto ok = false;
+    try
+    {
+        fs::create_directories(directory);
+        const auto report = [&results](Result result) {
+            std::cerr << fmt::format("{:<28}{:>16.1f} {}/s  (best {:.3f}s, median {:.3f}s)",
+                                     result.name,
+                                     static_cast<double>(result.work) / result.best_s,
+                                     result.unit,
+                                     result.best_s,
+                                     result.median_s)
+                      << std::endl;
+            results.push_back(std::move(result));
+        };
+
+        Machines machines(*options, directory / "disk");
+        for (const auto& program : { loop_program(),
+                                     z80_loop_program(),
+                                     exerciser_program(),
+                                     block_program(false),
+                                     block_program(true),
+                                     write_file_program(),
+                                     read_file_program(),
+                                     read_random_program() })
+        {
+            if (program.z80_only && (options->config.cpu != zcpm::Cpu::Z80))
+            {
+                std::cerr << program.name << " skipped (Z80 only)" << std::endl;
+                continue;
+            }
+            report(bench_program(machines, program, options->repeats));
+        }
+        if (!options->binary.empty())
+        {
+            report(bench_binary(machines, options->binary, options->arguments, options->repeats));
+        }
+
+        for (const auto files : { 10, 1000, 10000 })
+        {
+            const auto host_directory = directory / fmt::format("dir{:d}", files);
+            report(bench_directory(options->config, host_directory, files, options->repeats));
+        }
+
+        report(bench_terminal(zcpm::terminal::Type::PLAIN, "plain", options->rows, options->columns, options->repeats));
+        report(bench_terminal(zcpm::terminal::Type::VT100, "vt100", options->rows, options->columns, options->repeats));
+        report(bench_terminal(
+            zcpm::terminal::Type::TELEVIDEO, "televideo", options->rows, options->columns, options->repeats));
+
+        write_json(std::cout, *options, results);
+        ok = true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        BOOST_LOG_TRIVIAL(trace) << "Exception: " << e.what();
+    }
+
+    std::error_code error;
+    fs::remove_all(directory, error);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,20 +1,29 @@
 #include "builder.hpp"
 
 #include <zcpm/core/config.hpp>
+#include <zcpm/core/diskgeometry.hpp>
+#include <zcpm/core/cpu.hpp>
+#include <zcpm/core/engine.hpp>
+#include <zcpm/core/log.hpp>
 #include <zcpm/core/system.hpp>
+#include <zcpm/terminal/batch.hpp>
 #include <zcpm/terminal/plain.hpp>
 #include <zcpm/terminal/televideo.hpp>
 #include <zcpm/terminal/terminal.hpp>
 #include <zcpm/terminal/type.hpp>
 #include <zcpm/terminal/vt100.hpp>
 
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
 #include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup.hpp>
 #include <boost/program_options.hpp>
 
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string>
 #include <vector>
 
 namespace zcpm
@@ -26,34 +35,22 @@ namespace zcpm
         return value + "/" + addendum;
     }
 
-    std::unique_ptr<zcpm::System> build_machine(int argc, char** argv)
+    std::optional<MachineOptions> parse_command_line(int argc,
+                                                     char** argv,
+                                                     bool need_binary,
+                                                     log::Level default_log_level)
     {
-        // Command line parameters and their defaults
+        MachineOptions options;
         std::string logfile = "zcpm.log";
-        std::string bdos_file_name;                      // The file that provides a binary BDOS (and CCP etc)
-        uint16_t bdos_file_base = 0xDC00;                // Where to load that binary image
-        uint16_t wboot = 0xF203;                         // Address of WBOOT in loaded binary BDOS
-        uint16_t fbase = 0xE406;                         // Address of FBASE in loaded binary BDOS
-        terminal::Type terminal = terminal::Type::PLAIN; // Terminal type
-        std::string keymap_file_name; // The file that provides keystroke mapping for terminal emulation
-        int columns = 80;             // Number of display columns
-        int rows = 24;                // Number of display rows
-        Config config = { .memcheck = true,
-                          .log_bdos = true,
-                          .protect_warm_start_vector = true,
-                          .protect_bdos_jump = true,
-                          .bdos_sym = "~/zcpm/bdos.lab",
-                          .user_sym = "" };
-        std::string binary; // The CP/M binary that we try to load and execute
-        std::vector<std::string> arguments;
+        log::Level log_level = default_log_level; // Least severe level of log messages to write
 
         try
         {
             namespace po = boost::program_options;
             po::options_description desc("Supported options");
             desc.add_options()("help", "Displays this information")(
-                "bdosfile", po::value<std::string>(), "Binary file that provides BDOS etc")(
-                "bdossym", po::value<std::string>(), "Optional symbol (.lab) file for BDOS")(
+                "bdosfile", po::value<std::string>(), "Binary file that provides BDOS etc (default=built in)")(
+                "bdossym", po::value<std::string>(), "Optional symbol (.lab) file for BDOS (default=built in)")(
                 "usersym", po::value<std::string>(), "Optional symbol (.lab) file for user executable")(
                 "bdosbase", po::value<uint16_t>(), "Base address for binary BDOS file")(
                 "wboot", po::value<uint16_t>(), "Address of WBOOT in loaded binary BDOS")(
@@ -61,11 +58,46 @@ namespace zcpm
                 "terminal", po::value<terminal::Type>(), "Terminal type to emulate")(
                 "keymap", po::value<std::string>(), "Optional keymap file for terminal emulation")(
                 "columns", po::value<int>(), "Terminal column count")("rows", po::value<int>(), "Terminal row count")(
+                "lineflush", po::value<bool>(), "Write plain terminal output at each newline?")(
+                "curses", po::value<bool>(), "Draw VT100/Televideo screens via ncurses (else via ANSI sequences)?")(
+                "batchinput", po::value<std::string>(), "File of keystrokes for the batch terminal (default=stdin)")(
+                "batchoutput", po::value<std::string>(), "File for output from the batch terminal (default=stdout)")(
+                "batchend", po::value<bool>(), "End a batch run when the program waits for more input than given?")(
                 "memcheck", po::value<bool>(), "Enable memory access checks?")(
                 "logbdos", po::value<bool>(), "Enable logging of BDOS calls?")(
+                "calltrace", po::value<int>(), "Keep the last N BDOS/BIOS calls in a binary trace instead (0=no)")(
+                "profile", po::value<std::string>(), "File to write an execution profile to at exit (default=none)")(
+                "profilestacks", po::value<std::string>(), "File for the profile's call stacks, for flame graphs")(
                 "protectwarm", po::value<bool>(), "Protect warm start vector from modification?")(
                 "protectbdosjump", po::value<bool>(), "Protect BDOS jump vector from modification?")(
+                "engine", po::value<Engine>(), "Execution engine (INTERPRETER, BLOCKCACHE or TRANSLATE)")(
+                "cpu", po::value<Cpu>(), "Processor to emulate (Z80 or 8080)")(
+                "lazyflags", po::value<bool>(), "Only compute flags when they are needed?")(
+                "fast", po::value<bool>(), "Skip counting cycles and emulating the R register, where possible?")(
+                "idlepolls", po::value<int>(), "Unsuccessful console polls before waiting for input (0=never)")(
+                "idletimeout", po::value<int>(), "Milliseconds to wait for input when idle")(
+                "sectorcache", po::value<int>(), "Kilobytes of disk sectors to cache (0=no limit)")(
+                "flushonclose", po::value<bool>(), "Write files to the host as soon as they are closed?")(
+                "flushsectors", po::value<int>(), "Write changes to the host after this many sector writes (0=never)")(
+                "flushinterval", po::value<int>(), "Milliseconds between writes of changes to the host (0=never)")(
+                "fsync", po::value<bool>(), "Wait for writes to the host to reach the storage device?")(
+                "nativebdos", po::value<bool>(), "Handle BDOS file record reads & writes directly on the disk?")(
+                "nativeconsole", po::value<bool>(), "Handle BDOS console output directly, a string at a time?")(
+                "diskroot", po::value<std::string>(), "Host directory to use as the disk (default=current directory)")(
+                "diskimage", po::value<std::string>(), "Raw CP/M disk image to use instead of a host directory")(
+                "diskgeometry", po::value<DiskGeometry>(), "Geometry of the disk (SPT,BSH,DSM,DRM,OFF)")(
+                "dirindex", po::value<std::string>(), "File in which to keep the layout of the current directory")(
+                "clock", po::value<int>(), "Emulated clock rate in kHz, to pace timer interrupts to (0=no pacing)")(
+                "timer", po::value<int>(), "Rate of timer interrupts, per second (0=none)")(
+                "snapshot", po::value<std::string>(), "Start from this snapshot of the booted system (made if absent)")(
+                "socket", po::value<std::string>(), "Unix socket on which to listen for jobs (server only)")(
+                "jobs", po::value<std::string>(), "File listing the jobs to run (scheduler only)")(
+                "threads", po::value<int>(), "How many jobs to run at once (scheduler only; 0=one per core)")(
+                "stats", po::value<bool>(), "Show BDOS/BIOS call, disk & terminal statistics at exit (runner only)")(
+                "statsjson", po::value<std::string>(), "File to write those statistics to, as JSON (runner only)")(
+                "repeats", po::value<int>(), "How many times to run each benchmark (bench only)")(
                 "logfile", po::value<std::string>(), "Name of logfile")(
+                "loglevel", po::value<log::Level>(), "Least severe level to log (TRACE,DEBUG,INFO,WARNING,ERROR,NONE)")(
                 "binary", po::value<std::string>(), "CP/M binary input file to execute")(
                 "args", po::value<std::vector<std::string>>(), "Parameters for binary");
             po::positional_options_description p;
@@ -81,139 +113,379 @@ namespace zcpm
             {
                 std::cout << "ZCPM v0.1" << std::endl << std::endl;
                 std::cout << desc << std::endl;
-                return nullptr;
+                return std::nullopt;
+            }
+            if (vm.count("bdosfile"))
+            {
+                options.bdos_file_name = vm["bdosfile"].as<std::string>();
+            }
+            if (vm.count("bdossym"))
+            {
+                options.config.bdos_sym = vm["bdossym"].as<std::string>();
             }
-            bdos_file_name = (vm.count("bdosfile")) ? vm["bdosfile"].as<std::string>() : home_plus("zcpm/bdos.bin");
-            config.bdos_sym = (vm.count("bdossym")) ? vm["bdossym"].as<std::string>() : home_plus("zcpm/bdos.lab");
             if (vm.count("bdosbase"))
             {
-                bdos_file_base = vm["bdosbase"].as<uint16_t>();
+                options.bdos_file_base = vm["bdosbase"].as<uint16_t>();
             }
             if (vm.count("wboot"))
             {
-                wboot = vm["wboot"].as<uint16_t>();
+                options.wboot = vm["wboot"].as<uint16_t>();
             }
             if (vm.count("fbase"))
             {
-                fbase = vm["fbase"].as<uint16_t>();
+                options.fbase = vm["fbase"].as<uint16_t>();
             }
             if (vm.count("terminal"))
             {
-                terminal = vm["terminal"].as<terminal::Type>();
+                options.terminal = vm["terminal"].as<terminal::Type>();
             }
-            keymap_file_name = (vm.count("keymap")) ? vm["keymap"].as<std::string>() : home_plus("zcpm/wordstar.keys");
+            options.keymap_file_name =
+                (vm.count("keymap")) ? vm["keymap"].as<std::string>() : home_plus("zcpm/wordstar.keys");
             if (vm.count("columns"))
             {
-                columns = vm["columns"].as<int>();
+                options.columns = vm["columns"].as<int>();
             }
             if (vm.count("rows"))
             {
-                rows = vm["rows"].as<int>();
+                options.rows = vm["rows"].as<int>();
+            }
+            if (vm.count("lineflush"))
+            {
+                options.line_flush = vm["lineflush"].as<bool>();
+            }
+            if (vm.count("curses"))
+            {
+                options.use_curses = vm["curses"].as<bool>();
+            }
+            if (vm.count("batchinput"))
+            {
+                options.batch_input = vm["batchinput"].as<std::string>();
+            }
+            if (vm.count("batchoutput"))
+            {
+                options.batch_output = vm["batchoutput"].as<std::string>();
+            }
+            if (vm.count("batchend"))
+            {
+                options.batch_end = vm["batchend"].as<bool>();
             }
             if (vm.count("memcheck"))
             {
-                config.memcheck = vm["memcheck"].as<bool>();
+                options.config.memcheck = vm["memcheck"].as<bool>();
             }
             if (vm.count("logbdos"))
             {
-                config.log_bdos = vm["logbdos"].as<bool>();
+                options.config.log_bdos = vm["logbdos"].as<bool>();
+            }
+            if (vm.count("calltrace"))
+            {
+                options.config.call_trace = vm["calltrace"].as<int>();
+            }
+            if (vm.count("profile"))
+            {
+                options.config.profile = vm["profile"].as<std::string>();
+            }
+            if (vm.count("profilestacks"))
+            {
+                options.config.profile_stacks = vm["profilestacks"].as<std::string>();
             }
             if (vm.count("protectwarm"))
             {
-                config.protect_warm_start_vector = vm["protectwarm"].as<bool>();
+                options.config.protect_warm_start_vector = vm["protectwarm"].as<bool>();
             }
             if (vm.count("protectbdosjump"))
             {
-                config.protect_bdos_jump = vm["protectbdosjump"].as<bool>();
+                options.config.protect_bdos_jump = vm["protectbdosjump"].as<bool>();
+            }
+            if (vm.count("engine"))
+            {
+                options.config.engine = vm["engine"].as<Engine>();
+            }
+            if (vm.count("cpu"))
+            {
+                options.config.cpu = vm["cpu"].as<Cpu>();
+            }
+            if (vm.count("lazyflags"))
+            {
+                options.config.lazy_flags = vm["lazyflags"].as<bool>();
+            }
+            if (vm.count("fast"))
+            {
+                options.config.fast = vm["fast"].as<bool>();
+            }
+            if (vm.count("idlepolls"))
+            {
+                options.config.idle_polls = vm["idlepolls"].as<int>();
+            }
+            if (vm.count("idletimeout"))
+            {
+                options.config.idle_timeout_ms = vm["idletimeout"].as<int>();
+            }
+            if (vm.count("sectorcache"))
+            {
+                options.config.sector_cache_kb = vm["sectorcache"].as<int>();
+            }
+            if (vm.count("flushonclose"))
+            {
+                options.config.flush_on_close = vm["flushonclose"].as<bool>();
+            }
+            if (vm.count("flushsectors"))
+            {
+                options.config.flush_sectors = vm["flushsectors"].as<int>();
+            }
+            if (vm.count("flushinterval"))
+            {
+                options.config.flush_interval_ms = vm["flushinterval"].as<int>();
+            }
+            if (vm.count("fsync"))
+            {
+                options.config.flush_sync = vm["fsync"].as<bool>();
+            }
+            if (vm.count("nativebdos"))
+            {
+                options.config.native_bdos = vm["nativebdos"].as<bool>();
+            }
+            if (vm.count("nativeconsole"))
+            {
+                options.config.native_console = vm["nativeconsole"].as<bool>();
+            }
+            if (vm.count("diskroot"))
+            {
+                options.config.disk_root = vm["diskroot"].as<std::string>();
+            }
+            if (vm.count("diskimage"))
+            {
+                options.config.disk_image = vm["diskimage"].as<std::string>();
+            }
+            if (vm.count("diskgeometry"))
+            {
+                options.config.disk_geometry = vm["diskgeometry"].as<DiskGeometry>();
+            }
+            if (vm.count("dirindex"))
+            {
+                options.config.directory_index = vm["dirindex"].as<std::string>();
+            }
+            if (vm.count("clock"))
+            {
+                options.config.clock_khz = vm["clock"].as<int>();
+            }
+            if (vm.count("timer"))
+            {
+                options.config.timer_hz = vm["timer"].as<int>();
+            }
+            if (vm.count("snapshot"))
+            {
+                options.snapshot_file = vm["snapshot"].as<std::string>();
+            }
+            if (vm.count("socket"))
+            {
+                options.socket = vm["socket"].as<std::string>();
+            }
+            if (vm.count("jobs"))
+            {
+                options.jobs_file = vm["jobs"].as<std::string>();
+            }
+            if (vm.count("threads"))
+            {
+                options.threads = vm["threads"].as<int>();
+            }
+            if (vm.count("stats"))
+            {
+                options.stats = vm["stats"].as<bool>();
+            }
+            if (vm.count("statsjson"))
+            {
+                options.stats_json = vm["statsjson"].as<std::string>();
+            }
+            if (vm.count("repeats"))
+            {
+                options.repeats = vm["repeats"].as<int>();
             }
             if (vm.count("usersym"))
             {
-                config.user_sym = vm["usersym"].as<std::string>();
+                options.config.user_sym = vm["usersym"].as<std::string>();
             }
             if (vm.count("logfile"))
             {
                 logfile = vm["logfile"].as<std::string>();
             }
+            if (vm.count("loglevel"))
+            {
+                log_level = vm["loglevel"].as<log::Level>();
+            }
             if (vm.count("binary"))
             {
-                binary = vm["binary"].as<std::string>();
+                options.binary = vm["binary"].as<std::string>();
             }
             if (vm.count("args"))
             {
-                arguments = vm["args"].as<std::vector<std::string>>();
+                options.arguments = vm["args"].as<std::vector<std::string>>();
             }
 
-            if (binary.empty())
+            if (need_binary && options.binary.empty())
             {
                 std::cout << std::endl << "ZCPM/CPM" << std::endl << std::endl;
                 std::cout << desc << std::endl;
-                return nullptr;
+                return std::nullopt;
             }
         }
         catch (const std::exception& e)
         {
             std::cerr << "Exception: " << e.what() << std::endl;
-            return nullptr;
+            return std::nullopt;
         }
 
         // Set up logging
-        boost::log::add_file_log(boost::log::keywords::file_name = logfile, boost::log::keywords::auto_flush = true);
-        boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::trace);
+        log::set_level(log_level);
+        if (log_level == log::Level::none)
+        {
+            boost::log::core::get()->set_logging_enabled(false);
+        }
+        else
+        {
+            log::add_process_log(logfile);
+            boost::log::core::get()->set_filter(boost::log::trivial::severity >=
+                                                 static_cast<boost::log::trivial::severity_level>(log_level));
+        }
 
+        return options;
+    }
+
+    std::unique_ptr<terminal::Terminal> make_terminal(const MachineOptions& options)
+    {
         // Create the terminal emulation of choice
         std::unique_ptr<terminal::Terminal> p_terminal;
-        switch (terminal)
+        switch (options.terminal)
         {
-        case terminal::Type::PLAIN: p_terminal = std::make_unique<terminal::Plain>(rows, columns); break;
+        case terminal::Type::PLAIN:
+            p_terminal = std::make_unique<terminal::Plain>(options.rows, options.columns, options.line_flush);
+            break;
         case terminal::Type::VT100:
-            p_terminal = std::make_unique<terminal::Vt100>(rows, columns, keymap_file_name);
+            p_terminal = std::make_unique<terminal::Vt100>(
+                options.rows, options.columns, options.keymap_file_name, options.use_curses);
             break;
         case terminal::Type::TELEVIDEO:
-            p_terminal = std::make_unique<terminal::Televideo>(rows, columns, keymap_file_name);
+            p_terminal = std::make_unique<terminal::Televideo>(
+                options.rows, options.columns, options.keymap_file_name, options.use_curses);
+            break;
+        case terminal::Type::BATCH:
+            p_terminal = std::make_unique<terminal::Batch>(
+                options.rows, options.columns, options.batch_input, options.batch_output, options.batch_end);
             break;
         }
 
-        // Put it all together
-        auto p_machine(std::make_unique<zcpm::System>(std::move(p_terminal), config));
+        return p_terminal;
+    }
 
-        // The BDOS/CCP binary is built from Z80 source code which was reconstructed from a CP/M 2.2 disassembly plus a
-        // tweak or two. The assembled binary is what is loaded here. ZCPM intercepts calls to the BIOS from the BDOS.
-        if (!p_machine->load_binary(bdos_file_base, bdos_file_name))
+    std::unique_ptr<zcpm::System> boot_machine(const MachineOptions& options,
+                                               std::unique_ptr<terminal::Terminal> p_terminal)
+    {
+        // Starting from a snapshot means that the BDOS binary and its symbols are already loaded
+        auto config = options.config;
+        const auto use_snapshot = !options.snapshot_file.empty() && std::filesystem::exists(options.snapshot_file);
+        if (use_snapshot)
         {
-            p_machine.reset();
-            std::cerr << "Failed to load base memory image" << std::endl;
-            return nullptr;
+            config.bdos_sym.clear();
         }
 
-        // Based on the current binary image, work out where the BIOS appears to start and set vectors and initialise
-        // data structures.
-        try
+        auto p_machine(std::make_unique<zcpm::System>(std::move(p_terminal), config));
+
+        if (use_snapshot)
         {
-            p_machine->setup_bios(fbase, wboot);
+            try
+            {
+                p_machine->load_snapshot(options.snapshot_file);
+            }
+            catch (const std::exception& e)
+            {
+                p_machine.reset();
+                std::cerr << "Exception: " << e.what() << std::endl;
+                return nullptr;
+            }
+
+            // The disk may well have changed since the snapshot was taken, so have the BDOS take a fresh look at it
+            p_machine->forget_disk_login();
         }
-        catch (const std::exception& e)
+        else
         {
-            p_machine.reset();
-            std::cerr << "Exception: " << e.what() << std::endl;
-            return nullptr;
+            // The BDOS/CCP binary is built from Z80 source code which was reconstructed from a CP/M 2.2 disassembly
+            // plus a tweak or two. The assembled binary is what is loaded here, either as built in or from a file.
+            // ZCPM intercepts calls to the BIOS from the BDOS.
+            const auto loaded = options.bdos_file_name.empty()
+                                    ? p_machine->load_embedded_bdos(options.bdos_file_base)
+                                    : p_machine->load_binary(options.bdos_file_base, options.bdos_file_name);
+            if (!loaded)
+            {
+                p_machine.reset();
+                std::cerr << "Failed to load base memory image" << std::endl;
+                return nullptr;
+            }
+
+            // Based on the current binary image, work out where the BIOS appears to start and set vectors and
+            // initialise data structures.
+            try
+            {
+                p_machine->setup_bios(options.fbase, options.wboot);
+            }
+            catch (const std::exception& e)
+            {
+                p_machine.reset();
+                std::cerr << "Exception: " << e.what() << std::endl;
+                return nullptr;
+            }
+
+            p_machine->reset();
+
+            // Call the BDOS initialisation code so that it can set up its data structures before things are started
+            // for real.
+            p_machine->setup_bdos();
+
+            // That's the whole of the boot, so this is what a later run can start from
+            if (!options.snapshot_file.empty())
+            {
+                try
+                {
+                    p_machine->save_snapshot(options.snapshot_file);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "Exception: " << e.what() << std::endl;
+                }
+            }
         }
 
-        if (!p_machine->load_binary(0x0100, binary)) // CP/M binaries are ALWAYS loaded at 0x0100
+        return p_machine;
+    }
+
+    bool load_program(System& machine, const std::string& binary, const std::vector<std::string>& arguments)
+    {
+        if (!machine.load_binary(0x0100, binary)) // CP/M binaries are ALWAYS loaded at 0x0100
         {
-            p_machine.reset();
             std::cerr << "Failed to load binary" << std::endl;
-            return nullptr;
+            return false;
         }
 
-        p_machine->load_fcb(arguments);
+        machine.load_fcb(arguments);
 
-        p_machine->reset();
+        machine.reset();
+
+        return true;
+    }
 
-        // Call the BDOS initialisation code so that it can set up its data structures before things are started for
-        // real.
-        p_machine->setup_bdos();
+    std::unique_ptr<zcpm::System> build_machine(int argc, char** argv)
+    {
+        const auto options = parse_command_line(argc, argv);
+        if (!options)
+        {
+            return nullptr;
+        }
 
-        p_machine->reset();
+        // Create the terminal emulation of choice, then put it all together
+        auto p_machine = boot_machine(*options, make_terminal(*options));
+        if (!p_machine || !load_program(*p_machine, options->binary, options->arguments))
+        {
+            return nullptr;
+        }
 
         return p_machine;
     }
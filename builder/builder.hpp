@@ -1,12 +1,101 @@
 #pragma once
 
+#include <zcpm/core/config.hpp>
+#include <zcpm/core/engine.hpp>
+#include <zcpm/core/log.hpp>
 #include <zcpm/core/system.hpp>
+#include <zcpm/terminal/type.hpp>
 
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
-// Based on command line arguments, set up the logger and then construct
-// and return a ready-to-use machine instance.
 namespace zcpm
 {
+    namespace terminal
+    {
+        class Terminal;
+    }
+
+    // Everything that the command line specifies, other than logging
+    struct MachineOptions
+    {
+        std::string bdos_file_name;                      // The file that provides a binary BDOS etc (empty=built in)
+        uint16_t bdos_file_base = 0xDC00;                // Where to load that binary image
+        uint16_t wboot = 0xF203;                         // Address of WBOOT in loaded binary BDOS
+        uint16_t fbase = 0xE406;                         // Address of FBASE in loaded binary BDOS
+        terminal::Type terminal = terminal::Type::PLAIN; // Terminal type
+        std::string keymap_file_name; // The file that provides keystroke mapping for terminal emulation
+        int columns = 80;             // Number of display columns
+        int rows = 24;                // Number of display rows
+        bool line_flush = true;       // Write plain terminal output at each newline (when stdout is a terminal)?
+        bool use_curses = true;       // Draw an emulated terminal's screen via ncurses rather than via ANSI sequences?
+        std::string batch_input;      // Where the batch terminal reads keystrokes from (empty=stdin)
+        std::string batch_output;     // Where the batch terminal writes output to (empty=stdout)
+        bool batch_end = true;        // End a batch run when the program waits for input that has run out?
+        std::string snapshot_file;    // Snapshot of the booted machine to start from, or to create (empty=none)
+        std::string socket;           // Unix socket on which the server listens for jobs
+        std::string jobs_file;        // File listing the jobs for the scheduler to run
+        int threads = 0;              // How many jobs the scheduler runs at once (0=one per core)
+        bool stats = false;           // Show statistics of BDOS/BIOS calls, the disk and the terminal at exit (runner)
+        std::string stats_json;       // File to write those statistics to at exit, as JSON (runner; empty=none)
+        int repeats = 3;              // How many times to run each benchmark, keeping the best and median (bench)
+        Config config = { .memcheck = true,
+                          .log_bdos = true,
+                          .protect_warm_start_vector = true,
+                          .protect_bdos_jump = true,
+                          .bdos_sym = "",
+                          .user_sym = "",
+                          .engine = Engine::INTERPRETER,
+                          .cpu = Cpu::Z80,
+                          .lazy_flags = false,
+                          .fast = false,
+                          .idle_polls = 100,
+                          .idle_timeout_ms = 100,
+                          .sector_cache_kb = 0,
+                          .flush_on_close = false,
+                          .flush_sectors = 0,
+                          .flush_interval_ms = 0,
+                          .flush_sync = false,
+                          .native_bdos = false,
+                          .native_console = false,
+                          .disk_root = "",
+                          .disk_image = "",
+                          .disk_geometry = {},
+                          .directory_index = "",
+                          .call_trace = 0,
+                          .profile = "",
+                          .profile_stacks = "",
+                          .clock_khz = 4000,
+                          .timer_hz = 0 };
+        std::string binary; // The CP/M binary that we try to load and execute
+        std::vector<std::string> arguments;
+    };
+
+    // Parse the command line, and set up the logger as it specifies (or at default_log_level, if it doesn't say).
+    // Returns nothing if the program should go no further, having shown why (or shown the help). Unless need_binary is
+    // false, a CP/M binary must be named.
+    std::optional<MachineOptions> parse_command_line(int argc,
+                                                     char** argv,
+                                                     bool need_binary = true,
+                                                     log::Level default_log_level = log::Level::trace);
+
+    // Construct the terminal emulation that the options specify
+    std::unique_ptr<terminal::Terminal> make_terminal(const MachineOptions& options);
+
+    // Construct a machine with the specified terminal and boot it, ready for a program to be loaded; or if there is a
+    // snapshot file, restore the booted machine from that instead (or create it, if it doesn't exist yet). Returns
+    // nullptr on failure, having shown why.
+    std::unique_ptr<zcpm::System> boot_machine(const MachineOptions& options,
+                                               std::unique_ptr<terminal::Terminal> p_terminal);
+
+    // Load a CP/M binary into a booted machine and give it the specified arguments, ready to run. Returns false on
+    // failure, having shown why.
+    bool load_program(System& machine, const std::string& binary, const std::vector<std::string>& arguments);
+
+    // Based on command line arguments, set up the logger and then construct
+    // and return a ready-to-use machine instance.
     std::unique_ptr<zcpm::System> build_machine(int argc, char** argv);
 }
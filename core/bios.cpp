@@ -1,14 +1,18 @@
 #include "bios.hpp"
 
+#include "calltrace.hpp"
 #include "disk.hpp"
 #include "hardware.hpp"
+#include "log.hpp"
 #include "processor.hpp"
 
 #include <zcpm/terminal/terminal.hpp>
 
-#include <boost/log/trivial.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <stdexcept>
 #include <string>
@@ -25,10 +29,30 @@
 //   Scratchpads etc
 // m_dph_top
 
+namespace
+{
+    // Largest gap between successive unsuccessful console status polls for them to count as an idle loop; at 4MHz
+    // this is a little over a millisecond
+    const size_t MaxIdlePollCycles = 5000;
+
+    // Indexed by BIOS function number, i.e. position in the jump table
+    const std::array<std::string_view, zcpm::Bios::FunctionCount> FunctionNames{
+        "BOOT", "WBOOT", "CONST", "CONIN", "CONOUT", "LIST", "PUNCH", "READER", "HOME",
+        "SELDSK", "SETTRK", "SETSEC", "SETDMA", "READ", "WRITE", "LISTST", "SECTRAN"
+    };
+
+} // namespace
+
 namespace zcpm
 {
 
-    Bios::Bios(Hardware* p_hardware, terminal::Terminal* p_terminal) : m_phardware(p_hardware), m_pterminal(p_terminal)
+    Bios::Bios(Hardware* p_hardware, terminal::Terminal* p_terminal, const Config& behaviour)
+        : m_phardware(p_hardware),
+          m_pterminal(p_terminal),
+          m_disk(behaviour),
+          m_idle_polls(behaviour.idle_polls),
+          m_idle_timeout_ms(behaviour.idle_timeout_ms),
+          m_trace_calls(behaviour.call_trace > 0)
     {
         const size_t table_size = 33; // As per "CP/M 3 System Guide", Table 2-1
 
@@ -50,7 +74,7 @@ namespace zcpm
         // maybe stack should be elsewhere?
         m_stubs_base = base + 0x0100;
 
-        BOOST_LOG_TRIVIAL(trace) << fmt::format("Rewriting BIOS jump table at {:04X}", base);
+        ZCPM_LOG(trace) << fmt::format("Rewriting BIOS jump table at {:04X}", base);
 
         // Write our own jump table over the top of whatever is there currently, making it point to another
         // one ("stubs") higher in memory, and that's the one that is intercepted (which should reduce the
@@ -67,8 +91,9 @@ namespace zcpm
             m_phardware->write_byte(m_stubs_base + i, 0xC9);
         }
 
-        // Remember the top of the stubs area
+        // Remember the top of the stubs area, and have the processor hand over control when it reaches any of them
         m_stubs_top = m_stubs_base + table_size - 1;
+        m_phardware->m_processor->add_trap(m_stubs_base, table_size);
 
         // Write a known pattern into memory from the top of the BIOS jump table until the start
         // of the BIOS stubs area. (i.e., between the two regions)
@@ -99,17 +124,18 @@ namespace zcpm
         // DIRBF is a 128 byte scratch area; leave it uninitialised
 
         // HDBLK is a table describing our simulated HDD
-        m_phardware->write_word(hdblk + 0x00, 0x0080);    // SPT: Sectors per track
-        m_phardware->write_byte(hdblk + 0x02, Disk::BSH); // BSH: Block shift factor
-        m_phardware->write_byte(hdblk + 0x03, Disk::BLM); // BLM: Data allocation block mask
-        m_phardware->write_byte(hdblk + 0x04, 0x00);      // EXM: Extent mask
-        m_phardware->write_word(hdblk + 0x05, 0x07F7);    // DSM: Disk size in blocks - 1
-        m_phardware->write_word(hdblk + 0x07, 0x03FF);    // DRM: Directory max
-        m_phardware->write_byte(hdblk + 0x09, 0xFF);      // AL0: Alloc 0
-        m_phardware->write_byte(hdblk + 0x0A, 0xFF);      // AL1: Alloc 1
+        const auto& geometry = m_disk.get_geometry();
+        m_phardware->write_word(hdblk + 0x00, geometry.spt);                 // SPT: Sectors per track
+        m_phardware->write_byte(hdblk + 0x02, geometry.bsh);                 // BSH: Block shift factor
+        m_phardware->write_byte(hdblk + 0x03, geometry.blm());               // BLM: Data allocation block mask
+        m_phardware->write_byte(hdblk + 0x04, geometry.exm());               // EXM: Extent mask
+        m_phardware->write_word(hdblk + 0x05, geometry.dsm);                 // DSM: Disk size in blocks - 1
+        m_phardware->write_word(hdblk + 0x07, geometry.drm);                 // DRM: Directory max
+        m_phardware->write_byte(hdblk + 0x09, geometry.allocation() >> 8);   // AL0: Alloc 0
+        m_phardware->write_byte(hdblk + 0x0A, geometry.allocation() & 0xFF); // AL1: Alloc 1
         m_phardware->write_word(hdblk + 0x0B,
                                 0x0000); // CKS: Check size (For a HDD, can have 0. Removable media would need non-zero)
-        m_phardware->write_word(hdblk + 0x0D, 0x0000); // OFF: Track offset
+        m_phardware->write_word(hdblk + 0x0D, geometry.off); // OFF: Track offset
 
         // CHKHD1 is a scratch table for directory entries. But as our disk (a simulated HDD) is not
         // removable media, this can be zero bytes. Reserve two bytes for it just for neatness.
@@ -121,7 +147,7 @@ namespace zcpm
             m_phardware->write_byte(i, 0x00);
         }
 
-        BOOST_LOG_TRIVIAL(trace) << fmt::format(
+        ZCPM_LOG(trace) << fmt::format(
             "BIOS jump table {:04X}..{:04X}, BIOS stubs {:04X}..{:04X}, DPH etc {:04X}..{:04X}",
             m_discovered_base,
             m_discovered_base + table_size * 3 - 1,
@@ -130,13 +156,19 @@ namespace zcpm
             m_dph_base,
             m_dph_top);
 
-        BOOST_LOG_TRIVIAL(trace) << fmt::format(
+        ZCPM_LOG(trace) << fmt::format(
             "     dirbf={:04X} hdblk={:04X} chkhd1={:04X} allhd1={:04X}", dirbf, hdblk, chkhd1, allhd1);
 
         // Set up monitoring of the DPH etc stuff
         m_phardware->add_watch_read(m_dph_base, m_dph_top - m_dph_base + 1);
         m_phardware->add_watch_write(m_dph_base, m_dph_top - m_dph_base + 1);
 
+        // From now on, nothing should be modifying the BIOS jump table or our stubs. This covers the whole range
+        // including the jump table as well as our set of targets of each of the jump vectors. Technically there's a
+        // range of bytes between those two sets that is actually spare memory, but that would be over-complicating
+        // things.
+        m_phardware->add_protected(m_discovered_base, m_stubs_top - m_discovered_base + 1);
+
         // And add some pretend symbols to help make the run logs easier to read when something reads
         // or writes that data
         m_phardware->add_symbol(m_dph_base, "DPHBASE");
@@ -148,13 +180,9 @@ namespace zcpm
 
     Bios::~Bios() = default;
 
-    bool Bios::is_bios(uint16_t address) const
+    std::string_view Bios::function_name(unsigned int fn)
     {
-        // Check for the whole range including the jump table (whose address is already determined by
-        // the loaded binary memory image) as well as our set of targets of each of the jump vectors.
-        // Technically there's a range of bytes between those two sets that is actually spare memory,
-        // but that would be over-complicating things.
-        return (address >= m_discovered_base) && (address <= m_stubs_top);
+        return (fn < FunctionNames.size()) ? FunctionNames[fn] : "Unknown!";
     }
 
     bool Bios::check_and_handle(uint16_t address)
@@ -167,15 +195,17 @@ namespace zcpm
         // The address is within the BIOS stubs. Work out what BIOS function is being called
         const unsigned int fn = address - m_stubs_base;
 
-        const auto prefix(fmt::format("BIOS fn#{:d} ", fn));
-        std::string msg;
+        if (m_trace_calls)
+        {
+            m_phardware->trace_call(CallTrace::Kind::BIOS, static_cast<uint8_t>(fn));
+        }
+        const auto start = std::chrono::steady_clock::now();
 
         switch (fn)
         {
         case 0:
         {
-            msg = "BOOT()";
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "BOOT()");
             fn_boot();
         }
         break;
@@ -184,27 +214,35 @@ namespace zcpm
             // WBOOT is called as part of initialisation, but if we get here it means that user
             // code is trying to (either directly or indirectly) call it again, which is used as
             // a termination condition.
-            msg = "WBOOT()";
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "WBOOT()");
             m_phardware->set_finished(true);
         }
         break;
         case 2:
         {
-            msg = "CONST()";
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "CONST()");
             // Return A=FF if a character is ready to be read, A=00 otherwise
-            m_phardware->m_processor->reg_a() = m_pterminal->is_character_ready() ? 0xFF : 0x00;
+            m_phardware->m_processor->reg_a() =
+                logged_input(InputKind::STATUS, [this]() { return is_character_ready() ? 0xFF : 0x00; });
         }
         break;
         case 3:
         {
-            BOOST_LOG_TRIVIAL(trace) << prefix << "CONIN()";
+            ZCPM_LOG(trace) << fmt::format("BIOS fn#{:d} CONIN()", fn);
+            m_unsuccessful_polls = 0;
+            if ((m_input_position == m_input_log.size()) && m_pterminal->is_input_exhausted())
+            {
+                // Waiting for input that will never arrive is also used as a termination condition
+                log_bios_call(fn, "CONIN() at the end of the input");
+                m_phardware->set_finished(true);
+                break;
+            }
             // Block until a character is ready, and then return it in A
-            m_phardware->m_processor->reg_a() = m_pterminal->get_char();
+            m_phardware->m_processor->reg_a() =
+                logged_input(InputKind::CHARACTER, [this]() { return static_cast<uint8_t>(m_pterminal->get_char()); });
+            ++m_call_statistics.chars_in;
             const auto ch = m_phardware->m_processor->get_a();
-            msg = fmt::format("CONIN({:02X})", ch);
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "CONIN({:02X})", ch);
         }
         break;
         case 4:
@@ -212,20 +250,23 @@ namespace zcpm
             const auto ch = static_cast<char>(m_phardware->m_processor->get_c());
             if (ch >= ' ')
             {
-                msg = fmt::format("CONOUT({:02X} '{:c}')", ch, ch);
+                log_bios_call(fn, "CONOUT({:02X} '{:c}')", ch, ch);
             }
             else
             {
-                msg = fmt::format("CONOUT({:02X})", ch);
+                log_bios_call(fn, "CONOUT({:02X})", ch);
+            }
+            if (!m_quiet)
+            {
+                m_pterminal->print(ch);
             }
-            log_bios_call(prefix, msg);
-            m_pterminal->print(ch);
+            ++m_call_statistics.chars_out;
+            m_unsuccessful_polls = 0;
         }
         break;
         case 8:
         {
-            msg = "HOME()";
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "HOME()");
             fn_home();
         }
         break;
@@ -233,47 +274,41 @@ namespace zcpm
         {
             const auto disk = m_phardware->m_processor->get_c(); // Disk index; 0=A, 1=B, etc
             const auto flag = m_phardware->m_processor->get_e(); // Bit 0 is the "has been logged in before" flag
-            msg = fmt::format("SELDSK(disk={:02X},flag={:02X})", disk, flag);
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "SELDSK(disk={:02X},flag={:02X})", disk, flag);
             fn_seldsk(disk, flag);
         }
         break;
         case 10:
         {
             const auto bc = m_phardware->m_processor->get_bc();
-            msg = fmt::format("SETTRK({:04X})", bc);
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "SETTRK({:04X})", bc);
             fn_settrk(bc);
         }
         break;
         case 11:
         {
             const auto bc = m_phardware->m_processor->get_bc();
-            msg = fmt::format("SETSEC({:04X})", bc);
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "SETSEC({:04X})", bc);
             fn_setsec(bc);
         }
         break;
         case 12:
         {
             const auto bc = m_phardware->m_processor->get_bc();
-            msg = fmt::format("SETDMA({:04X})", bc);
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "SETDMA({:04X})", bc);
             fn_setdma(bc);
         }
         break;
         case 13:
         {
-            msg = "READ()";
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "READ()");
             m_phardware->m_processor->reg_a() = fn_read();
         }
         break;
         case 14:
         {
             const auto c = m_phardware->m_processor->get_c();
-            msg = fmt::format("WRITE({:02X})", c);
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "WRITE({:02X})", c);
             m_phardware->m_processor->reg_a() = fn_write(c);
         }
         break;
@@ -281,20 +316,22 @@ namespace zcpm
         {
             const auto bc = m_phardware->m_processor->get_bc();
             const auto de = m_phardware->m_processor->get_de();
-            msg = fmt::format("SECTRAN({:04X},{:04X})", bc, de);
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "SECTRAN({:04X},{:04X})", bc, de);
             const auto physical_sector_number = fn_sectran(bc, de);
             m_phardware->m_processor->reg_hl() = physical_sector_number;
         }
         break;
         default:
         {
-            msg = "Unknown!";
-            log_bios_call(prefix, msg);
+            log_bios_call(fn, "Unknown!");
             throw std::logic_error("BIOS unfinished, FIXME!");
         }
         }
 
+        auto& latency = m_call_statistics.functions[fn];
+        latency.add_call();
+        latency.add_time(std::chrono::steady_clock::now() - start);
+
         // Typically we're returning to a 'RET' in the intercepted BIOS which will then
         // let the user code carry on without further ado.
 
@@ -363,10 +400,17 @@ namespace zcpm
         // See http://www.seasip.info/Cpm/bios.html#read
         // Read the sector at m_track/m_sector into m_dma, return success status (which ends up in register A)
 
-        BOOST_LOG_TRIVIAL(trace) << fmt::format(
+        ZCPM_LOG(trace) << fmt::format(
             "Read TRACK:{:04X},SECTOR:{:04X} into {:04X}", m_track, m_sector, m_dma);
 
-        // Allocate a sector-size chunk of memory, into which data is read
+        // Where possible, read the sector straight into the emulated system's RAM
+        if (const auto ram = m_phardware->writable_ram_view(m_dma, Disk::SectorSize); !ram.empty())
+        {
+            m_disk.read(ram.first<Disk::SectorSize>(), m_track, m_sector);
+            return 0;
+        }
+
+        // Otherwise allocate a sector-size chunk of memory, into which data is read
         Disk::SectorData buffer{};
         // Read the specified disk sector into that memory chunk
         m_disk.read(buffer, m_track, m_sector);
@@ -381,20 +425,25 @@ namespace zcpm
         // See http://www.seasip.info/Cpm/bios.html#write
         // Write from m_dma to the sector at m_track/m_sector, return success status (which ends up in register A)
 
-        BOOST_LOG_TRIVIAL(trace) << fmt::format(
+        ZCPM_LOG(trace) << fmt::format(
             "Write TRACK:{:04X},SECTOR:{:04X} from {:04X}", m_track, m_sector, m_dma);
 
         // To help with debugging
         m_phardware->dump(m_dma, Disk::SectorSize);
 
-        // Allocate a sector-size chunk of memory
+        // Where possible, write the sector straight from the emulated system's RAM
+        if (const auto ram = m_phardware->ram_view(m_dma, Disk::SectorSize); !ram.empty())
+        {
+            m_disk.write(ram.first<Disk::SectorSize>(), m_track, m_sector);
+            return 0;
+        }
+
+        // Otherwise allocate a sector-size chunk of memory
         Disk::SectorData buffer{};
 
         // Copy from emulated RAM into that chunk
         m_phardware->copy_from_ram(buffer.data(), buffer.size(), m_dma);
-        // Write from that chunk to the disk (this is double-handling but given that we're using this to
-        // access disk which is much slower it won't be an issue, and it's all memcpy() underneath
-        // anyway so it's not slow)
+        // Write from that chunk to the disk
         m_disk.write(buffer, m_track, m_sector);
 
         return 0;
@@ -408,9 +457,148 @@ namespace zcpm
         return logical_sector_number;
     }
 
-    void Bios::log_bios_call(std::string_view prefix, std::string_view message) const
+    const Bios::PollStatistics& Bios::get_poll_statistics() const
+    {
+        return m_poll_statistics;
+    }
+
+    const Bios::CallStatistics& Bios::get_call_statistics() const
+    {
+        return m_call_statistics;
+    }
+
+    Disk& Bios::get_disk()
+    {
+        return m_disk;
+    }
+
+    Bios::State Bios::get_state() const
+    {
+        return { m_track, m_sector, m_dma };
+    }
+
+    void Bios::set_state(const State& state)
+    {
+        m_track = state.track;
+        m_sector = state.sector;
+        m_dma = state.dma;
+    }
+
+    void Bios::write_console(std::string_view text)
+    {
+        log_bios_call(4, "CONOUT({:d} chars)", text.size());
+        if (!m_quiet)
+        {
+            m_pterminal->write(text);
+        }
+        m_call_statistics.chars_out += text.size();
+        m_unsuccessful_polls = 0;
+    }
+
+    bool Bios::peek_console()
+    {
+        return logged_input(InputKind::STATUS, [this]() { return m_pterminal->is_character_ready() ? 0xFF : 0x00; }) !=
+               0x00;
+    }
+
+    void Bios::set_input_logging(bool logging)
+    {
+        m_logging_input = logging;
+        if (!logging)
+        {
+            m_input_log.clear();
+            m_input_position = 0;
+        }
+    }
+
+    size_t Bios::get_input_position() const
+    {
+        return m_input_position;
+    }
+
+    void Bios::set_input_position(size_t position)
+    {
+        m_input_position = std::min(position, m_input_log.size());
+    }
+
+    void Bios::set_quiet(bool quiet)
+    {
+        m_quiet = quiet;
+    }
+
+    template <typename Live> uint8_t Bios::logged_input(InputKind kind, Live live)
+    {
+        if (m_input_position < m_input_log.size())
+        {
+            const auto event = m_input_log[m_input_position];
+            if (event.kind == kind)
+            {
+                ++m_input_position;
+                return event.value;
+            }
+            // The replay has gone differently from the original run, so the rest of the log no longer applies
+            m_input_log.resize(m_input_position);
+        }
+
+        const uint8_t value = live();
+        if (m_logging_input)
+        {
+            m_input_log.push_back({ kind, value });
+            m_input_position = m_input_log.size();
+        }
+        return value;
+    }
+
+    bool Bios::is_character_ready()
+    {
+        ++m_poll_statistics.polls;
+
+        // A program which checks for a keystroke now and then while it does some real work shouldn't be slowed down (or
+        // have its run ended), so only polls which are close together (in emulated time) count towards being idle.
+        // Without a cycle count (in fast mode) there's no telling the two apart, so then a program is never idle.
+        const auto& processor = *m_phardware->m_processor;
+        const auto detect_idle = (m_idle_polls > 0) && processor.is_counting_cycles();
+        if (detect_idle)
+        {
+            const auto now = processor.get_cycle_count();
+            if (now - m_last_poll_cycles > MaxIdlePollCycles)
+            {
+                m_unsuccessful_polls = 0;
+            }
+            m_last_poll_cycles = now;
+        }
+
+        if (!detect_idle || (m_unsuccessful_polls < m_idle_polls))
+        {
+            if (m_pterminal->is_character_ready())
+            {
+                m_unsuccessful_polls = 0;
+                return true;
+            }
+            ++m_unsuccessful_polls;
+            return false;
+        }
+
+        // The program seems to be idle, so wait a while for some input (unless none can arrive)
+        if (m_pterminal->is_input_exhausted())
+        {
+            ZCPM_LOG(trace) << "CONST() idle at the end of the input";
+            m_phardware->set_finished(true);
+            return false;
+        }
+        ++m_poll_statistics.idle_waits;
+        if (m_pterminal->wait_for_character(m_idle_timeout_ms))
+        {
+            ++m_poll_statistics.wakeups;
+            m_unsuccessful_polls = 0;
+            return true;
+        }
+        return false;
+    }
+
+    void Bios::write_bios_log(unsigned int fn, std::string_view message) const
     {
-        BOOST_LOG_TRIVIAL(trace) << "  " << prefix << message << m_phardware->format_stack_info();
+        ZCPM_LOG(trace) << "  BIOS fn#" << fn << ' ' << message << m_phardware->format_stack_info();
     }
 
 } // namespace zcpm
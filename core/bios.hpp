@@ -1,9 +1,18 @@
 #pragma once
 
+#include "calllatency.hpp"
+#include "config.hpp"
 #include "disk.hpp"
+#include "log.hpp"
 
+#include <fmt/core.h>
+
+#include <array>
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace zcpm
 {
@@ -17,7 +26,7 @@ namespace zcpm
     class Bios final
     {
     public:
-        Bios(Hardware* p_hardware, terminal::Terminal* p_terminal);
+        Bios(Hardware* p_hardware, terminal::Terminal* p_terminal, const Config& behaviour);
 
         Bios(const Bios&) = delete;
         Bios& operator=(const Bios&) = delete;
@@ -26,7 +35,9 @@ namespace zcpm
 
         ~Bios();
 
-        bool is_bios(uint16_t address) const;
+        // The number of entries in the BIOS jump table, and the name of each function (by its position in the table)
+        inline static const unsigned int FunctionCount{ 17 };
+        [[nodiscard]] static std::string_view function_name(unsigned int fn);
 
         // Check if the specified address is within our custom BIOS implementation (and hence should be intercepted). If
         // so, work out what the intercepted BIOS call is trying to do and do whatever is needed, and then allows the
@@ -45,8 +56,86 @@ namespace zcpm
         uint8_t fn_write(uint8_t deblocking);                                            // #14
         uint16_t fn_sectran(uint16_t logical_sector_number, uint16_t trans_table) const; // #16
 
+        // As for a CONOUT (#04) of each character in turn
+        void write_console(std::string_view text);
+
+        // Check whether a keystroke is waiting, as CONST (#02) does, but for a check which isn't the program's own (so
+        // it doesn't count as a poll, and never waits)
+        [[nodiscard]] bool peek_console();
+
+        // Console input as the program has seen it (whether keystrokes were waiting, and what they were) is logged
+        // while checkpoints are kept, so that replaying part of a run from one of them sees just the same input.
+        // Setting the position in the log back to where it was at a checkpoint has the input from there on come from
+        // the log, until that runs out (or the replay goes differently), and then from the terminal again.
+        void set_input_logging(bool logging);
+        [[nodiscard]] size_t get_input_position() const;
+        void set_input_position(size_t position);
+
+        // Select whether console output is kept from the terminal, as it is while a replay repeats what has been seen
+        void set_quiet(bool quiet);
+
+        // Counters of console status polls, to show how much of the time programs have been idle
+        struct PollStatistics
+        {
+            size_t polls{ 0 };      // Total number of CONST calls
+            size_t idle_waits{ 0 }; // Polls made once idle, which waited for input
+            size_t wakeups{ 0 };    // Those waits which ended with input, rather than a timeout
+        };
+        [[nodiscard]] const PollStatistics& get_poll_statistics() const;
+
+        // Host time spent handling each BIOS function, and counts of characters passed to and from the terminal
+        struct CallStatistics
+        {
+            std::array<CallLatency, FunctionCount> functions; // By function number
+            uint64_t chars_out{ 0 };                          // Via CONOUT, or written a string at a time
+            uint64_t chars_in{ 0 };                           // Via CONIN
+        };
+        [[nodiscard]] const CallStatistics& get_call_statistics() const;
+
+        // The disk which BIOS reads and writes sectors of
+        [[nodiscard]] Disk& get_disk();
+
+        // The BIOS state which isn't kept in emulated memory, other than what the constructor derives from that memory
+        struct State
+        {
+            uint16_t track;
+            uint16_t sector;
+            uint16_t dma;
+        };
+        [[nodiscard]] State get_state() const;
+        void set_state(const State& state);
+
     private:
-        void log_bios_call(std::string_view prefix, std::string_view message) const;
+        // Log a BIOS call (unless calls are being traced instead), only formatting the message if it is wanted
+        template <typename... Args>
+        void log_bios_call(unsigned int fn, fmt::format_string<Args...> format, Args&&... args) const
+        {
+            if (!m_trace_calls && log::is_enabled<log::Level::trace>())
+            {
+                write_bios_log(fn, fmt::format(format, std::forward<Args>(args)...));
+            }
+        }
+        void write_bios_log(unsigned int fn, std::string_view message) const;
+
+        // Implements CONST. A program which keeps polling without finding any input (and without producing any output)
+        // is most likely just waiting for a keystroke, so rather than let it spin we wait for one to arrive.
+        bool is_character_ready();
+
+        // An entry in the console input log, as returned by CONST (or peek_console) or CONIN
+        enum class InputKind : uint8_t
+        {
+            STATUS,
+            CHARACTER
+        };
+        struct InputEvent
+        {
+            InputKind kind;
+            uint8_t value;
+        };
+
+        // The next input of the specified kind: from the log while that is being replayed, otherwise from 'live' (and
+        // then logged, if the log is being kept)
+        template <typename Live> uint8_t logged_input(InputKind kind, Live live);
 
         Hardware* m_phardware;
 
@@ -74,6 +163,23 @@ namespace zcpm
         uint16_t m_track{ 0 };    // Current track number on the current disk
         uint16_t m_sector{ 0 };   // Current sector number on the current disk
         uint16_t m_dma{ 0x0080 }; // Address of the DMA buffer
+
+        const int m_idle_polls;      // Consecutive unsuccessful polls before we consider the program to be idle
+        const int m_idle_timeout_ms; // How long an idle poll waits for input
+
+        const bool m_trace_calls; // Are calls recorded in the hardware's call trace, rather than logged?
+
+        int m_unsuccessful_polls{ 0 }; // Consecutive polls without input, since the last console I/O
+        size_t m_last_poll_cycles{ 0 }; // Processor cycle count at the previous poll
+
+        PollStatistics m_poll_statistics;
+        CallStatistics m_call_statistics;
+
+        std::vector<InputEvent> m_input_log;
+        size_t m_input_position{ 0 }; // The next entry to replay, or the end of the log if not replaying
+        bool m_logging_input{ false };
+
+        bool m_quiet{ false };
     };
 
 } // namespace zcpm
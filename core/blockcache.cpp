@@ -0,0 +1,314 @@
+#include "blockcache.hpp"
+
+#include "imemory.hpp"
+#include "instructions.hpp"
+#include "log.hpp"
+#include "processordata.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+
+namespace
+{
+    // Page zero holds the CP/M vectors and is watched by the hardware, so code there is always fetched from memory
+    const uint16_t FirstCachedAddress = 0x0100;
+
+    // Upper limit on the size of a block; longer runs of straight-line code simply become several blocks
+    const size_t MaxBlockInstructions = 64;
+
+    const uint8_t CyclesPerPrefix = 4;
+
+    // Returns true if the instruction can change the flow of control, and hence finishes a block
+    bool ends_block(uint8_t instruction)
+    {
+        switch (instruction)
+        {
+        case zcpm::JP_NN:
+        case zcpm::JP_CC_NN:
+        case zcpm::JR_E:
+        case zcpm::JR_DD_E:
+        case zcpm::JP_HL:
+        case zcpm::DJNZ_E:
+        case zcpm::CALL_NN:
+        case zcpm::CALL_CC_NN:
+        case zcpm::RET:
+        case zcpm::RET_CC:
+        case zcpm::RETI_RETN:
+        case zcpm::RST_P:
+        case zcpm::HALT:
+        case zcpm::ED_UNDEFINED: return true;
+        default: return false;
+        }
+    }
+
+    // Number of bytes which follow the opcode, for instructions which aren't in the 0xcb group
+    uint8_t operand_count(uint8_t instruction, bool indexed)
+    {
+        switch (instruction)
+        {
+        case zcpm::LD_R_N:
+        case zcpm::ADD_N:
+        case zcpm::ADC_N:
+        case zcpm::SUB_N:
+        case zcpm::SBC_N:
+        case zcpm::AND_N:
+        case zcpm::XOR_N:
+        case zcpm::OR_N:
+        case zcpm::CP_N:
+        case zcpm::JR_E:
+        case zcpm::JR_DD_E:
+        case zcpm::DJNZ_E:
+        case zcpm::IN_A_N:
+        case zcpm::OUT_N_A: return 1;
+
+        case zcpm::LD_A_INDIRECT_NN:
+        case zcpm::LD_INDIRECT_NN_A:
+        case zcpm::LD_RR_NN:
+        case zcpm::LD_HL_INDIRECT_NN:
+        case zcpm::LD_RR_INDIRECT_NN:
+        case zcpm::LD_INDIRECT_NN_HL:
+        case zcpm::LD_INDIRECT_NN_RR:
+        case zcpm::JP_NN:
+        case zcpm::JP_CC_NN:
+        case zcpm::CALL_NN:
+        case zcpm::CALL_CC_NN: return 2;
+
+        case zcpm::LD_R_INDIRECT_HL:
+        case zcpm::LD_INDIRECT_HL_R:
+        case zcpm::ADD_INDIRECT_HL:
+        case zcpm::ADC_INDIRECT_HL:
+        case zcpm::SUB_INDIRECT_HL:
+        case zcpm::SBC_INDIRECT_HL:
+        case zcpm::AND_INDIRECT_HL:
+        case zcpm::XOR_INDIRECT_HL:
+        case zcpm::OR_INDIRECT_HL:
+        case zcpm::CP_INDIRECT_HL:
+        case zcpm::INC_INDIRECT_HL:
+        case zcpm::DEC_INDIRECT_HL: return indexed ? 1 : 0; // The (IX/IY + d) displacement
+
+        case zcpm::LD_INDIRECT_HL_N: return indexed ? 2 : 1;
+
+        default: return 0;
+        }
+    }
+
+} // namespace
+
+namespace zcpm
+{
+
+    BlockCache::BlockCache(const IMemory& memory) : m_memory(memory), m_index(0x10000, nullptr)
+    {
+    }
+
+    BlockCache::~BlockCache() = default;
+
+    void BlockCache::clear()
+    {
+        std::fill(m_index.begin(), m_index.end(), nullptr);
+        for (auto& blocks : m_page_blocks)
+        {
+            blocks.clear();
+        }
+        m_code_pages.fill(false);
+        m_code_bytes.reset();
+        std::move(m_blocks.begin(), m_blocks.end(), std::back_inserter(m_retired));
+        m_blocks.clear();
+    }
+
+    size_t BlockCache::size() const
+    {
+        return m_blocks.size();
+    }
+
+    const DecodedInstruction* BlockCache::decode_block(uint16_t address)
+    {
+        // The processor only ever asks for a new block between instructions, so nothing retired is still in use
+        m_retired.clear();
+
+        auto p_block = std::make_unique<Block>();
+        p_block->start = address;
+
+        // Keep decoding until we reach something that branches, or code that is already cached
+        size_t next = address;
+        while ((p_block->instructions.size() < MaxBlockInstructions) && (next <= 0xFFFF) && !m_index[next])
+        {
+            DecodedInstruction d{};
+            if (!decode_instruction(next, d))
+            {
+                break;
+            }
+            p_block->instructions.push_back(d);
+            next += d.length;
+            if (ends_block(d.instruction))
+            {
+                break;
+            }
+        }
+        p_block->end = next;
+
+        if (p_block->instructions.empty())
+        {
+            return nullptr;
+        }
+
+        for (const auto& d : p_block->instructions)
+        {
+            m_index[d.address] = &d;
+        }
+        for (auto page = p_block->start >> 8; page <= ((p_block->end - 1) >> 8); ++page)
+        {
+            m_page_blocks[page].push_back(p_block.get());
+            m_code_pages[page] = true;
+        }
+        mark_code(*p_block);
+
+        m_blocks.push_back(std::move(p_block));
+
+        return m_index[address];
+    }
+
+    bool BlockCache::decode_instruction(uint16_t address, DecodedInstruction& result) const
+    {
+        if ((address < FirstCachedAddress) || (address > 0x10000 - DecodedInstruction::MaxLength))
+        {
+            return false;
+        }
+
+        result.address = address;
+        m_memory.copy_from_ram(result.bytes.data(), result.bytes.size(), address);
+
+        // Follow the same steps that the processor takes through any prefixes. Every step (each prefix plus the
+        // instruction itself) has the processor check for termination, consume 4 cycles, and advance R.
+        auto table = RegisterTable::DEFAULT;
+        uint8_t offset = 0;
+        uint8_t opcode = result.bytes[offset++];
+        uint8_t instruction = INSTRUCTION_TABLE[opcode];
+        uint8_t prefixes = 0;
+        uint8_t r = 0;
+        bool cb_group = false;
+        while ((instruction == DD_PREFIX) || (instruction == FD_PREFIX) || (instruction == ED_PREFIX) ||
+               (instruction == CB_PREFIX))
+        {
+            if (prefixes == DecodedInstruction::MaxPrefixes)
+            {
+                return false; // A pathological sequence of prefixes; leave that to the processor
+            }
+            result.check_offsets[prefixes++] = offset;
+            ++r;
+
+            switch (instruction)
+            {
+            case DD_PREFIX:
+            case FD_PREFIX:
+                table = (instruction == DD_PREFIX) ? RegisterTable::DD : RegisterTable::FD;
+                opcode = result.bytes[offset++];
+                instruction = INSTRUCTION_TABLE[opcode];
+                break;
+            case ED_PREFIX:
+                table = RegisterTable::DEFAULT;
+                opcode = result.bytes[offset++];
+                instruction = ED_INSTRUCTION_TABLE[opcode];
+                break;
+            default: // CB_PREFIX
+                if (table != RegisterTable::DEFAULT)
+                {
+                    // With an index prefix, the displacement precedes the opcode and the handler reads it at PC
+                    --r;
+                    opcode = result.bytes[offset + 1];
+                }
+                else
+                {
+                    opcode = result.bytes[offset++];
+                }
+                instruction = CB_INSTRUCTION_TABLE[opcode];
+                cb_group = true;
+                break;
+            }
+        }
+
+        result.opcode = opcode;
+        result.instruction = instruction;
+        result.table = table;
+        result.prefixes = prefixes;
+        result.prefix_cycles = prefixes * CyclesPerPrefix;
+        result.prefix_r = r;
+        result.operands_offset = offset;
+
+        const auto indexed = table != RegisterTable::DEFAULT;
+        if (cb_group)
+        {
+            result.length = offset + (indexed ? 2 : 0);
+        }
+        else
+        {
+            result.length = offset + operand_count(instruction, indexed);
+        }
+
+        return result.length <= DecodedInstruction::MaxLength;
+    }
+
+    void BlockCache::invalidate_range(size_t start, size_t end)
+    {
+        end = std::min<size_t>(end, 0x10000);
+
+        std::vector<Block*> discards;
+        for (auto page = start >> 8; (page < m_page_blocks.size()) && (page <= ((end - 1) >> 8)); ++page)
+        {
+            for (auto p_block : m_page_blocks[page])
+            {
+                if ((p_block->start < end) && (start < p_block->end) &&
+                    (std::find(discards.begin(), discards.end(), p_block) == discards.end()))
+                {
+                    discards.push_back(p_block);
+                }
+            }
+        }
+
+        for (auto p_block : discards)
+        {
+            ZCPM_LOG(trace) << fmt::format(
+                "Discarding cached block {:04X}-{:04X}", p_block->start, p_block->end - 1);
+
+            for (const auto& d : p_block->instructions)
+            {
+                if (m_index[d.address] == &d)
+                {
+                    m_index[d.address] = nullptr;
+                }
+            }
+            for (size_t a = p_block->start; a < p_block->end; ++a)
+            {
+                m_code_bytes.reset(a);
+            }
+            for (auto page = p_block->start >> 8; page <= ((p_block->end - 1) >> 8); ++page)
+            {
+                auto& blocks = m_page_blocks[page];
+                blocks.erase(std::remove(blocks.begin(), blocks.end(), p_block), blocks.end());
+                m_code_pages[page] = !blocks.empty();
+
+                // Another block could share some of the bytes we've just unmarked (e.g. if code jumps into the
+                // middle of an instruction), so make sure that the survivors remain marked
+                for (const auto p_other : blocks)
+                {
+                    mark_code(*p_other);
+                }
+            }
+
+            const auto it =
+                std::find_if(m_blocks.begin(), m_blocks.end(), [p_block](const auto& p) { return p.get() == p_block; });
+            m_retired.push_back(std::move(*it));
+            m_blocks.erase(it);
+        }
+    }
+
+    void BlockCache::mark_code(const Block& block)
+    {
+        for (auto a = block.start; a < block.end; ++a)
+        {
+            m_code_bytes.set(a);
+        }
+    }
+
+} // namespace zcpm
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace zcpm
+{
+
+    class IMemory;
+
+    // Which register decoding table an instruction uses, as selected by any 0xdd/0xfd prefix
+    enum class RegisterTable : uint8_t
+    {
+        DEFAULT,
+        DD,
+        FD
+    };
+
+    // A single Z80 instruction which has already been through opcode fetch, prefix handling and table lookup, so that
+    // executing it again can go straight to the instruction handler.
+    struct DecodedInstruction
+    {
+        // Longest instruction (including redundant prefixes) that we are prepared to cache
+        inline static const uint8_t MaxLength{ 8 };
+
+        // Most prefix bytes that we are prepared to cache before the instruction proper
+        inline static const uint8_t MaxPrefixes{ 4 };
+
+        uint16_t address;        // Address of the first byte, which may be a prefix
+        uint8_t opcode;          // The opcode as seen by the instruction handler
+        uint8_t instruction;     // Entry from one of the INSTRUCTION_TABLEs
+        RegisterTable table;     // Register table in effect once all prefixes are processed
+        uint8_t prefixes;        // Number of prefix steps taken before the instruction handler runs
+        uint8_t prefix_cycles;   // Cycles consumed by those prefix steps
+        uint8_t prefix_r;        // Amount that the R register is advanced by those prefix steps
+        uint8_t operands_offset; // Offset from 'address' to the PC value seen by the instruction handler
+        uint8_t length;          // Total length in bytes
+
+        // PC offset at the point at which each prefix step is checked for termination
+        std::array<uint8_t, MaxPrefixes> check_offsets;
+
+        // The instruction itself, which is where the handler's operand fetches are satisfied from
+        std::array<uint8_t, MaxLength> bytes;
+    };
+
+    // Cache of predecoded basic blocks, keyed by address. A block is a run of straight-line code which starts at an
+    // address that we've branched to, and finishes with whatever instruction could change the flow of control. Any
+    // modification of memory holding a cached instruction discards the blocks which include it, so self-modifying code
+    // behaves exactly as it would when decoded from memory each time.
+    class BlockCache final
+    {
+    public:
+        explicit BlockCache(const IMemory& memory);
+
+        BlockCache(const BlockCache&) = delete;
+        BlockCache& operator=(const BlockCache&) = delete;
+        BlockCache(BlockCache&&) = delete;
+        BlockCache& operator=(BlockCache&&) = delete;
+
+        ~BlockCache();
+
+        // Return the decoded instruction at the specified address, decoding a new block starting there if needed.
+        // Returns nullptr if that address isn't cacheable, in which case the caller should decode it from memory.
+        const DecodedInstruction* find(uint16_t address)
+        {
+            const auto p = m_index[address];
+            return p ? p : decode_block(address);
+        }
+
+        // Discard any cached blocks which include any of the specified bytes. This is called for every write to
+        // emulated RAM, so the common case (a page with no cached code in it) needs to be quick.
+        void invalidate(uint16_t address, size_t count = 1)
+        {
+            if ((count == 1) && !(m_code_pages[address >> 8] && m_code_bytes[address]))
+            {
+                return;
+            }
+            invalidate_range(address, address + count);
+        }
+
+        // Discard everything
+        void clear();
+
+        // Number of blocks currently cached
+        [[nodiscard]] size_t size() const;
+
+    private:
+        struct Block
+        {
+            size_t start; // Address of the first byte
+            size_t end;   // Address after the last byte
+            std::vector<DecodedInstruction> instructions;
+        };
+
+        const DecodedInstruction* decode_block(uint16_t address);
+
+        bool decode_instruction(uint16_t address, DecodedInstruction& result) const;
+
+        void invalidate_range(size_t start, size_t end);
+
+        void mark_code(const Block& block);
+
+        const IMemory& m_memory;
+
+        // For each address, the cached instruction starting there (if any)
+        std::vector<const DecodedInstruction*> m_index;
+
+        // All currently valid blocks
+        std::vector<std::unique_ptr<Block>> m_blocks;
+
+        // Blocks which have been invalidated, but which might still be executing; these are released the next time
+        // that a block is decoded, at which point the processor has finished with them
+        std::vector<std::unique_ptr<Block>> m_retired;
+
+        // For each 256 byte page, the blocks which include at least one byte from that page
+        std::array<std::vector<Block*>, 256> m_page_blocks;
+
+        // Quick checks to determine if a write might modify cached code
+        std::array<bool, 256> m_code_pages{};
+        std::bitset<0x10000> m_code_bytes;
+    };
+
+} // namespace zcpm
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace zcpm
+{
+
+    // How many times something was called, and how long (in host time) the calls took, as a histogram with power of
+    // two buckets of microseconds. Not every call needs to be timed; e.g. a BDOS call which never returns can't be.
+    class CallLatency final
+    {
+    public:
+        using Duration = std::chrono::steady_clock::duration;
+
+        // Bucket n holds calls which took less than 2^n microseconds (and, other than for the first, at least half of
+        // that); the last bucket also holds anything longer
+        inline static const size_t Buckets{ 24 };
+
+        void add_call()
+        {
+            ++m_calls;
+        }
+
+        void add_time(Duration duration)
+        {
+            const auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+            ++m_buckets[std::min<size_t>(std::bit_width(static_cast<uint64_t>(us)), Buckets - 1)];
+            ++m_timed;
+            m_total += duration;
+            m_max = std::max(m_max, duration);
+        }
+
+        [[nodiscard]] uint64_t calls() const
+        {
+            return m_calls;
+        }
+
+        [[nodiscard]] uint64_t timed() const
+        {
+            return m_timed;
+        }
+
+        [[nodiscard]] Duration total() const
+        {
+            return m_total;
+        }
+
+        [[nodiscard]] Duration max() const
+        {
+            return m_max;
+        }
+
+        [[nodiscard]] const std::array<uint64_t, Buckets>& buckets() const
+        {
+            return m_buckets;
+        }
+
+        // The upper limit of the bucket which holds the specified fraction (e.g. 0.5 for the median) of the timed
+        // calls, in microseconds; an estimate of that percentile which is never less than the actual value (unless it
+        // is in the last bucket)
+        [[nodiscard]] uint64_t percentile_us(double fraction) const
+        {
+            const auto wanted = static_cast<uint64_t>(fraction * static_cast<double>(m_timed));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < Buckets; ++i)
+            {
+                seen += m_buckets[i];
+                if ((seen > wanted) || (seen == m_timed))
+                {
+                    return uint64_t{ 1 } << i;
+                }
+            }
+            return uint64_t{ 1 } << (Buckets - 1);
+        }
+
+    private:
+        uint64_t m_calls{ 0 };
+        uint64_t m_timed{ 0 };
+        Duration m_total{};
+        Duration m_max{};
+        std::array<uint64_t, Buckets> m_buckets{};
+    };
+
+} // namespace zcpm
@@ -0,0 +1,49 @@
+#include "calltrace.hpp"
+
+#include "bios.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+
+namespace zcpm
+{
+
+    CallTrace::CallTrace(size_t capacity) : m_records(std::max<size_t>(capacity, 1))
+    {
+    }
+
+    void CallTrace::decode(const std::function<std::string(uint16_t)>& describe,
+                           const std::function<std::string(const Record&)>& bdos_name,
+                           const std::function<void(const std::string&)>& output) const
+    {
+        output(fmt::format("Call trace: the last {:d} of {:d} calls", m_full ? m_records.size() : m_next, m_total));
+
+        const auto first = m_full ? m_next : 0;
+        const auto count = m_full ? m_records.size() : m_next;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto& record = m_records[(first + i) % m_records.size()];
+
+            std::string name;
+            if (record.m_kind == Kind::BDOS)
+            {
+                name = "BDOS " + bdos_name(record);
+            }
+            else
+            {
+                name = fmt::format("BIOS fn#{:d} {}", record.m_function, Bios::function_name(record.m_function));
+            }
+
+            output(fmt::format("{:>12d} {:<24} A={:02X} BC={:04X} DE={:04X} HL={:04X} << {}",
+                               record.m_cycles,
+                               name,
+                               record.m_a,
+                               record.m_bc,
+                               record.m_de,
+                               record.m_hl,
+                               describe(record.m_caller)));
+        }
+    }
+
+} // namespace zcpm
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace zcpm
+{
+
+    // A record of the most recent BDOS and BIOS calls, kept in binary form in a ring buffer so that recording a call
+    // costs little more than copying a few registers. Once the buffer is full, each call replaces the oldest one. The
+    // records are only turned into text when they are wanted.
+    class CallTrace final
+    {
+    public:
+        enum class Kind : uint8_t
+        {
+            BDOS,
+            BIOS
+        };
+
+        struct Record
+        {
+            uint64_t m_cycles; // Processor cycle count at the time of the call
+            uint16_t m_caller; // Return address, from the top of the stack
+            uint16_t m_bc;
+            uint16_t m_de;
+            uint16_t m_hl;
+            uint8_t m_a;
+            Kind m_kind;
+            uint8_t m_function; // BDOS function (from C), or BIOS function (from the jump table entry)
+        };
+
+        explicit CallTrace(size_t capacity);
+
+        CallTrace(const CallTrace&) = delete;
+        CallTrace& operator=(const CallTrace&) = delete;
+        CallTrace(CallTrace&&) = delete;
+        CallTrace& operator=(CallTrace&&) = delete;
+
+        ~CallTrace() = default;
+
+        void add(const Record& record)
+        {
+            m_records[m_next] = record;
+            if (++m_next == m_records.size())
+            {
+                m_next = 0;
+                m_full = true;
+            }
+            ++m_total;
+        }
+
+        // How many calls have been recorded altogether, including those which have since been replaced
+        [[nodiscard]] uint64_t total() const
+        {
+            return m_total;
+        }
+
+        // Turn the records which remain into text, oldest first, and pass each line to the specified function.
+        // 'describe' is used to describe the caller's address, and 'bdos_name' to name a BDOS function.
+        void decode(const std::function<std::string(uint16_t)>& describe,
+                    const std::function<std::string(const Record&)>& bdos_name,
+                    const std::function<void(const std::string&)>& output) const;
+
+    private:
+        std::vector<Record> m_records;
+        size_t m_next{ 0 };   // Where the next record goes
+        bool m_full{ false }; // Has the buffer wrapped around yet?
+        uint64_t m_total{ 0 };
+    };
+
+} // namespace zcpm
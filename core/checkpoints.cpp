@@ -0,0 +1,127 @@
+#include "checkpoints.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    // Find a page in a checkpoint's pages, which are kept in order of page number
+    const zcpm::Checkpoints::SavedPage* find_page(const std::vector<zcpm::Checkpoints::SavedPage>& pages,
+                                                  uint8_t number)
+    {
+        const auto it = std::lower_bound(
+            pages.begin(), pages.end(), number, [](const auto& page, uint8_t n) { return page.number < n; });
+        return ((it != pages.end()) && (it->number == number)) ? &*it : nullptr;
+    }
+
+} // namespace
+
+namespace zcpm
+{
+
+    Checkpoints::Checkpoints(size_t limit) : m_limit(std::max<size_t>(limit, 1))
+    {
+    }
+
+    void Checkpoints::add(const Processor::State& processor,
+                          const Bios::State& bios,
+                          size_t input_position,
+                          const Scheduling& scheduling,
+                          std::span<const uint8_t> memory,
+                          const DirtyPages& dirty)
+    {
+        if (memory.size() != PageSize * PageCount)
+        {
+            throw std::logic_error("Checkpoint of the wrong memory size");
+        }
+
+        auto& checkpoint =
+            m_checkpoints.emplace_back(Checkpoint{ processor, bios, input_position, scheduling, {}, {} });
+        const auto first = m_checkpoints.size() == 1;
+        for (size_t number = 0; number < PageCount; ++number)
+        {
+            if (first || dirty[number])
+            {
+                auto& page = checkpoint.pages.emplace_back(SavedPage{ static_cast<uint8_t>(number), {} });
+                std::copy_n(memory.begin() + number * PageSize, PageSize, page.data.begin());
+            }
+        }
+
+        if (m_checkpoints.size() > m_limit)
+        {
+            // The oldest checkpoint is the only one with all of memory, so the next one takes whatever it lacks from
+            // there before becoming the oldest
+            auto& oldest = m_checkpoints[0];
+            auto& next = m_checkpoints[1];
+            std::vector<SavedPage> pages;
+            pages.reserve(PageCount);
+            for (size_t number = 0; number < PageCount; ++number)
+            {
+                const auto* p_page = find_page(next.pages, static_cast<uint8_t>(number));
+                pages.push_back(p_page ? *p_page : *find_page(oldest.pages, static_cast<uint8_t>(number)));
+            }
+            next.pages = std::move(pages);
+            m_checkpoints.erase(m_checkpoints.begin());
+        }
+    }
+
+    size_t Checkpoints::size() const
+    {
+        return m_checkpoints.size();
+    }
+
+    const Checkpoints::Checkpoint& Checkpoints::at(size_t index) const
+    {
+        return m_checkpoints.at(index);
+    }
+
+    Checkpoints::Checkpoint& Checkpoints::latest()
+    {
+        return m_checkpoints.back();
+    }
+
+    std::optional<size_t> Checkpoints::latest_before(uint64_t cycles) const
+    {
+        for (auto index = m_checkpoints.size(); index > 0; --index)
+        {
+            if (m_checkpoints[index - 1].processor.cycle_count < cycles)
+            {
+                return index - 1;
+            }
+        }
+        return std::nullopt;
+    }
+
+    Checkpoints::DirtyPages Checkpoints::changed_since(size_t index, const DirtyPages& dirty) const
+    {
+        auto result = dirty;
+        for (auto later = index + 1; later < m_checkpoints.size(); ++later)
+        {
+            for (const auto& page : m_checkpoints[later].pages)
+            {
+                result[page.number] = true;
+            }
+        }
+        return result;
+    }
+
+    const Checkpoints::Page& Checkpoints::page_at(size_t index, uint8_t number) const
+    {
+        // The first checkpoint has every page, so this always finds one
+        for (auto earlier = index + 1; earlier > 0; --earlier)
+        {
+            if (const auto* p_page = find_page(m_checkpoints[earlier - 1].pages, number))
+            {
+                return p_page->data;
+            }
+        }
+        throw std::logic_error("Checkpoint without a page");
+    }
+
+    void Checkpoints::truncate(size_t index)
+    {
+        m_checkpoints.erase(m_checkpoints.begin() + static_cast<std::ptrdiff_t>(index + 1), m_checkpoints.end());
+        m_checkpoints[index].sectors.clear();
+    }
+
+} // namespace zcpm
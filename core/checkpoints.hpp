@@ -0,0 +1,102 @@
+#pragma once
+
+#include "bios.hpp"
+#include "disk.hpp"
+#include "eventscheduler.hpp"
+#include "processor.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace zcpm
+{
+
+    // Checkpoints of the whole machine, taken now and then during a run so that the debugger can go back to an earlier
+    // point by restoring one and replaying forward from there (see System::reverse_step). Only the first checkpoint
+    // has all of memory; each later one has just the pages which were written since the one before (Hardware keeps a
+    // dirty flag for each page), so taking one costs in proportion to what the program has written rather than to the
+    // size of memory. The disk is handled the other way around: each checkpoint collects the previous contents of the
+    // sectors which are written after it is taken, so that those writes can be undone.
+    class Checkpoints final
+    {
+    public:
+        inline static const size_t PageSize{ 0x100 };
+        inline static const size_t PageCount{ 0x10000 / PageSize };
+
+        using Page = std::array<uint8_t, PageSize>;
+        using DirtyPages = std::array<bool, PageCount>;
+
+        struct SavedPage
+        {
+            uint8_t number;
+            Page data;
+        };
+
+        // Where the machine stood with respect to events and interrupts (see Hardware::run)
+        struct Scheduling
+        {
+            EventScheduler::Deadlines deadlines;
+            bool interrupt_pending; // Requested but not yet accepted
+            uint8_t interrupt_data; // To go with it
+            size_t slice_cycles;    // Left before the run gets round to the events again
+        };
+
+        struct Checkpoint
+        {
+            Processor::State processor;
+            Bios::State bios;
+            size_t input_position;                 // In the BIOS' console input log
+            Scheduling scheduling;                 // Of events and interrupts
+            std::vector<SavedPage> pages;          // Those written since the previous checkpoint (all, for the first)
+            std::vector<Disk::SectorCopy> sectors; // As they were before being written since this checkpoint
+        };
+
+        // Keeping at most 'limit' checkpoints, beyond which the oldest are merged into the next
+        explicit Checkpoints(size_t limit);
+
+        Checkpoints(const Checkpoints&) = delete;
+        Checkpoints& operator=(const Checkpoints&) = delete;
+        Checkpoints(Checkpoints&&) = delete;
+        Checkpoints& operator=(Checkpoints&&) = delete;
+
+        ~Checkpoints() = default;
+
+        // Add a checkpoint of the specified state, keeping the pages of memory which are marked as dirty (or all of
+        // them, for the first checkpoint)
+        void add(const Processor::State& processor,
+                 const Bios::State& bios,
+                 size_t input_position,
+                 const Scheduling& scheduling,
+                 std::span<const uint8_t> memory,
+                 const DirtyPages& dirty);
+
+        [[nodiscard]] size_t size() const;
+
+        [[nodiscard]] const Checkpoint& at(size_t index) const;
+
+        // The most recent checkpoint, which collects the sectors written since it was taken (there must be one)
+        [[nodiscard]] Checkpoint& latest();
+
+        // The index of the most recent checkpoint taken before the specified cycle count, if there is one
+        [[nodiscard]] std::optional<size_t> latest_before(uint64_t cycles) const;
+
+        // Which pages differ (or may differ) between memory as it was at the specified checkpoint and as it is now,
+        // given which pages have been written since the most recent checkpoint
+        [[nodiscard]] DirtyPages changed_since(size_t index, const DirtyPages& dirty) const;
+
+        // A page of memory as it was at the specified checkpoint
+        [[nodiscard]] const Page& page_at(size_t index, uint8_t number) const;
+
+        // Discard the checkpoints after the specified one, along with the sectors that it has collected
+        void truncate(size_t index);
+
+    private:
+        std::vector<Checkpoint> m_checkpoints;
+        const size_t m_limit;
+    };
+
+} // namespace zcpm
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "cpu.hpp"
+#include "diskgeometry.hpp"
+#include "engine.hpp"
+
 #include <string>
 
 namespace zcpm
@@ -13,5 +17,27 @@ namespace zcpm
         bool protect_bdos_jump;         // Protect against modification of the BDOS jump vector?
         std::string bdos_sym;           // Filename of BDOS symbols (generated by the assembler)
         std::string user_sym;           // Filename of symbols for a user executable (ditto)
+        Engine engine;                  // How the processor decodes & executes instructions
+        Cpu cpu;                        // Which processor to emulate
+        bool lazy_flags;                // Are flags only computed when something needs them?
+        bool fast;                      // Skip counting cycles & emulating R, where a run doesn't need them?
+        int idle_polls;                 // Unsuccessful console status polls before waiting for input (0=never wait)
+        int idle_timeout_ms;            // How long to wait for input, once a program seems to be idle
+        int sector_cache_kb;            // Upper limit on the memory used to cache disk sectors (0=no limit)
+        bool flush_on_close;            // Write files to the host filesystem as soon as BDOS closes them?
+        int flush_sectors;              // Write changes to the host filesystem after this many sector writes (0=never)
+        int flush_interval_ms;          // Write changes to the host filesystem this often (0=never)
+        bool flush_sync;                // Wait for writes to the host filesystem to reach the storage device?
+        bool native_bdos;               // Handle BDOS reads & writes of file records directly, rather than via BIOS?
+        bool native_console;            // Handle BDOS console output directly, rather than via BIOS per character?
+        std::string disk_root;          // Host directory whose files make up the disk (empty=the current directory)
+        std::string disk_image;         // Raw disk image to use instead of a host directory (empty=none)
+        DiskGeometry disk_geometry;     // Geometry of the disk (whether synthesised or an image)
+        std::string directory_index;    // File in which to keep the layout of the host directory (empty=none)
+        int call_trace;                 // Keep this many recent BDOS/BIOS calls in binary form, instead of logging them
+        std::string profile;            // File to write an execution profile to at exit (empty=don't profile)
+        std::string profile_stacks;     // File to write the profile's call stacks to, for flame graphs (empty=none)
+        int clock_khz;                  // Emulated clock rate, which runs with events are paced to (0=don't pace them)
+        int timer_hz;                   // Rate of timer interrupts (0=none)
     };
 } // namespace zcpm
@@ -0,0 +1,34 @@
+#include "cpu.hpp"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include <istream>
+
+namespace zcpm
+{
+    std::istream& operator>>(std::istream& in, Cpu& cpu)
+    {
+        std::string token;
+        in >> token;
+
+        boost::to_upper(token);
+
+        if (token == "Z80")
+        {
+            cpu = Cpu::Z80;
+        }
+        else if (token == "8080")
+        {
+            cpu = Cpu::I8080;
+        }
+        else
+        {
+            throw boost::program_options::validation_error(
+                boost::program_options::validation_error::invalid_option_value, "Invalid CPU");
+        }
+
+        return in;
+    }
+
+} // namespace zcpm
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <iosfwd>
+
+namespace zcpm
+{
+    enum class Cpu
+    {
+        Z80,  // The full Z80 instruction set
+        I8080 // Just the 8080 subset, with 8080 flags; any Z80-only instruction is an error
+    };
+
+    std::istream& operator>>(std::istream& in, Cpu& cpu);
+
+} // namespace zcpm
@@ -1,6 +1,7 @@
 #include "debugaction.hpp"
 
-#include <boost/log/trivial.hpp>
+#include "log.hpp"
+
 #include <fmt/core.h>
 
 #include <cstdlib>
@@ -42,6 +43,11 @@ namespace zcpm
         return m_address;
     }
 
+    bool DebugAction::watches_memory() const
+    {
+        return false;
+    }
+
     std::ostream& operator<<(std::ostream& os, const DebugAction& a)
     {
         os << a.describe();
@@ -56,7 +62,7 @@ namespace zcpm
     {
         if (m_address == address)
         {
-            BOOST_LOG_TRIVIAL(trace) << fmt::format("{}: Breakpoint at {:04X}", FACILITY, address);
+            ZCPM_LOG(trace) << fmt::format("{}: Breakpoint at {:04X}", FACILITY, address);
             std::cout << fmt::format("{}: Breakpoint at {:04X}", FACILITY, address) << std::endl;
             return false;
         }
@@ -72,12 +78,17 @@ namespace zcpm
     {
     }
 
+    bool Watchpoint::watches_memory() const
+    {
+        return true;
+    }
+
     bool Watchpoint::evaluate(uint16_t address) const
     {
         if (m_address == address)
         {
-            const auto message = fmt::format("{}: Watchpoint at {:04X}", FACILITY, address);
-            BOOST_LOG_TRIVIAL(trace) << message;
+            const auto message = fmt::format("{}: Watchpoint at {:04X} accessed", FACILITY, address);
+            ZCPM_LOG(trace) << message;
             std::cout << message << std::endl;
         }
         return true; // Allow the debugger to keep running
@@ -101,11 +112,11 @@ namespace zcpm
             if ((m_remaining == 0) || (--m_remaining == 0))
             {
                 const auto message = fmt::format("{}: Passpoint at {:04X} expired, stopping", FACILITY, address);
-                BOOST_LOG_TRIVIAL(trace) << message;
+                ZCPM_LOG(trace) << message;
                 std::cout << message << std::endl;
                 return false;
             }
-            BOOST_LOG_TRIVIAL(trace) << fmt::format("{}: Passpoint at {:04X} not yet expired", FACILITY, address);
+            ZCPM_LOG(trace) << fmt::format("{}: Passpoint at {:04X} not yet expired", FACILITY, address);
         }
 
         // Carry on, don't stop the debugger
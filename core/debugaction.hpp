@@ -35,8 +35,12 @@ namespace zcpm
 
         [[nodiscard]] uint16_t get_address() const;
 
-        // Called each time we reach a new address.  This method should return true
-        // if the system should continue, false if it should break (returning to the
+        // Returns true if this action is interested in accesses to its address as data, rather than in execution
+        // reaching it
+        [[nodiscard]] virtual bool watches_memory() const;
+
+        // Called each time we reach a new address (or for memory watches, each time the address is accessed). This
+        // method should return true if the system should continue, false if it should break (returning to the
         // debugger prompt)
         [[nodiscard]] virtual bool evaluate(uint16_t address) const = 0;
 
@@ -59,11 +63,12 @@ namespace zcpm
         [[nodiscard]] std::string describe() const override;
     };
 
-    // Always allows the debugger to keep running, but may cause some logging each time through
+    // Always allows the debugger to keep running, but causes some logging each time the address is read or written
     class Watchpoint : public DebugAction
     {
     public:
         Watchpoint(uint16_t address, std::string_view location);
+        [[nodiscard]] bool watches_memory() const override;
         [[nodiscard]] bool evaluate(uint16_t address) const override; // Will always return true
         [[nodiscard]] std::string describe() const override;
     };
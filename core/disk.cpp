@@ -1,18 +1,36 @@
 #include "disk.hpp"
 
+#include "diskimage.hpp"
+#include "log.hpp"
+
 #include <boost/algorithm/string.hpp>
-#include <boost/log/trivial.hpp>
 #include <fmt/core.h>
 
 #include <algorithm>
 #include <array>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <system_error>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace
 {
@@ -37,31 +55,10 @@ namespace
     }
 
     static const inline uint16_t EntrySize = 0x0020;
-    static const inline uint16_t BlockSize = 0x0800;
-    static const inline uint16_t SectorsPerBlock = BlockSize / zcpm::Disk::SectorSize;
+    static const inline uint16_t RecordsPerExtent = 0x0080; // Records in each logical (16KB) extent
 
     using Location = std::tuple<uint16_t, uint16_t>; // Track/Sector which identify a particular sector on the disk
 
-    // Given a block number and a sector offset, works out the actual track/sector. Assumes that sector_offset is
-    // strictly within that same block, not overflowing into an adjacent block!
-    Location find_location_within_block(uint16_t block, uint16_t sector_offset)
-    {
-        const auto s = block * SectorsPerBlock + sector_offset;
-        const auto track_index = s / zcpm::Disk::SectorSize;
-        const auto sector_index = s - track_index * zcpm::Disk::SectorSize;
-        return { track_index, sector_index };
-    }
-
-    // Map a track/sector to a block number and offset, where the offset is the index of the sequence within the block
-    // (first sector is zero, second sector is one, etc)
-    std::tuple<uint16_t, uint8_t> track_sector_to_block_and_offset(uint16_t track, uint16_t sector)
-    {
-        const auto n = track * zcpm::Disk::SectorSize + sector;
-        const auto block = n >> zcpm::Disk::BSH;
-        const auto offset = n & zcpm::Disk::BLM;
-        return { block, offset };
-    }
-
 } // namespace
 
 namespace zcpm
@@ -72,30 +69,32 @@ namespace zcpm
     {
     public:
         // Construct from a host filesystem file
-        Entry(const std::filesystem::directory_entry& e, uint8_t extent, uint16_t sectors, uint16_t first_block)
-            : m_raw_name(e.path().filename()),
-              m_name(convert(e.path().stem(), e.path().extension())),
+        Entry(const std::string& raw_name, size_t size, size_t extent, size_t sectors, uint16_t first_block)
+            : m_raw_name(raw_name),
+              m_name(convert(std::filesystem::path(raw_name).stem(), std::filesystem::path(raw_name).extension())),
               m_exists(true),
-              m_size(std::filesystem::file_size(e)),
-              m_sectors(std::min<size_t>(sectors, 0x0080)),
+              m_size(size),
+              m_sectors(sectors),
               m_extent(extent),
               m_first_block(first_block)
         {
         }
 
-        // Construct from a CP/M directory entry (16 bytes)
-        explicit Entry(const uint8_t* buffer)
+        // Construct from a CP/M directory entry (32 bytes), whose disk map holds 8-bit block numbers on a small disk
+        Entry(const uint8_t* buffer, const DiskGeometry& geometry)
             : m_modified(true) // Needs to be flushed on shutdown because it is not (originally) a host filesystem file
         {
             m_exists = (buffer[0x00] != 0xE5);
             m_name.assign(reinterpret_cast<const char*>(buffer + 1), 11);
             m_raw_name = boost::to_lower_copy(boost::trim_right_copy(m_name.substr(0, 8)) + "." +
                                               boost::trim_right_copy(m_name.substr(8, 3)));
-            m_extent = buffer[0x0C];
+            m_extent = (buffer[0x0C] & 0x1F) | (buffer[0x0E] << 5); // EX and S2, as per format_directory_entry()
             m_sectors = buffer[0x0F];
-            for (size_t i = 0; i < 8; i++)
+            const auto wide = geometry.dsm >= 0x0100;
+            for (size_t i = 0; i < (wide ? 8 : 16); i++)
             {
-                const uint16_t block = buffer[0x10 + i * 2 + 0] | (buffer[0x10 + i * 2 + 1] << 8);
+                const uint16_t block =
+                    wide ? (buffer[0x10 + i * 2 + 0] | (buffer[0x10 + i * 2 + 1] << 8)) : buffer[0x10 + i];
                 if (block > 0)
                 {
                     m_blocks.push_back(block);
@@ -105,65 +104,311 @@ namespace zcpm
 
         void show() const
         {
+            if (!log::is_enabled<log::Level::trace>())
+            {
+                return;
+            }
+
             std::stringstream blocks;
             for (const auto& b : m_blocks)
             {
                 blocks << ' ' << b;
             }
-            BOOST_LOG_TRIVIAL(trace) << "  '" << m_raw_name << "' '" << m_name << "' Size=" << m_size
-                                     << " Sectors=" << m_sectors << " Extent=" << m_extent
-                                     << " FirstBlock=" << m_first_block << " [" << blocks.str()
-                                     << " ] Exists:" << (m_exists ? 'Y' : 'N');
+            ZCPM_LOG(trace) << "  '" << m_raw_name << "' '" << m_name << "' Size=" << m_size
+                            << " Sectors=" << m_sectors << " Extent=" << m_extent
+                            << " FirstBlock=" << m_first_block << " [" << blocks.str()
+                            << " ] Exists:" << (m_exists ? 'Y' : 'N');
         }
 
         std::string m_raw_name;     // e.g. "file.txt"
         std::string m_name;         // e.g. "FILE    TXT"
         bool m_exists = false;      // True normally, false if the file has been deleted
         size_t m_size = 0;          // Size in bytes; for the *whole* file
-        size_t m_sectors = 0;       // Number of sectors in *this* extent
-        size_t m_extent = 0;        // Extent number (always zero for small files, can be other for bigger files)
+        size_t m_sectors = 0;       // Number of sectors in the last logical extent of *this* entry (RC)
+        size_t m_extent = 0;        // Last logical extent of this entry (EX & S2; always zero for small files)
         uint16_t m_first_block = 0; // What is the first block number of this file (across *all* of its extents/entries)
         std::vector<uint16_t> m_blocks; // Block indexes allocated for this entry for this file.  Always contiguous!!!
         bool m_modified = false;        // Does this need to be "flushed" to the host filesystem on completion?
     };
 
-    struct SectorInfo
+    // Which directory entry a block belongs to, and where that block appears in the entry's disk map
+    struct BlockOwner
+    {
+        inline static const size_t NoEntry{ SIZE_MAX };
+
+        size_t m_entry = NoEntry; // Index into the list of directory entries
+        uint8_t m_ordinal = 0;    // Index into that entry's m_blocks
+    };
+
+    // A file in the host directory, as recorded in the directory index
+    struct HostFile
     {
-        explicit SectorInfo(const Disk::SectorData& buffer) : m_data(buffer)
+        std::string m_raw_name;     // e.g. "file.txt"
+        size_t m_size = 0;          // Size in bytes
+        int64_t m_mtime = 0;        // Modification time, in nanoseconds
+        uint16_t m_first_block = 0; // Where the file's data starts on the disk; zero if it hasn't been placed yet
+    };
+
+    // Cache of the sectors that we know about, indexed by track and sector.  The sectors themselves live in a slab of
+    // slots, so adding a sector doesn't allocate once the slab has reached its working size.  If the cache has a size
+    // limit, then beyond that clean file data sectors are evicted (since they can be fetched from the host filesystem
+    // again) to make room for new ones. Sectors which can't be fetched again, because the host file that they came from
+    // no longer goes by their file's name, are pinned so that they aren't evicted.
+    class SectorCache final
+    {
+    public:
+        // The disk has the specified number of sectors per track and sectors in total, and sectors before the first
+        // data sector are never evicted
+        SectorCache(size_t max_sectors, uint16_t sectors_per_track, size_t total_sectors, size_t first_data_sector)
+            : m_max_sectors(max_sectors),
+              m_sectors_per_track(sectors_per_track),
+              m_first_data_sector(first_data_sector),
+              m_slots(total_sectors, NoSlot)
         {
+            m_dirty.resize((total_sectors + 63) / 64);
+            m_pinned.resize(m_dirty.size());
+            if (m_max_sectors)
+            {
+                m_data.reserve(m_max_sectors);
+                m_locations.reserve(m_max_sectors);
+            }
         }
 
-        void get_data(Disk::SectorData& buffer) const // Copy from cache into buffer
+        SectorCache(const SectorCache&) = delete;
+        SectorCache& operator=(const SectorCache&) = delete;
+        SectorCache(SectorCache&&) = delete;
+        SectorCache& operator=(SectorCache&&) = delete;
+
+        ~SectorCache() = default;
+
+        // Return the cached copy of the specified sector, or nullptr if it isn't cached
+        const Disk::SectorData* find(uint16_t track, uint16_t sector) const
         {
-            buffer = m_data;
+            const auto n = index(track, sector);
+            return ((n < m_slots.size()) && (m_slots[n] != NoSlot)) ? &m_data[m_slots[n]] : nullptr;
         }
 
-        void put_data(const Disk::SectorData& buffer) // Copy from buffer into cache
+        // Return the cached copy of the specified sector if it is yet to be written to the host filesystem (because it
+        // is dirty, or pinned), or nullptr otherwise
+        const Disk::SectorData* find_unflushed(uint16_t track, uint16_t sector) const
         {
-            m_data = buffer;
-            m_dirty = true;
+            const auto n = index(track, sector);
+            const auto unflushed = (n < m_slots.size()) && (m_slots[n] != NoSlot) && (is_dirty(n) || is_pinned(n));
+            return unflushed ? &m_data[m_slots[n]] : nullptr;
         }
 
-        Disk::SectorData m_data;
-        bool m_dirty{ false };
+        // Store a copy of the specified sector; a dirty sector is one which needs to be flushed to the host filesystem
+        void put(uint16_t track, uint16_t sector, Disk::ConstSectorView buffer, bool dirty)
+        {
+            const auto n = index(track, sector);
+            if (n >= m_slots.size())
+            {
+                // Beyond the disk geometry that we describe in the DPB; unlikely, but cope anyway
+                m_slots.resize(n + 1, NoSlot);
+                m_dirty.resize((n + 64) / 64);
+                m_pinned.resize(m_dirty.size());
+            }
+
+            if (m_slots[n] == NoSlot)
+            {
+                m_slots[n] = allocate_slot(n);
+            }
+            std::copy(buffer.begin(), buffer.end(), m_data[m_slots[n]].begin());
+            if (dirty)
+            {
+                m_dirty[n / 64] |= uint64_t(1) << (n % 64);
+            }
+        }
+
+        // Record that the specified sector has been flushed to the host filesystem, so that it could be fetched from
+        // there again
+        void set_clean(uint16_t track, uint16_t sector)
+        {
+            const auto n = index(track, sector);
+            if (n < m_slots.size())
+            {
+                m_dirty[n / 64] &= ~(uint64_t(1) << (n % 64));
+                m_pinned[n / 64] &= ~(uint64_t(1) << (n % 64));
+            }
+        }
+
+        // Keep the specified sector (which must be cached) from being evicted, until it is next flushed
+        void pin(uint16_t track, uint16_t sector)
+        {
+            const auto n = index(track, sector);
+            if ((n < m_slots.size()) && (m_slots[n] != NoSlot))
+            {
+                m_pinned[n / 64] |= uint64_t(1) << (n % 64);
+            }
+        }
+
+        // How many clean sectors have been evicted to make room for others
+        [[nodiscard]] uint64_t evictions() const
+        {
+            return m_evictions;
+        }
+
+        // Call f(track, sector, data) for each dirty sector, in track/sector order
+        template <typename F>
+        void for_each_dirty(F f) const
+        {
+            for (size_t word = 0; word < m_dirty.size(); ++word)
+            {
+                for (auto bits = m_dirty[word]; bits; bits &= bits - 1)
+                {
+                    const auto n = word * 64 + std::countr_zero(bits);
+                    f(static_cast<uint16_t>(n / m_sectors_per_track),
+                      static_cast<uint16_t>(n % m_sectors_per_track),
+                      m_data[m_slots[n]]);
+                }
+            }
+        }
+
+    private:
+        inline static const uint32_t NoSlot{ UINT32_MAX };
+
+        [[nodiscard]] size_t index(uint16_t track, uint16_t sector) const
+        {
+            return size_t(track) * m_sectors_per_track + sector;
+        }
+
+        [[nodiscard]] bool is_dirty(size_t n) const
+        {
+            return m_dirty[n / 64] & (uint64_t(1) << (n % 64));
+        }
+
+        [[nodiscard]] bool is_pinned(size_t n) const
+        {
+            return m_pinned[n / 64] & (uint64_t(1) << (n % 64));
+        }
+
+        // Find a slot for the sector with the specified index, either a new one or one taken from a clean sector
+        uint32_t allocate_slot(size_t n)
+        {
+            if (m_max_sectors && (m_data.size() >= m_max_sectors))
+            {
+                // Look for a clean data sector to evict, carrying on from where the last search finished.  Directory
+                // (and reserved) sectors are never evicted, because they're synthesised from directory entries that
+                // might since have changed.
+                for (size_t i = 0; i < m_locations.size(); ++i)
+                {
+                    const auto slot = m_next_victim;
+                    m_next_victim = (m_next_victim + 1) % m_locations.size();
+                    const auto victim = m_locations[slot];
+                    if ((victim >= m_first_data_sector) && !is_dirty(victim) && !is_pinned(victim))
+                    {
+                        ++m_evictions;
+                        m_slots[victim] = NoSlot;
+                        m_locations[slot] = static_cast<uint32_t>(n);
+                        return slot;
+                    }
+                }
+                // Everything is dirty (or pinned, or directory), so we have no choice but to go over the limit
+            }
+
+            m_data.emplace_back();
+            m_locations.push_back(static_cast<uint32_t>(n));
+            return static_cast<uint32_t>(m_data.size() - 1);
+        }
+
+        const size_t m_max_sectors; // Zero means no limit
+        const uint16_t m_sectors_per_track;
+        const size_t m_first_data_sector;
+
+        std::vector<uint32_t> m_slots;        // For each track/sector, the slot which holds its data (if any)
+        std::vector<uint64_t> m_dirty;        // For each track/sector, is it dirty?
+        std::vector<uint64_t> m_pinned;       // For each track/sector, is it pinned?
+        std::vector<Disk::SectorData> m_data; // Slots
+        std::vector<uint32_t> m_locations;    // For each slot, the track/sector that it holds
+        uint32_t m_next_victim{ 0 };          // Slot at which the next search for an eviction candidate starts
+        uint64_t m_evictions{ 0 };
     };
 
     // Implementation
 
     class Disk::Private final
     {
+        // The shape of the disk that we present to the BDOS
+        const DiskGeometry m_geometry;
+
         std::vector<Entry> m_entries;
-        // TODO: To speed up searches for files, consider adding a map of block number to Entry instance,
-        // so that way we don't need to do a linear search on every block query.
 
-        mutable std::map<Location, SectorInfo> m_sector_cache; // Cache of sectors that we know about
+        // Indexes into m_entries of the entries (including those of deleted files) with each CP/M name, so that a
+        // changed directory entry can be matched up without searching every entry
+        std::unordered_map<std::string, std::vector<size_t>> m_entries_by_name;
+
+        // For each block number, the entry which most recently claimed that block. This is indexed directly by block
+        // number (CP/M block numbers are small and dense) so that finding the file which owns a sector doesn't have
+        // to search every entry.
+        std::vector<BlockOwner> m_block_owners;
+
+        mutable SectorCache m_sector_cache;
+
+        struct FileCloser
+        {
+            void operator()(std::FILE* fp) const
+            {
+                std::fclose(fp);
+            }
+        };
+        using FilePtr = std::unique_ptr<std::FILE, FileCloser>;
+
+        // Number of host files that we keep open for reading
+        inline static const size_t MaxOpenFiles{ 8 };
+
+        // Host files which are open for reading, most recently used first
+        mutable std::vector<std::pair<std::string, FilePtr>> m_open_files;
+
+        // The first block that hasn't been given to a host file; blocks before the first data block hold the directory
+        uint16_t m_next_block;
+
+        // When do changes get written to the host filesystem, other than when the disk goes away?
+        const bool m_flush_on_close;  // When BDOS updates a file's directory entry (e.g. when closing it)
+        const size_t m_flush_sectors; // After this many sector writes (0=never)
+        const bool m_flush_sync;      // Make sure that each flush reaches the storage device?
+
+        // The host directory whose files make up the disk
+        const std::string m_root;
+
+        // Where the layout of the host directory is saved between runs, if anywhere
+        const std::string m_index_file;
+        inline static const std::string IndexMagic{ "zcpm-directory-index-2" };
+
+        size_t m_sectors_since_flush{ 0 };
+
+        // See Disk::Statistics
+        mutable uint64_t m_cache_hits{ 0 };
+        mutable uint64_t m_cache_misses{ 0 };
+        uint64_t m_flushes{ 0 };
+        uint64_t m_files_written{ 0 };
 
-        uint16_t m_next_block = 0x0010;
+        // Serialises access between the emulation and the background flusher (if there is one)
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        bool m_stopping{ false };
+        std::thread m_flusher;
 
     public:
-        Private()
+        explicit Private(const Config& behaviour)
+            : m_geometry(behaviour.disk_geometry),
+              m_sector_cache(static_cast<size_t>(std::max(behaviour.sector_cache_kb, 0)) * 1024 / SectorSize,
+                             m_geometry.spt,
+                             m_geometry.sectors(),
+                             first_data_sector()),
+              m_next_block(m_geometry.directory_blocks()),
+              m_flush_on_close(behaviour.flush_on_close),
+              m_flush_sectors(std::max(behaviour.flush_sectors, 0)),
+              m_flush_sync(behaviour.flush_sync),
+              m_root(behaviour.disk_root.empty() ? "." : behaviour.disk_root),
+              m_index_file(behaviour.directory_index)
         {
-            build_directory();
+            build_directory(m_root);
+
+            if (behaviour.flush_interval_ms > 0)
+            {
+                m_flusher = std::thread(
+                    &Private::run_flusher, this, std::chrono::milliseconds(behaviour.flush_interval_ms));
+            }
         }
 
         Private(const Private&) = delete;
@@ -173,6 +418,16 @@ namespace zcpm
 
         ~Private()
         {
+            if (m_flusher.joinable())
+            {
+                {
+                    std::lock_guard lock(m_mutex);
+                    m_stopping = true;
+                }
+                m_wakeup.notify_one();
+                m_flusher.join();
+            }
+
             try
             {
                 flush_to_host_filesystem();
@@ -185,29 +440,99 @@ namespace zcpm
 
         size_t size() const
         {
+            std::lock_guard lock(m_mutex);
             return m_entries.size();
         }
 
-        void read(SectorData& buffer, uint16_t track, uint16_t sector) const
+        [[nodiscard]] const DiskGeometry& get_geometry() const
+        {
+            return m_geometry;
+        }
+
+        void read(SectorView buffer, uint16_t track, uint16_t sector) const
+        {
+            std::lock_guard lock(m_mutex);
+            if (read_sector(buffer, track, sector))
+            {
+                ++m_cache_hits;
+            }
+            else
+            {
+                ++m_cache_misses;
+            }
+        }
+
+        void write(ConstSectorView buffer, uint16_t track, uint16_t sector)
+        {
+            std::lock_guard lock(m_mutex);
+
+            // Is it a directory entry or general data?
+            if (is_directory(track, sector))
+            {
+                // BDOS is modifying directory entries.
+                // Work out what has changed and then update m_entries accordingly
+                const auto updated = check_for_directory_changes(buffer, track, sector);
+
+                // Write the sector to the cache
+                write_disk_data(buffer, track, sector);
+
+                // BDOS updates a file's directory entry when it closes the file (and when it moves on to another
+                // extent), which is the natural point at which to write the file to the host filesystem
+                if (m_flush_on_close)
+                {
+                    for (const auto& name : updated)
+                    {
+                        flush_file(name);
+                    }
+                }
+            }
+            else
+            {
+                write_disk_data(buffer, track, sector);
+
+                if (m_flush_sectors && (++m_sectors_since_flush >= m_flush_sectors))
+                {
+                    flush_pending();
+                }
+            }
+        }
+
+        // Fill in the counters which are kept here, rather than by the facade
+        void get_statistics(Statistics& statistics) const
+        {
+            std::lock_guard lock(m_mutex);
+            statistics.cache_hits = m_cache_hits;
+            statistics.cache_misses = m_cache_misses;
+            statistics.evictions = m_sector_cache.evictions();
+            statistics.flushes = m_flushes;
+            statistics.files_written = m_files_written;
+        }
+
+    private:
+        // Returns true if the sector was in the cache
+        bool read_sector(SectorView buffer, uint16_t track, uint16_t sector) const
         {
             // First see if the specific sector is in the sector cache
-            const Location location{ track, sector };
-            const auto it = m_sector_cache.find(location);
-            if (it != m_sector_cache.end())
+            if (const auto p_data = m_sector_cache.find(track, sector); p_data)
             {
-                it->second.get_data(buffer);
-                return;
+                std::copy(p_data->begin(), p_data->end(), buffer.begin());
+                return true;
             }
 
             // It's not in the cache, so we need to go to the underlying (host) disk
 
             // Is it a directory entry or general data?
-            if ((track == 0) || (track == 1))
+            if (is_directory(track, sector))
             {
                 // Construct 4 directory entries in the buffer; the choice of *which* directory
                 // entries is determined by the track/sector values.
                 create_directory_entries(buffer, track, sector);
             }
+            else if (!is_data(track, sector))
+            {
+                // The reserved tracks, which nothing uses, look as if they have just been formatted
+                std::fill(buffer.begin(), buffer.end(), 0xE5);
+            }
             else
             {
                 // File data.  We use the directory entries to work out which bit of which file corresponds
@@ -217,67 +542,352 @@ namespace zcpm
 
             // Add the sector we've read (or synthesised) into the sector cache.  Fortunately CP/M disks
             // are not large, so we can comfortably have this in memory.
-            SectorInfo sector_info(buffer);
-            m_sector_cache.emplace(location, sector_info);
+            m_sector_cache.put(track, sector, buffer, false);
+            return false;
         }
 
-        void write(const SectorData& buffer, uint16_t track, uint16_t sector)
+        // Where things are on the disk, as determined by the geometry; the reserved tracks come first, then the
+        // directory, then file data, and blocks are numbered from the start of the directory
+        [[nodiscard]] size_t sector_number(uint16_t track, uint16_t sector) const
         {
-            // Is it a directory entry or general data?
-            if ((track == 0) || (track == 1))
-            {
-                // BDOS is modifying directory entries.
-                // Work out what has changed and then update m_entries accordingly
-                check_for_directory_changes(buffer);
-            }
+            return size_t(track) * m_geometry.spt + sector;
+        }
+        [[nodiscard]] size_t first_directory_sector() const
+        {
+            return size_t(m_geometry.off) * m_geometry.spt;
+        }
+        [[nodiscard]] size_t first_data_sector() const
+        {
+            return first_directory_sector() + (size_t(m_geometry.directory_blocks()) << m_geometry.bsh);
+        }
+        [[nodiscard]] bool is_directory(uint16_t track, uint16_t sector) const
+        {
+            const auto n = sector_number(track, sector);
+            return (n >= first_directory_sector()) && (n < first_data_sector());
+        }
+        [[nodiscard]] bool is_data(uint16_t track, uint16_t sector) const
+        {
+            return sector_number(track, sector) >= first_data_sector();
+        }
+        [[nodiscard]] uint16_t sectors_per_block() const
+        {
+            return static_cast<uint16_t>(1 << m_geometry.bsh);
+        }
+
+        // Given a block number and a sector offset, works out the actual track/sector. Assumes that sector_offset is
+        // strictly within that same block, not overflowing into an adjacent block!
+        [[nodiscard]] Location find_location_within_block(uint16_t block, uint16_t sector_offset) const
+        {
+            const auto s = first_directory_sector() + (size_t(block) << m_geometry.bsh) + sector_offset;
+            return { static_cast<uint16_t>(s / m_geometry.spt), static_cast<uint16_t>(s % m_geometry.spt) };
+        }
 
-            // Write the sector to the cache
-            write_disk_data(buffer, track, sector);
+        // Map a track/sector (which must not be in the reserved tracks) to a block number and offset, where the offset
+        // is the index of the sequence within the block (first sector is zero, second sector is one, etc)
+        [[nodiscard]] std::tuple<uint16_t, uint8_t> track_sector_to_block_and_offset(uint16_t track,
+                                                                                     uint16_t sector) const
+        {
+            const auto n = sector_number(track, sector) - first_directory_sector();
+            return { static_cast<uint16_t>(n >> m_geometry.bsh), static_cast<uint8_t>(n & m_geometry.blm()) };
         }
 
-        void build_directory(const std::string& dir = ".")
+        // A directory entry's disk map holds 16 8-bit block numbers, or 8 16-bit ones on a disk of more than 256
+        // blocks, and so it can cover several logical (16KB) extents, as determined by the extent mask
+        [[nodiscard]] size_t blocks_per_entry() const
+        {
+            return (m_geometry.dsm < 0x0100) ? 16 : 8;
+        }
+        [[nodiscard]] size_t records_per_entry() const
         {
-            const auto extent_size = 0x0080 * 0x0080; // 16KB
+            return size_t(RecordsPerExtent) * (m_geometry.exm() + 1);
+        }
 
-            // Iterate through cwd and store file info (not directories) into m_entries; there can be
-            // more than one entry per file if the file is large.
-            // Note that we deliberately ignore zcpm.log because that can get confusing.
-            for (const auto& item : std::filesystem::directory_iterator(dir))
+        // Number of records (sectors) in the entry, across all of its logical extents
+        [[nodiscard]] size_t records(const Entry& e) const
+        {
+            return (e.m_extent & m_geometry.exm()) * RecordsPerExtent + e.m_sectors;
+        }
+
+        // Which of the file's entries this is, counting from zero
+        [[nodiscard]] size_t entry_number(const Entry& e) const
+        {
+            return e.m_extent / (m_geometry.exm() + 1);
+        }
+
+        void build_directory(const std::string& dir)
+        {
+            // Work out which host files there are, and where those that are unchanged since the directory index was
+            // saved (if there is one) were placed
+            const auto indexed = load_directory_index();
+            const auto dir_mtime = modification_time(dir);
+            auto files = list_host_files(dir, indexed, dir_mtime);
+
+            // Unchanged files keep their blocks, so they go first (unless the index has them overlapping, in which case
+            // all but the first are placed again); the rest are placed after them
+            std::vector<bool> used(m_geometry.dsm + 1, false);
+            for (auto& f : files)
             {
-                if (std::filesystem::is_regular_file(item.path()))
+                if (!f.m_first_block)
                 {
-                    const auto bytes = std::filesystem::file_size(item);
-                    if (item.path().filename() != "zcpm.log") // TODO: Yuk
+                    continue;
+                }
+                const auto count = std::min(blocks_in(f), used.size() - f.m_first_block);
+                const auto first = used.begin() + f.m_first_block;
+                const auto vacant = std::find(first, first + count, true) == first + count;
+                const auto next_block = vacant ? add_host_file(f, f.m_first_block) : std::nullopt;
+                if (next_block)
+                {
+                    std::fill(first, first + count, true);
+                    m_next_block = std::max(m_next_block, *next_block);
+                }
+                else
+                {
+                    f.m_first_block = 0;
+                }
+            }
+            for (auto& f : files)
+            {
+                if (!f.m_first_block)
+                {
+                    if (const auto next_block = add_host_file(f, m_next_block))
                     {
-                        const auto num_entries = (bytes + extent_size - 1) / extent_size;
-                        const auto first_block =
-                            m_next_block; // Need to remember first block across *all* entries/extents
-                        auto remaining_sectors = (bytes + SectorSize - 1) / SectorSize;
-                        for (size_t i = 0; i < num_entries; i++)
-                        {
-                            Entry e(item, i, remaining_sectors, first_block);
-                            const auto num_blocks_this_entry = (e.m_sectors + SectorsPerBlock - 1) / SectorsPerBlock;
-                            for (size_t j = 0; j < num_blocks_this_entry; ++j)
-                            {
-                                e.m_blocks.push_back(m_next_block++);
-                            }
-                            remaining_sectors -= e.m_sectors;
-                            m_entries.push_back(e);
-                        }
+                        f.m_first_block = m_next_block;
+                        m_next_block = *next_block;
                     }
                 }
             }
 
-            BOOST_LOG_TRIVIAL(trace) << m_entries.size() << " directory entries:";
+            const auto unchanged = (dir_mtime == indexed.m_dir_mtime) && std::equal(files.begin(),
+                                                                                    files.end(),
+                                                                                    indexed.m_files.begin(),
+                                                                                    indexed.m_files.end(),
+                                                                                    same_host_file);
+            if (!m_index_file.empty() && !unchanged)
+            {
+                save_directory_index(dir_mtime, files);
+            }
+
+            ZCPM_LOG(trace) << m_entries.size() << " directory entries:";
             for (const auto& e : m_entries)
             {
                 e.show();
             }
         }
 
-        void create_directory_entries(SectorData& buffer, uint16_t track, uint16_t sector) const
+        // Number of blocks that a host file's data occupies
+        [[nodiscard]] size_t blocks_in(const HostFile& f) const
         {
-            const auto index = (track * SectorSize + sector) * 4;
+            const auto records_in_file = (f.m_size + SectorSize - 1) / SectorSize;
+            return (records_in_file + sectors_per_block() - 1) / sectors_per_block();
+        }
+
+        // Add the entries for a host file whose data starts at the specified block, returning the block after it. There
+        // can be more than one entry per file if the file is large. A file which doesn't fit on the disk (or in its
+        // directory) is left out, returning nothing.
+        std::optional<uint16_t> add_host_file(const HostFile& f, uint16_t first_block)
+        {
+            const auto records_in_file = (f.m_size + SectorSize - 1) / SectorSize;
+            const auto num_entries = (records_in_file + records_per_entry() - 1) / records_per_entry();
+            if ((first_block + blocks_in(f) > m_geometry.dsm + 1u) ||
+                (m_entries.size() + num_entries > m_geometry.drm + 1u))
+            {
+                ZCPM_LOG(trace) << "WARNING: No room on the disk for " << f.m_raw_name;
+                return std::nullopt;
+            }
+
+            auto next_block = first_block;
+            auto remaining_records = records_in_file;
+            for (size_t i = 0; i < num_entries; i++)
+            {
+                // The entry records the last logical extent that it holds, and how many records are in that
+                const auto records_this_entry = std::min(remaining_records, records_per_entry());
+                const auto last_extent = (records_this_entry - 1) / RecordsPerExtent;
+                Entry e(f.m_raw_name,
+                        f.m_size,
+                        i * (m_geometry.exm() + 1) + last_extent,
+                        records_this_entry - last_extent * RecordsPerExtent,
+                        first_block);
+                const auto num_blocks_this_entry = (records_this_entry + sectors_per_block() - 1) / sectors_per_block();
+                for (size_t j = 0; j < num_blocks_this_entry; ++j)
+                {
+                    e.m_blocks.push_back(next_block++);
+                }
+                remaining_records -= records_this_entry;
+                m_entries.push_back(e);
+                claim_blocks(m_entries.size() - 1);
+                index_entry(m_entries.size() - 1);
+            }
+            return next_block;
+        }
+
+        // The host files as recorded in the directory index, and the modification time of the directory itself at
+        // the time (which changes when files are created, deleted or renamed, but not when they are written to)
+        struct DirectoryIndex
+        {
+            int64_t m_dir_mtime = -1;
+            std::vector<HostFile> m_files;
+        };
+
+        static bool same_host_file(const HostFile& a, const HostFile& b)
+        {
+            return (a.m_raw_name == b.m_raw_name) && (a.m_size == b.m_size) && (a.m_mtime == b.m_mtime) &&
+                   (a.m_first_block == b.m_first_block);
+        }
+
+        // Returns a file's modification time, or -1 if it doesn't exist (or isn't a regular file or directory)
+        static int64_t modification_time(const std::string& name, size_t* p_size = nullptr)
+        {
+            struct stat status{};
+            if ((::stat(name.c_str(), &status) != 0) || !(S_ISREG(status.st_mode) || S_ISDIR(status.st_mode)))
+            {
+                return -1;
+            }
+            if (p_size)
+            {
+                *p_size = static_cast<size_t>(status.st_size);
+            }
+            return int64_t(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+        }
+
+        // Work out which regular files there are in the host directory, other than those that we use ourselves. If
+        // the directory hasn't changed since the index was saved then the index already lists them; otherwise the
+        // directory has to be read. Either way, each file's size and modification time are checked, and files which
+        // have changed are marked as needing to be placed on the disk again.
+        std::vector<HostFile> list_host_files(const std::string& dir,
+                                              const DirectoryIndex& indexed,
+                                              int64_t dir_mtime) const
+        {
+            std::vector<std::string> names;
+            if ((dir_mtime >= 0) && (dir_mtime == indexed.m_dir_mtime))
+            {
+                for (const auto& f : indexed.m_files)
+                {
+                    names.push_back(f.m_raw_name);
+                }
+            }
+            else
+            {
+                // Note that we deliberately ignore zcpm.log because that can get confusing.
+                const auto index_path = m_index_file.empty()
+                                            ? std::filesystem::path()
+                                            : std::filesystem::absolute(m_index_file).lexically_normal();
+                for (const auto& item : std::filesystem::directory_iterator(dir))
+                {
+                    if (std::filesystem::is_regular_file(item.path()) &&
+                        (item.path().filename() != "zcpm.log") && // TODO: Yuk
+                        (std::filesystem::absolute(item.path()).lexically_normal() != index_path))
+                    {
+                        names.push_back(item.path().filename());
+                    }
+                }
+            }
+
+            std::vector<HostFile> result;
+            for (const auto& name : names)
+            {
+                HostFile f{ .m_raw_name = name };
+                f.m_mtime = modification_time((std::filesystem::path(dir) / name).string(), &f.m_size);
+                if (f.m_mtime < 0)
+                {
+                    continue; // Deleted since the index was saved
+                }
+
+                const auto it = std::find_if(indexed.m_files.begin(), indexed.m_files.end(), [&f](const auto& i) {
+                    return i.m_raw_name == f.m_raw_name;
+                });
+                if ((it != indexed.m_files.end()) && (it->m_size == f.m_size) && (it->m_mtime == f.m_mtime))
+                {
+                    f.m_first_block = it->m_first_block;
+                }
+                result.push_back(f);
+            }
+            return result;
+        }
+
+        // Read the directory index (all in one go), if there is one. A missing or unreadable index is treated as
+        // empty, since it is only an optimisation.
+        DirectoryIndex load_directory_index() const
+        {
+            DirectoryIndex result;
+            if (m_index_file.empty())
+            {
+                return result;
+            }
+
+            std::string content;
+            {
+                size_t size = 0;
+                if (modification_time(m_index_file, &size) < 0)
+                {
+                    return result;
+                }
+                FilePtr fp(std::fopen(m_index_file.c_str(), "rb"));
+                content.resize(size);
+                if (!fp || (std::fread(content.data(), 1, size, fp.get()) != size))
+                {
+                    return result;
+                }
+            }
+
+            // The first line identifies the format and records the directory's modification time and the disk
+            // geometry (since the layout depends on it), and each subsequent line describes a file as
+            // "size mtime first_block name"
+            std::istringstream in(content);
+            std::string magic;
+            int64_t dir_mtime = -1;
+            std::string geometry;
+            if (!(in >> magic >> dir_mtime >> geometry) || (magic != IndexMagic) || (geometry != geometry_key()))
+            {
+                ZCPM_LOG(trace) << "Ignoring invalid directory index " << m_index_file;
+                return result;
+            }
+            HostFile f;
+            while (in >> f.m_size >> f.m_mtime >> f.m_first_block && (in.get() == ' ') &&
+                   std::getline(in, f.m_raw_name))
+            {
+                if ((f.m_first_block < m_next_block) || (f.m_first_block > m_geometry.dsm))
+                {
+                    f.m_first_block = 0; // Not somewhere that a file can be, so place it again
+                }
+                result.m_files.push_back(f);
+            }
+            result.m_dir_mtime = dir_mtime;
+
+            ZCPM_LOG(trace) << "Loaded directory index " << m_index_file << " of " << result.m_files.size()
+                            << " files";
+            return result;
+        }
+
+        // Identifies the disk geometry in the directory index
+        [[nodiscard]] std::string geometry_key() const
+        {
+            return fmt::format(
+                "{},{},{},{},{}", m_geometry.spt, m_geometry.bsh, m_geometry.dsm, m_geometry.drm, m_geometry.off);
+        }
+
+        // Write the directory index (all in one go)
+        void save_directory_index(int64_t dir_mtime, const std::vector<HostFile>& files) const
+        {
+            std::ostringstream out;
+            out << IndexMagic << ' ' << dir_mtime << ' ' << geometry_key() << '\n';
+            for (const auto& f : files)
+            {
+                out << f.m_size << ' ' << f.m_mtime << ' ' << f.m_first_block << ' ' << f.m_raw_name << '\n';
+            }
+            const auto content = out.str();
+
+            FilePtr fp(std::fopen(m_index_file.c_str(), "wb"));
+            if (!fp || (std::fwrite(content.data(), 1, content.size(), fp.get()) != content.size()))
+            {
+                ZCPM_LOG(trace) << "WARNING: Can't write directory index " << m_index_file;
+                return;
+            }
+            ZCPM_LOG(trace) << "Saved directory index " << m_index_file << " of " << files.size() << " files";
+        }
+
+        void create_directory_entries(SectorView buffer, uint16_t track, uint16_t sector) const
+        {
+            const auto index = (sector_number(track, sector) - first_directory_sector()) * (SectorSize / EntrySize);
 
             for (auto i = 0; i < SectorSize / EntrySize; i++)
             {
@@ -285,73 +895,89 @@ namespace zcpm
             }
         }
 
-        void read_disk_data(SectorData& buffer, uint16_t track, uint16_t sector) const
+        void read_disk_data(SectorView buffer, uint16_t track, uint16_t sector) const
         {
-            // TODO: Given that the most common use case is to read sector N+1 of a given file immediately after
-            // sector N of that same file, we could optimise this by keeping the file handle open and the file
-            // position maintained from call to call, and only close it if the active file/position changes.
-
             // Convert the track/sector into a block number.
             const auto [block, offset] = track_sector_to_block_and_offset(track, sector);
 
-            // Find that block number in the directory structure.  TODO: This uses a brute-force
-            // search, once this code matures we should add a new map from block number to File
-            // instance to avoid the need for this brute-force search.
-            for (const auto& f : m_entries)
+            // Find the file which owns that block
+            const auto p_entry = find_block_owner(block);
+            if (!p_entry)
+            {
+                ZCPM_LOG(trace) << "WARNING: Can't find file for this sector";
+                std::fill(buffer.begin(), buffer.end(), 0x00);
+                return;
+            }
+            const auto& f = *p_entry;
+
+            // We've found that the block we're looking for is in this file.  Read the whole of that block from it,
+            // since BDOS is most likely reading the file sequentially and will soon want the rest of the block. Where
+            // the block is within the file depends on both the extent and where it is in this entry's disk map.
+            const auto start = host_offset(f, m_block_owners[block].m_ordinal, 0);
+            const auto chunk = start / SectorSize;
+            std::vector<SectorData> data(sectors_per_block());
+            const auto fp = open_host_file(f.m_raw_name);
+            std::fseek(fp, static_cast<long>(start), SEEK_SET);
+            std::fread(data.data(), sizeof(SectorData), data.size(), fp);
+            ZCPM_LOG(trace) << "Reading chunks #" << chunk << "-" << (chunk + data.size() - 1) << " from "
+                            << f.m_raw_name;
+
+            std::copy(data[offset].begin(), data[offset].end(), buffer.begin());
+
+            // Populate the cache with the rest of the block, without disturbing any sectors that are already cached
+            // (which may have been modified)
+            for (uint16_t i = 0; i < data.size(); i++)
             {
-                for (const auto& b : f.m_blocks)
+                const auto [t, s] = find_location_within_block(block, i);
+                if ((i != offset) && !m_sector_cache.find(t, s))
                 {
-                    if (block == b)
-                    {
-                        // We've found that the block we're looking for is in this file.  Open the file and
-                        // read & return the right chunk from it.  We need to compare "this" block index against
-                        // the first block index for this file (not just for this entry!)
-                        const auto block_offset = block - f.m_first_block;
-                        const auto chunk = (block_offset << BSH) + offset;
-                        if (auto fp = std::fopen(f.m_raw_name.c_str(), "r"); fp)
-                        {
-                            std::fseek(fp, chunk * SectorSize, SEEK_SET);
-                            std::fread(buffer.data(), 01, buffer.size(), fp);
-                            std::fclose(fp);
-                            BOOST_LOG_TRIVIAL(trace) << "Reading chunk #" << chunk << " from " << f.m_raw_name;
-                        }
-                        else
-                        {
-                            throw std::system_error(errno, std::generic_category(), "File open failed");
-                        }
-                        return;
-                    }
+                    m_sector_cache.put(t, s, data[i], false);
                 }
             }
+        }
 
-            BOOST_LOG_TRIVIAL(trace) << "WARNING: Can't find file for this sector";
+        // Where the specified host file is, given that the disk isn't necessarily the current directory
+        std::string host_path(const std::string& name) const
+        {
+            return (std::filesystem::path(m_root) / name).string();
         }
 
-        void write_disk_data(const SectorData& buffer, uint16_t track, uint16_t sector)
+        // Return a handle to the specified host file, opened for reading. Recently used handles are kept open,
+        // since reading a file involves many reads from the same file.
+        std::FILE* open_host_file(const std::string& name) const
         {
-            // Do we have a cache entry for this sector?
-            const auto location(Location{ track, sector });
+            const auto it = std::find_if(
+                m_open_files.begin(), m_open_files.end(), [&name](const auto& open) { return open.first == name; });
+            if (it != m_open_files.end())
+            {
+                std::rotate(m_open_files.begin(), it, it + 1);
+                return m_open_files.front().second.get();
+            }
 
-            const auto it = m_sector_cache.find(location);
-            if (it != m_sector_cache.end())
+            FilePtr fp(std::fopen(host_path(name).c_str(), "rb"));
+            if (!fp)
             {
-                // Yes, already in cache.  In that case we modify it
-                it->second.put_data(buffer);
+                throw std::system_error(errno, std::generic_category(), "File open failed");
             }
-            else
+            if (m_open_files.size() == MaxOpenFiles)
             {
-                // No, new entry, create it.
-                SectorInfo sector_info(buffer);
-                sector_info.m_dirty = true;
-                m_sector_cache.emplace(location, sector_info);
+                m_open_files.pop_back();
             }
+            m_open_files.emplace(m_open_files.begin(), name, std::move(fp));
+            return m_open_files.front().second.get();
+        }
+
+        void write_disk_data(ConstSectorView buffer, uint16_t track, uint16_t sector)
+        {
+            // Modify the cached copy, or create it if it's not yet in the cache
+            m_sector_cache.put(track, sector, buffer, true);
         }
 
         // Given a memory location, formats the nth (counting from zero) directory entry (of size EntrySize) into that
         // location. Allows out of range values of 'n' which get mapped to E5 (inactive) file entries.  Note that this
         // may actually cause more than one entry to be created, in the case where a file requires multiple
         // entries/extents.
-        void format_directory_entry(uint8_t* base, uint16_t n) const
+        void format_directory_entry(uint8_t* base, size_t n) const
         {
             if (n >= m_entries.size())
             {
@@ -396,243 +1022,423 @@ namespace zcpm
                          0xFF; // S2 (TODO: mask & shift determined empirically; but where do magic values come from?)
             base[0x0F] = f.m_sectors; // RC (record count)
 
-            // Disk map.  Each 2-byte entry is a block number (each block is 2KB aka BlockSize)
+            // Disk map.  Each 1-byte (small disk) or 2-byte entry is a block number
             for (size_t i = 0; i < f.m_blocks.size(); i++)
             {
                 const auto block = f.m_blocks[i];
-                base[0x10 + i * 2 + 0] = block & 0xFF;
-                base[0x10 + i * 2 + 1] = (block >> 8) & 0xFF;
+                if (blocks_per_entry() == 16)
+                {
+                    base[0x10 + i] = block & 0xFF;
+                }
+                else
+                {
+                    base[0x10 + i * 2 + 0] = block & 0xFF;
+                    base[0x10 + i * 2 + 1] = (block >> 8) & 0xFF;
+                }
             }
         }
 
-        // BDOS appears to be modifying a directory sector; work out what has changed and what we need to do
-        void check_for_directory_changes(const SectorData& buffer)
+        // BDOS appears to be modifying a directory sector; work out what has changed and what we need to do. Returns
+        // the names of any existing files whose contents have been updated.
+        std::vector<std::string> check_for_directory_changes(ConstSectorView buffer, uint16_t track, uint16_t sector)
         {
-            // For each of the four entries in this directory sector build a 'pending' Entry for each,
-            // and then compare these against our 'real' entries to see what needs changing.
+            // The sector's previous contents are cached (as directory sectors are never evicted), unless BDOS is
+            // writing a sector that it hasn't read, which can only hold what we would have synthesised for it
+            SectorData previous{};
+            if (const auto p_data = m_sector_cache.find(track, sector); p_data)
+            {
+                previous = *p_data;
+            }
+            else
+            {
+                create_directory_entries(previous, track, sector);
+            }
+
+            // For each of the four entries in this directory sector that BDOS has actually changed, build a 'pending'
+            // Entry, and then compare that against our 'real' entries to see what needs changing.
+            std::vector<std::string> updated;
 
             for (auto i = 0; i < SectorSize / EntrySize; i++)
             {
-                Entry pending(buffer.data() + i * EntrySize);
+                const auto offset = i * EntrySize;
+                if (std::memcmp(previous.data() + offset, buffer.data() + offset, EntrySize) == 0)
+                {
+                    continue;
+                }
+
+                Entry pending(buffer.data() + offset, m_geometry);
                 if (pending.m_exists)
                 {
-                    BOOST_LOG_TRIVIAL(trace) << "Considering pending entry:";
+                    ZCPM_LOG(trace) << "Considering pending entry:";
                     pending.show();
 
-                    // Walk through m_entries to work out what action is required for this item, if any
-                    bool found = false;
-                    for (auto& e : m_entries)
+                    // Work out what action is required for this item, if any
+                    if (const auto n = find_entry(pending.m_name, entry_number(pending)); n != BlockOwner::NoEntry)
                     {
-                        if ((e.m_name == pending.m_name) && (e.m_extent == pending.m_extent) &&
-                            (e.m_blocks == pending.m_blocks))
+                        auto& e = m_entries[n];
+                        if ((e.m_blocks == pending.m_blocks) && (e.m_extent == pending.m_extent) &&
+                            (e.m_sectors == pending.m_sectors))
                         {
-                            BOOST_LOG_TRIVIAL(trace) << "  (no action required)";
-                            found = true;
+                            ZCPM_LOG(trace) << "  (no action required)";
                         }
-                        else if ((e.m_name == pending.m_name) && (e.m_extent == pending.m_extent) &&
-                                 (e.m_blocks != pending.m_blocks))
+                        else
                         {
-                            BOOST_LOG_TRIVIAL(trace) << "  (content modification)";
+                            ZCPM_LOG(trace) << "  (content modification)";
                             // NOTE: The following is a best-effort, there may be some tweaks needed here
+                            release_blocks(n);
+                            e.m_extent = pending.m_extent;
                             e.m_sectors = pending.m_sectors;
                             e.m_blocks = pending.m_blocks;
-                            e.m_size = e.m_sectors * SectorSize;
-                            e.m_first_block = m_next_block++;
+                            claim_blocks(n);
+                            e.m_size = records(e) * SectorSize;
                             e.m_modified = true;
-                            found = true;
-                        }
-                        else if (e.m_exists && (e.m_name != pending.m_name) && (e.m_extent == pending.m_extent) &&
-                                 (e.m_blocks == pending.m_blocks) && !pending.m_blocks.empty())
-                        {
-                            BOOST_LOG_TRIVIAL(trace)
-                                << "  (rename of '" << e.m_raw_name << "' to '" << pending.m_raw_name << "')";
-                            e.m_name = pending.m_name;
-                            e.m_raw_name = pending.m_raw_name;
-                            e.m_modified = true;
-                            found = true;
-                        }
-                        if (found)
-                        {
-                            break;
+                            updated.push_back(e.m_raw_name);
                         }
                     }
-
-                    if (!found)
+                    else if (const auto r = find_renamed_entry(pending); r != BlockOwner::NoEntry)
                     {
-                        BOOST_LOG_TRIVIAL(trace) << "  (file creation)";
+                        auto& e = m_entries[r];
+                        ZCPM_LOG(trace) << "  (rename of '" << e.m_raw_name << "' to '" << pending.m_raw_name
+                                        << "')";
+                        pin_entry(e);
+                        unindex_entry(r);
+                        e.m_name = pending.m_name;
+                        e.m_raw_name = pending.m_raw_name;
+                        e.m_modified = true;
+                        index_entry(r);
+                    }
+                    else
+                    {
+                        ZCPM_LOG(trace) << "  (file creation)";
                         // Add this newly-created entry to our overall collection.
                         m_entries.push_back(pending);
+                        claim_blocks(m_entries.size() - 1);
+                        index_entry(m_entries.size() - 1);
+                        if (!pending.m_blocks.empty())
+                        {
+                            updated.push_back(pending.m_raw_name);
+                        }
                     }
                 }
                 else
                 {
                     // Is it a file deletion?
+                    const auto n = find_entry(pending.m_name, entry_number(pending));
+                    if ((n != BlockOwner::NoEntry) && (m_entries[n].m_blocks == pending.m_blocks))
+                    {
+                        ZCPM_LOG(trace) << "  (deletion):";
+                        pending.show();
+                        m_entries[n].m_exists = false;
+                        m_entries[n].m_modified = true;
+                    }
+                }
+            }
 
-                    // Walk through m_entries to find the matching item that needs to be deleted
-                    for (auto& e : m_entries)
+            return updated;
+        }
+
+        // Bring all of an entry's data into the cache and keep it there until it is flushed. This is needed before the
+        // entry is renamed, since its host file keeps the old name: the data can't be fetched under the new name, and
+        // another file might be given the old one (as when an editor renames FOO.TXT to FOO.BAK and then FOO.$$$ to
+        // FOO.TXT).
+        void pin_entry(const Entry& e)
+        {
+            auto sectors_remaining = records(e);
+            for (size_t i = 0; (i < e.m_blocks.size()) && sectors_remaining; i++)
+            {
+                const auto sectors_this_block = std::min<size_t>(sectors_per_block(), sectors_remaining);
+                sectors_remaining -= sectors_this_block;
+                for (uint16_t j = 0; j < sectors_this_block; j++)
+                {
+                    const auto [track, sector] = find_location_within_block(e.m_blocks[i], j);
+                    SectorData data{};
+                    try
                     {
-                        if ((e.m_name == pending.m_name) && e.m_exists && !pending.m_exists &&
-                            (e.m_extent == pending.m_extent) && (e.m_blocks == pending.m_blocks))
-                        {
-                            BOOST_LOG_TRIVIAL(trace) << "  (deletion):";
-                            pending.show();
-                            e.m_exists = false;
-                            e.m_modified = true;
-                            break;
-                        }
+                        read_sector(data, track, sector);
+                        m_sector_cache.pin(track, sector);
+                    }
+                    catch (const std::exception& ex)
+                    {
+                        ZCPM_LOG(trace) << fmt::format(
+                            "TRACK:{:04X} SECTOR:{:04X} not available ({})", track, sector, ex.what());
                     }
                 }
             }
         }
 
-        void flush_to_host_filesystem() const
+        // Return the index of the existing entry with the specified name which is the specified one (counting from
+        // zero) of its file, or NoEntry if there isn't one
+        size_t find_entry(const std::string& name, size_t number) const
+        {
+            const auto it = m_entries_by_name.find(name);
+            if (it != m_entries_by_name.end())
+            {
+                for (const auto n : it->second)
+                {
+                    const auto& e = m_entries[n];
+                    if (e.m_exists && (entry_number(e) == number))
+                    {
+                        return n;
+                    }
+                }
+            }
+            return BlockOwner::NoEntry;
+        }
+
+        // Return the index of the existing entry which the pending entry is a renamed version of (i.e. the one with
+        // the same extent and disk map under another name), or NoEntry if there isn't one
+        size_t find_renamed_entry(const Entry& pending) const
+        {
+            if (pending.m_blocks.empty())
+            {
+                return BlockOwner::NoEntry;
+            }
+            const auto block = pending.m_blocks.front();
+            if (block >= m_block_owners.size())
+            {
+                return BlockOwner::NoEntry;
+            }
+            const auto n = m_block_owners[block].m_entry;
+            if (n == BlockOwner::NoEntry)
+            {
+                return BlockOwner::NoEntry;
+            }
+            const auto& e = m_entries[n];
+            const auto renamed = e.m_exists && (e.m_name != pending.m_name) && (e.m_extent == pending.m_extent) &&
+                                 (e.m_blocks == pending.m_blocks);
+            return renamed ? n : BlockOwner::NoEntry;
+        }
+
+        // Add the nth entry to the index of entries by name, or remove it from there (prior to its name changing)
+        void index_entry(size_t n)
+        {
+            m_entries_by_name[m_entries[n].m_name].push_back(n);
+        }
+        void unindex_entry(size_t n)
         {
-            // First take care of any directory-level changes; i.e., new files, deleted files, ...
-            flush_file_changes_to_host_filesystem();
+            auto& entries = m_entries_by_name[m_entries[n].m_name];
+            entries.erase(std::remove(entries.begin(), entries.end(), n), entries.end());
+        }
+
+        // Write everything to the host filesystem, including deletions; this happens when the disk goes away
+        void flush_to_host_filesystem()
+        {
+            flush_pending();
+            flush_deletions_to_host_filesystem();
+        }
+
+        // Write all modified files and sectors to the host filesystem
+        void flush_pending()
+        {
+            ZCPM_LOG(trace) << "Flushing to host filesystem";
+            ++m_flushes;
+
+            // First take care of files which have new or changed directory entries
+            std::vector<std::string> names;
+            for (const auto& e : m_entries)
+            {
+                if (e.m_exists && e.m_modified && (std::find(names.begin(), names.end(), e.m_raw_name) == names.end()))
+                {
+                    names.push_back(e.m_raw_name);
+                }
+            }
+            for (const auto& name : names)
+            {
+                flush_file(name);
+            }
 
             // And then take care of any remaining dirty sectors in the cache; these typically are
             // the result of a WRITERAND to existing files.
             flush_changed_sectors_to_host_filesystem();
+
+            m_sectors_since_flush = 0;
         }
 
-        void flush_file_changes_to_host_filesystem() const
+        // Write the named host file's unflushed sectors from all of its extents, and then set its length (creating it
+        // if need be). Setting the length last means that a file which is cut short by a crash still has its data.
+        void flush_file(const std::string& name)
+        {
+            std::vector<Change> changes;
+            size_t length = 0;
+            std::vector<Entry*> extents;
+            for (auto& e : m_entries)
+            {
+                if (!e.m_exists || (e.m_raw_name != name))
+                {
+                    continue;
+                }
+                ZCPM_LOG(trace) << "Flush '" << e.m_raw_name << "' to host filesystem:";
+                e.show();
+                extents.push_back(&e);
+                length = std::max(length, host_offset(e, 0, 0) + records(e) * SectorSize);
+
+                auto sectors_remaining = records(e);
+                for (size_t i = 0; (i < e.m_blocks.size()) && sectors_remaining; i++)
+                {
+                    const auto sectors_this_block = std::min<size_t>(sectors_per_block(), sectors_remaining);
+                    sectors_remaining -= sectors_this_block;
+                    for (uint16_t j = 0; j < sectors_this_block; j++)
+                    {
+                        const auto [track, sector] = find_location_within_block(e.m_blocks[i], j);
+                        if (const auto p_data = m_sector_cache.find_unflushed(track, sector); p_data)
+                        {
+                            changes.push_back({ &e.m_raw_name, host_offset(e, i, j), p_data, { track, sector } });
+                        }
+                    }
+                }
+            }
+
+            std::sort(changes.begin(), changes.end(), [](const auto& a, const auto& b) { return a.offset < b.offset; });
+            m_open_files.clear();
+            try
+            {
+                flush_changed_file(name, changes.begin(), changes.end(), length);
+            }
+            catch (const std::exception& ex)
+            {
+                ZCPM_LOG(trace) << "Can't write '" << name << "' (" << ex.what() << ")";
+                return;
+            }
+
+            for (auto p_e : extents)
+            {
+                p_e->m_modified = false;
+            }
+        }
+
+        void flush_deletions_to_host_filesystem()
         {
             // TODO: We don't yet cater for a *renamed* host file
 
-            for (const auto& e : m_entries)
+            for (auto& e : m_entries)
             {
-                if (e.m_modified)
+                if (!e.m_exists && e.m_modified)
                 {
-                    BOOST_LOG_TRIVIAL(trace) << "Flush '" << e.m_raw_name << "' to host filesystem:";
+                    // The modified flag has the 'exists' flag set to false, which means that is a deletion.
+                    // But we need to be careful where we have an entry for a newly-deleted file *and* one
+                    // for an existing file with the same name.  If this is the case, we don't delete anything.
+                    const auto has_existing_version =
+                        std::any_of(m_entries.begin(), m_entries.end(), [&e](const auto& f) {
+                            return f.m_exists && (f.m_raw_name == e.m_raw_name);
+                        });
+
+                    ZCPM_LOG(trace) << "Flush deletion of '" << e.m_raw_name << "' to host filesystem:";
                     e.show();
-                    if (e.m_exists)
+                    if (has_existing_version)
                     {
-                        if (auto fp = std::fopen(e.m_raw_name.c_str(), "w"); fp)
-                        {
-                            auto sectors_remaining = e.m_sectors;
-                            for (const auto& b : e.m_blocks)
-                            {
-                                const auto sectors_this_block = std::min<uint16_t>(SectorsPerBlock, sectors_remaining);
-                                BOOST_LOG_TRIVIAL(trace)
-                                    << "Writing " << sectors_this_block << " sector from block #" << b;
-                                for (auto i = 0; i < sectors_this_block; i++)
-                                {
-                                    const auto [track, sector] = find_location_within_block(b, i);
-                                    BOOST_LOG_TRIVIAL(trace)
-                                        << fmt::format("  Using data from TRACK:{:04X} SECTOR:{:04X}", track, sector);
-                                    const auto it = m_sector_cache.find({ track, sector });
-                                    if (it != m_sector_cache.end())
-                                    {
-                                        SectorData data{};
-                                        it->second.get_data(data);
-                                        if (std::fwrite(data.data(), sizeof(SectorData::value_type), data.size(), fp) <
-                                            data.size())
-                                        {
-                                            BOOST_LOG_TRIVIAL(trace) << "TODO: File write error handling";
-                                        }
-                                        it->second.m_dirty =
-                                            false; // No longer 'dirty' in the cache because it has now been flushed
-                                    }
-                                    else
-                                    {
-                                        BOOST_LOG_TRIVIAL(trace) << "TODO: file data not in cache, now what?";
-                                    }
-                                }
-                            }
-                            std::fclose(fp);
-                        }
-                        else
-                        {
-                            throw std::system_error(errno, std::generic_category(), "File open failed");
-                        }
+                        ZCPM_LOG(trace) << "(not erasing because an existing one is still present)";
                     }
                     else
                     {
-                        // The modified flag has the 'exists' flag set to false, which means that is a deletion.
-                        // But we need to be careful where we have an entry for a newly-deleted file *and* one
-                        // for an existing file with the same name.  If this is the case, we don't delete anything.
-                        const auto has_existing_version =
-                            std::any_of(m_entries.begin(),
-                                        m_entries.end(),
-                                        [e](auto f) { return f.m_exists && (f.m_raw_name == e.m_raw_name); });
-
-                        if (has_existing_version)
-                        {
-                            BOOST_LOG_TRIVIAL(trace) << "(not erasing because an existing one is still present)";
-                        }
-                        else
-                        {
-                            BOOST_LOG_TRIVIAL(trace) << "(erasing it if it still exists)";
-                            std::error_code ec;
-                            std::filesystem::remove(e.m_raw_name, ec); // Ignore any error, doesn't really matter
-                        }
+                        ZCPM_LOG(trace) << "(erasing it if it still exists)";
+                        std::error_code ec;
+                        std::filesystem::remove(host_path(e.m_raw_name), ec); // Ignore any error, doesn't really matter
                     }
+                    e.m_modified = false;
                 }
             }
         }
 
-        void flush_changed_sectors_to_host_filesystem() const
+        void flush_changed_sectors_to_host_filesystem()
         {
-            for (const auto& [key, value] : m_sector_cache)
-            {
-                if (value.m_dirty)
+            // Work out which file, and where in that file, each dirty sector belongs
+            std::vector<Change> changes;
+            m_sector_cache.for_each_dirty([this, &changes](uint16_t track, uint16_t sector, const SectorData& data) {
+                if (is_data(track, sector))
                 {
-                    const auto& [track, sector] = key;
-                    if (track > 1)
+                    const auto [block, offset] = track_sector_to_block_and_offset(track, sector);
+                    const auto p_entry = find_block_owner(block);
+                    const auto ordinal = p_entry ? m_block_owners[block].m_ordinal : 0;
+                    // Sectors beyond the entry's record count aren't part of the file (yet)
+                    const auto index = static_cast<size_t>((ordinal << m_geometry.bsh) + offset);
+                    if (p_entry && p_entry->m_exists && (index < records(*p_entry)))
                     {
-                        // Work out what file owns this sector
-                        const auto [block, offset] = track_sector_to_block_and_offset(track, sector);
-                        for (const auto& f : m_entries)
-                        {
-                            if (f.m_exists)
-                            {
-                                // TODO: Can we rewrite the following find/loop using an STL algorithm?
-                                for (size_t i = 0; i < f.m_blocks.size(); i++)
-                                {
-                                    if (f.m_blocks[i] == block)
-                                    {
-                                        BOOST_LOG_TRIVIAL(trace) << fmt::format(
-                                            "Sector {:02X}:{:02X} is block {:d} offset {:d} within file {}",
-                                            track,
-                                            sector,
-                                            block,
-                                            offset,
-                                            f.m_raw_name);
-                                        try
-                                        {
-                                            flush_changed_file(value, block, offset, f);
-                                        }
-                                        catch (const std::exception& e)
-                                        {
-                                            BOOST_LOG_TRIVIAL(trace) << "Exception during file flush: " << e.what();
-                                        }
-                                    }
-                                }
-                            }
-                        }
+                        ZCPM_LOG(trace) << fmt::format(
+                            "Sector {:02X}:{:02X} is block {:d} (#{:d} of its extent) offset {:d} within file {}",
+                            track,
+                            sector,
+                            block,
+                            ordinal,
+                            offset,
+                            p_entry->m_raw_name);
+                        changes.push_back(
+                            { &p_entry->m_raw_name, host_offset(*p_entry, ordinal, offset), &data, { track, sector } });
                     }
                 }
+            });
+            if (changes.empty())
+            {
+                return;
+            }
+
+            // Write each file's changes as runs of consecutive sectors, opening each file just once
+            std::sort(changes.begin(), changes.end(), [](const auto& a, const auto& b) {
+                return std::tie(*a.p_name, a.offset) < std::tie(*b.p_name, b.offset);
+            });
+            m_open_files.clear();
+            for (auto first = changes.begin(); first != changes.end();)
+            {
+                const auto last = std::find_if(
+                    first, changes.end(), [first](const auto& c) { return *c.p_name != *first->p_name; });
+                try
+                {
+                    flush_changed_file(*first->p_name, first, last);
+                }
+                catch (const std::exception& e)
+                {
+                    ZCPM_LOG(trace) << "Exception during file flush: " << e.what();
+                }
+                first = last;
             }
         }
 
-        void flush_changed_file(const SectorInfo& value, uint16_t block, uint8_t offset, const Entry& f) const
+        // Write the specified changes (which are sorted by offset) to the named host file, and then if a length is
+        // specified then set the file to that length (creating it if it doesn't exist)
+        template <typename Iterator>
+        void flush_changed_file(const std::string& name,
+                                Iterator first,
+                                Iterator last,
+                                std::optional<size_t> length = std::nullopt)
         {
-            const auto byte_offset = (((block - f.m_first_block) << BSH) + offset) * SectorSize;
-
-            // Note that we open/modify/close the file for *each* modified sector.  In a big system with lots of changes
-            // this is very inefficient, but in the typical use case for ZCPM we see just a handful of *modified*
-            // sectors, most file I/O is new files which uses different logic.
-
-            if (auto fp = std::fopen(f.m_raw_name.c_str(), "rb+"); fp)
+            auto fp = std::fopen(host_path(name).c_str(), "rb+");
+            if (!fp && length && (errno == ENOENT))
             {
-                std::fseek(fp, byte_offset, SEEK_SET);
-
-                SectorData data{};
-                value.get_data(data);
-                if (std::fwrite(data.data(), sizeof(SectorData::value_type), data.size(), fp) < SectorSize)
+                fp = std::fopen(host_path(name).c_str(), "wb");
+            }
+            if (fp)
+            {
+                ++m_files_written;
+                std::vector<uint8_t> run;
+                while (first != last)
                 {
-                    BOOST_LOG_TRIVIAL(trace) << "TODO: File write error handling";
+                    // Coalesce a run of consecutive sectors into a single write
+                    const auto start = first->offset;
+                    run.clear();
+                    do
+                    {
+                        run.insert(run.end(), first->p_data->begin(), first->p_data->end());
+                        const auto& [track, sector] = first->location;
+                        m_sector_cache.set_clean(track, sector);
+                        ++first;
+                    } while ((first != last) && (first->offset == start + run.size()));
+
+                    ZCPM_LOG(trace) << fmt::format(
+                        "Writing {} bytes at offset {:d} of {}", run.size(), start, name);
+                    std::fseek(fp, static_cast<long>(start), SEEK_SET);
+                    if (std::fwrite(run.data(), 1, run.size(), fp) < run.size())
+                    {
+                        ZCPM_LOG(trace) << "TODO: File write error handling";
+                    }
+                }
+                if (length)
+                {
+                    std::fflush(fp);
+                    if (::ftruncate(::fileno(fp), static_cast<off_t>(*length)) != 0)
+                    {
+                        ZCPM_LOG(trace) << "TODO: File write error handling";
+                    }
                 }
+                sync(fp);
                 std::fclose(fp);
             }
             else
@@ -641,29 +1447,168 @@ namespace zcpm
                 throw std::system_error(errno, std::generic_category(), "File open failed");
             }
         }
+
+        // A sector which is to be written to the named host file, at the specified offset within it
+        struct Change
+        {
+            const std::string* p_name;
+            size_t offset;
+            const SectorData* p_data;
+            Location location;
+        };
+
+        // If so configured, make sure that what we've written to the host file has reached the storage device
+        void sync(std::FILE* fp) const
+        {
+            if (m_flush_sync)
+            {
+                std::fflush(fp);
+                ::fsync(::fileno(fp));
+            }
+        }
+
+        // The offset within the host file of the specified sector of the nth block of this entry's disk map
+        [[nodiscard]] size_t host_offset(const Entry& e, size_t n, uint16_t sector) const
+        {
+            return (((entry_number(e) * blocks_per_entry() + n) << m_geometry.bsh) + sector) * SectorSize;
+        }
+
+        // Wake up periodically to flush changes, until the disk is going away
+        void run_flusher(std::chrono::milliseconds interval)
+        {
+            std::unique_lock lock(m_mutex);
+            while (!m_wakeup.wait_for(lock, interval, [this] { return m_stopping; }))
+            {
+                try
+                {
+                    flush_pending();
+                }
+                catch (const std::exception& e)
+                {
+                    ZCPM_LOG(trace) << "Exception during background flush: " << e.what();
+                }
+            }
+        }
+
+        // Return the entry which owns the specified block, or nullptr if no entry does
+        const Entry* find_block_owner(uint16_t block) const
+        {
+            if ((block >= m_block_owners.size()) || (m_block_owners[block].m_entry == BlockOwner::NoEntry))
+            {
+                return nullptr;
+            }
+            return &m_entries[m_block_owners[block].m_entry];
+        }
+
+        // Record the nth entry as the owner of each of its blocks.  A block which is reused after its file is deleted
+        // simply changes hands, so the deleted entry keeps ownership only of the blocks that nothing else has claimed.
+        void claim_blocks(size_t n)
+        {
+            const auto& blocks = m_entries[n].m_blocks;
+            for (size_t i = 0; i < blocks.size(); i++)
+            {
+                const auto block = blocks[i];
+                if (block >= m_block_owners.size())
+                {
+                    m_block_owners.resize(block + 1);
+                }
+                m_block_owners[block] = { n, static_cast<uint8_t>(i) };
+            }
+        }
+
+        // Forget the nth entry's ownership of its blocks, prior to its disk map changing
+        void release_blocks(size_t n)
+        {
+            for (const auto block : m_entries[n].m_blocks)
+            {
+                if ((block < m_block_owners.size()) && (m_block_owners[block].m_entry == n))
+                {
+                    m_block_owners[block] = {};
+                }
+            }
+        }
     };
 
     // Facade
 
-    Disk::Disk() : m_private(std::make_unique<Private>())
+    Disk::Disk(const Config& behaviour)
     {
+        if (behaviour.disk_image.empty())
+        {
+            m_private = std::make_unique<Private>(behaviour);
+        }
+        else
+        {
+            m_pimage = std::make_unique<DiskImage>(behaviour.disk_image, behaviour.disk_geometry, behaviour.flush_sync);
+        }
     }
 
     Disk::~Disk() = default;
 
     size_t Disk::size() const
     {
-        return m_private->size();
+        return m_private ? m_private->size() : 0;
+    }
+
+    const DiskGeometry& Disk::get_geometry() const
+    {
+        return m_pimage ? m_pimage->get_geometry() : m_private->get_geometry();
+    }
+
+    void Disk::read(SectorView buffer, uint16_t track, uint16_t sector) const
+    {
+        ++m_reads;
+        if (m_pimage)
+        {
+            std::memcpy(buffer.data(), m_pimage->sector(track, sector), buffer.size());
+        }
+        else
+        {
+            m_private->read(buffer, track, sector);
+        }
+    }
+
+    void Disk::write(ConstSectorView buffer, uint16_t track, uint16_t sector)
+    {
+        if (m_pundo_log)
+        {
+            auto& copy = m_pundo_log->emplace_back(SectorCopy{ track, sector, {} });
+            if (m_pimage)
+            {
+                std::memcpy(copy.data.data(), m_pimage->sector(track, sector), copy.data.size());
+            }
+            else
+            {
+                m_private->read(copy.data, track, sector);
+            }
+        }
+
+        ++m_writes;
+        if (m_pimage)
+        {
+            std::memcpy(m_pimage->sector(track, sector), buffer.data(), buffer.size());
+        }
+        else
+        {
+            m_private->write(buffer, track, sector);
+        }
     }
 
-    void Disk::read(SectorData& buffer, uint16_t track, uint16_t sector) const
+    void Disk::set_undo_log(std::vector<SectorCopy>* p_log)
     {
-        m_private->read(buffer, track, sector);
+        m_pundo_log = p_log;
     }
 
-    void Disk::write(const SectorData& buffer, uint16_t track, uint16_t sector)
+    Disk::Statistics Disk::get_statistics() const
     {
-        m_private->write(buffer, track, sector);
+        Statistics statistics;
+        statistics.reads = m_reads;
+        statistics.writes = m_writes;
+        if (m_private)
+        {
+            m_private->get_statistics(statistics);
+        }
+        return statistics;
     }
 
 } // namespace zcpm
@@ -1,17 +1,26 @@
 #pragma once
 
+#include "config.hpp"
+#include "diskgeometry.hpp"
+
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <span>
+#include <vector>
 
 namespace zcpm
 {
 
+    class DiskImage;
+
     class Disk final
     {
     public:
-        // Reads from cwd on instantiation.
-        Disk();
+        // Reads from cwd on instantiation. The configuration determines the size of the sector cache, and when changes
+        // are written back to the host filesystem (this always happens when the instance is destroyed). Alternatively,
+        // the configuration can name a raw disk image, which is used as it is (with the configured geometry).
+        explicit Disk(const Config& behaviour);
 
         Disk(const Disk&) = delete;
         Disk& operator=(const Disk&) = delete;
@@ -20,26 +29,63 @@ namespace zcpm
 
         ~Disk();
 
-        // Returns number of entries in this instance.
+        // Returns number of entries in this instance (which is zero for a disk image, as its directory isn't examined).
         size_t size() const;
 
         static const inline uint16_t SectorSize{ 0x0080 };
         using SectorData = std::array<uint8_t, SectorSize>; // 128 bytes each sector
 
-        static const inline uint8_t BSH{ 0x04 }; // Block shift: 16 sectors per block
-        static const inline uint8_t BLM{ 0x0F }; // Block mask
-        // Given the disk geometry that we've specified in the DPH, this means that track 0 (sectors 00..7F)
-        // and track 1 (sectors 00..7F) are directory entries, anything else is file data.
+        // Somewhere that a sector is copied to or from, which can be a SectorData or (to avoid copying it twice)
+        // directly in emulated RAM
+        using SectorView = std::span<uint8_t, SectorSize>;
+        using ConstSectorView = std::span<const uint8_t, SectorSize>;
+
+        // The geometry that the DPB needs to describe. For the disk that is synthesised from cwd, the reserved tracks
+        // (if any) are followed by the directory (as many blocks as it needs), and anything else is file data.
+        [[nodiscard]] const DiskGeometry& get_geometry() const;
 
         // Read data from the disk (via a cache) into the supplied sector buffer
-        void read(SectorData& buffer, uint16_t track, uint16_t sector) const;
+        void read(SectorView buffer, uint16_t track, uint16_t sector) const;
 
         // Write data from the supplied sector buffer to the disk (via a cache)
-        void write(const SectorData& buffer, uint16_t track, uint16_t sector);
+        void write(ConstSectorView buffer, uint16_t track, uint16_t sector);
+
+        // Counters of sector accesses, and of how the cache has dealt with them (a disk image has no cache, so only
+        // counts reads and writes)
+        struct Statistics
+        {
+            uint64_t reads{ 0 };
+            uint64_t writes{ 0 };
+            uint64_t cache_hits{ 0 };    // Reads of sectors which were already in the cache
+            uint64_t cache_misses{ 0 };  // Reads which had to go to the host filesystem (or synthesise a sector)
+            uint64_t evictions{ 0 };     // Clean sectors which were dropped from the cache to keep within its limit
+            uint64_t flushes{ 0 };       // Writes of all changes to the host filesystem
+            uint64_t files_written{ 0 }; // Host files (re)written by those flushes, or as files were closed
+        };
+        [[nodiscard]] Statistics get_statistics() const;
+
+        // What a sector held before it was written
+        struct SectorCopy
+        {
+            uint16_t track;
+            uint16_t sector;
+            SectorData data;
+        };
+
+        // While an undo log is set, each write first adds the sector's previous contents to it, so that the write can
+        // be undone later by writing those back (with no log set). nullptr stops this.
+        void set_undo_log(std::vector<SectorCopy>* p_log);
 
     private:
         class Private;
         std::unique_ptr<Private> m_private;
+
+        std::unique_ptr<DiskImage> m_pimage;
+
+        mutable uint64_t m_reads{ 0 };
+        uint64_t m_writes{ 0 };
+
+        std::vector<SectorCopy>* m_pundo_log{ nullptr };
     };
 
 } // namespace zcpm
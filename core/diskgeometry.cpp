@@ -0,0 +1,68 @@
+#include "diskgeometry.hpp"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace zcpm
+{
+    std::istream& operator>>(std::istream& in, DiskGeometry& geometry)
+    {
+        std::string token;
+        in >> token;
+
+        const auto invalid = []() {
+            return boost::program_options::validation_error(
+                boost::program_options::validation_error::invalid_option_value, "Invalid disk geometry");
+        };
+
+        std::vector<std::string> fields;
+        boost::split(fields, token, boost::is_any_of(","));
+        if (fields.size() != 5)
+        {
+            throw invalid();
+        }
+
+        std::vector<unsigned long> values;
+        for (const auto& field : fields)
+        {
+            size_t used = 0;
+            unsigned long value = 0;
+            try
+            {
+                value = std::stoul(field, &used, 0);
+            }
+            catch (const std::logic_error&) // Not a number, or too big
+            {
+                throw invalid();
+            }
+            if ((used != field.size()) || (value > 0xFFFF))
+            {
+                throw invalid();
+            }
+            values.push_back(value);
+        }
+
+        DiskGeometry result{ .spt = static_cast<uint16_t>(values[0]),
+                             .bsh = static_cast<uint8_t>(values[1]),
+                             .dsm = static_cast<uint16_t>(values[2]),
+                             .drm = static_cast<uint16_t>(values[3]),
+                             .off = static_cast<uint16_t>(values[4]) };
+
+        // Blocks are between 1KB and 16KB, with 16-bit block numbers needing at least 2KB. The BIOS has room for 256
+        // bytes of allocation vector (one bit per block), and AL0/AL1 allow for up to 16 directory blocks.
+        if ((result.spt == 0) || (values[1] < 3) || (values[1] > 7) || ((result.bsh == 3) && (result.dsm >= 0x0100)) ||
+            (result.dsm > 0x07FF) || (result.directory_blocks() > 16) || (result.directory_blocks() > result.dsm))
+        {
+            throw invalid();
+        }
+
+        geometry = result;
+        return in;
+    }
+
+} // namespace zcpm
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+namespace zcpm
+{
+    // The shape of a disk, as described to the BDOS by a DPB (Disk Parameter Block; see
+    // http://www.seasip.info/Cpm/dpb.html). The defaults describe the disk which is synthesised from the host's current
+    // directory, unless another geometry is selected. Sectors are always 128 bytes, and are never skewed (i.e. there
+    // is no sector translation).
+    struct DiskGeometry
+    {
+        uint16_t spt{ 0x0080 }; // Sectors per track
+        uint8_t bsh{ 0x04 };    // Block shift factor; a block is (128 << bsh) bytes
+        uint16_t dsm{ 0x07F7 }; // Disk size in blocks - 1
+        uint16_t drm{ 0x03FF }; // Number of directory entries - 1
+        uint16_t off{ 0x0000 }; // Number of reserved tracks, which precede the directory
+
+        // Block mask
+        [[nodiscard]] constexpr uint8_t blm() const
+        {
+            return static_cast<uint8_t>((1 << bsh) - 1);
+        }
+
+        // Extent mask, which follows from the block size and whether block numbers need 16 bits
+        [[nodiscard]] constexpr uint8_t exm() const
+        {
+            return static_cast<uint8_t>((1 << (bsh - ((dsm < 0x0100) ? 3 : 4))) - 1);
+        }
+
+        // Number of blocks that the directory occupies, from the start of the disk
+        [[nodiscard]] constexpr uint16_t directory_blocks() const
+        {
+            const auto block_size = 0x80 << bsh;
+            return static_cast<uint16_t>(((drm + 1) * 0x20 + block_size - 1) / block_size);
+        }
+
+        // AL0 (in the high byte) and AL1, which have a bit set for each block occupied by the directory
+        [[nodiscard]] constexpr uint16_t allocation() const
+        {
+            return static_cast<uint16_t>(0xFFFF << (16 - directory_blocks()));
+        }
+
+        // Total number of sectors, including the reserved tracks
+        [[nodiscard]] constexpr size_t sectors() const
+        {
+            return size_t(off) * spt + ((size_t(dsm) + 1) << bsh);
+        }
+    };
+
+    // Reads "SPT,BSH,DSM,DRM,OFF" (each in decimal, or hex with a 0x prefix), rejecting a geometry which the BIOS
+    // can't describe
+    std::istream& operator>>(std::istream& in, DiskGeometry& geometry);
+
+} // namespace zcpm
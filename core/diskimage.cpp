@@ -0,0 +1,82 @@
+#include "diskimage.hpp"
+
+#include "disk.hpp"
+#include "log.hpp"
+
+#include <fmt/core.h>
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace zcpm
+{
+
+    DiskImage::DiskImage(const std::string& filename, const DiskGeometry& geometry, bool sync)
+        : m_geometry(geometry),
+          m_sync(sync)
+    {
+        m_fd = ::open(filename.c_str(), O_RDWR);
+        if (m_fd < 0)
+        {
+            throw std::runtime_error(fmt::format("Can't open disk image {}", filename));
+        }
+
+        struct stat status{};
+        const auto required = m_geometry.sectors() * Disk::SectorSize;
+        if ((::fstat(m_fd, &status) != 0) || (static_cast<size_t>(status.st_size) < required))
+        {
+            ::close(m_fd);
+            throw std::runtime_error(
+                fmt::format("Disk image {} is smaller than the {} bytes that the disk needs", filename, required));
+        }
+
+        // Map the whole file, even if the disk doesn't use all of it
+        m_size = static_cast<size_t>(status.st_size);
+        auto p = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (p == MAP_FAILED)
+        {
+            ::close(m_fd);
+            throw std::runtime_error(fmt::format("Can't map disk image {}", filename));
+        }
+        m_pdata = static_cast<uint8_t*>(p);
+
+        ZCPM_LOG(trace) << fmt::format("Mapped disk image {} ({} bytes), SPT={} BSH={} DSM={} DRM={} OFF={}",
+                                                filename,
+                                                m_size,
+                                                m_geometry.spt,
+                                                m_geometry.bsh,
+                                                m_geometry.dsm,
+                                                m_geometry.drm,
+                                                m_geometry.off);
+    }
+
+    DiskImage::~DiskImage()
+    {
+        if (m_sync)
+        {
+            ::msync(m_pdata, m_size, MS_SYNC);
+        }
+        ::munmap(m_pdata, m_size);
+        ::close(m_fd);
+    }
+
+    const DiskGeometry& DiskImage::get_geometry() const
+    {
+        return m_geometry;
+    }
+
+    uint8_t* DiskImage::sector(uint16_t track, uint16_t sector) const
+    {
+        const auto n = size_t(track) * m_geometry.spt + sector;
+        if ((sector >= m_geometry.spt) || (n >= m_geometry.sectors()))
+        {
+            throw std::runtime_error(fmt::format("TRACK:{:04X},SECTOR:{:04X} is not on the disk image", track, sector));
+        }
+        return m_pdata + n * Disk::SectorSize;
+    }
+
+} // namespace zcpm
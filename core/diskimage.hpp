@@ -0,0 +1,46 @@
+#pragma once
+
+#include "diskgeometry.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace zcpm
+{
+
+    // A raw CP/M disk image (i.e. every sector of every track, in order, with no header) which is mapped into memory,
+    // so that reads and writes of sectors are just accesses to the mapping, and the operating system takes care of
+    // getting changes to the file
+    class DiskImage final
+    {
+    public:
+        // Throws if the file can't be mapped, or is too small for the geometry. With 'sync' set, changes are written
+        // back synchronously when the instance is destroyed, rather than whenever the operating system chooses.
+        DiskImage(const std::string& filename, const DiskGeometry& geometry, bool sync);
+
+        DiskImage(const DiskImage&) = delete;
+        DiskImage& operator=(const DiskImage&) = delete;
+        DiskImage(DiskImage&&) = delete;
+        DiskImage& operator=(DiskImage&&) = delete;
+
+        ~DiskImage();
+
+        [[nodiscard]] const DiskGeometry& get_geometry() const;
+
+        // Returns the specified sector within the mapping; throws if it isn't on the disk
+        [[nodiscard]] uint8_t* sector(uint16_t track, uint16_t sector) const;
+
+    private:
+        const DiskGeometry m_geometry;
+
+        const bool m_sync;
+
+        int m_fd{ -1 };
+
+        uint8_t* m_pdata{ nullptr };
+
+        size_t m_size{ 0 };
+    };
+
+} // namespace zcpm
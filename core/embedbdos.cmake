@@ -0,0 +1,59 @@
+# Turns the assembled BDOS binary and its label file into a C++ header of constexpr data, so that the core library can
+# provide a BDOS without reading anything at run time. Run as a script:
+#
+#   cmake -DBINARY=bdos.bin -DLABELS=bdos.lab -DOUTPUT=embeddedbdosdata.hpp -P embedbdos.cmake
+#
+# Labels are read as SymbolTable::load reads them (the label is everything before the colon, and the value is the hex
+# after the last '$'), and are written in ascending order of address, keeping the order of the file for any which
+# share an address.
+
+file(READ "${BINARY}" BINARY_HEX HEX)
+string(LENGTH "${BINARY_HEX}" BINARY_HEX_LENGTH)
+math(EXPR BINARY_SIZE "${BINARY_HEX_LENGTH} / 2")
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BINARY_BYTES "${BINARY_HEX}")
+string(REGEX REPLACE "((0x..,){16})" "\\1\n        " BINARY_BYTES "${BINARY_BYTES}")
+
+file(STRINGS "${LABELS}" LABEL_LINES)
+set(LABEL_INDEX 10000)
+set(LABEL_ENTRIES "")
+foreach(LINE IN LISTS LABEL_LINES)
+  if (LINE MATCHES "^([^:]*):.*\\$([0-9A-Fa-f]*)")
+    set(LABEL "${CMAKE_MATCH_1}")
+    string(TOUPPER "0000${CMAKE_MATCH_2}" VALUE)
+    string(LENGTH "${VALUE}" VALUE_LENGTH)
+    math(EXPR VALUE_START "${VALUE_LENGTH} - 4")
+    string(SUBSTRING "${VALUE}" ${VALUE_START} 4 VALUE)
+    if (NOT LABEL STREQUAL "" OR NOT CMAKE_MATCH_2 STREQUAL "")
+      # The index (fixed width, as is the address) keeps the sort stable
+      list(APPEND LABEL_ENTRIES "${VALUE}|${LABEL_INDEX}|${LABEL}")
+      math(EXPR LABEL_INDEX "${LABEL_INDEX} + 1")
+    endif()
+  endif()
+endforeach()
+list(SORT LABEL_ENTRIES)
+
+set(LABEL_SOURCE "")
+foreach(ENTRY IN LISTS LABEL_ENTRIES)
+  string(REGEX MATCH "^([0-9A-F]+)\\|[0-9]+\\|(.*)$" ENTRY_PARTS "${ENTRY}")
+  string(APPEND LABEL_SOURCE "        { 0x${CMAKE_MATCH_1}, \"${CMAKE_MATCH_2}\" },\n")
+endforeach()
+
+file(WRITE "${OUTPUT}" "// Generated by embedbdos.cmake from ${BINARY} and ${LABELS}; do not edit
+
+#pragma once
+
+#include <zcpm/core/symboltable.hpp>
+
+#include <array>
+#include <cstdint>
+
+namespace zcpm::embedded_bdos
+{
+    inline constexpr std::array<uint8_t, ${BINARY_SIZE}> Binary{
+        ${BINARY_BYTES}
+    };
+
+    inline constexpr SymbolTable::Label Symbols[]{
+${LABEL_SOURCE}    };
+} // namespace zcpm::embedded_bdos
+")
@@ -0,0 +1,18 @@
+#include "embeddedbdos.hpp"
+
+#include "embeddedbdosdata.hpp" // Generated from the bdos directory by embedbdos.cmake
+
+namespace zcpm::embedded_bdos
+{
+
+    std::span<const uint8_t> binary()
+    {
+        return Binary;
+    }
+
+    std::span<const SymbolTable::Label> symbols()
+    {
+        return Symbols;
+    }
+
+} // namespace zcpm::embedded_bdos
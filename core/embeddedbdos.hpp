@@ -0,0 +1,17 @@
+#pragma once
+
+#include "symboltable.hpp"
+
+#include <cstdint>
+#include <span>
+
+namespace zcpm::embedded_bdos
+{
+
+    // The BDOS (and CCP) binary from bdos/bdos.bin, as built into the library
+    std::span<const uint8_t> binary();
+
+    // Its symbols from bdos/bdos.lab, in ascending order of address
+    std::span<const SymbolTable::Label> symbols();
+
+} // namespace zcpm::embedded_bdos
@@ -0,0 +1,38 @@
+#include "engine.hpp"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include <istream>
+
+namespace zcpm
+{
+    std::istream& operator>>(std::istream& in, Engine& engine)
+    {
+        std::string token;
+        in >> token;
+
+        boost::to_upper(token);
+
+        if (token == "INTERPRETER")
+        {
+            engine = Engine::INTERPRETER;
+        }
+        else if (token == "BLOCKCACHE")
+        {
+            engine = Engine::BLOCK_CACHE;
+        }
+        else if (token == "TRANSLATE")
+        {
+            engine = Engine::TRANSLATE;
+        }
+        else
+        {
+            throw boost::program_options::validation_error(
+                boost::program_options::validation_error::invalid_option_value, "Invalid engine");
+        }
+
+        return in;
+    }
+
+} // namespace zcpm
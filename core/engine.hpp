@@ -0,0 +1,16 @@
+#pragma once
+
+#include <iosfwd>
+
+namespace zcpm
+{
+    enum class Engine
+    {
+        INTERPRETER, // Decode every instruction from memory each time it is executed
+        BLOCK_CACHE, // Decode straight-line code once into cached basic blocks, invalidated when the code is modified
+        TRANSLATE    // As BLOCK_CACHE, plus frequently executed code is translated into chains of specialised handlers
+    };
+
+    std::istream& operator>>(std::istream& in, Engine& engine);
+
+} // namespace zcpm
@@ -0,0 +1,91 @@
+#include "eventscheduler.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace zcpm
+{
+
+    EventScheduler::Id EventScheduler::schedule(uint64_t deadline, Handler handler, uint64_t period)
+    {
+        const auto id = m_next_id++;
+        m_events.push_back({ deadline, m_next_sequence++, id, period, std::move(handler) });
+        std::push_heap(m_events.begin(), m_events.end(), later);
+        return id;
+    }
+
+    void EventScheduler::cancel(Id id)
+    {
+        const auto it =
+            std::find_if(m_events.begin(), m_events.end(), [id](const Event& event) { return event.id == id; });
+        if (it != m_events.end())
+        {
+            m_events.erase(it);
+            std::make_heap(m_events.begin(), m_events.end(), later);
+        }
+    }
+
+    bool EventScheduler::empty() const
+    {
+        return m_events.empty();
+    }
+
+    uint64_t EventScheduler::next_deadline() const
+    {
+        return m_events.empty() ? Never : m_events.front().deadline;
+    }
+
+    void EventScheduler::run_due(uint64_t now)
+    {
+        while (!m_events.empty() && (m_events.front().deadline <= now))
+        {
+            std::pop_heap(m_events.begin(), m_events.end(), later);
+            auto event = std::move(m_events.back());
+            m_events.pop_back();
+
+            // Requeue a recurring event before handling it, so that the handler can cancel it
+            if (event.period)
+            {
+                const auto due = event.deadline + event.period;
+                const auto next = (due > now) ? due : now + event.period;
+                m_events.push_back({ next, m_next_sequence++, event.id, event.period, event.handler });
+                std::push_heap(m_events.begin(), m_events.end(), later);
+            }
+
+            event.handler();
+        }
+    }
+
+    EventScheduler::Deadlines EventScheduler::deadlines() const
+    {
+        Deadlines result;
+        result.reserve(m_events.size());
+        for (const auto& event : m_events)
+        {
+            result.push_back({ event.id, event.deadline, event.sequence });
+        }
+        return result;
+    }
+
+    void EventScheduler::restore(const Deadlines& deadlines)
+    {
+        for (auto& event : m_events)
+        {
+            const auto it = std::find_if(deadlines.begin(),
+                                         deadlines.end(),
+                                         [&event](const Deadline& deadline) { return deadline.id == event.id; });
+            if (it != deadlines.end())
+            {
+                event.deadline = it->deadline;
+                event.sequence = it->sequence;
+            }
+        }
+        std::make_heap(m_events.begin(), m_events.end(), later);
+    }
+
+    bool EventScheduler::later(const Event& a, const Event& b)
+    {
+        return (a.deadline != b.deadline) ? (a.deadline > b.deadline) : (a.sequence > b.sequence);
+    }
+
+} // namespace zcpm
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace zcpm
+{
+
+    // Events which are due to happen once the processor's cycle count reaches their deadlines, such as timer ticks.
+    // Whoever runs the processor asks for the next deadline, runs the processor until then (or a little beyond, since
+    // instructions aren't split), and then has the events which are due handled.
+    class EventScheduler final
+    {
+    public:
+        using Handler = std::function<void()>;
+        using Id = uint64_t;
+
+        inline static const uint64_t Never{ std::numeric_limits<uint64_t>::max() };
+
+        // Where a queued event stood, as kept by deadlines() to be put back by restore()
+        struct Deadline
+        {
+            Id id;
+            uint64_t deadline;
+            uint64_t sequence;
+        };
+        using Deadlines = std::vector<Deadline>;
+
+        EventScheduler() = default;
+
+        EventScheduler(const EventScheduler&) = delete;
+        EventScheduler& operator=(const EventScheduler&) = delete;
+        EventScheduler(EventScheduler&&) = delete;
+        EventScheduler& operator=(EventScheduler&&) = delete;
+
+        ~EventScheduler() = default;
+
+        // Queue an event for the specified cycle count. If period is non-zero, the event then recurs every that many
+        // cycles; any occurrences which are already in the past by the time it is handled are skipped.
+        Id schedule(uint64_t deadline, Handler handler, uint64_t period = 0);
+
+        // Remove an event from the queue, if it is still there
+        void cancel(Id id);
+
+        [[nodiscard]] bool empty() const;
+
+        // The cycle count at which the next event is due, or Never if there are none
+        [[nodiscard]] uint64_t next_deadline() const;
+
+        // Handle all of the events which are due by the specified cycle count, in order of deadline (and for the same
+        // deadline, in the order that they were queued). A handler may queue or cancel events.
+        void run_due(uint64_t now);
+
+        // Where each of the queued events stands, and putting them back there (e.g. to go back to a checkpoint). Events
+        // which have been queued since are left as they are, and those which have been cancelled since stay cancelled.
+        [[nodiscard]] Deadlines deadlines() const;
+        void restore(const Deadlines& deadlines);
+
+    private:
+        struct Event
+        {
+            uint64_t deadline;
+            uint64_t sequence; // Orders events with the same deadline
+            Id id;
+            uint64_t period;
+            Handler handler;
+        };
+
+        // Ordering for a heap whose front is the earliest event
+        static bool later(const Event& a, const Event& b);
+
+        std::vector<Event> m_events; // A heap, see later()
+        uint64_t m_next_sequence{ 0 };
+        Id m_next_id{ 1 };
+    };
+
+} // namespace zcpm
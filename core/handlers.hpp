@@ -14,4 +14,7 @@ namespace zcpm
     /// For the Z80 'OUT' instruction
     using OutputHandler = std::function<void(Hardware&, int, uint8_t)>;
 
+    /// For an access to a watched memory address (given the address and the byte or word value)
+    using WatchHandler = std::function<void(uint16_t, uint16_t)>;
+
 } // namespace zcpm
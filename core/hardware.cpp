@@ -2,31 +2,63 @@
 
 #include "bdos.hpp"
 #include "bios.hpp"
+#include "embeddedbdos.hpp"
+#include "log.hpp"
+#include "nativebdos.hpp"
+#include "nativeconsole.hpp"
 #include "processor.hpp"
 #include "registers.hpp"
 
 #include <zcpm/terminal/terminal.hpp>
 
-#include <boost/log/trivial.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <optional>
 #include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
 namespace zcpm
 {
 
     Hardware::Hardware(std::unique_ptr<terminal::Terminal> p_terminal, const Config& behaviour)
-        : m_processor(std::make_unique<Processor>(*this, *this)),
+        : m_processor(std::make_unique<Processor>(*this)),
           m_config(behaviour),
           m_pterminal(std::move(p_terminal))
     {
+        if (m_config.call_trace > 0)
+        {
+            m_pcall_trace = std::make_unique<CallTrace>(m_config.call_trace);
+        }
+
         m_memory.fill(0);
 
+        if (m_config.timer_hz > 0)
+        {
+            // A timer interrupt with RST 38H on the bus, as for interrupt mode 1
+            const auto clock_khz = (m_config.clock_khz > 0) ? m_config.clock_khz : 4000;
+            const auto period = std::max<uint64_t>(static_cast<uint64_t>(clock_khz) * 1000 / m_config.timer_hz, 1);
+            m_events.schedule(period, [this]() { request_interrupt(0xFF); }, period);
+        }
+
+        m_processor->set_engine(m_config.engine);
+        m_processor->set_cpu(m_config.cpu);
+        m_processor->set_lazy_flags(m_config.lazy_flags);
+        // The profiler needs every instruction to count its cycles
+        const auto profiling = !m_config.profile.empty() || !m_config.profile_stacks.empty();
+        m_processor->set_fast(m_config.fast && !profiling);
+        if (profiling)
+        {
+            m_processor->enable_profiler();
+        }
+
         // TODO: Add setters/getters etc for this kind of thing, rather than hiding it here
 
         // Monitor *any* write of page zero
@@ -46,7 +78,14 @@ namespace zcpm
         add_symbol(0xFFF0, "TBD!");
     }
 
-    Hardware::~Hardware() = default;
+    Hardware::~Hardware()
+    {
+        if (m_pcall_trace)
+        {
+            show_call_trace([](const std::string& line) { ZCPM_LOG(info) << line; });
+        }
+        write_profile();
+    }
 
     void Hardware::set_input_handler(const InputHandler& h)
     {
@@ -61,6 +100,10 @@ namespace zcpm
     void Hardware::set_fbase_and_wboot(uint16_t fbase, uint16_t wboot)
     {
         m_fbase = fbase;
+        m_wboot = wboot;
+
+        // BDOS calls are always counted and timed (see get_statistics), and may also be logged or handled natively
+        m_processor->add_trap(fbase);
 
         // Set up jump to BIOS 'WBOOT' from 0000
         write_byte(0x0000, 0xc3);           // JP
@@ -74,7 +117,42 @@ namespace zcpm
 
         // Find the start of the BIOS in the current memory image, and then manipulate the
         // jump tables etc so that we can intercept BIOS calls ourselves.
-        m_pbios = std::make_unique<Bios>(this, m_pterminal.get());
+        m_pbios = std::make_unique<Bios>(this, m_pterminal.get(), m_config);
+
+        if (m_config.native_bdos)
+        {
+            // This reads the DMA address, selected drive and write protection from the BDOS' own variables
+            const auto [userdma_ok, userdma] = m_symbols.evaluate_address_expression("USERDMA");
+            const auto [active_ok, active] = m_symbols.evaluate_address_expression("ACTIVE");
+            const auto [wrtprt_ok, wrtprt] = m_symbols.evaluate_address_expression("WRTPRT");
+            if (userdma_ok && active_ok && wrtprt_ok)
+            {
+                m_pnative_bdos = std::make_unique<NativeBdos>(
+                    *this, m_pbios->get_disk(), NativeBdos::Variables{ userdma, active, wrtprt });
+            }
+            else
+            {
+                ZCPM_LOG(trace) << "BDOS symbols for file access not found, so it is left to the BDOS";
+            }
+        }
+
+        if (m_config.native_console)
+        {
+            // This needs to know where the BDOS keeps its console state, which only its symbols can tell us
+            const auto [outflag_ok, outflag] = m_symbols.evaluate_address_expression("OUTFLAG");
+            const auto [curpos_ok, curpos] = m_symbols.evaluate_address_expression("CURPOS");
+            const auto [prtflag_ok, prtflag] = m_symbols.evaluate_address_expression("PRTFLAG");
+            const auto [charbuf_ok, charbuf] = m_symbols.evaluate_address_expression("CHARBUF");
+            if (outflag_ok && curpos_ok && prtflag_ok && charbuf_ok)
+            {
+                m_pnative_console = std::make_unique<NativeConsole>(
+                    *this, *m_pbios, NativeConsole::Variables{ outflag, curpos, prtflag, charbuf });
+            }
+            else
+            {
+                ZCPM_LOG(trace) << "BDOS symbols for console output not found, so it is left to the BDOS";
+            }
+        }
     }
 
     void Hardware::call_bios_boot()
@@ -95,153 +173,445 @@ namespace zcpm
         m_processor->reset_state();
     }
 
-    void Hardware::set_finished(bool finished)
+    Snapshot Hardware::save_snapshot() const
     {
-        m_finished = finished;
+        if (!m_pbios)
+        {
+            throw std::runtime_error("Can't take a snapshot before the BIOS is set up");
+        }
+
+        Snapshot snapshot{};
+        snapshot.fbase = m_fbase;
+        snapshot.wboot = m_wboot;
+        snapshot.processor = m_processor->get_state();
+        snapshot.bios = m_pbios->get_state();
+        snapshot.memory.assign(m_memory.begin(), m_memory.end());
+        snapshot.symbols = m_symbols.save();
+        return snapshot;
     }
 
-    bool Hardware::running() const
+    void Hardware::restore_snapshot(const Snapshot& snapshot)
     {
-        return !m_finished;
+        if (snapshot.memory.size() != m_memory.size())
+        {
+            throw std::runtime_error("Snapshot of the wrong memory size");
+        }
+
+        copy_to_ram(snapshot.memory.data(), snapshot.memory.size(), 0x0000);
+        if (!m_pbios)
+        {
+            // Setting up the BIOS needs the memory image to find the jump table in, and may need the BDOS symbols. It
+            // also rewrites some of memory and adds symbols of its own, hence both are restored again below.
+            m_symbols.restore(snapshot.symbols);
+            set_fbase_and_wboot(snapshot.fbase, snapshot.wboot);
+            copy_to_ram(snapshot.memory.data(), snapshot.memory.size(), 0x0000);
+        }
+        else if ((snapshot.fbase != m_fbase) || (snapshot.wboot != m_wboot))
+        {
+            throw std::runtime_error("Snapshot is of a differently configured machine");
+        }
+
+        m_symbols.restore(snapshot.symbols);
+        m_symbols.remove("USER");
+        m_symbols.load(m_config.user_sym, "USER");
+
+        m_pbios->set_state(snapshot.bios);
+        m_processor->set_state(snapshot.processor);
+
+        // Any BDOS call that was being timed belongs to the state which has just been replaced
+        if (m_pending_bdos)
+        {
+            finish_bdos_call(false);
+        }
     }
 
-    bool Hardware::check_and_handle_bdos_and_bios(uint16_t address) const
+    void Hardware::enable_checkpoints(uint64_t interval, size_t limit)
     {
-        // Note that BDOS calls are logged but not intercepted.  But BIOS calls are logged *and* intercepted. This is
-        // because our BDOS is implemented via a binary blob (a real BDOS implementation), which will in turn make calls
-        // into our own custom BIOS implementation. So BDOS calls are checked & logged but not intercepted, but BIOS
-        // calls need to be intercepted and translated to (e.g.) host system calls.
+        if (!m_pbios)
+        {
+            throw std::runtime_error("Can't take checkpoints before the BIOS is set up");
+        }
 
-        // Does this appear to be a BDOS call?  i.e., a jump to FBASE from 0005?
-        if (address == m_fbase)
+        disable_checkpoints();
+        m_pcheckpoints = std::make_unique<Checkpoints>(limit);
+        m_checkpoint_interval = std::max<uint64_t>(interval, 1);
+        m_pbios->set_input_logging(true);
+        // Scheduled first, so that the first checkpoint also records when the next one is due
+        schedule_checkpoints();
+        take_checkpoint();
+    }
+
+    void Hardware::disable_checkpoints()
+    {
+        if (m_pcheckpoints)
         {
-            if (m_config.log_bdos)
+            m_events.cancel(m_checkpoint_event);
+            m_pbios->get_disk().set_undo_log(nullptr);
+            m_pbios->set_input_logging(false);
+            m_pcheckpoints.reset();
+        }
+    }
+
+    size_t Hardware::checkpoint_count() const
+    {
+        return m_pcheckpoints ? m_pcheckpoints->size() : 0;
+    }
+
+    bool Hardware::restore_checkpoint(uint64_t before_cycles)
+    {
+        const auto index = m_pcheckpoints ? m_pcheckpoints->latest_before(before_cycles) : std::nullopt;
+        if (!index)
+        {
+            return false;
+        }
+
+        // Undo the disk writes made since that checkpoint, newest first, without logging the undoing writes themselves
+        auto& disk = m_pbios->get_disk();
+        disk.set_undo_log(nullptr);
+        for (auto later = m_pcheckpoints->size(); later > *index; --later)
+        {
+            const auto& sectors = m_pcheckpoints->at(later - 1).sectors;
+            for (auto it = sectors.rbegin(); it != sectors.rend(); ++it)
             {
-                // "Parse" the pending BDOS call into various bits of useful information
-                const auto registers = m_processor->get_registers();
-                const auto [bdos_name, description] = bdos::describe_call(registers, *this);
+                disk.write(it->data, it->track, it->sector);
+            }
+        }
 
-                // Log the information
-                BOOST_LOG_TRIVIAL(trace) << "BDOS: " << bdos_name << format_stack_info();
-                BOOST_LOG_TRIVIAL(trace) << "BDOS: " << description;
+        // Only the pages which have been written since then need to be put back
+        const auto changed = m_pcheckpoints->changed_since(*index, m_dirty_pages);
+        for (size_t number = 0; number < Checkpoints::PageCount; ++number)
+        {
+            if (changed[number])
+            {
+                const auto& page = m_pcheckpoints->page_at(*index, static_cast<uint8_t>(number));
+                copy_to_ram(page.data(), page.size(), static_cast<uint16_t>(number * Checkpoints::PageSize));
             }
+        }
 
-            return false; // BIOS was not intercepted
+        const auto& checkpoint = m_pcheckpoints->at(*index);
+        m_pbios->set_state(checkpoint.bios);
+        m_pbios->set_input_position(checkpoint.input_position);
+        m_processor->set_state(checkpoint.processor);
+
+        // Along with when each event is next due (including the next checkpoint), and where the run was in between
+        m_events.restore(checkpoint.scheduling.deadlines);
+        m_interrupt_pending = checkpoint.scheduling.interrupt_pending;
+        m_interrupt_data = checkpoint.scheduling.interrupt_data;
+        m_slice_cycles = checkpoint.scheduling.slice_cycles;
+
+        m_pcheckpoints->truncate(*index);
+        m_dirty_pages.fill(false);
+        disk.set_undo_log(&m_pcheckpoints->latest().sectors);
+
+        // Any BDOS call that was being timed belongs to the state which has just been replaced
+        if (m_pending_bdos)
+        {
+            finish_bdos_call(false);
         }
 
+        return true;
+    }
+
+    void Hardware::set_replaying(bool replaying)
+    {
         if (m_pbios)
         {
-            return m_pbios->check_and_handle(address);
+            m_pbios->set_quiet(replaying);
         }
-        else
+    }
+
+    void Hardware::take_checkpoint()
+    {
+        m_pcheckpoints->add(m_processor->get_state(),
+                            m_pbios->get_state(),
+                            m_pbios->get_input_position(),
+                            { m_events.deadlines(), m_interrupt_pending, m_interrupt_data, m_slice_cycles },
+                            m_memory,
+                            m_dirty_pages);
+        m_dirty_pages.fill(false);
+        m_pbios->get_disk().set_undo_log(&m_pcheckpoints->latest().sectors);
+    }
+
+    void Hardware::schedule_checkpoints()
+    {
+        m_checkpoint_event = m_events.schedule(
+            m_processor->get_cycle_count() + m_checkpoint_interval,
+            [this]() { take_checkpoint(); },
+            m_checkpoint_interval);
+    }
+
+    void Hardware::written(uint16_t address, size_t count)
+    {
+        m_processor->invalidate_code(address, count);
+        const auto end = std::min<size_t>(address + count, m_memory.size());
+        for (auto page = address / Checkpoints::PageSize; page * Checkpoints::PageSize < end; ++page)
         {
-            return false;
+            m_dirty_pages[page] = true;
         }
     }
 
-    void Hardware::add_watch_read(uint16_t base, uint16_t count)
+    std::span<uint8_t> Hardware::load_area(uint16_t base, size_t count)
     {
-        for (auto i = base; i < base + count; ++i)
+        const size_t limit = (m_fbase != 0) ? m_fbase : m_memory.size();
+        if ((count == 0) || (base >= limit) || (count > limit - base))
         {
-            m_watch_read.insert(i);
+            return {};
         }
+
+        written(base, count);
+
+        return { m_memory.data() + base, count };
+    }
+
+    void Hardware::set_finished(bool finished)
+    {
+        m_processor->set_finished(finished);
+    }
+
+    bool Hardware::running() const
+    {
+        return m_processor->running();
     }
 
-    void Hardware::add_watch_write(uint16_t base, uint16_t count)
+    void Hardware::run()
     {
-        for (auto i = base; i < base + count; ++i)
+        if (m_events.empty())
         {
-            m_watch_write.insert(i);
+            m_processor->emulate();
+            return;
+        }
+
+        // Run times are measured from here, in cycles and on the host's clock
+        const auto pace = m_config.clock_khz > 0;
+        auto start_cycles = m_processor->get_cycle_count();
+        auto start_time = std::chrono::steady_clock::now();
+
+        while (running())
+        {
+            switch (next_slice())
+            {
+            case Slice::RUN:
+                m_processor->emulate_for(m_slice_cycles);
+                m_slice_cycles = m_processor->get_cycles_left();
+                break;
+            case Slice::IDLE: break;
+            case Slice::UNBOUNDED: m_processor->emulate(); return;
+            case Slice::HALTED: return;
+            }
+
+            if (pace)
+            {
+                // Wait until the host's clock catches up, unless it is already well ahead (e.g. after waiting for
+                // input), in which case carry on from here rather than rush to catch up
+                const auto elapsed = m_processor->get_cycle_count() - start_cycles;
+                const auto target = start_time + std::chrono::microseconds(elapsed * 1000 / m_config.clock_khz);
+                const auto host_now = std::chrono::steady_clock::now();
+                if (target > host_now)
+                {
+                    std::this_thread::sleep_until(target);
+                }
+                else if (host_now - target > std::chrono::milliseconds(100))
+                {
+                    start_cycles = m_processor->get_cycle_count();
+                    start_time = host_now;
+                }
+            }
         }
     }
 
-    void Hardware::add_symbol(uint16_t a, std::string_view label)
+    void Hardware::step()
     {
-        m_symbols.add("ZCPM", a, label);
+        if (m_events.empty())
+        {
+            m_processor->emulate_instruction();
+            return;
+        }
+
+        switch (next_slice())
+        {
+        case Slice::RUN:
+            m_processor->emulate_step(m_slice_cycles);
+            m_slice_cycles = m_processor->get_cycles_left();
+            break;
+        case Slice::IDLE: break;
+        case Slice::UNBOUNDED:
+        case Slice::HALTED: m_processor->emulate_instruction(); break;
+        }
     }
 
-    uint8_t Hardware::read_byte(uint16_t address) const
+    Hardware::Slice Hardware::next_slice()
     {
-        const auto result = m_memory[address];
-        check_watched_memory_byte(address, Access::READ, result);
-        return result;
+        if (m_slice_cycles > 0)
+        {
+            return Slice::RUN;
+        }
+
+        const uint64_t now = m_processor->get_cycle_count();
+        m_events.run_due(now);
+        if (m_interrupt_pending && m_processor->interrupts_enabled())
+        {
+            m_interrupt_pending = false;
+            m_processor->interrupt(m_interrupt_data);
+        }
+
+        const auto deadline = m_events.next_deadline();
+        if (deadline == EventScheduler::Never)
+        {
+            // Nothing left to wait for
+            return m_processor->is_halted() ? Slice::HALTED : Slice::UNBOUNDED;
+        }
+
+        if (!m_processor->is_halted())
+        {
+            m_slice_cycles = deadline - now;
+            return Slice::RUN;
+        }
+
+        if (m_processor->interrupts_enabled() || m_interrupt_pending)
+        {
+            // Nothing happens until the next event, so go straight to it
+            m_processor->add_idle_cycles(deadline - now);
+            return Slice::IDLE;
+        }
+
+        // Halted for good
+        return Slice::HALTED;
     }
 
-    uint8_t Hardware::read_byte(uint16_t address, size_t& elapsed_cycles) const
+    EventScheduler& Hardware::events()
     {
-        const auto result = read_byte(address);
-        elapsed_cycles += 3;
-        return result;
+        return m_events;
     }
 
-    uint16_t Hardware::read_word(uint16_t address) const
+    void Hardware::request_interrupt(uint8_t data_on_bus)
     {
-        const auto result_low = m_memory[address];
-        const auto result_high = m_memory[(address + 1) & 0xffff];
-        const auto result = result_low | (result_high << 8);
-        check_watched_memory_word(address, Access::READ, result);
-        return result;
+        m_interrupt_pending = true;
+        m_interrupt_data = data_on_bus;
     }
 
-    uint16_t Hardware::read_word(uint16_t address, size_t& elapsed_cycles) const
+    bool Hardware::check_and_handle_bdos_and_bios(uint16_t address) const
     {
-        const auto result = read_word(address);
-        elapsed_cycles += 6;
-        return result;
+        // Note that BDOS calls are logged but (other than the optional native functions) not intercepted.  But
+        // BIOS calls are logged *and* intercepted. This is because our BDOS is implemented via a binary blob (a real
+        // BDOS implementation), which will in turn make calls into our own custom BIOS implementation. So BDOS calls
+        // are checked & logged but not intercepted, but BIOS calls need to be intercepted and translated to (e.g.)
+        // host system calls.
+
+        // Has a BDOS call which is being timed returned to its caller?
+        if (m_pending_bdos && (address == m_pending_bdos->return_address))
+        {
+            finish_bdos_call(true);
+        }
+
+        // Does this appear to be a BDOS call?  i.e., a jump to FBASE from 0005?
+        if (address == m_fbase)
+        {
+            start_bdos_call(m_processor->get_c());
+
+            if (m_config.log_bdos && m_pcall_trace)
+            {
+                trace_call(CallTrace::Kind::BDOS, m_processor->get_c());
+            }
+            else if (m_config.log_bdos && log::is_enabled<log::Level::trace>())
+            {
+                // "Parse" the pending BDOS call into various bits of useful information
+                const auto registers = m_processor->get_registers();
+                const auto [bdos_name, description] = bdos::describe_call(registers, *this);
+
+                // Log the information
+                ZCPM_LOG(trace) << "BDOS: " << bdos_name << format_stack_info();
+                ZCPM_LOG(trace) << "BDOS: " << description;
+            }
+
+            // The most common file functions and console output can be handled without going through the BDOS, in
+            // which case the processor returns to the caller as if the BDOS had
+            std::optional<uint8_t> result;
+            if (m_pnative_bdos)
+            {
+                result = m_pnative_bdos->call(m_processor->get_c(), m_processor->get_de());
+            }
+            if (!result && m_pnative_console)
+            {
+                result = m_pnative_console->call(m_processor->get_c(), m_processor->get_de());
+            }
+            if (result)
+            {
+                m_processor->reg_hl() = *result;
+                m_processor->reg_a() = *result;
+                m_processor->reg_b() = 0;
+                m_processor->return_from_trap();
+                return true;
+            }
+
+            return false; // BIOS was not intercepted
+        }
+
+        if (m_pbios)
+        {
+            return m_pbios->check_and_handle(address);
+        }
+        else
+        {
+            return false;
+        }
     }
 
-    void Hardware::write_byte(uint16_t address, uint8_t x)
+    void Hardware::add_watch_read(uint16_t base, size_t count)
     {
-        check_watched_memory_byte(address, Access::WRITE, x);
-        m_memory[address] = x;
+        m_watch_read.add(base, count);
     }
 
-    void Hardware::write_byte(uint16_t address, uint8_t x, size_t& elapsed_cycles)
+    void Hardware::add_watch_write(uint16_t base, size_t count)
     {
-        write_byte(address, x);
-        elapsed_cycles += 3;
+        m_watch_write.add(base, count);
     }
 
-    void Hardware::write_word(uint16_t address, uint16_t x)
+    void Hardware::remove_watch_read(uint16_t base, size_t count)
     {
-        check_watched_memory_word(address, Access::WRITE, x);
-        m_memory[address] = x;
-        m_memory[(address + 1) & 0xffff] = x >> 8;
+        m_watch_read.remove(base, count);
     }
 
-    void Hardware::write_word(uint16_t address, uint16_t x, size_t& elapsed_cycles)
+    void Hardware::remove_watch_write(uint16_t base, size_t count)
     {
-        write_word(address, x);
-        elapsed_cycles += 6;
+        m_watch_write.remove(base, count);
     }
 
-    uint8_t Hardware::read_byte_step(uint16_t& address, size_t& elapsed_cycles) const
+    bool Hardware::is_watched_read(uint16_t address) const
     {
-        const auto result = read_byte(address);
-        address++;
-        elapsed_cycles += 3;
-        return result;
+        return m_watch_read.contains(address);
     }
 
-    uint16_t Hardware::read_word_step(uint16_t& address, size_t& elapsed_cycles) const
+    bool Hardware::is_watched_write(uint16_t address) const
     {
-        const auto result = read_word(address);
-        address += 2;
-        elapsed_cycles += 6;
-        return result;
+        return m_watch_write.contains(address);
     }
 
-    void Hardware::push(uint16_t x, size_t& elapsed_cycles)
+    void Hardware::set_watch_read_handler(const WatchHandler& h)
     {
-        m_processor->reg_sp() -= 2;
-        write_word(m_processor->reg_sp(), x, elapsed_cycles);
+        m_watch_read_handler = h;
     }
 
-    uint16_t Hardware::pop(size_t& elapsed_cycles)
+    void Hardware::set_watch_write_handler(const WatchHandler& h)
     {
-        const auto result = read_word(m_processor->reg_sp(), elapsed_cycles);
-        m_processor->reg_sp() += 2;
-        return result;
+        m_watch_write_handler = h;
+    }
+
+    void Hardware::add_protected(uint16_t base, size_t count)
+    {
+        m_protected.add(base, count);
+    }
+
+    void Hardware::use_embedded_bdos_symbols()
+    {
+        if (m_config.bdos_sym.empty())
+        {
+            m_symbols.load(embedded_bdos::symbols(), "BDOS");
+        }
+    }
+
+    void Hardware::add_symbol(uint16_t a, std::string_view label)
+    {
+        m_symbols.add("ZCPM", a, label);
     }
 
     uint8_t Hardware::input_byte(int port)
@@ -254,7 +624,7 @@ namespace zcpm
             }
             catch (const std::exception& e)
             {
-                BOOST_LOG_TRIVIAL(trace) << "Exception in user input handler: " << e.what();
+                ZCPM_LOG(trace) << "Exception in user input handler: " << e.what();
                 return 0;
             }
         }
@@ -274,7 +644,7 @@ namespace zcpm
             }
             catch (const std::exception& e)
             {
-                BOOST_LOG_TRIVIAL(trace) << "Exception in user output handler: " << e.what();
+                ZCPM_LOG(trace) << "Exception in user output handler: " << e.what();
             }
         }
     }
@@ -291,6 +661,7 @@ namespace zcpm
 
         // TODO: This is exceedingly ugly, find a cleaner (but efficient!) solution
         std::memcpy(m_memory.data() + base, buffer, count);
+        written(base, count);
     }
 
     void Hardware::copy_from_ram(uint8_t* buffer, size_t count, uint16_t base) const
@@ -307,8 +678,41 @@ namespace zcpm
         std::memcpy(buffer, m_memory.data() + base, count);
     }
 
+    std::span<const uint8_t> Hardware::ram_view(uint16_t base, size_t count) const
+    {
+        if ((base + count > m_memory.size()) ||
+            (m_config.memcheck && m_check_memory_accesses &&
+             (m_watch_read.contains_any(base, count) || m_watchpoints.contains_any(base, count))))
+        {
+            return {};
+        }
+        return { m_memory.data() + base, count };
+    }
+
+    std::span<uint8_t> Hardware::writable_ram_view(uint16_t base, size_t count)
+    {
+        if ((base + count > m_memory.size()) ||
+            (m_config.memcheck && m_check_memory_accesses &&
+             (m_watch_write.contains_any(base, count) || m_protected.contains_any(base, count) ||
+              m_watchpoints.contains_any(base, count))))
+        {
+            return {};
+        }
+
+        // The caller is about to modify this memory
+        written(base, count);
+
+        return { m_memory.data() + base, count };
+    }
+
     void Hardware::dump(uint16_t base, size_t count) const
     {
+        // Don't bother formatting lines which wouldn't be logged anyway
+        if (!log::is_enabled<log::Level::trace>())
+        {
+            return;
+        }
+
         const size_t bytes_per_line = 16;
         size_t bytes_this_line = 0;
         std::string buf_address, buf_hex, buf_ascii;
@@ -330,7 +734,7 @@ namespace zcpm
 
             if (bytes_this_line == bytes_per_line)
             {
-                BOOST_LOG_TRIVIAL(trace) << buf_address << buf_hex << ' ' << buf_ascii;
+                ZCPM_LOG(trace) << buf_address << buf_hex << ' ' << buf_ascii;
                 buf_address.clear();
                 buf_hex.clear();
                 buf_ascii.clear();
@@ -339,7 +743,7 @@ namespace zcpm
         }
         if (!buf_address.empty() && !buf_hex.empty())
         {
-            BOOST_LOG_TRIVIAL(trace) << buf_address << buf_hex << ' ' << buf_ascii;
+            ZCPM_LOG(trace) << buf_address << buf_hex << ' ' << buf_ascii;
         }
     }
 
@@ -347,11 +751,21 @@ namespace zcpm
     {
         if (m_config.memcheck && (m_check_memory_accesses != protect))
         {
-            BOOST_LOG_TRIVIAL(trace) << (protect ? "Enabling" : "Disabling") << " memory access checks";
+            ZCPM_LOG(trace) << (protect ? "Enabling" : "Disabling") << " memory access checks";
             m_check_memory_accesses = protect;
         }
     }
 
+    void Hardware::add_watchpoint(uint16_t address)
+    {
+        m_watchpoints.add(address);
+    }
+
+    void Hardware::remove_watchpoint(uint16_t address)
+    {
+        m_watchpoints.remove(address);
+    }
+
     std::string Hardware::format_stack_info() const
     {
         // Ideally this method would simply iterate via SP back to user memory, but many programs manually set/restore
@@ -399,11 +813,88 @@ namespace zcpm
         return ss.str();
     }
 
+    void Hardware::trace_call(CallTrace::Kind kind, uint8_t function) const
+    {
+        const auto sp = m_processor->get_sp();
+        const auto ret = static_cast<uint16_t>(m_memory[sp] | (m_memory[(sp + 1) & 0xFFFF] << 8));
+        m_pcall_trace->add({ .m_cycles = m_processor->get_cycle_count(),
+                             .m_caller = static_cast<uint16_t>(ret - 3),
+                             .m_bc = m_processor->get_bc(),
+                             .m_de = m_processor->get_de(),
+                             .m_hl = m_processor->get_hl(),
+                             .m_a = m_processor->get_a(),
+                             .m_kind = kind,
+                             .m_function = function });
+    }
+
+    void Hardware::show_call_trace(const std::function<void(const std::string&)>& output) const
+    {
+        if (!m_pcall_trace)
+        {
+            output("No call trace is being kept");
+            return;
+        }
+
+        m_pcall_trace->decode([this](uint16_t address) { return describe_address(address); },
+                              [this](const CallTrace::Record& record)
+                              {
+                                  // Only the name is of use; anything in memory may well have changed since
+                                  Registers registers{};
+                                  registers.BC = record.m_bc;
+                                  registers.DE = record.m_de;
+                                  return std::get<0>(bdos::describe_call(registers, *this));
+                              },
+                              output);
+    }
+
     void Hardware::dump_symbol_table() const
     {
         m_symbols.dump();
     }
 
+    void Hardware::write_profile() const
+    {
+        const auto* p_profiler = m_processor->profiler();
+        if (!p_profiler)
+        {
+            return;
+        }
+
+        if (!m_config.profile.empty())
+        {
+            std::ofstream file(m_config.profile, std::ios::trunc);
+            if (!file)
+            {
+                std::cerr << "Can't write the profile to " << m_config.profile << std::endl;
+            }
+            else
+            {
+                // The BDOS starts with its 6 byte serial number, just before FBASE, and the BIOS with its jump table
+                const Profiler::Regions regions{ .bdos = static_cast<uint16_t>(m_fbase - 6),
+                                                 .bios = static_cast<uint16_t>(m_wboot - 3) };
+                p_profiler->write_report(
+                    file, [this](uint16_t address) { return m_symbols.describe(address); }, regions);
+            }
+        }
+
+        if (!m_config.profile_stacks.empty())
+        {
+            std::ofstream file(m_config.profile_stacks, std::ios::trunc);
+            if (!file)
+            {
+                std::cerr << "Can't write the profile's call stacks to " << m_config.profile_stacks << std::endl;
+            }
+            else
+            {
+                // Flame graph tools need every frame to have a name, so use the address where there is no symbol
+                p_profiler->write_collapsed_stacks(file, [this](uint16_t address) {
+                    const auto name = m_symbols.describe(address);
+                    return (name == "?") ? fmt::format("{:04X}", address) : name;
+                });
+            }
+        }
+    }
+
     std::tuple<bool, uint16_t> Hardware::evaluate_address_expression(std::string_view s) const
     {
         return m_symbols.evaluate_address_expression(s);
@@ -414,68 +905,157 @@ namespace zcpm
         return m_processor.get();
     }
 
-    void Hardware::check_watched_memory_byte(uint16_t address, Access mode, uint8_t value) const
+    Bios::PollStatistics Hardware::get_poll_statistics() const
     {
-        if (!m_config.memcheck || !m_check_memory_accesses)
+        return m_pbios ? m_pbios->get_poll_statistics() : Bios::PollStatistics{};
+    }
+
+    Statistics Hardware::get_statistics() const
+    {
+        Statistics statistics;
+        statistics.bdos = m_bdos_latency;
+        if (m_pbios)
         {
-            return;
+            statistics.bios = m_pbios->get_call_statistics();
+            statistics.polls = m_pbios->get_poll_statistics();
+            statistics.disk = m_pbios->get_disk().get_statistics();
+        }
+        statistics.refreshes = m_pterminal ? m_pterminal->refresh_count() : 0;
+        return statistics;
+    }
+
+    void Hardware::show_statistics(const std::function<void(const std::string&)>& output) const
+    {
+        get_statistics().describe([this](uint8_t function) { return bdos_function_name(function); }, output);
+    }
+
+    void Hardware::write_statistics_json(std::ostream& os) const
+    {
+        get_statistics().write_json(os, [this](uint8_t function) { return bdos_function_name(function); });
+    }
+
+    std::string Hardware::bdos_function_name(uint8_t function) const
+    {
+        // The description starts with "fn#N ", which is dropped
+        Registers registers{};
+        registers.BC = function;
+        const auto name = std::get<0>(bdos::describe_call(registers, *this));
+        const auto space = name.find(' ');
+        return (space == std::string::npos) ? name : name.substr(space + 1);
+    }
+
+    void Hardware::start_bdos_call(uint8_t function) const
+    {
+        // A call which never returned (e.g. because the program jumped elsewhere instead) is counted but not timed
+        if (m_pending_bdos)
+        {
+            finish_bdos_call(false);
         }
 
+        const auto sp = m_processor->get_sp();
+        const auto ret = static_cast<uint16_t>(m_memory[sp] | (m_memory[(sp + 1) & 0xFFFF] << 8));
+        const auto added_trap = !m_processor->has_trap(ret);
+        if (added_trap)
+        {
+            m_processor->add_trap(ret);
+        }
+        m_bdos_latency[function].add_call();
+        m_pending_bdos = PendingBdosCall{ function, ret, added_trap, std::chrono::steady_clock::now() };
+    }
+
+    void Hardware::finish_bdos_call(bool returned) const
+    {
+        if (returned)
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - m_pending_bdos->start;
+            m_bdos_latency[m_pending_bdos->function].add_time(elapsed);
+        }
+        if (m_pending_bdos->added_trap)
+        {
+            m_processor->remove_trap(m_pending_bdos->return_address);
+        }
+        m_pending_bdos.reset();
+    }
+
+    void Hardware::check_watched_memory_byte(uint16_t address, Access mode, uint8_t value) const
+    {
         // FIXME! This can be misleading; when we display PC, that can be the
         // wrong value because we're reading m_pc from the processor which "lags"
         // the actual PC. Can be tricky, and not so easy to fix (I've had a quick try already).
 
-        if ((mode == Access::READ) && (m_watch_read.count(address)))
+        if ((mode == Access::READ) && m_watch_read.contains(address))
         {
-            BOOST_LOG_TRIVIAL(trace) << fmt::format(
+            ZCPM_LOG(trace) << fmt::format(
                 "    {:02X} <- {} at PC={}", value, describe_address(address), describe_address(m_processor->get_pc()));
+            if (m_watch_read_handler)
+            {
+                m_watch_read_handler(address, value);
+            }
         }
-        if ((mode == Access::WRITE) && (m_watch_write.count(address)))
+        if ((mode == Access::WRITE) && m_watch_write.contains(address))
         {
-            BOOST_LOG_TRIVIAL(trace) << fmt::format(
+            ZCPM_LOG(trace) << fmt::format(
                 "    {:02X} -> {} at PC={}", value, describe_address(address), describe_address(m_processor->get_pc()));
             if (is_fatal_write(address))
             {
                 throw std::runtime_error("Aborting: illegal memory write");
             }
+            if (m_watch_write_handler)
+            {
+                m_watch_write_handler(address, value);
+            }
         }
-        if ((mode == Access::WRITE) && m_pbios && (m_pbios->is_bios(address)))
+        if (m_watchpoints.contains(address))
         {
-            BOOST_LOG_TRIVIAL(trace) << "BIOS write to " << describe_address(address)
-                                     << " at PC=" << describe_address(m_processor->get_pc());
+            m_processor->check_watchpoint(address);
+        }
+        if ((mode == Access::WRITE) && m_protected.contains(address))
+        {
+            ZCPM_LOG(trace) << "BIOS write to " << describe_address(address)
+                            << " at PC=" << describe_address(m_processor->get_pc());
             throw std::runtime_error("BIOS tampering!");
         }
     }
 
     void Hardware::check_watched_memory_word(uint16_t address, Access mode, uint16_t value) const
     {
-        if (!m_config.memcheck || !m_check_memory_accesses)
-        {
-            return;
-        }
-
         // FIXME!  This can be misleading; when we display PC, that can be the wrong value because we're reading
         // m_pc from the processor which "lags" the actual PC.  Can be tricky, and not so easy to fix.
 
-        if ((mode == Access::READ) && (m_watch_read.count(address + 0) || m_watch_read.count(address + 1)))
+        if ((mode == Access::READ) && m_watch_read.contains_word(address))
         {
-            BOOST_LOG_TRIVIAL(trace) << fmt::format(
+            ZCPM_LOG(trace) << fmt::format(
                 "  {:04X} <- {} at PC={}", value, describe_address(address), describe_address(m_processor->get_pc()));
+            if (m_watch_read_handler)
+            {
+                m_watch_read_handler(address, value);
+            }
         }
-        if ((mode == Access::WRITE) && (m_watch_write.count(address) || m_watch_write.count(address + 1)))
+        if ((mode == Access::WRITE) && m_watch_write.contains_word(address))
         {
-            BOOST_LOG_TRIVIAL(trace) << fmt::format(
+            ZCPM_LOG(trace) << fmt::format(
                 "  {:04X} -> {} at PC={}", value, describe_address(address), describe_address(m_processor->get_pc()));
             if (is_fatal_write(address))
             {
                 // Detected an attempt to clobber very low addresses.
                 throw std::runtime_error("Aborting: illegal memory write");
             }
+            if (m_watch_write_handler)
+            {
+                m_watch_write_handler(address, value);
+            }
+        }
+        for (const uint16_t a : { address, static_cast<uint16_t>(address + 1) })
+        {
+            if (m_watchpoints.contains(a))
+            {
+                m_processor->check_watchpoint(a);
+            }
         }
-        if ((mode == Access::WRITE) && m_pbios && (m_pbios->is_bios(address + 0) || m_pbios->is_bios(address + 1)))
+        if ((mode == Access::WRITE) && m_protected.contains_word(address))
         {
-            BOOST_LOG_TRIVIAL(trace) << "BIOS write to " << describe_address(address)
-                                     << " at PC=" << describe_address(m_processor->get_pc());
+            ZCPM_LOG(trace) << "BIOS write to " << describe_address(address)
+                            << " at PC=" << describe_address(m_processor->get_pc());
             throw std::runtime_error("BIOS tampering!");
         }
     }
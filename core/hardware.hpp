@@ -1,15 +1,27 @@
 #pragma once
 
+#include "bios.hpp"
+#include "calllatency.hpp"
+#include "calltrace.hpp"
+#include "checkpoints.hpp"
 #include "config.hpp"
+#include "eventscheduler.hpp"
 #include "handlers.hpp"
 #include "imemory.hpp"
 #include "processor.hpp"
+#include "snapshot.hpp"
+#include "statistics.hpp"
 #include "symboltable.hpp"
+#include "uncounted.hpp"
+#include "watchmap.hpp"
 
 #include <array>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
-#include <unordered_set>
+#include <optional>
+#include <ostream>
 
 namespace zcpm
 {
@@ -18,8 +30,9 @@ namespace zcpm
     {
         class Terminal;
     }
-    class Bios;
     class IDebuggable;
+    class NativeBdos;
+    class NativeConsole;
     class Processor;
 
     class Hardware final
@@ -52,17 +65,76 @@ namespace zcpm
 
         void reset();
 
+        // Capture the state of the whole machine, or replace it with one captured earlier (from this machine or
+        // another with the same configuration). Restoring onto a machine whose BIOS hasn't been set up yet also sets
+        // it up, as it was when the snapshot was taken. User symbols are not part of a snapshot.
+        [[nodiscard]] Snapshot save_snapshot() const;
+        void restore_snapshot(const Snapshot& snapshot);
+
+        // Start taking a checkpoint (see Checkpoints) every 'interval' cycles while running, beginning with one now and
+        // keeping up to 'limit' of them, along with a log of console input to replay from them; or stop, discarding
+        // them all. Checkpoints can't be taken before the BIOS is set up.
+        void enable_checkpoints(uint64_t interval, size_t limit);
+        void disable_checkpoints();
+
+        // How many checkpoints there are (zero unless they are enabled)
+        [[nodiscard]] size_t checkpoint_count() const;
+
+        // Go back to the latest checkpoint taken before the specified cycle count, discarding any later ones. Returns
+        // false, changing nothing, if there isn't one.
+        bool restore_checkpoint(uint64_t before_cycles);
+
+        // Keep console output from the terminal, while a replay from a checkpoint repeats what has already been seen
+        void set_replaying(bool replaying);
+
+        // The emulated RAM into which an image of the specified size is about to be loaded, for the loader to write to
+        // directly (unchecked, since the writes are the loader's rather than the program's). Empty if the image doesn't
+        // fit below FBASE, or below the top of memory if FBASE isn't known yet.
+        [[nodiscard]] std::span<uint8_t> load_area(uint16_t base, size_t count);
+
         // Implements IProcessorObserver
 
         void set_finished(bool finished) override;
-        bool running() const override;
         bool check_and_handle_bdos_and_bios(uint16_t address) const override;
 
         //
 
-        // TODO: Add more methods to set/query/remove memory watch points
-        void add_watch_read(uint16_t base, uint16_t count = 1);
-        void add_watch_write(uint16_t base, uint16_t count = 1);
+        // Are we still meant to be running? (i.e., set_finished(true) hasn't been called)
+        bool running() const;
+
+        // Run the processor until it finishes. If any events are queued, it is run in slices up to each event's
+        // deadline (kept in step with the host's clock, if Config::clock_khz says so) and the events are handled in
+        // between; a HALT then waits for the next event rather than ending the run, unless interrupts are disabled.
+        void run();
+
+        // Execute a single instruction, handling events and interrupts just as run() would at that point (so that a
+        // run can be repeated exactly one instruction at a time, as when replaying from a checkpoint). While halted
+        // waiting for an interrupt, this goes on to the next event's deadline instead.
+        void step();
+
+        // Events to be handled as the processor's cycle count reaches their deadlines (see run)
+        EventScheduler& events();
+
+        // Have a maskable interrupt accepted (see Processor::interrupt) as soon as interrupts are enabled, as for a
+        // device which holds the interrupt line active until it is seen to
+        void request_interrupt(uint8_t data_on_bus);
+
+        // Methods to set/query/remove memory watch points. Accesses to watched addresses are logged, and passed to any
+        // handler set below. These only have any effect when memory checks are enabled.
+        void add_watch_read(uint16_t base, size_t count = 1);
+        void add_watch_write(uint16_t base, size_t count = 1);
+        void remove_watch_read(uint16_t base, size_t count = 1);
+        void remove_watch_write(uint16_t base, size_t count = 1);
+        bool is_watched_read(uint16_t address) const;
+        bool is_watched_write(uint16_t address) const;
+        void set_watch_read_handler(const WatchHandler& h);
+        void set_watch_write_handler(const WatchHandler& h);
+
+        // Any write to a protected address is treated as fatal (if memory checks are enabled)
+        void add_protected(uint16_t base, size_t count = 1);
+
+        // Use the BDOS symbols that are built in (see embedded_bdos), unless some were loaded from a file
+        void use_embedded_bdos_symbols();
 
         // Directly add a one-off entry to the symbol table, which can be helpful for analysing run logs
         void add_symbol(uint16_t a, std::string_view label);
@@ -85,8 +157,23 @@ namespace zcpm
         void output_byte(int port, uint8_t x) override;
         void copy_to_ram(const uint8_t* buffer, size_t count, uint16_t base) override;
         void copy_from_ram(uint8_t* buffer, size_t count, uint16_t base) const override;
+        std::span<const uint8_t> ram_view(uint16_t base, size_t count) const override;
+        std::span<uint8_t> writable_ram_view(uint16_t base, size_t count) override;
         void dump(uint16_t base, size_t count) const override;
         void check_memory_accesses(bool protect) override;
+        void add_watchpoint(uint16_t address) override;
+        void remove_watchpoint(uint16_t address) override;
+
+        // The timed memory accessors above, for the processor's fast mode (see Processor::set_fast) which doesn't count
+        // cycles; these are just the untimed accessors
+        uint8_t read_byte(uint16_t address, Uncounted elapsed_cycles) const;
+        uint16_t read_word(uint16_t address, Uncounted elapsed_cycles) const;
+        void write_byte(uint16_t address, uint8_t x, Uncounted elapsed_cycles);
+        void write_word(uint16_t address, uint16_t x, Uncounted elapsed_cycles);
+        uint8_t read_byte_step(uint16_t& address, Uncounted elapsed_cycles) const;
+        uint16_t read_word_step(uint16_t& address, Uncounted elapsed_cycles) const;
+        void push(uint16_t x, Uncounted elapsed_cycles);
+        uint16_t pop(Uncounted elapsed_cycles);
 
         //
 
@@ -95,12 +182,32 @@ namespace zcpm
 
         void dump_symbol_table() const;
 
+        // If a call trace is being kept (see Config::call_trace), add the BDOS or BIOS call which is about to be made
+        void trace_call(CallTrace::Kind kind, uint8_t function) const;
+
+        // Decode the call trace, passing each line of text to the specified function
+        void show_call_trace(const std::function<void(const std::string&)>& output) const;
+
+        // If profiling (see Config::profile and Config::profile_stacks), write the profile so far to the named files
+        void write_profile() const;
+
         // Try to evaluate an expression such as 'foo1' where 'foo1' is a known label or perhaps 'foo2+23'.  Note that
         // all values are hexadecimal.  Returns a (success,value) pair, success=false means an evaluation failure.
         std::tuple<bool, uint16_t> evaluate_address_expression(std::string_view s) const;
 
         IDebuggable* get_idebuggable() const;
 
+        // Counters of console status polls (all zero until the BIOS has been set up)
+        Bios::PollStatistics get_poll_statistics() const;
+
+        // Counts and host time latencies of BDOS and BIOS calls, and counters of disk and terminal activity. These are
+        // always kept, as they cost little compared with the calls themselves.
+        [[nodiscard]] Statistics get_statistics() const;
+
+        // Describe those statistics, passing each line of text to the specified function, or write them as JSON
+        void show_statistics(const std::function<void(const std::string&)>& output) const;
+        void write_statistics_json(std::ostream& os) const;
+
         // This is public, and is an ugly hack. The underlying problem is that the system we're emulated is tightly
         // coupled, so it's hard to avoid the same patterns in emulation.
         std::unique_ptr<Processor> m_processor;
@@ -112,11 +219,69 @@ namespace zcpm
             WRITE
         };
 
+        // Cheap inline tests of whether an access might be of interest, before the out-of-line detailed checks
+        void check_watched_byte(uint16_t address, Access mode, uint8_t value) const
+        {
+            if (m_config.memcheck && m_check_memory_accesses &&
+                (m_watchpoints.contains(address) ||
+                 ((mode == Access::READ) ? m_watch_read.contains(address)
+                                         : (m_watch_write.contains(address) || m_protected.contains(address)))))
+            {
+                check_watched_memory_byte(address, mode, value);
+            }
+        }
+        void check_watched_word(uint16_t address, Access mode, uint16_t value) const
+        {
+            if (m_config.memcheck && m_check_memory_accesses &&
+                (m_watchpoints.contains_word(address) ||
+                 ((mode == Access::READ)
+                      ? m_watch_read.contains_word(address)
+                      : (m_watch_write.contains_word(address) || m_protected.contains_word(address)))))
+            {
+                check_watched_memory_word(address, mode, value);
+            }
+        }
+
+        // Called after any write to emulated memory, to discard any cached decoding of it and mark its pages as dirty
+        void written(uint16_t address)
+        {
+            m_processor->invalidate_code(address);
+            m_dirty_pages[address / Checkpoints::PageSize] = true;
+        }
+        void written(uint16_t address, size_t count);
+
+        // Add a checkpoint of the current state, and collect subsequent disk writes in it
+        void take_checkpoint();
+
+        // Have checkpoints taken every interval from now on
+        void schedule_checkpoints();
+
+        // What run() or step() is to do next
+        enum class Slice
+        {
+            RUN,       // Run the processor for up to m_slice_cycles
+            IDLE,      // Nothing, having gone on to the next event while halted
+            UNBOUNDED, // Run the processor, as there are no events left to wait for
+            HALTED     // Nothing, for good
+        };
+
+        // Carry on with the current slice of a run, or if it is over, handle the events which are due and any interrupt
+        // which can be accepted, and then start the next one
+        Slice next_slice();
+
         void check_watched_memory_byte(uint16_t address, Access mode, uint8_t value) const;
         void check_watched_memory_word(uint16_t address, Access mode, uint16_t value) const;
 
         std::string describe_address(uint16_t a) const;
 
+        // The name of a BDOS function, e.g. "C_WRITE"
+        std::string bdos_function_name(uint8_t function) const;
+
+        // Start timing a BDOS call, which is about to be made, until it returns to its caller; or stop timing it,
+        // either because it has returned or because it is being abandoned
+        void start_bdos_call(uint8_t function) const;
+        void finish_bdos_call(bool returned) const;
+
         // Returns true if an attempted write to the specified address should be fatal for ZCPM
         bool is_fatal_write(uint16_t address) const;
 
@@ -133,24 +298,200 @@ namespace zcpm
 
         std::array<uint8_t, 0x10000> m_memory{};
 
-        bool m_finished{ false };
-
         std::unique_ptr<Bios> m_pbios;
 
+        // Optional handling of BDOS file functions, bypassing the BDOS
+        std::unique_ptr<NativeBdos> m_pnative_bdos;
+
+        // Optional handling of BDOS console output, bypassing the BDOS
+        std::unique_ptr<NativeConsole> m_pnative_console;
+
         bool m_check_memory_accesses{ false }; // Indicates if we have temporarily allowed/disallowed memory checks
 
-        // Addresses that we are watching; for now we just log their access, but longer-term we'll invoke a
-        // user-supplied handler
-        std::unordered_set<uint16_t> m_watch_read;
+        // Addresses that we are watching; we log their access, and invoke the corresponding handler (if any)
+        WatchMap m_watch_read;
+        WatchMap m_watch_write;
+        WatchHandler m_watch_read_handler;
+        WatchHandler m_watch_write_handler;
+
+        // Addresses that may not be written, such as the BIOS jump table and stubs
+        WatchMap m_protected;
 
-        // Addresses that we are watching; for now we just log their access, but longer-term we'll invoke a
-        // user-supplied handler
-        std::unordered_set<uint16_t> m_watch_write;
+        // Addresses of debugger watchpoints, whose accesses are reported to the processor
+        WatchMap m_watchpoints;
 
         uint16_t m_fbase{ 0 };
+        uint16_t m_wboot{ 0 };
 
         // Table of known symbols.
         SymbolTable m_symbols;
+
+        // Optional binary record of recent BDOS and BIOS calls, kept instead of logging them
+        std::unique_ptr<CallTrace> m_pcall_trace;
+
+        // See get_statistics(); a BDOS call which is being timed has a trap at its return address, unless one was
+        // already there
+        struct PendingBdosCall
+        {
+            uint8_t function;
+            uint16_t return_address;
+            bool added_trap;
+            std::chrono::steady_clock::time_point start;
+        };
+        mutable std::array<CallLatency, 256> m_bdos_latency;
+        mutable std::optional<PendingBdosCall> m_pending_bdos;
+
+        EventScheduler m_events;
+
+        // Only present while checkpoints are enabled; the dirty flags are kept regardless, as that costs no more than
+        // checking whether to keep them
+        std::unique_ptr<Checkpoints> m_pcheckpoints;
+        uint64_t m_checkpoint_interval{ 0 };
+        EventScheduler::Id m_checkpoint_event{ 0 };
+        Checkpoints::DirtyPages m_dirty_pages{};
+
+        // An interrupt that has been requested but not yet accepted
+        bool m_interrupt_pending{ false };
+        uint8_t m_interrupt_data{ 0 };
+
+        // How many cycles are left of the current slice of a run (see next_slice), which is kept between runs so that
+        // stopping and starting again (e.g. at a breakpoint) doesn't change when events are handled
+        size_t m_slice_cycles{ 0 };
     };
 
+    // The memory accessors are defined here so that the processor, which uses them directly when it knows that it is
+    // running on a Hardware, can have them inlined into its instruction handlers.
+
+    inline uint8_t Hardware::read_byte(uint16_t address) const
+    {
+        const auto result = m_memory[address];
+        check_watched_byte(address, Access::READ, result);
+        return result;
+    }
+
+    inline uint8_t Hardware::read_byte(uint16_t address, size_t& elapsed_cycles) const
+    {
+        const auto result = read_byte(address);
+        elapsed_cycles += 3;
+        return result;
+    }
+
+    inline uint16_t Hardware::read_word(uint16_t address) const
+    {
+        const auto result_low = m_memory[address];
+        const auto result_high = m_memory[(address + 1) & 0xffff];
+        const auto result = result_low | (result_high << 8);
+        check_watched_word(address, Access::READ, result);
+        return result;
+    }
+
+    inline uint16_t Hardware::read_word(uint16_t address, size_t& elapsed_cycles) const
+    {
+        const auto result = read_word(address);
+        elapsed_cycles += 6;
+        return result;
+    }
+
+    inline void Hardware::write_byte(uint16_t address, uint8_t x)
+    {
+        check_watched_byte(address, Access::WRITE, x);
+        m_memory[address] = x;
+        written(address);
+    }
+
+    inline void Hardware::write_byte(uint16_t address, uint8_t x, size_t& elapsed_cycles)
+    {
+        write_byte(address, x);
+        elapsed_cycles += 3;
+    }
+
+    inline void Hardware::write_word(uint16_t address, uint16_t x)
+    {
+        check_watched_word(address, Access::WRITE, x);
+        m_memory[address] = x;
+        m_memory[(address + 1) & 0xffff] = x >> 8;
+        written(address);
+        written((address + 1) & 0xffff);
+    }
+
+    inline void Hardware::write_word(uint16_t address, uint16_t x, size_t& elapsed_cycles)
+    {
+        write_word(address, x);
+        elapsed_cycles += 6;
+    }
+
+    inline uint8_t Hardware::read_byte_step(uint16_t& address, size_t& elapsed_cycles) const
+    {
+        const auto result = read_byte(address);
+        address++;
+        elapsed_cycles += 3;
+        return result;
+    }
+
+    inline uint16_t Hardware::read_word_step(uint16_t& address, size_t& elapsed_cycles) const
+    {
+        const auto result = read_word(address);
+        address += 2;
+        elapsed_cycles += 6;
+        return result;
+    }
+
+    inline void Hardware::push(uint16_t x, size_t& elapsed_cycles)
+    {
+        m_processor->reg_sp() -= 2;
+        write_word(m_processor->reg_sp(), x, elapsed_cycles);
+    }
+
+    inline uint16_t Hardware::pop(size_t& elapsed_cycles)
+    {
+        const auto result = read_word(m_processor->reg_sp(), elapsed_cycles);
+        m_processor->reg_sp() += 2;
+        return result;
+    }
+
+    inline uint8_t Hardware::read_byte(uint16_t address, Uncounted /*elapsed_cycles*/) const
+    {
+        return read_byte(address);
+    }
+
+    inline uint16_t Hardware::read_word(uint16_t address, Uncounted /*elapsed_cycles*/) const
+    {
+        return read_word(address);
+    }
+
+    inline void Hardware::write_byte(uint16_t address, uint8_t x, Uncounted /*elapsed_cycles*/)
+    {
+        write_byte(address, x);
+    }
+
+    inline void Hardware::write_word(uint16_t address, uint16_t x, Uncounted /*elapsed_cycles*/)
+    {
+        write_word(address, x);
+    }
+
+    inline uint8_t Hardware::read_byte_step(uint16_t& address, Uncounted /*elapsed_cycles*/) const
+    {
+        return read_byte(address++);
+    }
+
+    inline uint16_t Hardware::read_word_step(uint16_t& address, Uncounted /*elapsed_cycles*/) const
+    {
+        const auto result = read_word(address);
+        address += 2;
+        return result;
+    }
+
+    inline void Hardware::push(uint16_t x, Uncounted /*elapsed_cycles*/)
+    {
+        m_processor->reg_sp() -= 2;
+        write_word(m_processor->reg_sp(), x);
+    }
+
+    inline uint16_t Hardware::pop(Uncounted /*elapsed_cycles*/)
+    {
+        const auto result = read_word(m_processor->reg_sp());
+        m_processor->reg_sp() += 2;
+        return result;
+    }
+
 } // namespace zcpm
@@ -1,9 +1,9 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <ostream>
-#include <vector>
 
 namespace zcpm
 {
@@ -19,12 +19,16 @@ namespace zcpm
         // Single getter for all registers in one step
         virtual Registers get_registers() const = 0;
 
-        // Skip any redundant prefix bytes, and get the next 4 bytes that pc+offset is pointing at plus the skipped
-        // bytes. This "skipping" is to handle illegal DD/FD prefix byte combinations, to allow a debugger to have
-        // a sane picture of what has been discarded.
-        virtual std::tuple<uint8_t, uint8_t, uint8_t, uint8_t, std::vector<uint8_t>> get_opcodes_at(
-            uint16_t pc,
-            uint16_t offset) const = 0;
+        // The instruction at the specified address: its first 4 bytes (enough for any instruction) after skipping any
+        // redundant prefix bytes, and how many were skipped. This "skipping" is to handle illegal DD/FD prefix byte
+        // combinations, to allow a debugger to have a sane picture of what has been discarded. Nothing is allocated,
+        // so this is cheap enough to call for every instruction of a long listing.
+        struct Opcodes
+        {
+            std::array<uint8_t, 4> m_bytes;
+            uint16_t m_skipped; // DD/FD bytes, starting at the specified address
+        };
+        virtual Opcodes get_opcodes_at(uint16_t address) const = 0;
 
         // Add a debug action (e.g. a breakpoint)
         virtual void add_action(std::unique_ptr<DebugAction> p_action) = 0;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <span>
 
 namespace zcpm
 {
@@ -37,11 +38,23 @@ namespace zcpm
         virtual void copy_to_ram(const uint8_t* buffer, size_t count, uint16_t base) = 0;
         virtual void copy_from_ram(uint8_t* buffer, size_t count, uint16_t base) const = 0;
 
+        // Direct access to a range of emulated RAM, for bulk transfers to or from it. These return an empty span if
+        // the range can't be accessed directly (because it wraps around the top of memory, or because accesses to any
+        // of it need to be checked), in which case the caller needs to fall back to the methods above. The writable
+        // view is for a caller which is about to modify that memory.
+        [[nodiscard]] virtual std::span<const uint8_t> ram_view(uint16_t base, size_t count) const = 0;
+        [[nodiscard]] virtual std::span<uint8_t> writable_ram_view(uint16_t base, size_t count) = 0;
+
         // Used for inspecting a section of memory
         virtual void dump(uint16_t base, size_t count) const = 0;
 
         // Should we be checking for 'naughty' memory accesses currently?
         virtual void check_memory_accesses(bool protect) = 0;
+
+        // Debugger watchpoints; any access to a watchpoint address (while memory accesses are being checked) is passed
+        // on to Processor::check_watchpoint
+        virtual void add_watchpoint(uint16_t address) = 0;
+        virtual void remove_watchpoint(uint16_t address) = 0;
     };
 
 } // namespace zcpm
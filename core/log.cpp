@@ -0,0 +1,115 @@
+#include "log.hpp"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/log/attributes/constant.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/sync_frontend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/program_options.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+
+namespace
+{
+    // Identifies the ThreadLog (if any) of the thread which logs a message
+    const char* const ThreadLogAttribute = "ThreadLog";
+
+    std::atomic<unsigned> next_thread_log{ 1 };
+
+    using FileSink = boost::log::sinks::synchronous_sink<boost::log::sinks::text_ostream_backend>;
+
+    boost::shared_ptr<FileSink> make_file_sink(const std::string& filename)
+    {
+        auto p_file = boost::make_shared<std::ofstream>(filename, std::ios::trunc);
+        if (!p_file->is_open())
+        {
+            throw std::runtime_error("Can't open log file " + filename);
+        }
+
+        auto p_backend = boost::make_shared<boost::log::sinks::text_ostream_backend>();
+        p_backend->add_stream(p_file);
+        p_backend->auto_flush(true);
+        return boost::make_shared<FileSink>(p_backend);
+    }
+
+} // namespace
+
+namespace zcpm::log
+{
+    void add_process_log(const std::string& filename)
+    {
+        auto p_sink = make_file_sink(filename);
+        p_sink->set_filter(!boost::log::expressions::has_attr<unsigned>(ThreadLogAttribute));
+        boost::log::core::get()->add_sink(p_sink);
+    }
+
+    ThreadLog::ThreadLog(const std::string& filename)
+    {
+        const auto id = next_thread_log++;
+
+        auto p_sink = make_file_sink(filename);
+        p_sink->set_filter(boost::log::expressions::attr<unsigned>(ThreadLogAttribute) == id);
+        boost::log::core::get()->add_sink(p_sink);
+        m_sink = p_sink;
+
+        m_attribute = boost::log::core::get()
+                          ->add_thread_attribute(ThreadLogAttribute, boost::log::attributes::constant<unsigned>(id))
+                          .first;
+    }
+
+    ThreadLog::~ThreadLog()
+    {
+        boost::log::core::get()->remove_thread_attribute(m_attribute);
+        boost::log::core::get()->remove_sink(m_sink);
+    }
+
+    std::istream& operator>>(std::istream& in, Level& level)
+    {
+        std::string token;
+        in >> token;
+
+        boost::to_upper(token);
+
+        if (token == "TRACE")
+        {
+            level = Level::trace;
+        }
+        else if (token == "DEBUG")
+        {
+            level = Level::debug;
+        }
+        else if (token == "INFO")
+        {
+            level = Level::info;
+        }
+        else if (token == "WARNING")
+        {
+            level = Level::warning;
+        }
+        else if (token == "ERROR")
+        {
+            level = Level::error;
+        }
+        else if (token == "FATAL")
+        {
+            level = Level::fatal;
+        }
+        else if (token == "NONE")
+        {
+            level = Level::none;
+        }
+        else
+        {
+            throw boost::program_options::validation_error(
+                boost::program_options::validation_error::invalid_option_value, "Invalid log level");
+        }
+
+        return in;
+    }
+
+} // namespace zcpm::log
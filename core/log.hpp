@@ -0,0 +1,97 @@
+#pragma once
+
+#include <boost/log/attributes/attribute_set.hpp>
+#include <boost/log/sinks/sink.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <atomic>
+#include <iosfwd>
+#include <string>
+
+// The least severe level of logging which is compiled in at all (0=trace .. 5=fatal, 6=none); see LOG_LEVEL in the
+// top level CMakeLists.txt
+#ifndef ZCPM_LOG_LEVEL
+#define ZCPM_LOG_LEVEL 0
+#endif
+
+namespace zcpm::log
+{
+    // As for Boost.Log's trivial severity levels, in increasing order of severity
+    enum class Level
+    {
+        trace,
+        debug,
+        info,
+        warning,
+        error,
+        fatal,
+        none
+    };
+
+    std::istream& operator>>(std::istream& in, Level& level);
+
+    inline constexpr Level CompiledLevel{ static_cast<Level>(ZCPM_LOG_LEVEL) };
+
+    // The least severe level which is actually logged at run time
+    inline std::atomic<Level> runtime_level{ Level::trace };
+
+    inline void set_level(Level level)
+    {
+        runtime_level.store(level, std::memory_order_relaxed);
+    }
+
+    // Send log messages to the specified file, other than those from a thread which has a ThreadLog of its own
+    void add_process_log(const std::string& filename);
+
+    // While one of these exists, log messages from the thread which created it go to the specified file instead of to
+    // the process log. This gives each of several machines run on separate threads a log of its own.
+    class ThreadLog final
+    {
+    public:
+        explicit ThreadLog(const std::string& filename);
+
+        ThreadLog(const ThreadLog&) = delete;
+        ThreadLog& operator=(const ThreadLog&) = delete;
+        ThreadLog(ThreadLog&&) = delete;
+        ThreadLog& operator=(ThreadLog&&) = delete;
+
+        ~ThreadLog();
+
+    private:
+        boost::shared_ptr<boost::log::sinks::sink> m_sink;
+        boost::log::attribute_set::iterator m_attribute;
+    };
+
+    template <Level L> constexpr bool is_compiled()
+    {
+        return L >= CompiledLevel;
+    }
+
+    // Is logging at the specified level wanted? Use this to avoid preparing something which is only needed for logging.
+    template <Level L> bool is_enabled()
+    {
+        if constexpr (is_compiled<L>())
+        {
+            return L >= runtime_level.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+} // namespace zcpm::log
+
+// Use as for BOOST_LOG_TRIVIAL, e.g. ZCPM_LOG(trace) << fmt::format(...). A statement below the compiled level
+// generates no code, and one below the run time level costs a single comparison; either way nothing after the
+// ZCPM_LOG(...) is evaluated.
+#define ZCPM_LOG(level)                                                                                                \
+    if constexpr (!::zcpm::log::is_compiled<::zcpm::log::Level::level>())                                              \
+    {                                                                                                                  \
+    }                                                                                                                  \
+    else if (!::zcpm::log::is_enabled<::zcpm::log::Level::level>())                                                    \
+    {                                                                                                                  \
+    }                                                                                                                  \
+    else                                                                                                               \
+        BOOST_LOG_TRIVIAL(level)
@@ -0,0 +1,217 @@
+#include "nativebdos.hpp"
+
+#include "disk.hpp"
+#include "imemory.hpp"
+#include "log.hpp"
+
+#include <fmt/core.h>
+
+namespace
+{
+    // BDOS functions of interest
+    const uint8_t ReadSequential = 20;
+    const uint8_t WriteSequential = 21;
+    const uint8_t ReadRandom = 33;
+    const uint8_t WriteRandom = 34;
+
+    // Offsets of the FCB fields which are used here (see http://seasip.info/Cpm/fcb.html)
+    const size_t FcbDrive = 0x00;
+    const size_t FcbReadOnly = 0x09; // High bit of the first byte of the file type
+    const size_t FcbExtent = 0x0C;
+    const size_t FcbModule = 0x0E; // S2
+    const size_t FcbRecordCount = 0x0F;
+    const size_t FcbMap = 0x10;
+    const size_t FcbCurrentRecord = 0x20;
+    const size_t FcbRandomRecord = 0x21;
+
+    // Bytes which the BDOS might change; the random record number is only ever read
+    const size_t FcbModifiable = FcbRandomRecord;
+
+    const uint8_t RecordsPerExtent = 0x80;
+
+} // namespace
+
+namespace zcpm
+{
+
+    NativeBdos::NativeBdos(IMemory& memory, Disk& disk, const Variables& variables)
+        : m_memory(memory), m_disk(disk), m_variables(variables)
+    {
+    }
+
+    NativeBdos::~NativeBdos() = default;
+
+    std::optional<uint8_t> NativeBdos::call(uint8_t function, uint16_t de)
+    {
+        switch (function)
+        {
+        case ReadSequential: return read(de, true);
+        case WriteSequential: return write(de, true);
+        case ReadRandom: return read(de, false);
+        case WriteRandom: return write(de, false);
+        default: return std::nullopt;
+        }
+    }
+
+    std::optional<uint8_t> NativeBdos::read(uint16_t address, bool sequential)
+    {
+        FcbBytes fcb{};
+        if (!load(address, fcb) || (!sequential && !position(fcb)))
+        {
+            return std::nullopt;
+        }
+
+        // Reaching the end of the extent means either moving on to the next one, or the end of the file
+        const auto record = fcb[FcbCurrentRecord];
+        if (record >= fcb[FcbRecordCount])
+        {
+            return std::nullopt;
+        }
+
+        const auto location = locate(fcb, record);
+        if (!location)
+        {
+            return std::nullopt;
+        }
+        const auto [track, sector] = *location;
+        const auto dma = this->dma();
+
+        ZCPM_LOG(trace) << fmt::format(
+            "Native read of record {:02X} from TRACK:{:04X},SECTOR:{:04X} into {:04X}", record, track, sector, dma);
+
+        if (const auto ram = m_memory.writable_ram_view(dma, Disk::SectorSize); !ram.empty())
+        {
+            m_disk.read(ram.first<Disk::SectorSize>(), track, sector);
+        }
+        else
+        {
+            Disk::SectorData buffer{};
+            m_disk.read(buffer, track, sector);
+            m_memory.copy_to_ram(buffer.data(), buffer.size(), dma);
+        }
+
+        if (sequential)
+        {
+            fcb[FcbCurrentRecord] = record + 1;
+        }
+        store(address, fcb);
+
+        return 0;
+    }
+
+    std::optional<uint8_t> NativeBdos::write(uint16_t address, bool sequential)
+    {
+        FcbBytes fcb{};
+        // Only drive A exists, and it's write protected if bit 0 of the vector is set
+        if ((m_memory.read_byte(m_variables.wrtprt) & 0x01) || !load(address, fcb) || (fcb[FcbReadOnly] & 0x80) ||
+            (!sequential && !position(fcb)))
+        {
+            return std::nullopt;
+        }
+
+        // Writing the last record of an extent sequentially moves on to the next extent
+        const auto record = fcb[FcbCurrentRecord];
+        if (record >= (sequential ? RecordsPerExtent - 1 : RecordsPerExtent))
+        {
+            return std::nullopt;
+        }
+
+        // A record in a block which hasn't been allocated yet is also left to the BDOS
+        const auto location = locate(fcb, record);
+        if (!location)
+        {
+            return std::nullopt;
+        }
+        const auto [track, sector] = *location;
+        const auto dma = this->dma();
+
+        ZCPM_LOG(trace) << fmt::format(
+            "Native write of record {:02X} to TRACK:{:04X},SECTOR:{:04X} from {:04X}", record, track, sector, dma);
+
+        if (const auto ram = m_memory.ram_view(dma, Disk::SectorSize); !ram.empty())
+        {
+            m_disk.write(ram.first<Disk::SectorSize>(), track, sector);
+        }
+        else
+        {
+            Disk::SectorData buffer{};
+            m_memory.copy_from_ram(buffer.data(), buffer.size(), dma);
+            m_disk.write(buffer, track, sector);
+        }
+
+        if (record >= fcb[FcbRecordCount])
+        {
+            fcb[FcbRecordCount] = record + 1;
+        }
+        fcb[FcbModule] &= 0x7F; // The file has been written to, so closing it needs to update the directory
+        if (sequential)
+        {
+            fcb[FcbCurrentRecord] = record + 1;
+        }
+        store(address, fcb);
+
+        return 0;
+    }
+
+    bool NativeBdos::load(uint16_t address, FcbBytes& fcb) const
+    {
+        if (address > 0x10000 - fcb.size())
+        {
+            return false;
+        }
+        m_memory.copy_from_ram(fcb.data(), fcb.size(), address);
+
+        // Only drive A exists
+        const auto drive = fcb[FcbDrive] ? fcb[FcbDrive] - 1 : m_memory.read_byte(m_variables.active);
+        return drive == 0;
+    }
+
+    void NativeBdos::store(uint16_t address, const FcbBytes& fcb)
+    {
+        m_memory.copy_to_ram(fcb.data(), FcbModifiable, address);
+    }
+
+    uint16_t NativeBdos::dma() const
+    {
+        return m_memory.read_word(m_variables.userdma);
+    }
+
+    bool NativeBdos::position(FcbBytes& fcb)
+    {
+        // This follows the BDOS, which only deals with a random record in the current extent itself (and otherwise
+        // closes that extent and opens the right one)
+        const auto r0 = fcb[FcbRandomRecord];
+        const auto r1 = fcb[FcbRandomRecord + 1];
+        const auto r2 = fcb[FcbRandomRecord + 2];
+        const auto extent = ((r1 << 1) | (r0 >> 7)) & 0x1F;
+        const auto module = (r1 >> 4) & 0x0F;
+        if (r2 || (extent != fcb[FcbExtent]) || (((module - fcb[FcbModule]) & 0x7F) != 0))
+        {
+            return false;
+        }
+
+        fcb[FcbCurrentRecord] = r0 & 0x7F;
+        return true;
+    }
+
+    std::optional<std::tuple<uint16_t, uint16_t>> NativeBdos::locate(const FcbBytes& fcb, uint8_t record) const
+    {
+        const auto& geometry = m_disk.get_geometry();
+
+        // The disk map holds 16 8-bit block numbers, or 8 16-bit block numbers when there are more than 256 blocks;
+        // with an extent mask, it covers several 128-record extents
+        const auto n = (((fcb[FcbExtent] & geometry.exm()) << 7) | record) >> geometry.bsh;
+        const auto block = (geometry.dsm < 0x0100)
+                               ? fcb[FcbMap + n]
+                               : static_cast<uint16_t>(fcb[FcbMap + 2 * n] | (fcb[FcbMap + 2 * n + 1] << 8));
+        if ((block < geometry.directory_blocks()) || (block > geometry.dsm))
+        {
+            return std::nullopt;
+        }
+
+        const auto first = size_t(geometry.off) * geometry.spt;
+        const auto s = first + ((size_t(block) << geometry.bsh) | (record & geometry.blm()));
+        return std::tuple{ static_cast<uint16_t>(s / geometry.spt), static_cast<uint16_t>(s % geometry.spt) };
+    }
+
+} // namespace zcpm
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <tuple>
+
+namespace zcpm
+{
+
+    class Disk;
+    class IMemory;
+
+    // Implements the most frequently used BDOS file functions (sequential and random reads and writes of records that
+    // are already allocated) directly on the disk, rather than by having the BDOS work out which sector is wanted and
+    // then call BIOS SETTRK/SETSEC/SETDMA/READ or WRITE for it. Anything else (including a read or write that needs a
+    // new extent or a new block) is left to the BDOS. The BDOS state that affects these functions is read from the
+    // BDOS' own variables, so that there's no copy of it which could get out of step.
+    class NativeBdos final
+    {
+    public:
+        // Addresses of BDOS variables, as named in its source
+        struct Variables
+        {
+            uint16_t userdma; // The DMA address, as set by BDOS function 26
+            uint16_t active;  // Currently selected drive
+            uint16_t wrtprt;  // Write protect vector, with a bit for each drive
+        };
+
+        NativeBdos(IMemory& memory, Disk& disk, const Variables& variables);
+
+        NativeBdos(const NativeBdos&) = delete;
+        NativeBdos& operator=(const NativeBdos&) = delete;
+        NativeBdos(NativeBdos&&) = delete;
+        NativeBdos& operator=(NativeBdos&&) = delete;
+
+        ~NativeBdos();
+
+        // Called on entry to the BDOS with the function number (C) and parameter (DE). Returns the result (for A and
+        // L) if the call has been dealt with, or std::nullopt if the BDOS itself needs to handle it.
+        std::optional<uint8_t> call(uint8_t function, uint16_t de);
+
+    private:
+        // A copy of an FCB in emulated memory
+        using FcbBytes = std::array<uint8_t, 36>;
+
+        std::optional<uint8_t> read(uint16_t address, bool sequential);
+        std::optional<uint8_t> write(uint16_t address, bool sequential);
+
+        // Copy the FCB at the specified address, returning false if it isn't one that we can deal with
+        bool load(uint16_t address, FcbBytes& fcb) const;
+
+        // Copy back the parts of the FCB which a read or write can change
+        void store(uint16_t address, const FcbBytes& fcb);
+
+        [[nodiscard]] uint16_t dma() const;
+
+        // Set the current record from the random record number, returning false if that needs a different extent
+        static bool position(FcbBytes& fcb);
+
+        // Return the track and sector of a record in the current extent, or std::nullopt if it has no block
+        std::optional<std::tuple<uint16_t, uint16_t>> locate(const FcbBytes& fcb, uint8_t record) const;
+
+        IMemory& m_memory;
+
+        Disk& m_disk;
+
+        const Variables m_variables;
+    };
+
+} // namespace zcpm
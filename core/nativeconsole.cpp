@@ -0,0 +1,125 @@
+#include "nativeconsole.hpp"
+
+#include "bios.hpp"
+#include "imemory.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // BDOS functions of interest
+    const uint8_t ConsoleOutput = 2;
+    const uint8_t PrintString = 9;
+
+    const uint8_t Terminator = '$'; // Of a string for PrintString
+
+    const uint8_t TabSize = 8;
+
+    const size_t ScanSize = 0x100; // How much memory to look through at a time for the terminator
+
+} // namespace
+
+namespace zcpm
+{
+
+    NativeConsole::NativeConsole(IMemory& memory, Bios& bios, const Variables& variables)
+        : m_memory(memory), m_bios(bios), m_variables(variables)
+    {
+    }
+
+    NativeConsole::~NativeConsole() = default;
+
+    std::optional<uint8_t> NativeConsole::call(uint8_t function, uint16_t de)
+    {
+        if ((function != ConsoleOutput) && (function != PrintString))
+        {
+            return std::nullopt;
+        }
+
+        // For each character, the BDOS checks for a keystroke (to pause on a ^S, or reboot on a ^C) unless it already
+        // has one, and echoes to the printer if ^P has been typed. Leave it to do both of those.
+        if ((m_memory.read_byte(m_variables.prtflag) != 0) ||
+            ((m_memory.read_byte(m_variables.charbuf) == 0) && m_bios.peek_console()))
+        {
+            return std::nullopt;
+        }
+
+        const auto suppressed = m_memory.read_byte(m_variables.outflag) != 0;
+        auto column = m_memory.read_byte(m_variables.curpos);
+        m_output.clear();
+
+        if (function == ConsoleOutput)
+        {
+            outcon(de & 0xFF, column, suppressed);
+        }
+        else
+        {
+            // Find the terminator a piece at a time, since watched memory beyond the string doesn't matter. A string
+            // which wraps around the top of memory (or which can't be accessed directly) is left to the BDOS.
+            size_t length = 0;
+            for (;;)
+            {
+                const auto base = de + length;
+                const auto piece = m_memory.ram_view(static_cast<uint16_t>(base), std::min(ScanSize, 0x10000 - base));
+                if (piece.empty())
+                {
+                    return std::nullopt;
+                }
+                const auto end = std::find(piece.begin(), piece.end(), Terminator);
+                length += static_cast<size_t>(end - piece.begin());
+                if (end != piece.end())
+                {
+                    break;
+                }
+            }
+            for (const auto ch : m_memory.ram_view(de, length))
+            {
+                outcon(ch, column, suppressed);
+            }
+        }
+
+        m_memory.write_byte(m_variables.curpos, column);
+        if (!m_output.empty())
+        {
+            m_bios.write_console(m_output);
+        }
+
+        return 0;
+    }
+
+    void NativeConsole::outcon(uint8_t ch, uint8_t& column, bool suppressed)
+    {
+        // A tab is output as spaces up to the next tab stop, and each character then goes via OUTCHAR
+        const auto tab = (ch == '\t');
+        do
+        {
+            const auto out = tab ? static_cast<uint8_t>(' ') : ch;
+            if (!suppressed)
+            {
+                m_output += static_cast<char>(out);
+            }
+
+            // Update the cursor column as OUTCHAR does; a rubout doesn't move it, and of the control characters only a
+            // backspace or a line feed do (other than at the start of a line)
+            if (out >= ' ')
+            {
+                if (out != 0x7F)
+                {
+                    ++column;
+                }
+            }
+            else if (column != 0)
+            {
+                if (out == '\b')
+                {
+                    --column;
+                }
+                else if (out == '\n')
+                {
+                    column = 0;
+                }
+            }
+        } while (tab && (column % TabSize != 0));
+    }
+
+} // namespace zcpm
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace zcpm
+{
+
+    class Bios;
+    class IMemory;
+
+    // Implements the BDOS console output functions (2 and 9) directly, so that a whole string is passed to the
+    // terminal at once, rather than the BDOS making a BIOS CONOUT call for each character. As the BDOS does, this
+    // expands tabs and keeps track of the cursor column (which BDOS line editing relies on), so it needs to know where
+    // the BDOS keeps the variables involved. Anything more involved is left to the BDOS: echoing to the printer (after
+    // a ^P), and a keystroke which is waiting to be read (which might be a ^S or ^C).
+    class NativeConsole final
+    {
+    public:
+        // Addresses of BDOS variables, as named in its source
+        struct Variables
+        {
+            uint16_t outflag; // Non-zero to suppress output
+            uint16_t curpos;  // Cursor column
+            uint16_t prtflag; // Non-zero to echo output to the printer
+            uint16_t charbuf; // A keystroke which has already been read, if non-zero
+        };
+
+        NativeConsole(IMemory& memory, Bios& bios, const Variables& variables);
+
+        NativeConsole(const NativeConsole&) = delete;
+        NativeConsole& operator=(const NativeConsole&) = delete;
+        NativeConsole(NativeConsole&&) = delete;
+        NativeConsole& operator=(NativeConsole&&) = delete;
+
+        ~NativeConsole();
+
+        // Called on entry to the BDOS with the function number (C) and parameter (DE). Returns the result (for A and
+        // L) if the call has been dealt with, or std::nullopt if the BDOS itself needs to handle it.
+        std::optional<uint8_t> call(uint8_t function, uint16_t de);
+
+    private:
+        // As for the BDOS' OUTCON; appends to m_output whatever needs to be shown
+        void outcon(uint8_t ch, uint8_t& column, bool suppressed);
+
+        IMemory& m_memory;
+
+        Bios& m_bios;
+
+        const Variables m_variables;
+
+        std::string m_output; // Reused for each call
+    };
+
+} // namespace zcpm
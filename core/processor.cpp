@@ -1,17 +1,22 @@
 #include "processor.hpp"
 
+#include "hardware.hpp"
 #include "instructions.hpp"
+#include "log.hpp"
 #include "processordata.hpp"
 #include "registers.hpp"
 
-#include <boost/log/trivial.hpp>
 #include <fmt/core.h>
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <iostream>
-#include <set>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
 
 // Uncomment this to allow very chatty logging of calls/returns
 // #define TRACING
@@ -63,6 +68,17 @@ namespace
         zcpm::Processor::S_FLAG_MASK | zcpm::Processor::Y_FLAG_MASK | zcpm::Processor::X_FLAG_MASK;
     const uint8_t HC_FLAG_MASK = zcpm::Processor::H_FLAG_MASK | zcpm::Processor::C_FLAG_MASK;
 
+    // The 8080 has no N, X or Y flags; bit 1 of its flags always reads as 1, and bits 3 and 5 as 0
+    uint8_t flags_8080(uint8_t f)
+    {
+        return (f & ~YX_FLAG_MASK) | zcpm::Processor::N_FLAG_MASK;
+    }
+
+    [[noreturn]] void reject_z80_instruction(uint16_t address, uint8_t opcode)
+    {
+        throw std::runtime_error(fmt::format("Z80 instruction {:02X} at {:04X} in 8080 mode", opcode, address));
+    }
+
     /* Indirect (HL) or prefixed indexed (IX + d) and (IY + d) memory operands are
      * encoded using the 3 bits "110" (0x06).
      */
@@ -100,45 +116,23 @@ namespace
         0,
     };
 
-    // Register definitions. These are used as indexes into an array; the first enum Reg8 indexes into one view of a
-    // union to that array, the second enum Reg16 indexes into another view of that union into that array. For that
-    // reason it's not an 'enum class'.
-
-    // clang-format off
-    enum Reg8
+    // Returns true for the instructions which finish a translation, because they can change the flow of control
+    bool is_branch(uint8_t instruction)
     {
-        C, B, E, D, L, H, F, A,
-        IXL, IXH,
-        IYL, IYH,
-        // No 8-bit access to SP
-    };
-
-    enum Reg16
-    {
-        BC, DE, HL, AF,
-        IX, IY,
-        SP
-    };
-
-    const std::set<uint8_t> DdFdPrefixable = {
-        0x09,
-        0x19,
-        0x21, 0x22, 0x23, 0x24, 0x25, 0x26,             0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e,
-        0x34, 0x35, 0x36,             0x39,
-        0x44, 0x45, 0x46,                               0x4c, 0x4d, 0x4e,
-        0x54, 0x55, 0x56,                               0x5c, 0x5d, 0x5e,
-        0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
-        0x70, 0x71, 0x72, 0x73, 0x74, 0x75,       0x77,                         0x7c, 0x7d, 0x7e,
-        0x84, 0x85, 0x86,                               0x8c, 0x8d, 0x8e,
-        0x94, 0x95, 0x96,                               0x9c, 0x9d, 0x9e,
-        0xa4, 0xa5, 0xa6,                               0xac, 0xad, 0xae,
-        0xb4, 0xb5, 0xb6,                               0xbc, 0xbd, 0xbe,
-        0xcb,
-        0xe1,       0xe3,       0xe5,                   0xe9,
-        0xf9
-    };
-
-    // clang-format on
+        switch (instruction)
+        {
+        case zcpm::JP_NN:
+        case zcpm::JP_CC_NN:
+        case zcpm::JR_E:
+        case zcpm::JR_DD_E:
+        case zcpm::DJNZ_E:
+        case zcpm::CALL_NN:
+        case zcpm::CALL_CC_NN:
+        case zcpm::RET:
+        case zcpm::RET_CC: return true;
+        default: return false;
+        }
+    }
 
 } // namespace
 
@@ -146,78 +140,217 @@ namespace zcpm
 {
 
     Processor::Processor(IMemory& memory, IProcessorObserver& processor_observer)
-        : m_current_register_table(m_register_table), m_memory(memory), m_processor_observer(processor_observer)
+        : m_pregister_indexes(&REGISTER_INDEX_TABLES[0]), m_memory(memory), m_processor_observer(processor_observer)
     {
         ::memset(m_registers.byte, 0, sizeof(m_registers));
         ::memset(m_alternates, 0, sizeof(m_alternates));
 
         reset_state();
 
-        /* Build register decoding tables for both 3-bit encoded 8-bit registers and 2-bit
-         * encoded 16-bit registers. When an opcode is prefixed by 0xdd, HL is replaced by
-         * IX. When 0xfd prefixed, HL is replaced by IY.
-         */
+        // CP/M programs terminate by reaching address 0008, e.g. via a RET or a RST0.  We
+        // manually treat this as a termination condition.
+        m_traps[0x0008] = TRAP_STOP;
+    }
 
-        // 8-bit "R" registers
+    Processor::Processor(Hardware& hardware) : Processor(hardware, hardware)
+    {
+        m_phardware = &hardware;
+    }
 
-        m_register_table[0] = &m_registers.byte[Reg8::B];
-        m_register_table[1] = &m_registers.byte[Reg8::C];
-        m_register_table[2] = &m_registers.byte[Reg8::D];
-        m_register_table[3] = &m_registers.byte[Reg8::E];
-        m_register_table[4] = &m_registers.byte[Reg8::H];
-        m_register_table[5] = &m_registers.byte[Reg8::L];
+    void Processor::set_engine(Engine engine)
+    {
+        switch (engine)
+        {
+        case Engine::INTERPRETER:
+            m_pblock_cache.reset();
+            m_ptranslation_cache.reset();
+            break;
+        case Engine::BLOCK_CACHE:
+            m_pblock_cache = std::make_unique<BlockCache>(m_memory);
+            m_ptranslation_cache.reset();
+            break;
+        case Engine::TRANSLATE:
+            m_pblock_cache = std::make_unique<BlockCache>(m_memory);
+            m_ptranslation_cache = std::make_unique<TranslationCache>();
+            break;
+        }
+        m_pdecoded = nullptr;
+    }
 
-        // Encoding 0x06 is used for indexed memory operands and direct HL or IX/IY register access
+    void Processor::set_lazy_flags(bool lazy)
+    {
+        materialize_flags();
+        m_lazy_flags = lazy;
+    }
 
-        m_register_table[6] = &m_registers.word[Reg16::HL];
-        m_register_table[7] = &m_registers.byte[Reg8::A];
+    void Processor::set_cpu(Cpu cpu)
+    {
+        materialize_flags();
+        m_intel8080 = (cpu == Cpu::I8080);
+        if (m_intel8080)
+        {
+            reg_f() = flags_8080(reg_f());
+        }
+    }
 
-        // "Regular" 16-bit "RR" registers
+    void Processor::set_fast(bool fast)
+    {
+        m_fast = fast;
+    }
 
-        m_register_table[8] = &m_registers.word[Reg16::BC];
-        m_register_table[9] = &m_registers.word[Reg16::DE];
-        m_register_table[10] = &m_registers.word[Reg16::HL];
-        m_register_table[11] = &m_registers.word[Reg16::SP];
+    void Processor::enable_profiler()
+    {
+        if (!m_pprofiler)
+        {
+            m_pprofiler = std::make_unique<Profiler>();
+            m_pprofiler->resync(get_cycle_count());
+            for (auto& trap : m_traps)
+            {
+                trap |= TRAP_PROFILE;
+            }
+        }
+    }
 
-        // 16-bit "SS" registers for PUSH and POP instructions (note that SP is replaced by AF)
+    void Processor::start_recording(size_t capacity)
+    {
+        m_precorder = std::make_unique<TraceRecorder>(capacity);
+        m_recording = true;
+        for (auto& trap : m_traps)
+        {
+            trap |= TRAP_RECORD;
+        }
+    }
 
-        m_register_table[12] = &m_registers.word[Reg16::BC];
-        m_register_table[13] = &m_registers.word[Reg16::DE];
-        m_register_table[14] = &m_registers.word[Reg16::HL];
-        m_register_table[15] = &m_registers.word[Reg16::AF];
+    void Processor::stop_recording()
+    {
+        m_recording = false;
+        for (auto& trap : m_traps)
+        {
+            trap &= ~TRAP_RECORD;
+        }
+    }
 
-        // 0xdd and 0xfd prefixed register decoding tables
+    void Processor::record_instruction(uint16_t next_pc)
+    {
+        auto registers = get_registers();
+        registers.PC = next_pc; // m_pc isn't kept up to date during execution
+        m_precorder->record(m_effective_pc, registers, m_memory);
+    }
 
-        for (int i = 0; i < 16; i++)
+    void Processor::add_trap(uint16_t base, size_t count)
+    {
+        const auto end = std::min<size_t>(base + count, m_traps.size());
+        for (size_t a = base; a < end; ++a)
+        {
+            m_traps[a] |= TRAP_OBSERVER;
+        }
+    }
+
+    void Processor::remove_trap(uint16_t base, size_t count)
+    {
+        const auto end = std::min<size_t>(base + count, m_traps.size());
+        for (size_t a = base; a < end; ++a)
         {
-            m_dd_register_table[i] = m_fd_register_table[i] = m_register_table[i];
+            m_traps[a] &= ~TRAP_OBSERVER;
         }
+    }
+
+    bool Processor::has_trap(uint16_t address) const
+    {
+        return m_traps[address] & TRAP_OBSERVER;
+    }
+
+    bool Processor::has_debug_action(uint16_t address) const
+    {
+        return m_traps[address] & TRAP_DEBUG;
+    }
+
+    void Processor::set_finished(bool finished)
+    {
+        m_finished = finished;
+    }
 
-        m_dd_register_table[4] = &m_registers.byte[Reg8::IXH];
-        m_dd_register_table[5] = &m_registers.byte[Reg8::IXL];
-        m_dd_register_table[6] = &m_registers.word[Reg16::IX];
-        m_dd_register_table[10] = &m_registers.word[Reg16::IX];
-        m_dd_register_table[14] = &m_registers.word[Reg16::IX];
+    void Processor::return_from_trap()
+    {
+        m_return_from_trap = true;
+    }
+
+    bool Processor::running() const
+    {
+        return !m_finished;
+    }
 
-        m_fd_register_table[4] = &m_registers.byte[Reg8::IYH];
-        m_fd_register_table[5] = &m_registers.byte[Reg8::IYL];
-        m_fd_register_table[6] = &m_registers.word[Reg16::IY];
-        m_fd_register_table[10] = &m_registers.word[Reg16::IY];
-        m_fd_register_table[14] = &m_registers.word[Reg16::IY];
+    size_t Processor::get_cycle_count() const
+    {
+        return m_cycle_count + m_trap_cycles;
+    }
+
+    bool Processor::is_counting_cycles() const
+    {
+        return m_counting_cycles;
     }
 
     void Processor::reset_state()
     {
-        reg_af() = 0xffff;
+        reg_af() = m_intel8080 ? (0xff00 | flags_8080(0xff)) : 0xffff;
         reg_sp() = 0xffff;
         m_i = m_pc = m_iff1 = m_iff2 = m_effective_pc = 0;
         m_im = InterruptMode::IM0;
+        m_halted = false;
+    }
+
+    Processor::State Processor::get_state() const
+    {
+        State state{};
+        std::copy(std::begin(m_registers.word), std::end(m_registers.word), state.registers.begin());
+        state.registers[Reg16::AF] = get_af(); // Allowing for any pending flags
+        std::copy(std::begin(m_alternates), std::end(m_alternates), state.alternates.begin());
+        state.i = m_i;
+        state.r = m_r;
+        state.pc = m_pc;
+        state.iff1 = m_iff1;
+        state.iff2 = m_iff2;
+        state.im = static_cast<uint8_t>(m_im);
+        state.halted = m_halted;
+        state.cycle_count = get_cycle_count();
+        return state;
+    }
+
+    void Processor::set_state(const State& state)
+    {
+        std::copy(state.registers.begin(), state.registers.end(), std::begin(m_registers.word));
+        std::copy(state.alternates.begin(), state.alternates.end(), std::begin(m_alternates));
+        m_pending_flags.op = FlagsOp::NONE;
+        m_i = state.i;
+        m_r = state.r;
+        m_pc = m_effective_pc = state.pc;
+        m_iff1 = state.iff1;
+        m_iff2 = state.iff2;
+        m_im = static_cast<InterruptMode>(state.im);
+        m_cycle_count = state.cycle_count;
+        m_trap_cycles = 0;
+        m_halted = state.halted;
+        m_pdecoded = nullptr;
+        if (m_pprofiler)
+        {
+            m_pprofiler->resync(m_cycle_count);
+        }
+    }
+
+    void Processor::add_idle_cycles(size_t cycles)
+    {
+        m_cycle_count += cycles;
+        if (m_pprofiler)
+        {
+            m_pprofiler->resync(m_cycle_count);
+        }
     }
 
     size_t Processor::interrupt(uint8_t data_on_bus)
     {
         if (m_iff1)
         {
+            m_halted = false;
             m_iff1 = m_iff2 = 0;
             m_r = (m_r & 0x80) | ((m_r + 1) & 0x7f);
 
@@ -234,21 +367,21 @@ namespace zcpm
 
             case InterruptMode::IM1:
             {
-                size_t elapsed_cycles = 0;
                 reg_sp() -= 2;
                 m_memory.write_word(reg_sp(), m_pc);
-                m_pc = 0x0038;
-                return elapsed_cycles + 13;
+                m_pc = m_effective_pc = 0x0038;
+                m_cycle_count += 13;
+                return 13;
             }
 
             case InterruptMode::IM2:
             {
-                size_t elapsed_cycles = 0;
                 reg_sp() -= 2;
                 m_memory.write_word(reg_sp(), m_pc);
                 const uint16_t vector = m_i << 8 | data_on_bus;
-                m_pc = m_memory.read_word(vector);
-                return elapsed_cycles + 19;
+                m_pc = m_effective_pc = m_memory.read_word(vector);
+                m_cycle_count += 19;
+                return 19;
             }
             }
         }
@@ -256,18 +389,24 @@ namespace zcpm
         return 0;
     }
 
+    bool Processor::interrupts_enabled() const
+    {
+        return m_iff1 != 0;
+    }
+
     size_t Processor::non_maskable_interrupt()
     {
+        m_halted = false;
         m_iff2 = m_iff1;
         m_iff1 = 0;
         m_r = (m_r & 0x80) | ((m_r + 1) & 0x7f);
 
-        size_t elapsed_cycles = 0;
         reg_sp() -= 2;
         m_memory.write_word(reg_sp(), m_pc);
-        m_pc = 0x0066;
+        m_pc = m_effective_pc = 0x0066;
+        m_cycle_count += 11;
 
-        return elapsed_cycles + 11;
+        return 11;
     }
 
     size_t Processor::emulate()
@@ -278,6 +417,19 @@ namespace zcpm
         return emulate(opcode, true, 0, 0);
     }
 
+    size_t Processor::emulate_for(size_t max_cycles)
+    {
+        m_effective_pc = m_pc;
+        uint8_t opcode = m_memory.read_byte(m_pc++);
+
+        return emulate(opcode, false, 0, max_cycles);
+    }
+
+    bool Processor::is_halted() const
+    {
+        return m_halted;
+    }
+
     size_t Processor::emulate_instruction()
     {
         m_effective_pc = m_pc;
@@ -286,6 +438,23 @@ namespace zcpm
         return emulate(opcode, false, 0, 0);
     }
 
+    size_t Processor::emulate_step(size_t max_cycles)
+    {
+        m_effective_pc = m_pc;
+        uint8_t opcode = m_memory.read_byte(m_pc++);
+
+        m_stepping = true;
+        const auto elapsed_cycles = emulate(opcode, false, 0, max_cycles);
+        m_stepping = false;
+
+        return elapsed_cycles;
+    }
+
+    size_t Processor::get_cycles_left() const
+    {
+        return m_cycles_left;
+    }
+
     uint8_t Processor::get_a() const
     {
         return m_registers.byte[Reg8::A];
@@ -293,7 +462,7 @@ namespace zcpm
 
     uint8_t Processor::get_f() const
     {
-        return m_registers.byte[Reg8::F];
+        return compute_flags();
     }
 
     uint8_t Processor::get_b() const
@@ -328,7 +497,7 @@ namespace zcpm
 
     uint16_t Processor::get_af() const
     {
-        return m_registers.word[Reg16::AF];
+        return (m_registers.byte[Reg8::A] << 8) | compute_flags();
     }
 
     uint16_t Processor::get_bc() const
@@ -363,6 +532,7 @@ namespace zcpm
 
     uint8_t& Processor::reg_f()
     {
+        materialize_flags();
         return m_registers.byte[Reg8::F];
     }
 
@@ -398,6 +568,7 @@ namespace zcpm
 
     uint16_t& Processor::reg_af()
     {
+        materialize_flags();
         return m_registers.word[Reg16::AF];
     }
 
@@ -447,17 +618,14 @@ namespace zcpm
         return r;
     }
 
-    std::tuple<uint8_t, uint8_t, uint8_t, uint8_t, std::vector<uint8_t>> Processor::get_opcodes_at(
-        uint16_t pc,
-        uint16_t offset) const
+    IDebuggable::Opcodes Processor::get_opcodes_at(uint16_t address) const
     {
         // Find the first non-prefix byte from the requested position (ie, byte other than DD/FD)
-        std::vector<uint8_t> skipped;
         uint16_t skip_count = 0;
         uint8_t non_prefix_byte = 0;
-        while (pc + offset + skip_count <= 0xFFFF)
+        while (address + skip_count <= 0xFFFF)
         {
-            const auto b = m_memory.read_byte(pc + offset + skip_count);
+            const auto b = m_memory.read_byte(address + skip_count);
             if ((b == 0xDD) || (b == 0xFD))
             {
                 ++skip_count;
@@ -469,37 +637,38 @@ namespace zcpm
             }
         }
 
-        // Was there any DD/FD bytes at the start of the sequence?
-        if (skip_count)
+        // If there were DD/FD bytes at the start of the sequence but they precede an opcode that doesn't "need" a
+        // prefix, the sequence is invalid and the caller is told to skip it; otherwise nothing is to be ignored
+        if (skip_count && DD_FD_PREFIXABLE_TABLE[non_prefix_byte])
         {
-            // This means that pc+offset points at one or more DD/FD bytes
-            if (DdFdPrefixable.contains(non_prefix_byte))
-            {
-                // The use of DD/FD is valid, nothing to be ignored
-                skip_count = 0;
-            }
-            else
-            {
-                // The DD/FD sequence is invalid (they precede an opcode that doesn't "need" a prefix).
-                // Let the caller know about this DD/FD sequence.
-                for (auto i = 0; i < skip_count; i++)
-                {
-                    skipped.push_back(m_memory.read_byte(pc + offset + i));
-                }
-            }
+            skip_count = 0;
         }
 
-        const auto op1 = m_memory.read_byte(pc + offset + skip_count + 0);
-        const auto op2 = m_memory.read_byte(pc + offset + skip_count + 1);
-        const auto op3 = m_memory.read_byte(pc + offset + skip_count + 2);
-        const auto op4 = m_memory.read_byte(pc + offset + skip_count + 3);
-        return { op1, op2, op3, op4, skipped };
+        Opcodes result{ {}, skip_count };
+        for (size_t i = 0; i < result.m_bytes.size(); ++i)
+        {
+            result.m_bytes[i] = m_memory.read_byte(address + skip_count + i);
+        }
+        return result;
     }
 
     void Processor::add_action(std::unique_ptr<DebugAction> p_action)
     {
         const auto a = p_action->get_address();
-        m_debug_actions.insert({ a, std::move(p_action) });
+        if (p_action->watches_memory())
+        {
+            m_memory.add_watchpoint(a);
+        }
+        else
+        {
+            m_traps[a] |= TRAP_DEBUG;
+        }
+
+        const auto it = std::upper_bound(m_debug_actions.begin(),
+                                         m_debug_actions.end(),
+                                         a,
+                                         [](uint16_t address, const auto& p) { return address < p->get_address(); });
+        m_debug_actions.insert(it, std::move(p_action));
     }
 
     void Processor::show_actions(std::ostream& os) const
@@ -508,7 +677,7 @@ namespace zcpm
         int count = 0;
         for (const auto& a : m_debug_actions)
         {
-            os << ++count << ": " << *(a.second) << std::endl;
+            os << ++count << ": " << *a << std::endl;
         }
     }
 
@@ -519,65 +688,812 @@ namespace zcpm
             return false;
         }
 
-        auto it = m_debug_actions.begin();
-        for (size_t i = 1; i < index; i++)
+        const auto it = m_debug_actions.begin() + static_cast<ptrdiff_t>(index - 1);
+        const auto a = (*it)->get_address();
+        const auto memory = (*it)->watches_memory();
+        m_debug_actions.erase(it);
+
+        // Stop monitoring the address if that was the last action of its kind there
+        const auto same_kind = [a, memory](const auto& p) {
+            return (p->get_address() == a) && (p->watches_memory() == memory);
+        };
+        if (std::none_of(m_debug_actions.begin(), m_debug_actions.end(), same_kind))
+        {
+            if (memory)
+            {
+                m_memory.remove_watchpoint(a);
+            }
+            else
+            {
+                m_traps[a] &= ~TRAP_DEBUG;
+            }
+        }
+
+        return true;
+    }
+
+    void Processor::check_watchpoint(uint16_t address)
+    {
+        if (!evaluate_actions(address, true))
         {
-            ++it;
+            m_processor_observer.set_finished(true);
         }
-        m_debug_actions.erase(it);
+    }
+
+    bool Processor::evaluate_actions(uint16_t address, bool memory_watches) const
+    {
+        const auto start = std::lower_bound(m_debug_actions.begin(),
+                                            m_debug_actions.end(),
+                                            address,
+                                            [](const auto& p, uint16_t a) { return p->get_address() < a; });
 
+        for (auto it = start; (it != m_debug_actions.end()) && ((*it)->get_address() == address); ++it)
+        {
+            if (((*it)->watches_memory() == memory_watches) && !(*it)->evaluate(address))
+            {
+                return false;
+            }
+        }
         return true;
     }
 
+    template <bool Prefixes>
     bool Processor::is_default_table() const
     {
-        return m_current_register_table == m_register_table;
+        return !Prefixes || (m_pregister_indexes == &REGISTER_INDEX_TABLES[0]);
     }
 
     void Processor::set_default_table()
     {
-        m_current_register_table = m_register_table;
+        m_pregister_indexes = &REGISTER_INDEX_TABLES[0];
     }
 
     void Processor::set_dd()
     {
-        m_current_register_table = m_dd_register_table;
+        m_pregister_indexes = &REGISTER_INDEX_TABLES[1];
     }
 
     void Processor::set_fd()
     {
-        m_current_register_table = m_fd_register_table;
+        m_pregister_indexes = &REGISTER_INDEX_TABLES[2];
+    }
+
+    void Processor::select_table(RegisterTable table)
+    {
+        switch (table)
+        {
+        case RegisterTable::DEFAULT: set_default_table(); break;
+        case RegisterTable::DD: set_dd(); break;
+        case RegisterTable::FD: set_fd(); break;
+        }
     }
 
-    uint8_t& Processor::R(int r) const
+    size_t Processor::move_block(Hardware& hardware, bool increment, uint8_t& last)
     {
-        return *(static_cast<uint8_t*>(m_current_register_table[r]));
+        const size_t count = reg_bc() ? reg_bc() : 0x10000;
+        const size_t hl = reg_hl();
+        const size_t de = reg_de();
+
+        // Give up if either range wraps around memory, otherwise work out the lowest address of each
+        if (increment ? ((hl + count > 0x10000) || (de + count > 0x10000)) : ((hl + 1 < count) || (de + 1 < count)))
+        {
+            return 0;
+        }
+        const auto source = static_cast<uint16_t>(increment ? hl : hl + 1 - count);
+        const auto destination = static_cast<uint16_t>(increment ? de : de + 1 - count);
+
+        // Copying a byte at a time only differs from memmove() when the destination is ahead of the source (in the
+        // direction of travel) by less than the count, so that it overwrites source bytes before they are read. LDIR
+        // with DE=HL+n is commonly used to fill memory with an n byte pattern, so that is handled here too.
+        const size_t offset = static_cast<uint16_t>(increment ? de - hl : hl - de);
+        const auto replicates = (offset > 0) && (offset < count);
+        if (replicates && !increment)
+        {
+            return 0;
+        }
+
+        const auto source_view = hardware.ram_view(source, count);
+        const auto destination_view =
+            source_view.empty() ? std::span<uint8_t>() : hardware.writable_ram_view(destination, count);
+        if (destination_view.empty())
+        {
+            return 0;
+        }
+        const auto p_source = source_view.data();
+        const auto p_destination = destination_view.data();
+
+        if (!replicates)
+        {
+            std::memmove(p_destination, p_source, count);
+        }
+        else if (offset == 1)
+        {
+            std::memset(p_destination, *p_source, count);
+        }
+        else
+        {
+            // The destination ends up as repeated copies of the bytes between the source and the destination
+            for (size_t i = 0; i < count; i += offset)
+            {
+                std::memcpy(p_destination + i, p_source, std::min(offset, count - i));
+            }
+        }
+
+        last = increment ? p_destination[count - 1] : p_destination[0];
+        return count;
     }
 
-    uint8_t& Processor::S(int s) const
+    size_t Processor::compare_block(const Hardware& hardware, bool increment, uint8_t& last)
     {
-        return *(static_cast<uint8_t*>(m_register_table[s]));
+        const size_t count = reg_bc() ? reg_bc() : 0x10000;
+        const size_t hl = reg_hl();
+
+        if (increment ? (hl + count > 0x10000) : (hl + 1 < count))
+        {
+            return 0;
+        }
+        const auto view = hardware.ram_view(static_cast<uint16_t>(increment ? hl : hl + 1 - count), count);
+        if (view.empty())
+        {
+            return 0;
+        }
+        const auto p = view.data();
+
+        // Search for A, finishing at the end of the range if it isn't found
+        size_t iterations = count;
+        if (increment)
+        {
+            const auto p_found = static_cast<const uint8_t*>(std::memchr(p, reg_a(), count));
+            if (p_found)
+            {
+                iterations = p_found - p + 1;
+            }
+            last = p[iterations - 1];
+        }
+        else
+        {
+            const auto top = std::make_reverse_iterator(p + count);
+            const auto it = std::find(top, std::make_reverse_iterator(p), reg_a());
+            if (it != std::make_reverse_iterator(p))
+            {
+                iterations = std::distance(top, it) + 1;
+            }
+            last = p[count - iterations];
+        }
+        return iterations;
+    }
+
+    inline Processor::TrapOutcome Processor::check_traps(size_t elapsed_cycles)
+    {
+        const auto trap = m_traps[m_effective_pc];
+        if (!trap && !m_finished)
+        {
+            return TrapOutcome::CONTINUE;
+        }
+
+        if ((trap & TRAP_STOP) || m_finished)
+        {
+            ZCPM_LOG(trace) << fmt::format("Stopping execution at PC={:04X}", m_effective_pc);
+            m_processor_observer.set_finished(true);
+            return TrapOutcome::STOP;
+        }
+
+        // Have we hit a BDOS or BIOS address that needs to be intercepted?
+        if (trap & TRAP_OBSERVER)
+        {
+            m_trap_cycles = elapsed_cycles;
+            if (m_pprofiler)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                m_processor_observer.check_and_handle_bdos_and_bios(m_effective_pc);
+                m_pprofiler->add_trap_time(m_effective_pc, std::chrono::steady_clock::now() - start);
+            }
+            else
+            {
+                m_processor_observer.check_and_handle_bdos_and_bios(m_effective_pc);
+            }
+            if (m_return_from_trap)
+            {
+                m_return_from_trap = false;
+                return TrapOutcome::RETURN;
+            }
+        }
+
+        return TrapOutcome::CONTINUE;
+    }
+
+    template <typename Memory>
+    Memory& Processor::memory_as() const
+    {
+        if constexpr (std::is_same_v<Memory, Hardware>)
+        {
+            return *m_phardware;
+        }
+        else
+        {
+            return m_memory;
+        }
+    }
+
+    template <typename Memory, bool Cached>
+    uint8_t Processor::fetch_byte(uint16_t pc) const
+    {
+        if (Cached && m_pdecoded)
+        {
+            const uint16_t offset = pc - m_pdecoded->address;
+            if (offset < m_pdecoded->length)
+            {
+                return m_pdecoded->bytes[offset];
+            }
+        }
+        return memory_as<Memory>().read_byte(pc);
+    }
+
+    template <typename Memory, bool Cached>
+    uint16_t Processor::fetch_word(uint16_t pc) const
+    {
+        if (Cached && m_pdecoded)
+        {
+            const uint16_t offset = pc - m_pdecoded->address;
+            if (offset + 1 < m_pdecoded->length)
+            {
+                return m_pdecoded->bytes[offset] | (m_pdecoded->bytes[offset + 1] << 8);
+            }
+        }
+        return memory_as<Memory>().read_word(pc);
+    }
+
+    template <typename Memory, bool Cached, typename Cycles>
+    uint8_t Processor::fetch_byte_step(uint16_t& pc, Cycles& elapsed_cycles) const
+    {
+        if (Cached && m_pdecoded)
+        {
+            const auto result = fetch_byte<Memory, Cached>(pc);
+            pc++;
+            elapsed_cycles += 3;
+            return result;
+        }
+        return memory_as<Memory>().read_byte_step(pc, elapsed_cycles);
+    }
+
+    template <typename Memory, bool Cached, typename Cycles>
+    uint16_t Processor::fetch_word_step(uint16_t& pc, Cycles& elapsed_cycles) const
+    {
+        if (Cached && m_pdecoded)
+        {
+            const auto result = fetch_word<Memory, Cached>(pc);
+            pc += 2;
+            elapsed_cycles += 6;
+            return result;
+        }
+        return memory_as<Memory>().read_word_step(pc, elapsed_cycles);
+    }
+
+    template <typename Memory>
+    bool Processor::run_translations(uint16_t& pc, size_t& elapsed_cycles, uint8_t& r)
+    {
+        auto& cache = *m_ptranslation_cache;
+        bool executed = false;
+
+        // Keep following the flow of control from one translation to the next, for as long as there is one
+        for (;;)
+        {
+            auto p_translation = cache.find(pc);
+            if (!p_translation && (!cache.is_hot(pc) || !(p_translation = translate<Memory>(pc))))
+            {
+                return executed;
+            }
+
+            const auto generation = cache.generation();
+            for (const auto& op : p_translation->ops)
+            {
+                // Anything which needs special handling (stopping, BDOS/BIOS, debug actions) is left to the
+                // interpreter, which makes exactly the same checks as it would if it had executed the code itself
+                if (m_traps[op.address] || m_finished)
+                {
+                    return executed;
+                }
+
+                m_effective_pc = op.address;
+                pc = op.next;
+                elapsed_cycles += op.cycles;
+                r++;
+                op.handler(*this, op, pc, elapsed_cycles);
+                executed = true;
+
+                // If that modified any translated code, then this translation might have been discarded
+                if (cache.generation() != generation)
+                {
+                    return executed;
+                }
+            }
+        }
+    }
+
+    template <typename Memory>
+    const Translation* Processor::translate(uint16_t address)
+    {
+        auto p_translation = std::make_unique<Translation>();
+        p_translation->start = address;
+
+        // Translation makes use of the block cache's decoding, and stops at the same places that its blocks do
+        size_t next = address;
+        while ((p_translation->ops.size() < TranslationCache::MaxInstructions) && (next <= 0xFFFF))
+        {
+            const auto p_decoded = m_pblock_cache->find(next);
+            TranslatedOp op{};
+            if (!p_decoded || !bind_instruction<Memory>(*p_decoded, op))
+            {
+                break;
+            }
+            p_translation->ops.push_back(op);
+            next += p_decoded->length;
+            if (is_branch(p_decoded->instruction))
+            {
+                break;
+            }
+        }
+        p_translation->end = next;
+
+        return p_translation->ops.empty() ? nullptr : m_ptranslation_cache->add(std::move(p_translation));
+    }
+
+    template <typename Memory>
+    bool Processor::bind_instruction(const DecodedInstruction& decoded, TranslatedOp& result)
+    {
+        // Only unprefixed instructions are translated, so register operands always come from the default table
+        if (decoded.prefixes)
+        {
+            return false;
+        }
+
+        // An 8080 leaves Z80-only instructions, and those whose flags differ, to the interpreter
+        if (m_intel8080 && (Z80_ONLY_TABLE[decoded.opcode] || (decoded.instruction == ADD_HL_RR) ||
+                            ((decoded.instruction == POP_SS) && (P(decoded.opcode) == 3))))
+        {
+            return false;
+        }
+        set_default_table();
+
+        const auto opcode = decoded.opcode;
+        const uint8_t n = decoded.bytes[1];
+        const uint16_t nn = decoded.bytes[1] | (decoded.bytes[2] << 8);
+
+        result.address = decoded.address;
+        result.next = decoded.address + decoded.length;
+        result.cycles = 4;
+
+        // Cycles for fetching immediate operands are included in the fixed cycles, but memory accesses made by the
+        // handlers count their own cycles, exactly as they do in execute()
+        switch (decoded.instruction)
+        {
+        case NOP: result.handler = [](Processor&, const TranslatedOp&, uint16_t&, size_t&) {}; break;
+
+        case LD_R_R:
+            result.p_r1 = &R(Y(opcode));
+            result.p_r2 = &R(Z(opcode));
+            result.handler = [](Processor&, const TranslatedOp& op, uint16_t&, size_t&) { *op.p_r1 = *op.p_r2; };
+            break;
+
+        case LD_R_N:
+            result.p_r1 = &R(Y(opcode));
+            result.operand = n;
+            result.cycles += 3;
+            result.handler = [](Processor&, const TranslatedOp& op, uint16_t&, size_t&) { *op.p_r1 = op.operand; };
+            break;
+
+        case LD_R_INDIRECT_HL:
+            result.p_r1 = &R(Y(opcode));
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                *op.p_r1 = p.memory_as<Memory>().read_byte(p.reg_hl(), elapsed_cycles);
+            };
+            break;
+
+        case LD_INDIRECT_HL_R:
+            result.p_r2 = &R(Z(opcode));
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.memory_as<Memory>().write_byte(p.reg_hl(), *op.p_r2, elapsed_cycles);
+            };
+            break;
+
+        case LD_INDIRECT_HL_N:
+            result.operand = n;
+            result.cycles += 3;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.memory_as<Memory>().write_byte(p.reg_hl(), op.operand, elapsed_cycles);
+            };
+            break;
+
+        case LD_A_INDIRECT_BC:
+        case LD_A_INDIRECT_DE:
+            result.p_rr = (decoded.instruction == LD_A_INDIRECT_BC) ? &reg_bc() : &reg_de();
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.reg_a() = p.memory_as<Memory>().read_byte(*op.p_rr, elapsed_cycles);
+            };
+            break;
+
+        case LD_A_INDIRECT_NN:
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.reg_a() = p.memory_as<Memory>().read_byte(op.operand, elapsed_cycles);
+            };
+            break;
+
+        case LD_INDIRECT_BC_A:
+        case LD_INDIRECT_DE_A:
+            result.p_rr = (decoded.instruction == LD_INDIRECT_BC_A) ? &reg_bc() : &reg_de();
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.memory_as<Memory>().write_byte(*op.p_rr, p.reg_a(), elapsed_cycles);
+            };
+            break;
+
+        case LD_INDIRECT_NN_A:
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.memory_as<Memory>().write_byte(op.operand, p.reg_a(), elapsed_cycles);
+            };
+            break;
+
+        case LD_RR_NN:
+            result.p_rr = &RR(P(opcode));
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor&, const TranslatedOp& op, uint16_t&, size_t&) { *op.p_rr = op.operand; };
+            break;
+
+        case LD_HL_INDIRECT_NN:
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.reg_hl() = p.memory_as<Memory>().read_word(op.operand, elapsed_cycles);
+            };
+            break;
+
+        case LD_INDIRECT_NN_HL:
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                p.memory_as<Memory>().write_word(op.operand, p.reg_hl(), elapsed_cycles);
+            };
+            break;
+
+        case LD_SP_HL:
+            result.cycles += 2;
+            result.handler = [](Processor& p, const TranslatedOp&, uint16_t&, size_t&) { p.reg_sp() = p.reg_hl(); };
+            break;
+
+        case PUSH_SS:
+            result.cycles += 1;
+            if (P(opcode) == 3)
+            {
+                // AF is accessed via reg_af() when each instruction executes, so that any pending flags are computed
+                result.handler = [](Processor& p, const TranslatedOp&, uint16_t&, size_t& elapsed_cycles) {
+                    p.memory_as<Memory>().push(p.reg_af(), elapsed_cycles);
+                };
+            }
+            else
+            {
+                result.p_rr = &SS(P(opcode));
+                result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                    p.memory_as<Memory>().push(*op.p_rr, elapsed_cycles);
+                };
+            }
+            break;
+
+        case POP_SS:
+            if (P(opcode) == 3)
+            {
+                result.handler = [](Processor& p, const TranslatedOp&, uint16_t&, size_t& elapsed_cycles) {
+                    const auto af = p.memory_as<Memory>().pop(elapsed_cycles);
+                    p.reg_af() = af;
+                };
+            }
+            else
+            {
+                result.p_rr = &SS(P(opcode));
+                result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                    *op.p_rr = p.memory_as<Memory>().pop(elapsed_cycles);
+                };
+            }
+            break;
+
+        case EX_DE_HL:
+            result.handler = [](Processor& p, const TranslatedOp&, uint16_t&, size_t&) {
+                std::swap(p.reg_de(), p.reg_hl());
+            };
+            break;
+
+        case ADD_R:
+        case ADC_R:
+        case SUB_R:
+        case SBC_R:
+        case AND_R:
+        case XOR_R:
+        case OR_R:
+        case CP_R:
+            result.p_alu = alu_operation(Y(opcode));
+            result.p_r2 = &R(Z(opcode));
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t&) { (p.*op.p_alu)(*op.p_r2); };
+            break;
+
+        case ADD_N:
+        case ADC_N:
+        case SUB_N:
+        case SBC_N:
+        case AND_N:
+        case XOR_N:
+        case OR_N:
+        case CP_N:
+            result.p_alu = alu_operation(Y(opcode));
+            result.operand = n;
+            result.cycles += 3;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t&) {
+                (p.*op.p_alu)(static_cast<uint8_t>(op.operand));
+            };
+            break;
+
+        case ADD_INDIRECT_HL:
+        case ADC_INDIRECT_HL:
+        case SUB_INDIRECT_HL:
+        case SBC_INDIRECT_HL:
+        case AND_INDIRECT_HL:
+        case XOR_INDIRECT_HL:
+        case OR_INDIRECT_HL:
+        case CP_INDIRECT_HL:
+            result.p_alu = alu_operation(Y(opcode));
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t& elapsed_cycles) {
+                (p.*op.p_alu)(p.memory_as<Memory>().read_byte(p.reg_hl(), elapsed_cycles));
+            };
+            break;
+
+        case INC_R:
+            result.p_r1 = &R(Y(opcode));
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t&) { p.op_inc(*op.p_r1); };
+            break;
+
+        case DEC_R:
+            result.p_r1 = &R(Y(opcode));
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t&) { p.op_dec(*op.p_r1); };
+            break;
+
+        case INC_RR:
+            result.p_rr = &RR(P(opcode));
+            result.cycles += 2;
+            result.handler = [](Processor&, const TranslatedOp& op, uint16_t&, size_t&) { ++*op.p_rr; };
+            break;
+
+        case DEC_RR:
+            result.p_rr = &RR(P(opcode));
+            result.cycles += 2;
+            result.handler = [](Processor&, const TranslatedOp& op, uint16_t&, size_t&) { --*op.p_rr; };
+            break;
+
+        case ADD_HL_RR:
+            result.p_rr = &RR(P(opcode));
+            result.cycles += 7;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t&, size_t&) {
+                const uint16_t x = p.reg_hl();
+                const uint16_t y = *op.p_rr;
+                const int z = x + y;
+
+                const int c = x ^ y ^ z;
+                uint8_t f = p.reg_f() & SZPV_FLAG_MASK;
+                f |= (z >> 8) & YX_FLAG_MASK;
+                f |= (c >> 8) & H_FLAG_MASK;
+                f |= c >> (16 - C_FLAG_BIT);
+
+                p.reg_hl() = z;
+                p.reg_f() = f;
+            };
+            break;
+
+        case JP_NN:
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor&, const TranslatedOp& op, uint16_t& pc, size_t&) { pc = op.operand; };
+            break;
+
+        case JP_CC_NN:
+            result.cc = Y(opcode);
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t& pc, size_t&) {
+                if (p.test_cc(op.cc))
+                {
+                    pc = op.operand;
+                }
+            };
+            break;
+
+        case JR_E:
+            result.operand = result.next + static_cast<signed char>(n);
+            result.cycles += 8;
+            result.handler = [](Processor&, const TranslatedOp& op, uint16_t& pc, size_t&) { pc = op.operand; };
+            break;
+
+        case JR_DD_E:
+            result.cc = Q(opcode);
+            result.operand = result.next + static_cast<signed char>(n);
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t& pc, size_t& elapsed_cycles) {
+                if (p.test_dd(op.cc))
+                {
+                    pc = op.operand;
+                    elapsed_cycles += 8;
+                }
+                else
+                {
+                    elapsed_cycles += 3;
+                }
+            };
+            break;
+
+        case DJNZ_E:
+            result.operand = result.next + static_cast<signed char>(n);
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t& pc, size_t& elapsed_cycles) {
+                if (--p.reg_b())
+                {
+                    pc = op.operand;
+                    elapsed_cycles += 9;
+                }
+                else
+                {
+                    elapsed_cycles += 4;
+                }
+            };
+            break;
+
+        case CALL_NN:
+            result.operand = nn;
+            result.cycles += 6 + 1;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t& pc, size_t& elapsed_cycles) {
+                p.memory_as<Memory>().push(op.next, elapsed_cycles);
+                pc = op.operand;
+            };
+            break;
+
+        case CALL_CC_NN:
+            result.cc = Y(opcode);
+            result.operand = nn;
+            result.cycles += 6;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t& pc, size_t& elapsed_cycles) {
+                if (p.test_cc(op.cc))
+                {
+                    p.memory_as<Memory>().push(op.next, elapsed_cycles);
+                    pc = op.operand;
+                    elapsed_cycles++;
+                }
+            };
+            break;
+
+        case RET:
+            result.handler = [](Processor& p, const TranslatedOp&, uint16_t& pc, size_t& elapsed_cycles) {
+                pc = p.memory_as<Memory>().pop(elapsed_cycles);
+            };
+            break;
+
+        case RET_CC:
+            result.cc = Y(opcode);
+            result.cycles += 1;
+            result.handler = [](Processor& p, const TranslatedOp& op, uint16_t& pc, size_t& elapsed_cycles) {
+                if (p.test_cc(op.cc))
+                {
+                    pc = p.memory_as<Memory>().pop(elapsed_cycles);
+                }
+            };
+            break;
+
+        default: return false;
+        }
+
+        return true;
+    }
+
+    auto Processor::alu_operation(uint8_t y) -> void (Processor::*)(uint8_t)
+    {
+        // In the same order as the Y() field of the 8-bit arithmetic & logical instructions
+        static const std::array<void (Processor::*)(uint8_t), 8> operations = {
+            &Processor::op_add, &Processor::op_adc, &Processor::op_sub, &Processor::op_sbc,
+            &Processor::op_and, &Processor::op_xor, &Processor::op_or,  &Processor::op_cp,
+        };
+        return operations[y];
+    }
+
+    template <bool Prefixes>
+    uint8_t& Processor::R(int r)
+    {
+        return m_registers.byte[(Prefixes ? *m_pregister_indexes : REGISTER_INDEX_TABLES[0])[r]];
+    }
+
+    uint8_t& Processor::S(int s)
+    {
+        return m_registers.byte[REGISTER_INDEX_TABLES[0][s]];
+    }
+
+    template <bool Prefixes>
+    uint16_t& Processor::RR(int rr)
+    {
+        return m_registers.word[(Prefixes ? *m_pregister_indexes : REGISTER_INDEX_TABLES[0])[rr + 8]];
+    }
+
+    template <bool Prefixes>
+    uint16_t& Processor::SS(int ss)
+    {
+        if (ss == 3)
+        {
+            materialize_flags(); // PUSH AF or POP AF
+        }
+        return m_registers.word[(Prefixes ? *m_pregister_indexes : REGISTER_INDEX_TABLES[0])[ss + 12]];
     }
 
-    uint16_t& Processor::RR(int rr) const
+    template <bool Prefixes>
+    uint16_t& Processor::HL_IX_IY()
     {
-        return *(static_cast<uint16_t*>(m_current_register_table[rr + 8]));
+        return m_registers.word[(Prefixes ? *m_pregister_indexes : REGISTER_INDEX_TABLES[0])[6]];
     }
 
-    uint16_t& Processor::SS(int ss) const
+    size_t Processor::emulate(uint8_t opcode, bool unbounded, size_t elapsed_cycles, size_t max_cycles)
     {
-        return *(static_cast<uint16_t*>(m_current_register_table[ss + 12]));
+        // Pick the instantiation which suits the processor, memory implementation, engine and mode that we're using
+        if (m_intel8080)
+        {
+            return emulate_as<true>(opcode, unbounded, elapsed_cycles, max_cycles);
+        }
+        else
+        {
+            return emulate_as<false>(opcode, unbounded, elapsed_cycles, max_cycles);
+        }
     }
 
-    uint16_t& Processor::HL_IX_IY() const
+    template <bool Intel8080>
+    size_t Processor::emulate_as(uint8_t opcode, bool unbounded, size_t elapsed_cycles, size_t max_cycles)
     {
-        return *(static_cast<uint16_t*>(m_current_register_table[6]));
+        // Anything written since the last instruction was recorded was written by something other than the processor
+        if (m_recording)
+        {
+            m_precorder->discard_writes();
+        }
+
+        m_counting_cycles = !(m_phardware && m_fast && unbounded);
+        if (!m_counting_cycles)
+        {
+            return m_pblock_cache
+                       ? execute<Hardware, true, false, Intel8080>(opcode, unbounded, elapsed_cycles, max_cycles)
+                       : execute<Hardware, false, false, Intel8080>(opcode, unbounded, elapsed_cycles, max_cycles);
+        }
+        else if (m_phardware)
+        {
+            return m_pblock_cache
+                       ? execute<Hardware, true, true, Intel8080>(opcode, unbounded, elapsed_cycles, max_cycles)
+                       : execute<Hardware, false, true, Intel8080>(opcode, unbounded, elapsed_cycles, max_cycles);
+        }
+        else
+        {
+            return m_pblock_cache
+                       ? execute<IMemory, true, true, Intel8080>(opcode, unbounded, elapsed_cycles, max_cycles)
+                       : execute<IMemory, false, true, Intel8080>(opcode, unbounded, elapsed_cycles, max_cycles);
+        }
     }
 
-    size_t Processor::emulate(uint8_t opcode, bool unbounded, size_t elapsed_cycles, size_t max_cycles)
+    template <typename Memory, bool Cached, bool Accurate, bool Intel8080>
+    size_t Processor::execute(uint8_t opcode, bool unbounded, size_t initial_cycles, size_t max_cycles)
     {
+        auto& memory = memory_as<Memory>();
+
+        // An 8080 has no DD/FD prefixes, so only ever uses the default register table
+        constexpr bool Prefixes = !Intel8080;
+
+        // Without Accurate, these counters are optimised away
+        using Cycles = std::conditional_t<Accurate, size_t, Uncounted>;
+        using Refresh = std::conditional_t<Accurate, uint8_t, Uncounted>;
+        Cycles elapsed_cycles = initial_cycles;
+        Refresh r = m_r & 0x7f;
+
         uint16_t pc = m_pc;
-        uint8_t r = m_r & 0x7f;
+
+        // The first opcode has been provided by the caller, so never comes from the block cache
+        m_pdecoded = nullptr;
 
         goto start_emulation; // NOLINT: imported 3rd-party code
 
@@ -586,7 +1502,77 @@ namespace zcpm
             uint8_t instruction;
 
             m_effective_pc = pc; // In case the following method causes a debugger hook to fire
-            opcode = m_memory.read_byte(pc);
+
+            if constexpr (Cached)
+            {
+                // Translated code is only used for unbounded runs, as it doesn't check the cycle count as it goes
+                if (m_ptranslation_cache && unbounded)
+                {
+                    bool translated = false;
+                    if constexpr (Accurate)
+                    {
+                        translated = run_translations<Memory>(pc, elapsed_cycles, r);
+                    }
+                    else
+                    {
+                        // Translated code always counts, so give it counters whose values are simply dropped
+                        size_t cycles = 0;
+                        uint8_t refresh = 0;
+                        translated = run_translations<Memory>(pc, cycles, refresh);
+                    }
+                    if (translated)
+                    {
+                        // Make the same debug action check as at the end of an interpreted instruction
+                        if ((m_traps[pc] & TRAP_DEBUG) && !evaluate_actions(pc, false))
+                        {
+                            m_processor_observer.set_finished(true);
+                            goto stop_emulation; // NOLINT: imported 3rd-party code
+                        }
+                        continue;
+                    }
+                }
+
+                m_pdecoded = m_pblock_cache->find(pc);
+                if (m_pdecoded)
+                {
+                    if constexpr (Intel8080)
+                    {
+                        if (m_pdecoded->prefixes)
+                        {
+                            reject_z80_instruction(m_pdecoded->address, m_pdecoded->bytes[0]);
+                        }
+                    }
+
+                    // This instruction has already been decoded, so make the same termination checks and BDOS/BIOS
+                    // checks that each of its prefixes would normally make, and then go straight to its handler.
+                    for (uint8_t i = 0; i < m_pdecoded->prefixes; ++i)
+                    {
+                        pc = m_pdecoded->address + m_pdecoded->check_offsets[i];
+                        const auto outcome = check_traps(elapsed_cycles);
+                        if (outcome == TrapOutcome::STOP)
+                        {
+                            goto stop_emulation; // NOLINT: imported 3rd-party code
+                        }
+                        if (outcome == TrapOutcome::RETURN)
+                        {
+                            set_default_table();
+                            instruction = RET;
+                            goto execute_instruction; // NOLINT: imported 3rd-party code
+                        }
+                    }
+
+                    elapsed_cycles += m_pdecoded->prefix_cycles;
+                    r += m_pdecoded->prefix_r;
+                    select_table(m_pdecoded->table);
+                    opcode = m_pdecoded->opcode;
+                    instruction = m_pdecoded->instruction;
+                    pc = m_pdecoded->address + m_pdecoded->operands_offset;
+
+                    goto emulate_next_instruction; // NOLINT: imported 3rd-party code
+                }
+            }
+
+            opcode = memory.read_byte(pc);
             pc++;
 
         start_emulation:
@@ -599,17 +1585,16 @@ namespace zcpm
 
         emulate_next_instruction:
 
-            // CP/M programs terminate by reaching address 0008, e.g. via a RET or a RST0.  We
-            // manually treat this as a termination condition.
-            if ((m_effective_pc == 0x0008) || !(m_processor_observer.running()))
+            // Have we been asked to stop, or hit an address which needs special handling?
+            switch (check_traps(elapsed_cycles))
             {
-                BOOST_LOG_TRIVIAL(trace) << fmt::format("Stopping execution at PC={:04X}", m_effective_pc);
-                m_processor_observer.set_finished(true);
-                goto stop_emulation; // NOLINT: imported 3rd-party code
+            case TrapOutcome::CONTINUE: break;
+            case TrapOutcome::STOP: goto stop_emulation; // NOLINT: imported 3rd-party code
+            case TrapOutcome::RETURN: instruction = RET; break;
             }
 
-            // Have we hit a BIOS address that needs to be intercepted?
-            m_processor_observer.check_and_handle_bdos_and_bios(m_effective_pc);
+            // A trap on one of the prefixes of a cached instruction comes straight here, once it has been handled
+        [[maybe_unused]] execute_instruction:
 
             elapsed_cycles += 4;
             r++;
@@ -620,29 +1605,29 @@ namespace zcpm
 
             case LD_R_R:
             {
-                R(Y(opcode)) = R(Z(opcode));
+                R<Prefixes>(Y(opcode)) = R<Prefixes>(Z(opcode));
 
                 break;
             }
 
             case LD_R_N:
             {
-                R(Y(opcode)) = m_memory.read_byte_step(pc, elapsed_cycles);
+                R<Prefixes>(Y(opcode)) = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
 
                 break;
             }
 
             case LD_R_INDIRECT_HL:
             {
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    R(Y(opcode)) = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    R<Prefixes>(Y(opcode)) = memory.read_byte(reg_hl(), elapsed_cycles);
                 }
                 else
                 {
-                    auto d = static_cast<int>(m_memory.read_byte_step(pc, elapsed_cycles));
-                    d += HL_IX_IY();
-                    S(Y(opcode)) = m_memory.read_byte(d, elapsed_cycles);
+                    auto d = static_cast<int>(fetch_byte_step<Memory, Cached>(pc, elapsed_cycles));
+                    d += HL_IX_IY<Prefixes>();
+                    S(Y(opcode)) = memory.read_byte(d, elapsed_cycles);
 
                     elapsed_cycles += 5;
                 }
@@ -652,15 +1637,15 @@ namespace zcpm
 
             case LD_INDIRECT_HL_R:
             {
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    m_memory.write_byte(reg_hl(), R(Z(opcode)), elapsed_cycles);
+                    memory.write_byte(reg_hl(), R<Prefixes>(Z(opcode)), elapsed_cycles);
                 }
                 else
                 {
-                    auto d = static_cast<int>(m_memory.read_byte_step(pc, elapsed_cycles));
-                    d += HL_IX_IY();
-                    m_memory.write_byte(d, S(Z(opcode)), elapsed_cycles);
+                    auto d = static_cast<int>(fetch_byte_step<Memory, Cached>(pc, elapsed_cycles));
+                    d += HL_IX_IY<Prefixes>();
+                    memory.write_byte(d, S(Z(opcode)), elapsed_cycles);
 
                     elapsed_cycles += 5;
                 }
@@ -672,17 +1657,17 @@ namespace zcpm
             {
                 uint8_t n;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    n = m_memory.read_byte_step(pc, elapsed_cycles);
-                    m_memory.write_byte(reg_hl(), n, elapsed_cycles);
+                    n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
+                    memory.write_byte(reg_hl(), n, elapsed_cycles);
                 }
                 else
                 {
-                    auto d = static_cast<int>(m_memory.read_byte_step(pc, elapsed_cycles));
-                    d += HL_IX_IY();
-                    n = m_memory.read_byte_step(pc, elapsed_cycles);
-                    m_memory.write_byte(d, n, elapsed_cycles);
+                    auto d = static_cast<int>(fetch_byte_step<Memory, Cached>(pc, elapsed_cycles));
+                    d += HL_IX_IY<Prefixes>();
+                    n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
+                    memory.write_byte(d, n, elapsed_cycles);
 
                     elapsed_cycles += 2;
                 }
@@ -692,51 +1677,64 @@ namespace zcpm
 
             case LD_A_INDIRECT_BC:
             {
-                reg_a() = m_memory.read_byte(reg_bc(), elapsed_cycles);
+                reg_a() = memory.read_byte(reg_bc(), elapsed_cycles);
 
                 break;
             }
 
             case LD_A_INDIRECT_DE:
             {
-                reg_a() = m_memory.read_byte(reg_de(), elapsed_cycles);
+                reg_a() = memory.read_byte(reg_de(), elapsed_cycles);
 
                 break;
             }
 
             case LD_A_INDIRECT_NN:
             {
-                const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                reg_a() = m_memory.read_byte(nn, elapsed_cycles);
+                const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                reg_a() = memory.read_byte(nn, elapsed_cycles);
 
                 break;
             }
 
             case LD_INDIRECT_BC_A:
             {
-                m_memory.write_byte(reg_bc(), reg_a(), elapsed_cycles);
+                memory.write_byte(reg_bc(), reg_a(), elapsed_cycles);
 
                 break;
             }
 
             case LD_INDIRECT_DE_A:
             {
-                m_memory.write_byte(reg_de(), reg_a(), elapsed_cycles);
+                memory.write_byte(reg_de(), reg_a(), elapsed_cycles);
 
                 break;
             }
 
             case LD_INDIRECT_NN_A:
             {
-                const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                m_memory.write_byte(nn, reg_a(), elapsed_cycles);
+                const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                memory.write_byte(nn, reg_a(), elapsed_cycles);
 
                 break;
             }
 
             case LD_A_I_LD_A_R:
             {
-                const uint8_t a = opcode == OPCODE_LD_A_I ? m_i : (r & 0x80) | (r & 0x7f);
+                uint8_t a = m_i;
+                if (opcode != OPCODE_LD_A_I)
+                {
+                    if constexpr (Accurate)
+                    {
+                        a = (r & 0x80) | (r & 0x7f);
+                    }
+                    else
+                    {
+                        // R isn't counted, so just make sure that it differs from one read to the next
+                        m_r = (m_r & 0x80) | ((m_r + 1) & 0x7f);
+                        a = m_r;
+                    }
+                }
                 uint8_t f = SZYX_FLAGS_TABLE[a];
 
                 /* Note: On a real processor, if an interrupt occurs during the execution of either
@@ -759,10 +1757,14 @@ namespace zcpm
                 {
                     m_i = reg_a();
                 }
-                else
+                else if constexpr (Accurate)
                 {
                     r = reg_a() & 0x7f;
                 }
+                else
+                {
+                    m_r = (m_r & 0x80) | (reg_a() & 0x7f);
+                }
 
                 elapsed_cycles++;
 
@@ -773,46 +1775,46 @@ namespace zcpm
 
             case LD_RR_NN:
             {
-                RR(P(opcode)) = m_memory.read_word_step(pc, elapsed_cycles);
+                RR<Prefixes>(P(opcode)) = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
 
                 break;
             }
 
             case LD_HL_INDIRECT_NN:
             {
-                const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                HL_IX_IY() = m_memory.read_word(nn, elapsed_cycles);
+                const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                HL_IX_IY<Prefixes>() = memory.read_word(nn, elapsed_cycles);
 
                 break;
             }
 
             case LD_RR_INDIRECT_NN:
             {
-                const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                RR(P(opcode)) = m_memory.read_word(nn, elapsed_cycles);
+                const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                RR<Prefixes>(P(opcode)) = memory.read_word(nn, elapsed_cycles);
 
                 break;
             }
 
             case LD_INDIRECT_NN_HL:
             {
-                const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                m_memory.write_word(nn, HL_IX_IY(), elapsed_cycles);
+                const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                memory.write_word(nn, HL_IX_IY<Prefixes>(), elapsed_cycles);
 
                 break;
             }
 
             case LD_INDIRECT_NN_RR:
             {
-                const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                m_memory.write_word(nn, RR(P(opcode)), elapsed_cycles);
+                const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                memory.write_word(nn, RR<Prefixes>(P(opcode)), elapsed_cycles);
 
                 break;
             }
 
             case LD_SP_HL:
             {
-                reg_sp() = HL_IX_IY();
+                reg_sp() = HL_IX_IY<Prefixes>();
                 elapsed_cycles += 2;
 
                 break;
@@ -820,7 +1822,7 @@ namespace zcpm
 
             case PUSH_SS:
             {
-                m_memory.push(SS(P(opcode)), elapsed_cycles);
+                memory.push(SS<Prefixes>(P(opcode)), elapsed_cycles);
                 elapsed_cycles++;
 
                 break;
@@ -828,7 +1830,14 @@ namespace zcpm
 
             case POP_SS:
             {
-                SS(P(opcode)) = m_memory.pop(elapsed_cycles);
+                SS<Prefixes>(P(opcode)) = memory.pop(elapsed_cycles);
+                if constexpr (Intel8080)
+                {
+                    if (P(opcode) == 3)
+                    {
+                        reg_f() = flags_8080(reg_f()); // POP PSW can't set the bits which are fixed on an 8080
+                    }
+                }
 
                 break;
             }
@@ -844,6 +1853,11 @@ namespace zcpm
 
             case EX_AF_AF_PRIME:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 std::swap(reg_af(), m_alternates[Reg16::AF]);
 
                 break;
@@ -851,6 +1865,11 @@ namespace zcpm
 
             case EXX:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 std::swap(reg_bc(), m_alternates[Reg16::BC]);
                 std::swap(reg_de(), m_alternates[Reg16::DE]);
                 std::swap(reg_hl(), m_alternates[Reg16::HL]);
@@ -860,9 +1879,9 @@ namespace zcpm
 
             case EX_INDIRECT_SP_HL:
             {
-                const uint16_t t = m_memory.read_word(reg_sp(), elapsed_cycles);
-                m_memory.write_word(reg_sp(), HL_IX_IY(), elapsed_cycles);
-                HL_IX_IY() = t;
+                const uint16_t t = memory.read_word(reg_sp(), elapsed_cycles);
+                memory.write_word(reg_sp(), HL_IX_IY<Prefixes>(), elapsed_cycles);
+                HL_IX_IY<Prefixes>() = t;
 
                 elapsed_cycles += 3;
 
@@ -871,8 +1890,8 @@ namespace zcpm
 
             case LDI_LDD:
             {
-                uint8_t n = m_memory.read_byte(reg_hl(), elapsed_cycles);
-                m_memory.write_byte(reg_de(), n, elapsed_cycles);
+                uint8_t n = memory.read_byte(reg_hl(), elapsed_cycles);
+                memory.write_byte(reg_de(), n, elapsed_cycles);
 
                 uint8_t f = reg_f() & SZC_FLAG_MASK;
                 f |= --reg_bc() ? PV_FLAG_MASK : 0;
@@ -903,37 +1922,59 @@ namespace zcpm
 
                 uint8_t n;
 
-                r -= 2;
-                elapsed_cycles -= 8;
-                for (;;)
+                // If the whole repeat is to be executed, then try to do it in one go
+                size_t count = 0;
+                if constexpr (std::is_same_v<Memory, Hardware>)
                 {
-                    r += 2;
-
-                    n = m_memory.read_byte(hl);
-                    m_memory.write_byte(de, n);
-
-                    hl += d;
-                    de += d;
-
-                    if (--bc)
-                    {
-                        elapsed_cycles += 21;
-                    }
-                    else
+                    if (unbounded || (max_cycles == 0))
                     {
-                        elapsed_cycles += 16;
-                        break;
+                        count = move_block(memory, d > 0, n);
                     }
+                }
 
-                    if (unbounded || (elapsed_cycles < max_cycles) || (max_cycles == 0))
-                    {
-                        continue;
-                    }
-                    else
+                if (count)
+                {
+                    const auto delta = static_cast<uint16_t>(d * static_cast<int>(count));
+                    hl += delta;
+                    de += delta;
+                    bc = 0;
+                    r += 2 * (count - 1);
+                    elapsed_cycles += 21 * (count - 1) + 16 - 8;
+                }
+                else
+                {
+                    r -= 2;
+                    elapsed_cycles -= 8;
+                    for (;;)
                     {
-                        f |= PV_FLAG_MASK;
-                        pc -= 2;
-                        break;
+                        r += 2;
+
+                        n = memory.read_byte(hl);
+                        memory.write_byte(de, n);
+
+                        hl += d;
+                        de += d;
+
+                        if (--bc)
+                        {
+                            elapsed_cycles += 21;
+                        }
+                        else
+                        {
+                            elapsed_cycles += 16;
+                            break;
+                        }
+
+                        if (unbounded || (elapsed_cycles < max_cycles) || (max_cycles == 0))
+                        {
+                            continue;
+                        }
+                        else
+                        {
+                            f |= PV_FLAG_MASK;
+                            pc -= 2;
+                            break;
+                        }
                     }
                 }
 
@@ -953,7 +1994,7 @@ namespace zcpm
             case CPI_CPD:
             {
                 uint8_t a = reg_a();
-                uint8_t n = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                uint8_t n = memory.read_byte(reg_hl(), elapsed_cycles);
                 uint8_t z = a - n;
 
                 reg_hl() += opcode == OPCODE_CPI ? +1 : -1;
@@ -983,34 +2024,55 @@ namespace zcpm
 
                 uint8_t n, z;
 
-                r -= 2;
-                elapsed_cycles -= 8;
-                for (;;)
+                // If the whole repeat is to be executed, then try to do it in one go
+                size_t count = 0;
+                if constexpr (std::is_same_v<Memory, Hardware>)
                 {
-                    r += 2;
-
-                    n = m_memory.read_byte(hl);
-                    z = a - n;
-
-                    hl += d;
-                    if (--bc && z)
-                    {
-                        elapsed_cycles += 21;
-                    }
-                    else
+                    if (unbounded || (max_cycles == 0))
                     {
-                        elapsed_cycles += 16;
-                        break;
+                        count = compare_block(memory, d > 0, n);
                     }
+                }
 
-                    if (unbounded || (elapsed_cycles < max_cycles) || (max_cycles == 0))
-                    {
-                        continue;
-                    }
-                    else
+                if (count)
+                {
+                    z = a - n;
+                    hl += static_cast<uint16_t>(d * static_cast<int>(count));
+                    bc -= static_cast<uint16_t>(count);
+                    r += 2 * (count - 1);
+                    elapsed_cycles += 21 * (count - 1) + 16 - 8;
+                }
+                else
+                {
+                    r -= 2;
+                    elapsed_cycles -= 8;
+                    for (;;)
                     {
-                        pc -= 2;
-                        break;
+                        r += 2;
+
+                        n = memory.read_byte(hl);
+                        z = a - n;
+
+                        hl += d;
+                        if (--bc && z)
+                        {
+                            elapsed_cycles += 21;
+                        }
+                        else
+                        {
+                            elapsed_cycles += 16;
+                            break;
+                        }
+
+                        if (unbounded || (elapsed_cycles < max_cycles) || (max_cycles == 0))
+                        {
+                            continue;
+                        }
+                        else
+                        {
+                            pc -= 2;
+                            break;
+                        }
                     }
                 }
 
@@ -1034,14 +2096,14 @@ namespace zcpm
 
             case ADD_R:
             {
-                op_add(R(Z(opcode)));
+                op_add(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case ADD_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_add(n);
 
                 break;
@@ -1049,7 +2111,7 @@ namespace zcpm
 
             case ADD_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
                 op_add(x);
 
                 break;
@@ -1057,14 +2119,14 @@ namespace zcpm
 
             case ADC_R:
             {
-                op_adc(R(Z(opcode)));
+                op_adc(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case ADC_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_adc(n);
 
                 break;
@@ -1072,7 +2134,7 @@ namespace zcpm
 
             case ADC_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
 
                 op_adc(x);
                 break;
@@ -1080,14 +2142,14 @@ namespace zcpm
 
             case SUB_R:
             {
-                op_sub(R(Z(opcode)));
+                op_sub(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case SUB_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_sub(n);
 
                 break;
@@ -1095,7 +2157,7 @@ namespace zcpm
 
             case SUB_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
                 op_sub(x);
 
                 break;
@@ -1103,14 +2165,14 @@ namespace zcpm
 
             case SBC_R:
             {
-                op_sbc(R(Z(opcode)));
+                op_sbc(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case SBC_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_sbc(n);
 
                 break;
@@ -1118,7 +2180,7 @@ namespace zcpm
 
             case SBC_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
                 op_sbc(x);
 
                 break;
@@ -1126,14 +2188,14 @@ namespace zcpm
 
             case AND_R:
             {
-                op_and(R(Z(opcode)));
+                op_and(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case AND_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_and(n);
 
                 break;
@@ -1141,7 +2203,7 @@ namespace zcpm
 
             case AND_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
                 op_and(x);
 
                 break;
@@ -1149,21 +2211,21 @@ namespace zcpm
 
             case OR_R:
             {
-                op_or(R(Z(opcode)));
+                op_or(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case OR_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_or(n);
                 break;
             }
 
             case OR_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
                 op_or(x);
 
                 break;
@@ -1171,14 +2233,14 @@ namespace zcpm
 
             case XOR_R:
             {
-                op_xor(R(Z(opcode)));
+                op_xor(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case XOR_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_xor(n);
 
                 break;
@@ -1186,7 +2248,7 @@ namespace zcpm
 
             case XOR_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
                 op_xor(x);
 
                 break;
@@ -1194,14 +2256,14 @@ namespace zcpm
 
             case CP_R:
             {
-                op_cp(R(Z(opcode)));
+                op_cp(R<Prefixes>(Z(opcode)));
 
                 break;
             }
 
             case CP_N:
             {
-                auto n = m_memory.read_byte_step(pc, elapsed_cycles);
+                auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
                 op_cp(n);
 
                 break;
@@ -1209,7 +2271,7 @@ namespace zcpm
 
             case CP_INDIRECT_HL:
             {
-                uint8_t x = read_indirect_hl(pc, elapsed_cycles);
+                uint8_t x = read_indirect_hl<Memory, Cached, Prefixes>(pc, elapsed_cycles);
                 op_cp(x);
 
                 break;
@@ -1218,9 +2280,9 @@ namespace zcpm
             case INC_R:
             {
                 const auto y = Y(opcode);
-                auto x = R(y);
+                auto x = R<Prefixes>(y);
                 op_inc(x);
-                R(y) = x;
+                R<Prefixes>(y) = x;
 
                 break;
             }
@@ -1229,21 +2291,21 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_inc(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    auto d = static_cast<int>(m_memory.read_byte_step(pc, elapsed_cycles));
-                    d += HL_IX_IY();
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    auto d = static_cast<int>(fetch_byte_step<Memory, Cached>(pc, elapsed_cycles));
+                    d += HL_IX_IY<Prefixes>();
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_inc(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     elapsed_cycles += 6;
                 }
@@ -1254,9 +2316,9 @@ namespace zcpm
             case DEC_R:
             {
                 const auto y = Y(opcode);
-                auto x = R(y);
+                auto x = R<Prefixes>(y);
                 op_dec(x);
-                R(y) = x;
+                R<Prefixes>(y) = x;
 
                 break;
             }
@@ -1265,21 +2327,21 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_dec(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    auto d = static_cast<int>(m_memory.read_byte_step(pc, elapsed_cycles));
-                    d += HL_IX_IY();
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    auto d = static_cast<int>(fetch_byte_step<Memory, Cached>(pc, elapsed_cycles));
+                    d += HL_IX_IY<Prefixes>();
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_dec(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     elapsed_cycles += 6;
                 }
@@ -1305,8 +2367,18 @@ namespace zcpm
                 {
                     d += 0x06;
                 }
-                reg_a() += reg_f() & N_FLAG_MASK ? -d : +d;
-                reg_f() = SZYXP_FLAGS_TABLE[reg_a()] | ((reg_a() ^ a) & H_FLAG_MASK) | (reg_f() & N_FLAG_MASK) | c;
+                if constexpr (Intel8080)
+                {
+                    // The 8080 has no N flag, and only adjusts for an addition
+                    reg_a() += d;
+                    reg_f() = flags_8080(SZYXP_FLAGS_TABLE[reg_a()] | ((reg_a() ^ a) & H_FLAG_MASK) | c);
+                }
+                else
+                {
+                    reg_a() += reg_f() & N_FLAG_MASK ? -d : +d;
+                    reg_f() =
+                        SZYXP_FLAGS_TABLE[reg_a()] | ((reg_a() ^ a) & H_FLAG_MASK) | (reg_f() & N_FLAG_MASK) | c;
+                }
 
                 break;
             }
@@ -1314,6 +2386,10 @@ namespace zcpm
             case CPL:
             {
                 reg_a() = ~reg_a();
+                if constexpr (Intel8080)
+                {
+                    break; // CMA leaves the flags alone
+                }
                 reg_f() =
                     (reg_f() & (SZPV_FLAG_MASK | C_FLAG_MASK)) | (reg_a() & YX_FLAG_MASK) | H_FLAG_MASK | N_FLAG_MASK;
 
@@ -1340,17 +2416,31 @@ namespace zcpm
 
             case CCF:
             {
+                const uint8_t f_before = reg_f();
+
                 const uint8_t c = reg_f() & C_FLAG_MASK;
                 reg_f() = (reg_f() & (SZPV_FLAG_MASK | YX_FLAG_MASK)) | (c << H_FLAG_BIT) | (reg_a() & YX_FLAG_MASK) |
                           (c ^ C_FLAG_MASK);
 
+                if constexpr (Intel8080)
+                {
+                    reg_f() = (f_before & ~C_FLAG_MASK) | (reg_f() & C_FLAG_MASK); // Only the carry is affected
+                }
+
                 break;
             }
 
             case SCF:
             {
+                const uint8_t f_before = reg_f();
+
                 reg_f() = (reg_f() & (SZPV_FLAG_MASK | YX_FLAG_MASK)) | (reg_a() & YX_FLAG_MASK) | C_FLAG_MASK;
 
+                if constexpr (Intel8080)
+                {
+                    reg_f() = (f_before & ~C_FLAG_MASK) | (reg_f() & C_FLAG_MASK); // Only the carry is affected
+                }
+
                 break;
             }
 
@@ -1369,6 +2459,7 @@ namespace zcpm
                 {
                     elapsed_cycles = max_cycles;
                 }
+                m_halted = true;
 
                 goto stop_emulation; // NOLINT: imported 3rd-party code
             }
@@ -1422,8 +2513,10 @@ namespace zcpm
 
             case ADD_HL_RR:
             {
-                const uint16_t x = HL_IX_IY();
-                const uint16_t y = RR(P(opcode));
+                const uint8_t f_before = reg_f();
+
+                const uint16_t x = HL_IX_IY<Prefixes>();
+                const uint16_t y = RR<Prefixes>(P(opcode));
                 const int z = x + y;
 
                 const int c = x ^ y ^ z;
@@ -1432,18 +2525,23 @@ namespace zcpm
                 f |= (c >> 8) & H_FLAG_MASK;
                 f |= c >> (16 - C_FLAG_BIT);
 
-                HL_IX_IY() = z;
+                HL_IX_IY<Prefixes>() = z;
                 reg_f() = f;
 
                 elapsed_cycles += 7;
 
+                if constexpr (Intel8080)
+                {
+                    reg_f() = (f_before & ~C_FLAG_MASK) | (reg_f() & C_FLAG_MASK); // Only the carry is affected
+                }
+
                 break;
             }
 
             case ADC_HL_RR:
             {
                 const uint16_t x = reg_hl();
-                const uint16_t y = RR(P(opcode));
+                const uint16_t y = RR<Prefixes>(P(opcode));
                 const int z = x + y + (reg_f() & C_FLAG_MASK);
 
                 const int c = x ^ y ^ z;
@@ -1463,7 +2561,7 @@ namespace zcpm
             case SBC_HL_RR:
             {
                 const uint16_t x = reg_hl();
-                const uint16_t y = RR(P(opcode));
+                const uint16_t y = RR<Prefixes>(P(opcode));
                 const int z = x - y - (reg_f() & C_FLAG_MASK);
 
                 int c = x ^ y ^ z;
@@ -1484,9 +2582,9 @@ namespace zcpm
 
             case INC_RR:
             {
-                uint16_t x = RR(P(opcode));
+                uint16_t x = RR<Prefixes>(P(opcode));
                 x++;
-                RR(P(opcode)) = x;
+                RR<Prefixes>(P(opcode)) = x;
 
                 elapsed_cycles += 2;
 
@@ -1495,9 +2593,9 @@ namespace zcpm
 
             case DEC_RR:
             {
-                uint16_t x = RR(P(opcode));
+                uint16_t x = RR<Prefixes>(P(opcode));
                 x--;
-                RR(P(opcode)) = x;
+                RR<Prefixes>(P(opcode)) = x;
 
                 elapsed_cycles += 2;
 
@@ -1508,45 +2606,73 @@ namespace zcpm
 
             case RLCA:
             {
+                const uint8_t f_before = reg_f();
+
                 reg_a() = (reg_a() << 1) | (reg_a() >> 7);
                 reg_f() = (reg_f() & SZPV_FLAG_MASK) | (reg_a() & (YX_FLAG_MASK | C_FLAG_MASK));
 
+                if constexpr (Intel8080)
+                {
+                    reg_f() = (f_before & ~C_FLAG_MASK) | (reg_f() & C_FLAG_MASK); // Only the carry is affected
+                }
+
                 break;
             }
 
             case RLA:
             {
+                const uint8_t f_before = reg_f();
+
                 uint8_t a = reg_a() << 1;
                 uint8_t f = (reg_f() & SZPV_FLAG_MASK) | (a & YX_FLAG_MASK) | (reg_a() >> 7);
                 reg_a() = a | (reg_f() & C_FLAG_MASK);
                 reg_f() = f;
 
+                if constexpr (Intel8080)
+                {
+                    reg_f() = (f_before & ~C_FLAG_MASK) | (reg_f() & C_FLAG_MASK); // Only the carry is affected
+                }
+
                 break;
             }
 
             case RRCA:
             {
+                const uint8_t f_before = reg_f();
+
                 const uint8_t c = reg_a() & 0x01;
                 reg_a() = (reg_a() >> 1) | (reg_a() << 7);
                 reg_f() = (reg_f() & SZPV_FLAG_MASK) | (reg_a() & YX_FLAG_MASK) | c;
 
+                if constexpr (Intel8080)
+                {
+                    reg_f() = (f_before & ~C_FLAG_MASK) | (reg_f() & C_FLAG_MASK); // Only the carry is affected
+                }
+
                 break;
             }
 
             case RRA:
             {
+                const uint8_t f_before = reg_f();
+
                 const uint8_t c = reg_a() & 0x01;
                 reg_a() = (reg_a() >> 1) | ((reg_f() & C_FLAG_MASK) << 7);
                 reg_f() = (reg_f() & SZPV_FLAG_MASK) | (reg_a() & YX_FLAG_MASK) | c;
 
+                if constexpr (Intel8080)
+                {
+                    reg_f() = (f_before & ~C_FLAG_MASK) | (reg_f() & C_FLAG_MASK); // Only the carry is affected
+                }
+
                 break;
             }
 
             case RLC_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_rlc(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
 
                 break;
             }
@@ -1555,26 +2681,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_rlc(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_rlc(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1586,9 +2712,9 @@ namespace zcpm
 
             case RL_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_rl(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
 
                 break;
             }
@@ -1597,26 +2723,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_rl(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_rl(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1628,9 +2754,9 @@ namespace zcpm
 
             case RRC_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_rrc(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
 
                 break;
             }
@@ -1639,26 +2765,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_rrc(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_rrc(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1670,9 +2796,9 @@ namespace zcpm
 
             case RR_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_rr_instruction(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
 
                 break;
             }
@@ -1681,26 +2807,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_rr_instruction(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_rr_instruction(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1712,9 +2838,9 @@ namespace zcpm
 
             case SLA_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_sla(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
 
                 break;
             }
@@ -1723,26 +2849,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_sla(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_sla(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1754,9 +2880,9 @@ namespace zcpm
 
             case SLL_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_sll(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
 
                 break;
             }
@@ -1765,26 +2891,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_sll(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_sll(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1796,9 +2922,9 @@ namespace zcpm
 
             case SRA_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_sra(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
 
                 break;
             }
@@ -1807,26 +2933,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_sra(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_sra(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1838,9 +2964,9 @@ namespace zcpm
 
             case SRL_R:
             {
-                uint8_t x = R(Z(opcode));
+                uint8_t x = R<Prefixes>(Z(opcode));
                 op_srl(x);
-                R(Z(opcode)) = x;
+                R<Prefixes>(Z(opcode)) = x;
                 break;
             }
 
@@ -1848,26 +2974,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     op_srl(x);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     op_srl(x);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -1879,12 +3005,12 @@ namespace zcpm
 
             case RLD_RRD:
             {
-                uint8_t x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                uint8_t x = memory.read_byte(reg_hl(), elapsed_cycles);
 
                 uint16_t y = (reg_a() & 0xf0) << 8;
                 y |= opcode == OPCODE_RLD ? (x << 4) | (reg_a() & 0x0f)
                                           : ((x & 0x0f) << 8) | ((reg_a() & 0x0f) << 4) | (x >> 4);
-                m_memory.write_byte(reg_hl(), y, elapsed_cycles);
+                memory.write_byte(reg_hl(), y, elapsed_cycles);
                 y >>= 8;
 
                 reg_a() = y;
@@ -1899,9 +3025,9 @@ namespace zcpm
 
             case BIT_B_R:
             {
-                int x = R(Z(opcode)) & (1 << Y(opcode));
-                reg_f() = (x ? 0 : Z_FLAG_MASK | PV_FLAG_MASK) | (x & S_FLAG_MASK) | (R(Z(opcode)) & YX_FLAG_MASK) |
-                          H_FLAG_MASK | (reg_f() & C_FLAG_MASK);
+                int x = R<Prefixes>(Z(opcode)) & (1 << Y(opcode));
+                reg_f() = (x ? 0 : Z_FLAG_MASK | PV_FLAG_MASK) | (x & S_FLAG_MASK) |
+                          (R<Prefixes>(Z(opcode)) & YX_FLAG_MASK) | H_FLAG_MASK | (reg_f() & C_FLAG_MASK);
 
                 break;
             }
@@ -1910,7 +3036,7 @@ namespace zcpm
             {
                 uint16_t d;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
                     d = reg_hl();
 
@@ -1918,15 +3044,15 @@ namespace zcpm
                 }
                 else
                 {
-                    d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
                     pc += 2;
 
                     elapsed_cycles += 5;
                 }
 
-                uint8_t x = m_memory.read_byte(d, elapsed_cycles);
+                uint8_t x = memory.read_byte(d, elapsed_cycles);
                 x &= 1 << Y(opcode);
                 reg_f() = (x ? 0 : Z_FLAG_MASK | PV_FLAG_MASK) | (x & S_FLAG_MASK) | (d & YX_FLAG_MASK) | H_FLAG_MASK |
                           (reg_f() & C_FLAG_MASK);
@@ -1936,7 +3062,7 @@ namespace zcpm
 
             case SET_B_R:
             {
-                R(Z(opcode)) |= 1 << Y(opcode);
+                R<Prefixes>(Z(opcode)) |= 1 << Y(opcode);
 
                 break;
             }
@@ -1945,26 +3071,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     x |= 1 << Y(opcode);
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     x |= 1 << Y(opcode);
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
 
                     pc += 2;
@@ -1977,7 +3103,7 @@ namespace zcpm
 
             case RES_B_R:
             {
-                R(Z(opcode)) &= ~(1 << Y(opcode));
+                R<Prefixes>(Z(opcode)) &= ~(1 << Y(opcode));
 
                 break;
             }
@@ -1986,26 +3112,26 @@ namespace zcpm
             {
                 uint8_t x;
 
-                if (is_default_table())
+                if (is_default_table<Prefixes>())
                 {
-                    x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+                    x = memory.read_byte(reg_hl(), elapsed_cycles);
                     x &= ~(1 << Y(opcode));
-                    m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                    memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                     elapsed_cycles++;
                 }
                 else
                 {
-                    int d = m_memory.read_byte(pc);
-                    d = static_cast<signed char>(d) + HL_IX_IY();
+                    int d = fetch_byte<Memory, Cached>(pc);
+                    d = static_cast<signed char>(d) + HL_IX_IY<Prefixes>();
 
-                    x = m_memory.read_byte(d, elapsed_cycles);
+                    x = memory.read_byte(d, elapsed_cycles);
                     x &= ~(1 << Y(opcode));
-                    m_memory.write_byte(d, x, elapsed_cycles);
+                    memory.write_byte(d, x, elapsed_cycles);
 
                     if (Z(opcode) != INDIRECT_HL)
                     {
-                        R(Z(opcode)) = x;
+                        R<Prefixes>(Z(opcode)) = x;
                     }
                     pc += 2;
 
@@ -2019,7 +3145,7 @@ namespace zcpm
 
             case JP_NN:
             {
-                const uint16_t nn = m_memory.read_word(pc);
+                const uint16_t nn = fetch_word<Memory, Cached>(pc);
                 pc = nn;
 
                 elapsed_cycles += 6;
@@ -2031,7 +3157,7 @@ namespace zcpm
             {
                 if (test_cc(Y(opcode)))
                 {
-                    const uint16_t nn = m_memory.read_word(pc);
+                    const uint16_t nn = fetch_word<Memory, Cached>(pc);
 
                     pc = nn;
                 }
@@ -2047,7 +3173,12 @@ namespace zcpm
 
             case JR_E:
             {
-                const int e = m_memory.read_byte(pc);
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
+                const int e = fetch_byte<Memory, Cached>(pc);
                 pc += static_cast<signed char>(e) + 1;
 
                 elapsed_cycles += 8;
@@ -2057,9 +3188,14 @@ namespace zcpm
 
             case JR_DD_E:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 if (test_dd(Q(opcode)))
                 {
-                    const int e = m_memory.read_byte(pc);
+                    const int e = fetch_byte<Memory, Cached>(pc);
                     pc += static_cast<signed char>(e) + 1;
 
                     elapsed_cycles += 8;
@@ -2076,16 +3212,21 @@ namespace zcpm
 
             case JP_HL:
             {
-                pc = HL_IX_IY();
+                pc = HL_IX_IY<Prefixes>();
 
                 break;
             }
 
             case DJNZ_E:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 if (--reg_b())
                 {
-                    const int e = m_memory.read_byte(pc);
+                    const int e = fetch_byte<Memory, Cached>(pc);
                     pc += static_cast<signed char>(e) + 1;
 
                     elapsed_cycles += 9;
@@ -2104,10 +3245,10 @@ namespace zcpm
 
             case CALL_NN:
             {
-                const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                m_memory.push(pc, elapsed_cycles);
+                const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                memory.push(pc, elapsed_cycles);
 #ifdef TRACING
-                BOOST_LOG_TRIVIAL(trace) << fmt::format("TRACE: Calling {:04X} from PC={:04X}", nn, pc - 3);
+                ZCPM_LOG(trace) << fmt::format("TRACE: Calling {:04X} from PC={:04X}", nn, pc - 3);
 #endif
                 pc = nn;
 
@@ -2120,10 +3261,10 @@ namespace zcpm
             {
                 if (test_cc(Y(opcode)))
                 {
-                    const auto nn = m_memory.read_word_step(pc, elapsed_cycles);
-                    m_memory.push(pc, elapsed_cycles);
+                    const auto nn = fetch_word_step<Memory, Cached>(pc, elapsed_cycles);
+                    memory.push(pc, elapsed_cycles);
 #ifdef TRACING
-                    BOOST_LOG_TRIVIAL(trace) << fmt::format("TRACE: Calling {:04X} from PC={:04X} (cond)", nn, pc - 3);
+                    ZCPM_LOG(trace) << fmt::format("TRACE: Calling {:04X} from PC={:04X} (cond)", nn, pc - 3);
 #endif
                     pc = nn;
 
@@ -2142,11 +3283,11 @@ namespace zcpm
             case RET:
             {
 #ifdef TRACING
-                BOOST_LOG_TRIVIAL(trace) << fmt::format("TRACE: Returning from PC={:04X}", pc - 1);
+                ZCPM_LOG(trace) << fmt::format("TRACE: Returning from PC={:04X}", pc - 1);
 #endif
-                pc = m_memory.pop(elapsed_cycles);
+                pc = memory.pop(elapsed_cycles);
 #ifdef TRACING
-                BOOST_LOG_TRIVIAL(trace) << fmt::format("TRACE: Returning to PC={:04X}", pc);
+                ZCPM_LOG(trace) << fmt::format("TRACE: Returning to PC={:04X}", pc);
 #endif
 
                 break;
@@ -2157,11 +3298,11 @@ namespace zcpm
                 if (test_cc(Y(opcode)))
                 {
 #ifdef TRACING
-                    BOOST_LOG_TRIVIAL(trace) << fmt::format("TRACE: Returning from PC={:04X} (cond)", pc - 1);
+                    ZCPM_LOG(trace) << fmt::format("TRACE: Returning from PC={:04X} (cond)", pc - 1);
 #endif
-                    pc = m_memory.pop(elapsed_cycles);
+                    pc = memory.pop(elapsed_cycles);
 #ifdef TRACING
-                    BOOST_LOG_TRIVIAL(trace) << fmt::format("TRACE: Returning to PC={:04X}", pc);
+                    ZCPM_LOG(trace) << fmt::format("TRACE: Returning to PC={:04X}", pc);
 #endif
                 }
                 elapsed_cycles++;
@@ -2172,14 +3313,14 @@ namespace zcpm
             case RETI_RETN:
             {
                 m_iff1 = m_iff2;
-                pc = m_memory.pop(elapsed_cycles);
+                pc = memory.pop(elapsed_cycles);
 
                 break;
             }
 
             case RST_P:
             {
-                m_memory.push(pc, elapsed_cycles);
+                memory.push(pc, elapsed_cycles);
                 pc = RST_TABLE[Y(opcode)];
                 elapsed_cycles++;
 
@@ -2190,8 +3331,8 @@ namespace zcpm
 
             case IN_A_N:
             {
-                const auto n = m_memory.read_byte_step(pc, elapsed_cycles);
-                reg_a() = m_memory.input_byte(n);
+                const auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
+                reg_a() = memory.input_byte(n);
 
                 elapsed_cycles += 4;
 
@@ -2200,10 +3341,10 @@ namespace zcpm
 
             case IN_R_C:
             {
-                uint8_t x = m_memory.input_byte(reg_c());
+                uint8_t x = memory.input_byte(reg_c());
                 if (Y(opcode) != INDIRECT_HL)
                 {
-                    R(Y(opcode)) = x;
+                    R<Prefixes>(Y(opcode)) = x;
                 }
 
                 reg_f() = SZYXP_FLAGS_TABLE[x] | (reg_f() & C_FLAG_MASK);
@@ -2222,8 +3363,8 @@ namespace zcpm
 
             case INI_IND:
             {
-                int x = m_memory.input_byte(reg_c());
-                m_memory.write_byte(reg_hl(), x, elapsed_cycles);
+                int x = memory.input_byte(reg_c());
+                memory.write_byte(reg_hl(), x, elapsed_cycles);
 
                 int f = SZYX_FLAGS_TABLE[--reg_b() & 0xff] | (x >> (7 - N_FLAG_BIT));
                 if (opcode == OPCODE_INI)
@@ -2260,8 +3401,8 @@ namespace zcpm
                 {
                     r += 2;
 
-                    x = m_memory.input_byte(reg_c());
-                    m_memory.write_byte(hl, x);
+                    x = memory.input_byte(reg_c());
+                    memory.write_byte(hl, x);
 
                     hl += d;
 
@@ -2302,8 +3443,8 @@ namespace zcpm
 
             case OUT_N_A:
             {
-                const auto n = m_memory.read_byte_step(pc, elapsed_cycles);
-                m_memory.output_byte(n, reg_a());
+                const auto n = fetch_byte_step<Memory, Cached>(pc, elapsed_cycles);
+                memory.output_byte(n, reg_a());
 
                 elapsed_cycles += 4;
 
@@ -2312,8 +3453,8 @@ namespace zcpm
 
             case OUT_C_R:
             {
-                const uint8_t x = Y(opcode) != INDIRECT_HL ? R(Y(opcode)) : 0;
-                m_memory.output_byte(reg_c(), x);
+                const uint8_t x = Y(opcode) != INDIRECT_HL ? R<Prefixes>(Y(opcode)) : 0;
+                memory.output_byte(reg_c(), x);
 
                 elapsed_cycles += 4;
 
@@ -2322,8 +3463,8 @@ namespace zcpm
 
             case OUTI_OUTD:
             {
-                uint8_t x = m_memory.read_byte(reg_hl(), elapsed_cycles);
-                m_memory.output_byte(reg_c(), x);
+                uint8_t x = memory.read_byte(reg_hl(), elapsed_cycles);
+                memory.output_byte(reg_c(), x);
 
                 reg_hl() += opcode == OPCODE_OUTI ? +1 : -1;
 
@@ -2351,8 +3492,8 @@ namespace zcpm
                 {
                     r += 2;
 
-                    x = m_memory.read_byte(hl);
-                    m_memory.output_byte(reg_c(), x);
+                    x = memory.read_byte(hl);
+                    memory.output_byte(reg_c(), x);
 
                     hl += d;
                     if (--b)
@@ -2394,17 +3535,22 @@ namespace zcpm
 
             case CB_PREFIX:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 // Special handling if the 0xcb prefix is prefixed by a 0xdd or 0xfd prefix
 
-                if (!(is_default_table()))
+                if (!(is_default_table<Prefixes>()))
                 {
                     r--;
                     // Indexed memory access routine will correctly update pc
-                    opcode = m_memory.read_byte(pc + 1);
+                    opcode = memory.read_byte(pc + 1);
                 }
                 else
                 {
-                    opcode = m_memory.read_byte(pc);
+                    opcode = memory.read_byte(pc);
                     pc++;
                 }
                 instruction = CB_INSTRUCTION_TABLE[opcode];
@@ -2414,27 +3560,42 @@ namespace zcpm
 
             case DD_PREFIX:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 set_dd();
 
-                opcode = m_memory.read_byte(pc);
+                opcode = memory.read_byte(pc);
                 pc++;
                 goto emulate_next_opcode; // NOLINT: imported 3rd-party code
             }
 
             case FD_PREFIX:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 set_fd();
 
-                opcode = m_memory.read_byte(pc);
+                opcode = memory.read_byte(pc);
                 pc++;
                 goto emulate_next_opcode; // NOLINT: imported 3rd-party code
             }
 
             case ED_PREFIX:
             {
+                if constexpr (Intel8080)
+                {
+                    reject_z80_instruction(pc - 1, opcode);
+                }
+
                 set_default_table();
 
-                opcode = m_memory.read_byte(pc);
+                opcode = memory.read_byte(pc);
                 pc++;
                 instruction = ED_INSTRUCTION_TABLE[opcode];
 
@@ -2449,29 +3610,50 @@ namespace zcpm
             }
             }
 
-            // Have we reached the specified maximum cycle count?
-            if (!unbounded && (elapsed_cycles >= max_cycles))
+            // Are the profiler or the recorder seeing each instruction, or do we have any debug actions for this
+            // address? (This is the one check for all of them, so that none costs anything extra unless it is in use.)
+            if (m_traps[pc] & (TRAP_PROFILE | TRAP_RECORD | TRAP_DEBUG))
             {
-                goto stop_emulation; // NOLINT: imported 3rd-party code
-            }
+                if (m_traps[pc] & TRAP_PROFILE)
+                {
+                    m_pprofiler->record(m_effective_pc, instruction, pc, m_cycle_count + elapsed_cycles);
+                }
+                if (m_traps[pc] & TRAP_RECORD)
+                {
+                    record_instruction(pc);
+                }
 
-            // Do we have any debug actions for this address?
-            if (m_debug_actions.count(pc) > 0)
-            {
-                // Yes, we have one or more, find them and evaluate them.  If any evaluate to false,
-                // then we stop the emulation (typically to return to the debugger).
-                const auto [start, stop] = m_debug_actions.equal_range(pc);
-                if (std::any_of(start, stop, [pc](const auto& a) { return a.second->evaluate(pc) == false; }))
+                // If we have debug actions, find them and evaluate them (unless we're about to stop anyway).  If any
+                // evaluate to false, then we stop the emulation (typically to return to the debugger).
+                if ((m_traps[pc] & TRAP_DEBUG) && (unbounded || (!m_stepping && (elapsed_cycles < max_cycles))) &&
+                    !evaluate_actions(pc, false))
                 {
                     m_processor_observer.set_finished(true);
                     goto stop_emulation; // NOLINT: imported 3rd-party code
                 }
             }
+
+            // Have we reached the specified maximum cycle count (or executed the one instruction that was wanted)?
+            if (!unbounded && ((elapsed_cycles >= max_cycles) || m_stepping))
+            {
+                goto stop_emulation; // NOLINT: imported 3rd-party code
+            }
         }
 
     stop_emulation:
 
-        m_r = (m_r & 0x80) | (r & 0x7f);
+        m_cycle_count += elapsed_cycles;
+        m_trap_cycles = 0;
+
+        if (!unbounded)
+        {
+            m_cycles_left = (max_cycles > elapsed_cycles) ? max_cycles - elapsed_cycles : 0;
+        }
+
+        if constexpr (Accurate)
+        {
+            m_r = (m_r & 0x80) | (r & 0x7f);
+        }
         m_pc = m_effective_pc = pc & 0xffff;
 
         return elapsed_cycles;
@@ -2487,190 +3669,278 @@ namespace zcpm
         return test_cc(dd);
     }
 
-    uint8_t Processor::read_indirect_hl(uint16_t& pc, size_t& elapsed_cycles)
+    template <typename Memory, bool Cached, bool Prefixes, typename Cycles>
+    uint8_t Processor::read_indirect_hl(uint16_t& pc, Cycles& elapsed_cycles)
     {
         uint8_t x;
-        if (is_default_table())
+        if (is_default_table<Prefixes>())
         {
-            x = m_memory.read_byte(reg_hl(), elapsed_cycles);
+            x = memory_as<Memory>().read_byte(reg_hl(), elapsed_cycles);
         }
         else
         {
-            auto d = static_cast<int>(m_memory.read_byte_step(pc, elapsed_cycles));
-            d += HL_IX_IY();
-            x = m_memory.read_byte(d, elapsed_cycles);
+            auto d = static_cast<int>(fetch_byte_step<Memory, Cached>(pc, elapsed_cycles));
+            d += HL_IX_IY<Prefixes>();
+            x = memory_as<Memory>().read_byte(d, elapsed_cycles);
             elapsed_cycles += 5;
         }
         return x;
     }
 
+    void Processor::set_flags(FlagsOp op, uint8_t a, uint8_t x, int z, uint8_t extra)
+    {
+        m_pending_flags = { op, a, x, extra, z };
+        if (!m_lazy_flags)
+        {
+            materialize_flags();
+        }
+    }
+
+    void Processor::materialize_flags()
+    {
+        if (m_pending_flags.op != FlagsOp::NONE)
+        {
+            m_registers.byte[Reg8::F] = compute_flags();
+            m_pending_flags.op = FlagsOp::NONE;
+        }
+    }
+
+    uint8_t Processor::compute_flags() const
+    {
+        if (m_intel8080)
+        {
+            return compute_8080_flags();
+        }
+
+        const auto& p = m_pending_flags;
+        switch (p.op)
+        {
+        case FlagsOp::NONE: return m_registers.byte[Reg8::F];
+
+        case FlagsOp::ADD:
+        {
+            const int c = p.a ^ p.x ^ p.z;
+            int f = c & H_FLAG_MASK;
+            f |= SZYX_FLAGS_TABLE[p.z & 0xff];
+            f |= OVERFLOW_TABLE[c >> 7];
+            f |= p.z >> (8 - C_FLAG_BIT);
+            return f;
+        }
+
+        case FlagsOp::SUB:
+        {
+            int c = p.a ^ p.x ^ p.z;
+            int f = N_FLAG_MASK | (c & H_FLAG_MASK);
+            f |= SZYX_FLAGS_TABLE[p.z & 0xff];
+            c &= 0x0180;
+            f |= OVERFLOW_TABLE[c >> 7];
+            f |= c >> (8 - C_FLAG_BIT);
+            return f;
+        }
+
+        case FlagsOp::CP:
+        {
+            int c = p.a ^ p.x ^ p.z;
+            int f = N_FLAG_MASK | (c & H_FLAG_MASK);
+            f |= SZYX_FLAGS_TABLE[p.z & 0xff] & SZ_FLAG_MASK;
+            f |= p.x & YX_FLAG_MASK;
+            c &= 0x0180;
+            f |= OVERFLOW_TABLE[c >> 7];
+            f |= c >> (8 - C_FLAG_BIT);
+            return f;
+        }
+
+        case FlagsOp::INC:
+        case FlagsOp::DEC:
+        {
+            const int c = p.x ^ p.z;
+            int f = (p.op == FlagsOp::DEC) ? (N_FLAG_MASK | p.extra) : p.extra;
+            f |= c & H_FLAG_MASK;
+            f |= SZYX_FLAGS_TABLE[p.z & 0xff];
+            f |= OVERFLOW_TABLE[(c >> 7) & 0x03];
+            return f;
+        }
+
+        case FlagsOp::LOGIC: return SZYXP_FLAGS_TABLE[p.z & 0xff] | p.extra;
+        }
+
+        return m_registers.byte[Reg8::F];
+    }
+
+    uint8_t Processor::compute_8080_flags() const
+    {
+        // P is always parity, and the auxiliary carry (in place of H) is inverted for subtraction and decrements. AND
+        // sets it from bit 3 of its operands.
+        const auto& p = m_pending_flags;
+        const uint8_t szp = SZYXP_FLAGS_TABLE[p.z & 0xff] & SZPV_FLAG_MASK;
+        switch (p.op)
+        {
+        case FlagsOp::NONE: return m_registers.byte[Reg8::F];
+
+        case FlagsOp::ADD: return flags_8080(szp | ((p.a ^ p.x ^ p.z) & H_FLAG_MASK) | ((p.z >> 8) & C_FLAG_MASK));
+
+        case FlagsOp::SUB:
+        case FlagsOp::CP:
+        {
+            const int c = p.a ^ p.x ^ p.z;
+            return flags_8080(szp | (~c & H_FLAG_MASK) | ((c >> 8) & C_FLAG_MASK));
+        }
+
+        case FlagsOp::INC: return flags_8080(szp | (((p.z & 0x0f) == 0x00) ? H_FLAG_MASK : 0) | p.extra);
+
+        case FlagsOp::DEC: return flags_8080(szp | (((p.z & 0x0f) != 0x0f) ? H_FLAG_MASK : 0) | p.extra);
+
+        case FlagsOp::LOGIC:
+        {
+            const uint8_t h = (p.extra & H_FLAG_MASK) ? (((p.a | p.x) << 1) & H_FLAG_MASK) : 0;
+            return flags_8080(szp | h | (p.extra & C_FLAG_MASK));
+        }
+        }
+
+        return m_registers.byte[Reg8::F];
+    }
+
+    uint8_t Processor::carry_flag() const
+    {
+        const auto& p = m_pending_flags;
+        switch (p.op)
+        {
+        case FlagsOp::NONE: return m_registers.byte[Reg8::F] & C_FLAG_MASK;
+        case FlagsOp::ADD: return (p.z >> 8) & C_FLAG_MASK;
+        case FlagsOp::SUB:
+        case FlagsOp::CP: return ((p.a ^ p.x ^ p.z) >> 8) & C_FLAG_MASK;
+        case FlagsOp::INC:
+        case FlagsOp::DEC:
+        case FlagsOp::LOGIC: return p.extra & C_FLAG_MASK;
+        }
+
+        return 0;
+    }
+
     void Processor::op_add(uint8_t x)
     {
         const uint8_t a = reg_a();
-        int z = a + x;
-        int c = a ^ x ^ z;
-        int f = c & H_FLAG_MASK;
-        f |= SZYX_FLAGS_TABLE[z & 0xff];
-        f |= OVERFLOW_TABLE[c >> 7];
-        f |= z >> (8 - C_FLAG_BIT);
+        const int z = a + x;
         reg_a() = z;
-        reg_f() = f;
+        set_flags(FlagsOp::ADD, a, x, z);
     }
 
     void Processor::op_adc(uint8_t x)
     {
         const uint8_t a = reg_a();
-        int z = a + x + (reg_f() & C_FLAG_MASK);
-        int c = a ^ x ^ z;
-        int f = c & H_FLAG_MASK;
-        f |= SZYX_FLAGS_TABLE[z & 0xff];
-        f |= OVERFLOW_TABLE[c >> 7];
-        f |= z >> (8 - C_FLAG_BIT);
+        const int z = a + x + carry_flag();
         reg_a() = z;
-        reg_f() = f;
+        set_flags(FlagsOp::ADD, a, x, z);
     }
 
     void Processor::op_sub(uint8_t x)
     {
         const uint8_t a = reg_a();
-        int z = a - x;
-        int c = a ^ x ^ z;
-        int f = N_FLAG_MASK | (c & H_FLAG_MASK);
-        f |= SZYX_FLAGS_TABLE[z & 0xff];
-        c &= 0x0180;
-        f |= OVERFLOW_TABLE[c >> 7];
-        f |= c >> (8 - C_FLAG_BIT);
+        const int z = a - x;
         reg_a() = z;
-        reg_f() = f;
+        set_flags(FlagsOp::SUB, a, x, z);
     }
 
     void Processor::op_sbc(uint8_t x)
     {
         const uint8_t a = reg_a();
-        int z = a - x - (reg_f() & C_FLAG_MASK);
-        int c = a ^ x ^ z;
-        int f = N_FLAG_MASK | (c & H_FLAG_MASK);
-        f |= SZYX_FLAGS_TABLE[z & 0xff];
-        c &= 0x0180;
-        f |= OVERFLOW_TABLE[c >> 7];
-        f |= c >> (8 - C_FLAG_BIT);
+        const int z = a - x - carry_flag();
         reg_a() = z;
-        reg_f() = f;
+        set_flags(FlagsOp::SUB, a, x, z);
     }
 
     void Processor::op_and(uint8_t x)
     {
-        reg_f() = SZYXP_FLAGS_TABLE[reg_a() &= x] | H_FLAG_MASK;
+        const uint8_t a = reg_a();
+        set_flags(FlagsOp::LOGIC, a, x, reg_a() &= x, H_FLAG_MASK);
     }
 
     void Processor::op_or(uint8_t x)
     {
-        reg_f() = SZYXP_FLAGS_TABLE[reg_a() |= x];
+        set_flags(FlagsOp::LOGIC, 0, 0, reg_a() |= x);
     }
 
     void Processor::op_xor(uint8_t x)
     {
-        reg_f() = SZYXP_FLAGS_TABLE[reg_a() ^= x];
+        set_flags(FlagsOp::LOGIC, 0, 0, reg_a() ^= x);
     }
 
     void Processor::op_cp(uint8_t x)
     {
         const uint8_t a = reg_a();
-        int z = a - x;
-
-        int c = a ^ x ^ z;
-        int f = N_FLAG_MASK | (c & H_FLAG_MASK);
-        f |= SZYX_FLAGS_TABLE[z & 0xff] & SZ_FLAG_MASK;
-        f |= x & YX_FLAG_MASK;
-        c &= 0x0180;
-        f |= OVERFLOW_TABLE[c >> 7];
-        f |= c >> (8 - C_FLAG_BIT);
-
-        reg_f() = f;
+        set_flags(FlagsOp::CP, a, x, a - x);
     }
 
     void Processor::op_inc(uint8_t& x)
     {
-        int z = x + 1;
-        int c = x ^ z;
-
-        int f = reg_f() & C_FLAG_MASK;
-        f |= c & H_FLAG_MASK;
-        f |= SZYX_FLAGS_TABLE[z & 0xff];
-        f |= OVERFLOW_TABLE[(c >> 7) & 0x03];
-
+        const uint8_t old = x;
+        const int z = x + 1;
         x = z;
-        reg_f() = f;
+        set_flags(FlagsOp::INC, 0, old, z, carry_flag());
     }
 
     void Processor::op_dec(uint8_t& x)
     {
-        int z = x - 1;
-        int c = x ^ z;
-
-        int f = N_FLAG_MASK | (reg_f() & C_FLAG_MASK);
-        f |= c & H_FLAG_MASK;
-        f |= SZYX_FLAGS_TABLE[z & 0xff];
-        f |= OVERFLOW_TABLE[(c >> 7) & 0x03];
-
+        const uint8_t old = x;
+        const int z = x - 1;
         x = z;
-        reg_f() = f;
+        set_flags(FlagsOp::DEC, 0, old, z, carry_flag());
     }
 
     void Processor::op_rlc(uint8_t& x)
     {
         const uint8_t c = x >> 7;
         x = (x << 1) | c;
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
     void Processor::op_rl(uint8_t& x)
     {
         const uint8_t c = x >> 7;
-        x = (x << 1) | (reg_f() & C_FLAG_MASK);
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        x = (x << 1) | carry_flag();
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
     void Processor::op_rrc(uint8_t& x)
     {
         const uint8_t c = x & 0x01;
         x = (x >> 1) | (c << 7);
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
     void Processor::op_rr_instruction(uint8_t& x)
     {
         const uint8_t c = x & 0x01;
-        x = (x >> 1) | ((reg_f() & C_FLAG_MASK) << 7);
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        x = (x >> 1) | (carry_flag() << 7);
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
     void Processor::op_sla(uint8_t& x)
     {
         const uint8_t c = x >> 7;
         x <<= 1;
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
     void Processor::op_sll(uint8_t& x)
     {
         const uint8_t c = x >> 7;
         x = (x << 1) | 0x01;
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
     void Processor::op_sra(uint8_t& x)
     {
         const uint8_t c = x & 0x01;
         x = static_cast<signed char>(x) >> 1;
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
     void Processor::op_srl(uint8_t& x)
     {
         const uint8_t c = x & 0x01;
         x >>= 1;
-        reg_f() = SZYXP_FLAGS_TABLE[x & 0xff] | c;
+        set_flags(FlagsOp::LOGIC, 0, 0, x, c);
     }
 
 } // namespace zcpm
@@ -1,11 +1,18 @@
 #pragma once
 
+#include "blockcache.hpp"
+#include "cpu.hpp"
 #include "debugaction.hpp"
+#include "engine.hpp"
 #include "idebuggable.hpp"
 #include "imemory.hpp"
+#include "profiler.hpp"
+#include "tracerecorder.hpp"
+#include "translationcache.hpp"
+#include "uncounted.hpp"
 
+#include <array>
 #include <cstdint>
-#include <map>
 #include <memory>
 #include <ostream>
 #include <vector>
@@ -13,6 +20,7 @@
 namespace zcpm
 {
 
+    class Hardware;
     class Registers;
 
     // TODO: Not sure about the best name for this; it's not a true Observer?
@@ -27,15 +35,14 @@ namespace zcpm
         IProcessorObserver& operator=(const IProcessorObserver& other) = delete;
         IProcessorObserver& operator=(IProcessorObserver&& other) = delete;
 
-        // Can be used from user-supplied handlers to stop execution
+        // Called by the processor when it stops execution; can also be used from user-supplied handlers to stop
+        // execution (which needs to be passed on to Processor::set_finished)
         virtual void set_finished(bool finished) = 0;
 
-        // Are we still meant to be running? (i.e., stop() hasn't yet been called)
-        [[nodiscard]] virtual bool running() const = 0;
-
-        // Check if the specified address is within our custom BIOS implementation (and hence should be intercepted). If
-        // so, works out what the intercepted BIOS call is trying to do and does whatever is needed, and then allows the
-        // caller to return to normal processing. Returns true if BIOS was intercepted.
+        // Check if the specified address is within our custom BIOS implementation (and hence should be intercepted).
+        // If so, works out what the intercepted BIOS call is trying to do and does whatever is needed, and then allows
+        // the caller to return to normal processing. Returns true if BIOS was intercepted. This is only called for
+        // addresses which have been registered with Processor::add_trap.
         virtual bool check_and_handle_bdos_and_bios(uint16_t address) const = 0;
     };
 
@@ -44,6 +51,9 @@ namespace zcpm
     public:
         Processor(IMemory& memory, IProcessorObserver& processor_observer);
 
+        // As above, but knowing the concrete memory implementation lets the processor access it without virtual calls
+        explicit Processor(Hardware& hardware);
+
         Processor(const Processor&) = delete;
         Processor& operator=(const Processor&) = delete;
         Processor(Processor&&) = delete;
@@ -54,11 +64,122 @@ namespace zcpm
         // Initialise processor's state to power-on default
         void reset_state();
 
+        // Everything about the processor which a program can observe, in a form which can be saved and later restored
+        // (see Snapshot); this is plain data, so that it can be copied as is
+        struct State
+        {
+            std::array<uint16_t, 7> registers; // Indexed by Reg16
+            std::array<uint16_t, 4> alternates;
+            uint16_t i;
+            uint16_t r;
+            uint16_t pc;
+            uint16_t iff1;
+            uint16_t iff2;
+            uint8_t im;
+            bool halted;
+            uint64_t cycle_count;
+        };
+        [[nodiscard]] State get_state() const;
+        void set_state(const State& state);
+
+        // Select how instructions are decoded & executed; by default the processor is a plain interpreter
+        void set_engine(Engine engine);
+
+        // Select which processor is emulated; as an 8080, the interpreter has no prefix handling and computes 8080
+        // flags, and any Z80-only instruction is an error (the exception says which, and where)
+        void set_cpu(Cpu cpu);
+
+        // Select whether the flags are computed after every instruction (the default), or only when something needs
+        // them. Either way the flags seen by the emulated program are identical.
+        void set_lazy_flags(bool lazy);
+
+        // Select whether unbounded runs (see emulate()) count cycles and emulate the refresh register, or skip both for
+        // speed, in which case the cycle count doesn't advance and R only changes when it is read. Bounded runs (and
+        // hence single steps, interrupts and any run with scheduled events) always take the accurate path.
+        void set_fast(bool fast);
+
+        // Start profiling execution (see Profiler). Every instruction is then recorded as it completes, so this rules
+        // out translated code and wants accurate cycle counts (i.e. not set_fast(true)). There's no cost at all until
+        // this is called.
+        void enable_profiler();
+
+        // The profile so far, if enable_profiler() has been called (otherwise nullptr)
+        [[nodiscard]] const Profiler* profiler() const
+        {
+            return m_pprofiler.get();
+        }
+
+        // Start recording each instruction as it completes (see TraceRecorder), keeping the most recent 'capacity' of
+        // them and discarding any earlier recording. Like profiling, this rules out translated code while it lasts.
+        void start_recording(size_t capacity);
+
+        // Stop recording, keeping what has been recorded so far
+        void stop_recording();
+
+        // The recording, if start_recording() has been called (otherwise nullptr)
+        [[nodiscard]] const TraceRecorder* recorder() const
+        {
+            return m_precorder.get();
+        }
+
+        // Must be called after any modification of emulated memory, so that any cached decoding of it is discarded
+        void invalidate_code(uint16_t address, size_t count = 1)
+        {
+            if (m_pblock_cache)
+            {
+                m_pblock_cache->invalidate(address, count);
+            }
+            if (m_ptranslation_cache)
+            {
+                m_ptranslation_cache->invalidate(address, count);
+            }
+            if (m_recording)
+            {
+                m_precorder->add_write(address, count);
+            }
+        }
+
+        // Mark addresses at which the observer's check_and_handle_bdos_and_bios() needs to be called, or unmark them
+        void add_trap(uint16_t base, size_t count = 1);
+        void remove_trap(uint16_t base, size_t count = 1);
+        [[nodiscard]] bool has_trap(uint16_t address) const;
+
+        // Are there any debug actions which execution reaching the specified address would evaluate? (That is,
+        // breakpoints or passpoints, rather than memory watches.)
+        [[nodiscard]] bool has_debug_action(uint16_t address) const;
+
+        // Request that execution stops at the next instruction (or, with false, clear such a request)
+        void set_finished(bool finished);
+
+        // Called from within check_and_handle_bdos_and_bios() to have the instruction at the trap address behave as a
+        // RET, for when the observer has done all that the code there would have done
+        void return_from_trap();
+
+        // Are we still meant to be running? (i.e., set_finished(true) hasn't been called)
+        [[nodiscard]] bool running() const;
+
+        // Total number of cycles executed. While running, this is only brought up to date when the observer is called
+        // to handle a trap, so is accurate from within check_and_handle_bdos_and_bios() (and hence for BIOS calls).
+        [[nodiscard]] size_t get_cycle_count() const;
+
+        // Is the cycle count being kept? It isn't while running in fast mode (see set_fast), when get_cycle_count()
+        // doesn't advance.
+        [[nodiscard]] bool is_counting_cycles() const;
+
+        // Called by the memory implementation when a watchpoint address (see IMemory::add_watchpoint) is accessed
+        void check_watchpoint(uint16_t address);
+
+        // Add cycles which passed without any instructions being executed (i.e. while halted)
+        void add_idle_cycles(size_t cycles);
+
         // Trigger an interrupt according to the current interrupt mode and return the number of cycles elapsed to
         // accept it. If maskable interrupts are disabled, this will return zero. In interrupt mode 0, data_on_bus must
         // be a single byte opcode
         size_t interrupt(uint8_t data_on_bus);
 
+        // Would a maskable interrupt be accepted?
+        [[nodiscard]] bool interrupts_enabled() const;
+
         // Trigger a non-maskable interrupt, then return the number of cycles elapsed to accept it
         size_t non_maskable_interrupt();
 
@@ -66,10 +187,27 @@ namespace zcpm
         // Returns the number of cycles consumed
         size_t emulate();
 
+        // Execute instructions until completion, a breakpoint, a HALT, or at least max_cycles have been consumed
+        // Returns the number of cycles consumed
+        size_t emulate_for(size_t max_cycles);
+
+        // Has a HALT been executed, with no interrupt accepted since?
+        [[nodiscard]] bool is_halted() const;
+
         // Execute a single instruction
         // Returns the number of cycles consumed
         size_t emulate_instruction();
 
+        // Execute a single instruction just as it would be executed by emulate_for(max_cycles), so that a repeated
+        // block instruction or a HALT stops where it would there (but without evaluating any debug actions)
+        // Returns the number of cycles consumed
+        size_t emulate_step(size_t max_cycles);
+
+        // How many of the cycles given to the latest emulate_for() or emulate_step() were still to go when it stopped;
+        // zero if it would have stopped there anyway. (A DI or EI gives it a few more, so that the next instruction is
+        // executed before an interrupt can be accepted.)
+        [[nodiscard]] size_t get_cycles_left() const;
+
         // Individual read-only getters for registers
         [[nodiscard]] uint8_t get_a() const;
         [[nodiscard]] uint8_t get_f() const;
@@ -106,9 +244,7 @@ namespace zcpm
         // Implementation of IDebuggable
 
         Registers get_registers() const override;
-        std::tuple<uint8_t, uint8_t, uint8_t, uint8_t, std::vector<uint8_t>> get_opcodes_at(
-            uint16_t pc,
-            uint16_t offset) const override;
+        Opcodes get_opcodes_at(uint16_t address) const override;
         void add_action(std::unique_ptr<DebugAction> p_action) override;
         void show_actions(std::ostream& os) const override;
         bool remove_action(size_t index) override;
@@ -165,33 +301,108 @@ namespace zcpm
         };
         InterruptMode m_im{ InterruptMode::IM0 };
 
-        // Register decoding tables
-        void *m_register_table[16]{}, *m_dd_register_table[16]{}, *m_fd_register_table[16]{};
-
+        // Without Prefixes (as for the 8080, which has no DD/FD prefixes) the default table is known to be the current
+        // one, so that the lookups through it can be resolved at compile time
+        template <bool Prefixes = true>
         bool is_default_table() const;
         void set_default_table();
         void set_dd();
         void set_fd();
 
-        // Access registers via indirection tables. S() is for the special cases "LD H/L, (IX/Y + d)"
+        // Access registers via the decoding tables. S() is for the special cases "LD H/L, (IX/Y + d)"
         // and "LD (IX/Y + d), H/L".
-        [[nodiscard]] uint8_t& R(int r) const;
-        [[nodiscard]] uint8_t& S(int s) const;
-        [[nodiscard]] uint16_t& RR(int rr) const;
-        [[nodiscard]] uint16_t& SS(int ss) const;
-        [[nodiscard]] uint16_t& HL_IX_IY() const;
+        template <bool Prefixes = true>
+        [[nodiscard]] uint8_t& R(int r);
+        [[nodiscard]] uint8_t& S(int s);
+        template <bool Prefixes = true>
+        [[nodiscard]] uint16_t& RR(int rr);
+        template <bool Prefixes = true>
+        [[nodiscard]] uint16_t& SS(int ss);
+        template <bool Prefixes = true>
+        [[nodiscard]] uint16_t& HL_IX_IY();
+
+        void select_table(RegisterTable table);
+
+        // What needs to happen after checking for a trap
+        enum class TrapOutcome : uint8_t
+        {
+            CONTINUE, // Execute the instruction as normal
+            STOP,     // Stop execution
+            RETURN    // Execute a RET instead of the instruction
+        };
+
+        // Handle any trap at the current (effective) PC. The cycle count is that of the current emulate() call so far.
+        [[nodiscard]] TrapOutcome check_traps(size_t elapsed_cycles);
+
+        // Bulk implementations of LDIR/LDDR and CPIR/CPDR, for when the whole repeat is being executed. These work
+        // directly on the hardware's memory, and return the number of iterations performed (also setting the last byte
+        // transferred or compared), or zero if the instruction needs to be executed byte by byte instead.
+        size_t move_block(Hardware& hardware, bool increment, uint8_t& last);
+        size_t compare_block(const Hardware& hardware, bool increment, uint8_t& last);
+
+        // Evaluate all debug actions at the specified address which either are (or are not) memory watches, returning
+        // false if any of them wants execution to stop (typically to return to the debugger)
+        [[nodiscard]] bool evaluate_actions(uint16_t address, bool memory_watches) const;
+
+        // Add the instruction which has just completed (leaving 'next_pc' as the address of the next one) to the
+        // recording
+        void record_instruction(uint16_t next_pc);
+
+        // Execute translated code from the specified address for as long as possible, translating any code there once
+        // it has become hot. Returns false if nothing was executed, in which case the interpreter needs to take over.
+        template <typename Memory>
+        [[nodiscard]] bool run_translations(uint16_t& pc, size_t& elapsed_cycles, uint8_t& r);
+
+        // Translate the straight-line code starting at the specified address, returning nullptr if it can't be
+        template <typename Memory>
+        const Translation* translate(uint16_t address);
+
+        // Bind a single decoded instruction to a suitable handler, returning false if it can't be translated
+        template <typename Memory>
+        [[nodiscard]] bool bind_instruction(const DecodedInstruction& decoded, TranslatedOp& result);
+
+        // The 8-bit arithmetic or logical operation selected by the Y() field of an instruction
+        static auto alu_operation(uint8_t y) -> void (Processor::*)(uint8_t);
+
+        // Returns the memory implementation to be used by a particular instantiation of execute()
+        template <typename Memory>
+        [[nodiscard]] Memory& memory_as() const;
+
+        // Fetch operands of the current instruction; from the block cache if the instruction came from there, otherwise
+        // from memory. These are otherwise the same as the equivalent IMemory methods.
+        template <typename Memory, bool Cached>
+        [[nodiscard]] uint8_t fetch_byte(uint16_t pc) const;
+        template <typename Memory, bool Cached>
+        [[nodiscard]] uint16_t fetch_word(uint16_t pc) const;
+        template <typename Memory, bool Cached, typename Cycles>
+        [[nodiscard]] uint8_t fetch_byte_step(uint16_t& pc, Cycles& elapsed_cycles) const;
+        template <typename Memory, bool Cached, typename Cycles>
+        [[nodiscard]] uint16_t fetch_word_step(uint16_t& pc, Cycles& elapsed_cycles) const;
 
         // Run until either a breakpoint or termination or elapsed_cycles (+emulated cycles) >= max_cycles.
         // Using a 'max_cycles' value of zero is equivalent to emulating a single instruction.
         // 'unbounded' means to run continuously until a HALT or similar is encountered.
         size_t emulate(uint8_t opcode, bool unbounded, size_t elapsed_cycles = 0, size_t max_cycles = 0);
 
+        // The rest of emulate(), once the CPU has been chosen
+        template <bool Intel8080>
+        size_t emulate_as(uint8_t opcode, bool unbounded, size_t elapsed_cycles, size_t max_cycles);
+
+        // The implementation of emulate(). This is instantiated for each combination of memory implementation (the
+        // generic IMemory, or the concrete Hardware, which allows memory accesses to be inlined), whether or not the
+        // block cache is used, whether cycles and R are counted (Accurate) or not (only for unbounded runs on a
+        // Hardware, see set_fast), and whether it is an 8080 (see set_cpu), so that the common cases don't pay for the
+        // flexibility.
+        template <typename Memory, bool Cached, bool Accurate, bool Intel8080>
+        size_t execute(uint8_t opcode, bool unbounded, size_t elapsed_cycles, size_t max_cycles);
+
         // Helper methods which were originally macros which accessed global data. As a result some of these have
         // somewhat ugly signatures & semantics, but that's because they're gradually being changed from macros which
         // use other macros and globals into something eventually better.
         bool test_cc(uint8_t cc);
         bool test_dd(uint8_t dd);
-        uint8_t read_indirect_hl(uint16_t& pc, size_t& elapsed_cycles);
+        template <typename Memory, bool Cached, bool Prefixes, typename Cycles>
+        uint8_t read_indirect_hl(uint16_t& pc, Cycles& elapsed_cycles);
         void op_add(uint8_t x);
         void op_adc(uint8_t x);
         void op_sub(uint8_t x);
@@ -211,18 +422,108 @@ namespace zcpm
         void op_sra(uint8_t& x);
         void op_srl(uint8_t& x);
 
-        // Current register decoding table, use it to determine if the current instruction is prefixed. It points to:
-        //   m_dd_register_table for 0xdd prefixes;
-        //   m_fd_register_table for 0xfd prefixes;
-        //   m_register_table otherwise.
-        void** m_current_register_table;
+        // The kinds of operation whose flags can be deferred, where the flags are entirely determined by the operands
+        // and result that are recorded in PendingFlags
+        enum class FlagsOp : uint8_t
+        {
+            NONE,  // Nothing is pending, F is up to date
+            ADD,   // ADD/ADC; a + x (+ carry) = z
+            SUB,   // SUB/SBC; a - x (- carry) = z
+            CP,    // As SUB, except that X/Y come from the operand
+            INC,   // x + 1 = z, with the old carry preserved in 'extra'
+            DEC,   // x - 1 = z, with the old carry preserved in 'extra'
+            LOGIC, // Logical operations and shifts; S/Z/Y/X/P from z, plus H or C in 'extra' (AND also records a & x)
+        };
+
+        struct PendingFlags
+        {
+            FlagsOp op;
+            uint8_t a;
+            uint8_t x;
+            uint8_t extra;
+            int z;
+        };
+
+        // Record the flags that an operation would set, computing them now unless lazy flags are enabled
+        void set_flags(FlagsOp op, uint8_t a, uint8_t x, int z, uint8_t extra = 0);
+
+        // Compute F (if pending) and store it, so that F can be read or written directly
+        void materialize_flags();
+
+        // The current value of F, allowing for any pending flags
+        [[nodiscard]] uint8_t compute_flags() const;
+
+        // As compute_flags(), for an 8080
+        [[nodiscard]] uint8_t compute_8080_flags() const;
+
+        // The current value of the carry flag, which is much cheaper than computing all of F
+        [[nodiscard]] uint8_t carry_flag() const;
+
+        bool m_lazy_flags{ false };
+        bool m_fast{ false };
+        bool m_counting_cycles{ true }; // False for the duration of a fast mode run
+        bool m_stepping{ false };       // True for the duration of emulate_step()
+        size_t m_cycles_left{ 0 };      // See get_cycles_left()
+        bool m_intel8080{ false };
+        PendingFlags m_pending_flags{};
+
+        // Current register decoding table (one of the compile-time REGISTER_INDEX_TABLES), use it to determine if the
+        // current instruction is prefixed. It points to the DD table for 0xdd prefixes, the FD table for 0xfd prefixes,
+        // and the default table otherwise.
+        const std::array<uint8_t, 16>* m_pregister_indexes;
 
         IMemory& m_memory;
         IProcessorObserver& m_processor_observer;
 
-        // Use an ordered map to make displaying of actions nicer. Given that we don't expect to have more than a few
-        // actions defined at any one time, the performance improvements of unordered_map aren't an issue here.
-        std::multimap<uint16_t, std::unique_ptr<DebugAction>> m_debug_actions;
+        // The same object as m_memory if we were constructed with a Hardware, otherwise nullptr
+        Hardware* m_phardware{ nullptr };
+
+        // Only present when the block cache engine is in use
+        std::unique_ptr<BlockCache> m_pblock_cache;
+
+        // Only present when the translating engine is in use (which also uses the block cache)
+        std::unique_ptr<TranslationCache> m_ptranslation_cache;
+
+        // If the current instruction came from the block cache, this is its decoded form (otherwise nullptr)
+        const DecodedInstruction* m_pdecoded{ nullptr };
+
+        // Only present when profiling
+        std::unique_ptr<Profiler> m_pprofiler;
+
+        // Present once recording has started, and kept after it stops so that the history can still be seen
+        std::unique_ptr<TraceRecorder> m_precorder;
+        bool m_recording{ false };
+
+        // All debug actions, kept in order of address (and then in order of creation) to make displaying of actions
+        // nicer. Executing code only looks at these when the trap table flags an address as having actions.
+        std::vector<std::unique_ptr<DebugAction>> m_debug_actions;
+
+        // Flags in the trap table
+        enum Trap : uint8_t
+        {
+            TRAP_STOP = 0x01,     // Execution terminates on reaching this address
+            TRAP_OBSERVER = 0x02, // The observer wants to intercept BDOS/BIOS calls here
+            TRAP_DEBUG = 0x04,    // One or more debug actions are defined here
+            TRAP_PROFILE = 0x08,  // Set everywhere while profiling, so that each instruction is recorded
+            TRAP_RECORD = 0x10    // Set everywhere while recording, so that each instruction is kept in the history
+        };
+
+        // For each address, the reasons (if any) that the processor needs to do more than just execute the instruction
+        // there. This means that the common case only costs a table lookup.
+        std::array<uint8_t, 0x10000> m_traps{};
+
+        // Set to request that execution stops
+        bool m_finished{ false };
+
+        // Set by a HALT, until an interrupt is accepted
+        bool m_halted{ false };
+
+        // Set by return_from_trap()
+        bool m_return_from_trap{ false };
+
+        // Cycles executed by completed calls of emulate(), and by the current call as of the latest observer trap
+        size_t m_cycle_count{ 0 };
+        size_t m_trap_cycles{ 0 };
     };
 
 } // namespace zcpm
@@ -5,14 +5,100 @@
 #include <array>
 #include <cstdint>
 
-// Lookup tables used by the Z80 processor implementation.  These are only ever used within processor.cpp but they
-// are defined in this header to make maintenance easier; this header content should very rarely need changes,
-// whereas changes to processor.cpp are more likely.
+// Lookup tables used by the Z80 processor implementation.  These are only ever used within processor.cpp and
+// blockcache.cpp but they are defined in this header to make maintenance easier; this header content should very
+// rarely need changes, whereas changes to processor.cpp are more likely.
 
 namespace zcpm
 {
 
-    inline static const std::array<uint8_t, 256> INSTRUCTION_TABLE = {
+    // Register definitions. These are used as indexes into an array; the first enum Reg8 indexes into one view of a
+    // union to that array, the second enum Reg16 indexes into another view of that union into that array. For that
+    // reason it's not an 'enum class'.
+
+    // clang-format off
+    enum Reg8 : uint8_t
+    {
+        C, B, E, D, L, H, F, A,
+        IXL, IXH,
+        IYL, IYH,
+        // No 8-bit access to SP
+    };
+
+    enum Reg16 : uint8_t
+    {
+        BC, DE, HL, AF,
+        IX, IY,
+        SP
+    };
+    // clang-format on
+
+    // Register decoding tables for both 3-bit encoded 8-bit registers and 2-bit encoded 16-bit registers. Entries 0-7
+    // are the 8-bit "R" registers, which are indexes into the byte view of the registers, except for entry 6; that
+    // encoding is used for indexed memory operands and direct HL or IX/IY register access, so it is an index into the
+    // word view. Entries 8-11 are the "regular" 16-bit "RR" registers, and 12-15 the "SS" registers for PUSH and POP
+    // (where SP is replaced by AF), both of which are indexes into the word view.
+    using RegisterIndexes = std::array<uint8_t, 16>;
+
+    constexpr RegisterIndexes make_register_indexes(Reg8 h, Reg8 l, Reg16 hl)
+    {
+        // clang-format off
+        return { Reg8::B, Reg8::C, Reg8::D, Reg8::E, h, l, hl, Reg8::A,
+                 Reg16::BC, Reg16::DE, hl, Reg16::SP,
+                 Reg16::BC, Reg16::DE, hl, Reg16::AF };
+        // clang-format on
+    }
+
+    // The register decoding tables in the same order as RegisterTable; when an opcode is prefixed by 0xdd, HL is
+    // replaced by IX, and when 0xfd prefixed, HL is replaced by IY.
+    inline constexpr std::array<RegisterIndexes, 3> REGISTER_INDEX_TABLES = {
+        make_register_indexes(Reg8::H, Reg8::L, Reg16::HL),
+        make_register_indexes(Reg8::IXH, Reg8::IXL, Reg16::IX),
+        make_register_indexes(Reg8::IYH, Reg8::IYL, Reg16::IY),
+    };
+
+    // For each opcode, is it affected by a preceding 0xdd or 0xfd prefix? (If not, the prefix is ignored.)
+    inline constexpr std::array<bool, 256> DD_FD_PREFIXABLE_TABLE = [] {
+        std::array<bool, 256> result{};
+        // clang-format off
+        for (const uint8_t opcode : {
+            0x09,
+            0x19,
+            0x21, 0x22, 0x23, 0x24, 0x25, 0x26,             0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e,
+            0x34, 0x35, 0x36,             0x39,
+            0x44, 0x45, 0x46,                               0x4c, 0x4d, 0x4e,
+            0x54, 0x55, 0x56,                               0x5c, 0x5d, 0x5e,
+            0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+            0x70, 0x71, 0x72, 0x73, 0x74, 0x75,       0x77,                         0x7c, 0x7d, 0x7e,
+            0x84, 0x85, 0x86,                               0x8c, 0x8d, 0x8e,
+            0x94, 0x95, 0x96,                               0x9c, 0x9d, 0x9e,
+            0xa4, 0xa5, 0xa6,                               0xac, 0xad, 0xae,
+            0xb4, 0xb5, 0xb6,                               0xbc, 0xbd, 0xbe,
+            0xcb,
+            0xe1,       0xe3,       0xe5,                   0xe9,
+            0xf9 })
+        // clang-format on
+        {
+            result[opcode] = true;
+        }
+        return result;
+    }();
+
+    // For each unprefixed opcode, is it an instruction (or prefix) that the 8080 doesn't have?
+    inline constexpr std::array<bool, 256> Z80_ONLY_TABLE = [] {
+        std::array<bool, 256> result{};
+        // clang-format off
+        for (const uint8_t opcode : {
+            0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38,
+            0xcb, 0xd9, 0xdd, 0xed, 0xfd })
+        // clang-format on
+        {
+            result[opcode] = true;
+        }
+        return result;
+    }();
+
+    inline constexpr std::array<uint8_t, 256> INSTRUCTION_TABLE = {
         NOP,
         LD_RR_NN,
         LD_INDIRECT_BC_A,
@@ -271,7 +357,7 @@ namespace zcpm
         RST_P,
     };
 
-    inline static const std::array<uint8_t, 256> CB_INSTRUCTION_TABLE = {
+    inline constexpr std::array<uint8_t, 256> CB_INSTRUCTION_TABLE = {
         RLC_R,   RLC_R,   RLC_R,   RLC_R,   RLC_R,   RLC_R,   RLC_INDIRECT_HL,   RLC_R,
         RRC_R,   RRC_R,   RRC_R,   RRC_R,   RRC_R,   RRC_R,   RRC_INDIRECT_HL,   RRC_R,
         RL_R,    RL_R,    RL_R,    RL_R,    RL_R,    RL_R,    RL_INDIRECT_HL,    RL_R,
@@ -306,7 +392,7 @@ namespace zcpm
         SET_B_R, SET_B_R, SET_B_R, SET_B_R, SET_B_R, SET_B_R, SET_B_INDIRECT_HL, SET_B_R,
     };
 
-    inline static const std::array<uint8_t, 256> ED_INSTRUCTION_TABLE = {
+    inline constexpr std::array<uint8_t, 256> ED_INSTRUCTION_TABLE = {
         ED_UNDEFINED, ED_UNDEFINED,      ED_UNDEFINED, ED_UNDEFINED,      ED_UNDEFINED, ED_UNDEFINED,
         ED_UNDEFINED, ED_UNDEFINED,      ED_UNDEFINED, ED_UNDEFINED,      ED_UNDEFINED, ED_UNDEFINED,
         ED_UNDEFINED, ED_UNDEFINED,      ED_UNDEFINED, ED_UNDEFINED,      ED_UNDEFINED, ED_UNDEFINED,
@@ -352,7 +438,7 @@ namespace zcpm
         ED_UNDEFINED, ED_UNDEFINED,      ED_UNDEFINED, ED_UNDEFINED,
     };
 
-    inline static const std::array<uint8_t, 256> SZYX_FLAGS_TABLE = {
+    inline constexpr std::array<uint8_t, 256> SZYX_FLAGS_TABLE = {
         0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x20, 0x20, 0x20, 0x20,
         0x20, 0x20, 0x20, 0x20, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
@@ -370,7 +456,7 @@ namespace zcpm
         0xa8, 0xa8, 0xa8, 0xa8,
     };
 
-    inline static const std::array<uint8_t, 256> SZYXP_FLAGS_TABLE = {
+    inline constexpr std::array<uint8_t, 256> SZYXP_FLAGS_TABLE = {
         0x44, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x08, 0x0c, 0x0c, 0x08, 0x0c, 0x08, 0x08, 0x0c, 0x00, 0x04,
         0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x0c, 0x08, 0x08, 0x0c, 0x08, 0x0c, 0x0c, 0x08, 0x20, 0x24, 0x24, 0x20,
         0x24, 0x20, 0x20, 0x24, 0x2c, 0x28, 0x28, 0x2c, 0x28, 0x2c, 0x2c, 0x28, 0x24, 0x20, 0x20, 0x24, 0x20, 0x24,
@@ -0,0 +1,261 @@
+#include "profiler.hpp"
+
+#include "instructions.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <string_view>
+#include <utility>
+
+namespace
+{
+    // Calls nested more deeply than this are treated as jumps, so that code which calls without ever returning (or
+    // which switches stacks) can't make the shadow stack grow without limit
+    const size_t MaxDepth = 1024;
+
+    double percent(uint64_t part, uint64_t whole)
+    {
+        return (whole == 0) ? 0.0 : (100.0 * static_cast<double>(part) / static_cast<double>(whole));
+    }
+
+} // namespace
+
+namespace zcpm
+{
+
+    Profiler::Profiler()
+    {
+        m_nodes.push_back({ .entry = 0, .parent = 0, .children = {} });
+    }
+
+    void Profiler::record(uint16_t address, uint8_t instruction, uint16_t next, uint64_t cycles)
+    {
+        const auto elapsed = cycles - m_last_cycles;
+        m_last_cycles = cycles;
+
+        ++m_counts[address];
+        m_cycles[address] += elapsed;
+        m_nodes[m_stack.empty() ? 0 : m_stack.back().node].self_cycles += elapsed;
+
+        // A conditional CALL or RET was taken if it didn't simply fall through to the following instruction
+        switch (instruction)
+        {
+        case CALL_CC_NN:
+            if (next == static_cast<uint16_t>(address + 3))
+            {
+                break;
+            }
+            [[fallthrough]];
+        case CALL_NN: push(next, address + 3); break;
+        case RST_P: push(next, address + 1); break;
+        case RET_CC:
+            if (next == static_cast<uint16_t>(address + 1))
+            {
+                break;
+            }
+            [[fallthrough]];
+        case RET:
+        case RETI_RETN: pop(next); break;
+        default: break;
+        }
+    }
+
+    void Profiler::add_trap_time(uint16_t address, std::chrono::steady_clock::duration duration)
+    {
+        auto& trap_time = m_trap_times[address];
+        ++trap_time.calls;
+        trap_time.duration += duration;
+    }
+
+    void Profiler::push(uint16_t entry, uint16_t return_address)
+    {
+        if (m_stack.size() >= MaxDepth)
+        {
+            return;
+        }
+
+        const auto parent = m_stack.empty() ? 0 : m_stack.back().node;
+        const auto key = (static_cast<uint64_t>(parent) << 16) | entry;
+        auto it = m_lookup.find(key);
+        if (it == m_lookup.end())
+        {
+            const auto node = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.push_back({ .entry = entry, .parent = parent, .children = {} });
+            m_nodes[parent].children.push_back(node);
+            it = m_lookup.emplace(key, node).first;
+        }
+
+        ++m_nodes[it->second].calls;
+        m_stack.push_back({ it->second, return_address });
+    }
+
+    void Profiler::pop(uint16_t return_address)
+    {
+        // Return to the innermost frame which expects to return here; a RET that matches no frame (such as one used
+        // as a computed jump) is ignored, and one that matches an outer frame unwinds everything inside that
+        const auto it = std::find_if(m_stack.rbegin(), m_stack.rend(), [return_address](const Frame& frame) {
+            return frame.return_address == return_address;
+        });
+        if (it != m_stack.rend())
+        {
+            m_stack.erase(std::next(it).base(), m_stack.end());
+        }
+    }
+
+    uint64_t Profiler::inclusive_cycles(uint32_t node, std::vector<uint64_t>& inclusive) const
+    {
+        auto total = m_nodes[node].self_cycles;
+        for (const auto child : m_nodes[node].children)
+        {
+            total += inclusive_cycles(child, inclusive);
+        }
+        inclusive[node] = total;
+        return total;
+    }
+
+    void Profiler::write_report(std::ostream& os,
+                                const std::function<std::string(uint16_t)>& describe,
+                                const Regions& regions,
+                                size_t top) const
+    {
+        const auto total_count = std::accumulate(m_counts.begin(), m_counts.end(), uint64_t{ 0 });
+        const auto total_cycles = std::accumulate(m_cycles.begin(), m_cycles.end(), uint64_t{ 0 });
+        os << fmt::format("Profile of {:d} instructions, {:d} cycles\n", total_count, total_cycles);
+
+        // Split between the user's program, the BDOS and the BIOS, both in emulated cycles and in host time spent
+        // handling traps there
+        const std::array<std::string_view, 3> region_names{ "User", "BDOS", "BIOS" };
+        const auto region = [&regions](uint16_t address) -> size_t {
+            return (address >= regions.bios) ? 2 : ((address >= regions.bdos) ? 1 : 0);
+        };
+        std::array<uint64_t, 3> region_cycles{};
+        for (size_t a = 0; a < m_cycles.size(); ++a)
+        {
+            region_cycles[region(static_cast<uint16_t>(a))] += m_cycles[a];
+        }
+        std::array<TrapTime, 3> region_traps{};
+        for (const auto& [address, trap_time] : m_trap_times)
+        {
+            region_traps[region(address)].calls += trap_time.calls;
+            region_traps[region(address)].duration += trap_time.duration;
+        }
+        os << fmt::format("\n{:<6}{:>16}{:>8}{:>12}{:>14}\n", "Region", "Cycles", "%", "Traps", "Host ms");
+        for (size_t i = 0; i < region_names.size(); ++i)
+        {
+            os << fmt::format("{:<6}{:>16d}{:>8.1f}{:>12d}{:>14.3f}\n",
+                              region_names[i],
+                              region_cycles[i],
+                              percent(region_cycles[i], total_cycles),
+                              region_traps[i].calls,
+                              std::chrono::duration<double, std::milli>(region_traps[i].duration).count());
+        }
+
+        // Functions, merging every node of the call tree which has the same entry point; a function's inclusive cycles
+        // only count its outermost activation on any stack, so that recursion doesn't count the same cycles twice
+        struct Function
+        {
+            uint64_t inclusive{ 0 };
+            uint64_t self{ 0 };
+            uint64_t calls{ 0 };
+        };
+        std::vector<uint64_t> inclusive(m_nodes.size());
+        inclusive_cycles(0, inclusive);
+        std::unordered_map<uint16_t, Function> functions;
+        std::vector<uint32_t> active(0x10000);
+        const std::function<void(uint32_t)> visit = [&](uint32_t node) {
+            const auto entry = m_nodes[node].entry;
+            if (node != 0)
+            {
+                auto& function = functions[entry];
+                function.inclusive += (active[entry] == 0) ? inclusive[node] : 0;
+                function.self += m_nodes[node].self_cycles;
+                function.calls += m_nodes[node].calls;
+                ++active[entry];
+            }
+            for (const auto child : m_nodes[node].children)
+            {
+                visit(child);
+            }
+            if (node != 0)
+            {
+                --active[entry];
+            }
+        };
+        visit(0);
+
+        std::vector<std::pair<uint16_t, Function>> by_inclusive(functions.begin(), functions.end());
+        std::sort(by_inclusive.begin(), by_inclusive.end(), [](const auto& a, const auto& b) {
+            return (a.second.inclusive != b.second.inclusive) ? (a.second.inclusive > b.second.inclusive)
+                                                              : (a.first < b.first);
+        });
+        by_inclusive.resize(std::min(by_inclusive.size(), top));
+        os << fmt::format("\nTop {:d} functions, by inclusive cycles (top level: {:d} self cycles)\n",
+                          by_inclusive.size(),
+                          m_nodes[0].self_cycles);
+        os << fmt::format("{:>16}{:>8}{:>16}{:>8}{:>12}  {}\n", "Inclusive", "%", "Self", "%", "Calls", "Function");
+        for (const auto& [entry, function] : by_inclusive)
+        {
+            os << fmt::format("{:>16d}{:>8.1f}{:>16d}{:>8.1f}{:>12d}  {:04X} {}\n",
+                              function.inclusive,
+                              percent(function.inclusive, total_cycles),
+                              function.self,
+                              percent(function.self, total_cycles),
+                              function.calls,
+                              entry,
+                              describe(entry));
+        }
+
+        // Individual addresses
+        std::vector<uint16_t> hot;
+        for (size_t a = 0; a < m_counts.size(); ++a)
+        {
+            if (m_counts[a] > 0)
+            {
+                hot.push_back(static_cast<uint16_t>(a));
+            }
+        }
+        const auto hot_end = hot.begin() + static_cast<ptrdiff_t>(std::min(hot.size(), top));
+        std::partial_sort(hot.begin(), hot_end, hot.end(), [this](uint16_t a, uint16_t b) {
+            return (m_cycles[a] != m_cycles[b]) ? (m_cycles[a] > m_cycles[b]) : (a < b);
+        });
+        hot.erase(hot_end, hot.end());
+        os << fmt::format("\nTop {:d} addresses, by cycles\n", hot.size());
+        os << fmt::format("{:>16}{:>8}{:>16}  {}\n", "Cycles", "%", "Count", "Address");
+        for (const auto a : hot)
+        {
+            os << fmt::format("{:>16d}{:>8.1f}{:>16d}  {:04X} {}\n",
+                              m_cycles[a],
+                              percent(m_cycles[a], total_cycles),
+                              m_counts[a],
+                              a,
+                              describe(a));
+        }
+    }
+
+    void Profiler::write_collapsed_stacks(std::ostream& os, const std::function<std::string(uint16_t)>& describe) const
+    {
+        std::string stack = "[top]";
+        const std::function<void(uint32_t)> visit = [&](uint32_t node) {
+            const auto length = stack.size();
+            if (node != 0)
+            {
+                stack += ';';
+                stack += describe(m_nodes[node].entry);
+            }
+            if (m_nodes[node].self_cycles > 0)
+            {
+                os << stack << ' ' << m_nodes[node].self_cycles << '\n';
+            }
+            for (const auto child : m_nodes[node].children)
+            {
+                visit(child);
+            }
+            stack.resize(length);
+        };
+        visit(0);
+    }
+
+} // namespace zcpm
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zcpm
+{
+
+    // An execution profile: how many times each address was executed and how many cycles were spent there, plus a call
+    // tree built by following CALLs, RSTs and RETs on a shadow stack. The processor records each instruction as it
+    // completes, so every cycle is charged to exactly one address and to the function which was running at the time.
+    class Profiler final
+    {
+    public:
+        // Where the BDOS and the BIOS start in memory; anything below the BDOS is counted as the user's
+        struct Regions
+        {
+            uint16_t bdos;
+            uint16_t bios;
+        };
+
+        Profiler();
+
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+        Profiler(Profiler&&) = delete;
+        Profiler& operator=(Profiler&&) = delete;
+
+        ~Profiler() = default;
+
+        // Record the instruction (see Instruction) at 'address' as complete, having left the PC at 'next' and the total
+        // cycle count at 'cycles'
+        void record(uint16_t address, uint8_t instruction, uint16_t next, uint64_t cycles);
+
+        // Don't charge any cycles up to this total cycle count to the next instruction, e.g. after the processor has
+        // been idle or its state has been restored
+        void resync(uint64_t cycles)
+        {
+            m_last_cycles = cycles;
+        }
+
+        // Record time spent on the host handling a trap (i.e. a BDOS or BIOS call handled in C++) at 'address'
+        void add_trap_time(uint16_t address, std::chrono::steady_clock::duration duration);
+
+        [[nodiscard]] uint64_t count(uint16_t address) const
+        {
+            return m_counts[address];
+        }
+
+        [[nodiscard]] uint64_t cycles(uint16_t address) const
+        {
+            return m_cycles[address];
+        }
+
+        // The report on hot spots, functions and regions. 'describe' names an address, and 'top' limits each list.
+        void write_report(std::ostream& os,
+                          const std::function<std::string(uint16_t)>& describe,
+                          const Regions& regions,
+                          size_t top = 20) const;
+
+        // The call tree as collapsed stacks (one line per distinct stack: frames separated by ';', then the cycles spent
+        // in the innermost frame), which is what flame graph tools take as input
+        void write_collapsed_stacks(std::ostream& os, const std::function<std::string(uint16_t)>& describe) const;
+
+    private:
+        struct Node
+        {
+            uint16_t entry;  // Address that was called (meaningless for the root)
+            uint32_t parent; // Index of the calling node (the root is its own parent)
+            uint64_t self_cycles{ 0 };
+            uint64_t calls{ 0 };
+            std::vector<uint32_t> children;
+        };
+
+        struct Frame
+        {
+            uint32_t node;
+            uint16_t return_address;
+        };
+
+        struct TrapTime
+        {
+            uint64_t calls{ 0 };
+            std::chrono::steady_clock::duration duration{};
+        };
+
+        void push(uint16_t entry, uint16_t return_address);
+        void pop(uint16_t return_address);
+
+        uint64_t inclusive_cycles(uint32_t node, std::vector<uint64_t>& inclusive) const;
+
+        std::array<uint64_t, 0x10000> m_counts{};
+        std::array<uint64_t, 0x10000> m_cycles{};
+        uint64_t m_last_cycles{ 0 };
+
+        std::vector<Node> m_nodes;                       // The call tree, with the root first
+        std::unordered_map<uint64_t, uint32_t> m_lookup; // (parent << 16 | entry) -> child node
+        std::vector<Frame> m_stack;                      // The shadow stack, innermost last (empty = in the root)
+
+        std::map<uint16_t, TrapTime> m_trap_times;
+    };
+
+} // namespace zcpm
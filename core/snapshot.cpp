@@ -0,0 +1,117 @@
+#include "snapshot.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    // Identifies the file format, and changes whenever the layout of any of the structures does
+    const char Magic[8] = { 'Z', 'C', 'P', 'M', 'S', 'N', 'A', 'P' };
+    const uint32_t Version = 2;
+
+    const size_t MemorySize = 0x10000;
+
+    struct Header
+    {
+        char magic[sizeof(Magic)];
+        uint32_t version;
+        uint32_t header_size; // Sizes of this and the other structures, to catch a different build or host
+        uint32_t processor_size;
+        uint32_t bios_size;
+        uint32_t symbols_size;
+        uint16_t fbase;
+        uint16_t wboot;
+    };
+
+    template <typename T> void append(std::string& out, const T& value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T> T take(std::string_view& in)
+    {
+        T value{};
+        if (in.size() < sizeof(value))
+        {
+            throw std::runtime_error("Truncated snapshot");
+        }
+        std::memcpy(&value, in.data(), sizeof(value));
+        in.remove_prefix(sizeof(value));
+        return value;
+    }
+
+} // namespace
+
+namespace zcpm
+{
+
+    void Snapshot::save(std::string_view filename) const
+    {
+        if (memory.size() != MemorySize)
+        {
+            throw std::runtime_error("Snapshot of the wrong memory size");
+        }
+
+        // Zero-filled first, so that any padding is written as zeroes
+        Header header{};
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.header_size = sizeof(Header);
+        header.processor_size = sizeof(processor);
+        header.bios_size = sizeof(bios);
+        header.symbols_size = static_cast<uint32_t>(symbols.size());
+        header.fbase = fbase;
+        header.wboot = wboot;
+
+        std::string content;
+        content.reserve(sizeof(header) + sizeof(processor) + sizeof(bios) + memory.size() + symbols.size());
+        append(content, header);
+        append(content, processor);
+        append(content, bios);
+        content.append(memory.begin(), memory.end());
+        content.append(symbols.begin(), symbols.end());
+
+        std::ofstream file(std::string(filename), std::ios::binary | std::ios::trunc);
+        if (!file.write(content.data(), static_cast<std::streamsize>(content.size())) || !file.flush())
+        {
+            throw std::runtime_error("Can't write snapshot to " + std::string(filename));
+        }
+    }
+
+    Snapshot Snapshot::load(std::string_view filename)
+    {
+        std::ifstream file(std::string(filename), std::ios::binary);
+        if (!file.is_open())
+        {
+            throw std::runtime_error("Can't open " + std::string(filename));
+        }
+        const std::string content{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+        std::string_view rest(content);
+
+        const auto header = take<Header>(rest);
+        if ((std::memcmp(header.magic, Magic, sizeof(Magic)) != 0) || (header.version != Version) ||
+            (header.header_size != sizeof(Header)) || (header.processor_size != sizeof(Processor::State)) ||
+            (header.bios_size != sizeof(Bios::State)))
+        {
+            throw std::runtime_error(std::string(filename) + " is not a snapshot from this version of ZCPM");
+        }
+
+        Snapshot result{};
+        result.fbase = header.fbase;
+        result.wboot = header.wboot;
+        result.processor = take<Processor::State>(rest);
+        result.bios = take<Bios::State>(rest);
+        if (rest.size() != MemorySize + header.symbols_size)
+        {
+            throw std::runtime_error(std::string(filename) + " is the wrong size for a snapshot");
+        }
+        result.memory.assign(rest.begin(), rest.begin() + MemorySize);
+        result.symbols.assign(rest.begin() + MemorySize, rest.end());
+
+        return result;
+    }
+
+} // namespace zcpm
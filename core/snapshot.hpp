@@ -0,0 +1,33 @@
+#pragma once
+
+#include "bios.hpp"
+#include "processor.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace zcpm
+{
+
+    // The state of a whole machine at a moment in time, e.g. once it has booted, which can be written to a file and
+    // read back later. The file holds these structures just as they are in memory, so only the same build of ZCPM on
+    // the same kind of host can read it; anything else is rejected. The host files that make up the disk are not
+    // included.
+    struct Snapshot
+    {
+        uint16_t fbase; // As passed to Hardware::set_fbase_and_wboot
+        uint16_t wboot;
+        Processor::State processor;
+        Bios::State bios;
+        std::vector<uint8_t> memory;  // All 64K of it
+        std::vector<uint8_t> symbols; // As from SymbolTable::save
+
+        // Write to the specified file, throwing an exception on failure
+        void save(std::string_view filename) const;
+
+        // Read from the specified file (in one go), throwing an exception if it can't be read or is not valid
+        static Snapshot load(std::string_view filename);
+    };
+
+} // namespace zcpm
@@ -0,0 +1,164 @@
+#include "statistics.hpp"
+
+#include <fmt/core.h>
+
+#include <chrono>
+#include <string_view>
+
+namespace
+{
+    double to_ms(zcpm::CallLatency::Duration duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    double to_us(zcpm::CallLatency::Duration duration)
+    {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+
+    std::string describe_latency(std::string_view name, const zcpm::CallLatency& latency)
+    {
+        if (latency.timed() == 0)
+        {
+            return fmt::format("{:<24}{:>10d}", name, latency.calls());
+        }
+        return fmt::format("{:<24}{:>10d}{:>10d}{:>12.3f}{:>10.1f}{:>10d}{:>10d}{:>12.1f}",
+                           name,
+                           latency.calls(),
+                           latency.timed(),
+                           to_ms(latency.total()),
+                           to_us(latency.total()) / static_cast<double>(latency.timed()),
+                           latency.percentile_us(0.5),
+                           latency.percentile_us(0.99),
+                           to_us(latency.max()));
+    }
+
+    std::string latency_json(unsigned int function, std::string_view name, const zcpm::CallLatency& latency)
+    {
+        std::string buckets;
+        for (const auto count : latency.buckets())
+        {
+            buckets += fmt::format("{}{:d}", buckets.empty() ? "" : ",", count);
+        }
+        return fmt::format(R"({{"function":{:d},"name":"{}","calls":{:d},"timed":{:d},"total_us":{:.3f},)"
+                           R"("max_us":{:.3f},"histogram":[{}]}})",
+                           function,
+                           name,
+                           latency.calls(),
+                           latency.timed(),
+                           to_us(latency.total()),
+                           to_us(latency.max()),
+                           buckets);
+    }
+
+} // namespace
+
+namespace zcpm
+{
+
+    void Statistics::describe(const std::function<std::string(uint8_t)>& bdos_name,
+                              const std::function<void(const std::string&)>& output) const
+    {
+        output(fmt::format("{:<24}{:>10}{:>10}{:>12}{:>10}{:>10}{:>10}{:>12}",
+                           "Call (host time)",
+                           "Calls",
+                           "Timed",
+                           "Total ms",
+                           "Mean us",
+                           "p50 <us",
+                           "p99 <us",
+                           "Max us"));
+        for (unsigned int fn = 0; fn < bdos.size(); ++fn)
+        {
+            if (bdos[fn].calls() > 0)
+            {
+                output(describe_latency(fmt::format("BDOS fn#{:d} {}", fn, bdos_name(static_cast<uint8_t>(fn))),
+                                        bdos[fn]));
+            }
+        }
+        for (unsigned int fn = 0; fn < bios.functions.size(); ++fn)
+        {
+            if (bios.functions[fn].calls() > 0)
+            {
+                output(describe_latency(fmt::format("BIOS fn#{:d} {}", fn, Bios::function_name(fn)),
+                                        bios.functions[fn]));
+            }
+        }
+
+        output(fmt::format("Console: {:d} characters out, {:d} in, {:d} screen refreshes; {:d} status polls, {:d} idle "
+                           "waits, {:d} woken by input",
+                           bios.chars_out,
+                           bios.chars_in,
+                           refreshes,
+                           polls.polls,
+                           polls.idle_waits,
+                           polls.wakeups));
+        output(fmt::format("Disk: {:d} sector reads ({:d} cache hits, {:d} misses), {:d} writes; {:d} evictions, {:d} "
+                           "flushes, {:d} files written",
+                           disk.reads,
+                           disk.cache_hits,
+                           disk.cache_misses,
+                           disk.writes,
+                           disk.evictions,
+                           disk.flushes,
+                           disk.files_written));
+    }
+
+    void Statistics::write_json(std::ostream& os, const std::function<std::string(uint8_t)>& bdos_name) const
+    {
+        std::string limits;
+        for (size_t i = 0; i < CallLatency::Buckets; ++i)
+        {
+            limits += fmt::format("{}{:d}", limits.empty() ? "" : ",", uint64_t{ 1 } << i);
+        }
+        os << "{\n";
+        os << fmt::format("  \"histogram_limits_us\": [{}],\n", limits);
+
+        os << "  \"bdos\": [";
+        auto first = true;
+        for (unsigned int fn = 0; fn < bdos.size(); ++fn)
+        {
+            if (bdos[fn].calls() > 0)
+            {
+                os << (first ? "\n    " : ",\n    ") << latency_json(fn, bdos_name(static_cast<uint8_t>(fn)), bdos[fn]);
+                first = false;
+            }
+        }
+        os << "\n  ],\n";
+
+        os << "  \"bios\": [";
+        first = true;
+        for (unsigned int fn = 0; fn < bios.functions.size(); ++fn)
+        {
+            if (bios.functions[fn].calls() > 0)
+            {
+                os << (first ? "\n    " : ",\n    ") << latency_json(fn, Bios::function_name(fn), bios.functions[fn]);
+                first = false;
+            }
+        }
+        os << "\n  ],\n";
+
+        os << fmt::format(R"(  "console": {{"chars_out":{:d},"chars_in":{:d},"refreshes":{:d},"polls":{:d},)"
+                          R"("idle_waits":{:d},"wakeups":{:d}}},)"
+                          "\n",
+                          bios.chars_out,
+                          bios.chars_in,
+                          refreshes,
+                          polls.polls,
+                          polls.idle_waits,
+                          polls.wakeups);
+        os << fmt::format(R"(  "disk": {{"reads":{:d},"writes":{:d},"cache_hits":{:d},"cache_misses":{:d},)"
+                          R"("evictions":{:d},"flushes":{:d},"files_written":{:d}}})"
+                          "\n",
+                          disk.reads,
+                          disk.writes,
+                          disk.cache_hits,
+                          disk.cache_misses,
+                          disk.evictions,
+                          disk.flushes,
+                          disk.files_written);
+        os << "}\n";
+    }
+
+} // namespace zcpm
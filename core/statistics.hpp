@@ -0,0 +1,35 @@
+#pragma once
+
+#include "bios.hpp"
+#include "calllatency.hpp"
+#include "disk.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+namespace zcpm
+{
+
+    // What a machine has been doing, as far as its BDOS and BIOS calls, its disk and its terminal go (see
+    // Hardware::get_statistics)
+    struct Statistics
+    {
+        std::array<CallLatency, 256> bdos; // By function number, timed from the call until the BDOS returns
+        Bios::CallStatistics bios;
+        Bios::PollStatistics polls;
+        Disk::Statistics disk;
+        uint64_t refreshes{ 0 }; // Of a screen-based terminal's display
+
+        // Describe the statistics as text, passing each line to the specified function. Only functions which have been
+        // called are listed. 'bdos_name' names a BDOS function.
+        void describe(const std::function<std::string(uint8_t)>& bdos_name,
+                      const std::function<void(const std::string&)>& output) const;
+
+        // Write the statistics as a JSON object, e.g. for monitoring
+        void write_json(std::ostream& os, const std::function<std::string(uint8_t)>& bdos_name) const;
+    };
+
+} // namespace zcpm
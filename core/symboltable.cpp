@@ -1,16 +1,105 @@
 #include "symboltable.hpp"
 
-#include <boost/algorithm/string.hpp>
-#include <boost/log/trivial.hpp>
+#include "log.hpp"
+
 #include <fmt/core.h>
 
-#include <cstdlib>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
 #include <fstream>
 #include <iostream>
-#include <regex>
+#include <iterator>
 #include <stdexcept>
 #include <string>
 
+namespace
+{
+    const uint32_t NoSymbol = UINT32_MAX;
+
+    char to_upper(char ch)
+    {
+        return static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+    }
+
+    // Case-insensitive comparison of labels; returns <0, 0 or >0 as for std::string::compare
+    int compare_labels(std::string_view a, std::string_view b)
+    {
+        const auto length = std::min(a.size(), b.size());
+        for (size_t i = 0; i < length; ++i)
+        {
+            const auto ua = to_upper(a[i]);
+            const auto ub = to_upper(b[i]);
+            if (ua != ub)
+            {
+                return (ua < ub) ? -1 : 1;
+            }
+        }
+        return (a.size() < b.size()) ? -1 : ((a.size() > b.size()) ? 1 : 0);
+    }
+
+    bool is_alphanumeric(char ch)
+    {
+        return std::isalnum(static_cast<unsigned char>(ch)) != 0;
+    }
+
+    bool is_hex_digit(char ch)
+    {
+        return std::isxdigit(static_cast<unsigned char>(ch)) != 0;
+    }
+
+    // Helpers for the binary form of the table, which is made up of 32-bit counts, each of them followed by that many
+    // elements (bytes, or Symbols) if it is the size of an array
+    void append_count(std::vector<uint8_t>& out, size_t count)
+    {
+        const auto value = static_cast<uint32_t>(count);
+        const auto* p = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), p, p + sizeof(value));
+    }
+
+    template <typename T> void append_array(std::vector<uint8_t>& out, const T* data, size_t count)
+    {
+        append_count(out, count);
+        const auto* p = reinterpret_cast<const uint8_t*>(data);
+        out.insert(out.end(), p, p + count * sizeof(T));
+    }
+
+    size_t take_count(std::span<const uint8_t>& in)
+    {
+        uint32_t value = 0;
+        if (in.size() < sizeof(value))
+        {
+            throw std::runtime_error("Truncated symbol table");
+        }
+        std::memcpy(&value, in.data(), sizeof(value));
+        in = in.subspan(sizeof(value));
+        return value;
+    }
+
+    template <typename T> std::vector<T> take_array(std::span<const uint8_t>& in)
+    {
+        const auto count = take_count(in);
+        if (in.size() < count * sizeof(T))
+        {
+            throw std::runtime_error("Truncated symbol table");
+        }
+        std::vector<T> result(count);
+        std::memcpy(result.data(), in.data(), count * sizeof(T));
+        in = in.subspan(count * sizeof(T));
+        return result;
+    }
+
+    // Parse as much of the string as is valid hex, as strtoul would, returning 0 if none of it is
+    unsigned long parse_hex_prefix(std::string_view s)
+    {
+        unsigned long value = 0;
+        std::from_chars(s.data(), s.data() + s.size(), value, 16);
+        return value;
+    }
+
+} // namespace
+
 namespace zcpm
 {
 
@@ -21,35 +110,62 @@ namespace zcpm
             return;
         }
 
-        std::ifstream file(filename.data());
+        std::ifstream file(filename.data(), std::ios::binary);
         if (!file.is_open())
         {
             throw std::runtime_error("Can't open " + std::string(filename));
         }
-        std::string s;
-        while (std::getline(file, s))
+        const std::string content{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+        const auto ns = intern_prefix(prefix);
+        std::string_view rest(content);
+        while (!rest.empty())
         {
+            const auto eol = rest.find('\n');
+            const auto s = rest.substr(0, eol);
+            rest = (eol == std::string_view::npos) ? std::string_view() : rest.substr(eol + 1);
+
             // Assume that each line is in the format 'FOO: equ $1234'. So anything to the left
             // of the colon is the label and anything to the right of the $ is the value in hex.
             const auto colon = s.find_first_of(':');
             const auto dollar = s.find_last_of('$');
 
-            if ((colon != std::string::npos) && (dollar != std::string::npos) && (colon < dollar))
+            if ((colon != std::string_view::npos) && (dollar != std::string_view::npos) && (colon < dollar))
             {
-                const auto label = std::string(s, 0, colon);
-                const auto hvalue = std::string(s, dollar + 1, std::string::npos);
+                const auto label = s.substr(0, colon);
+                const auto hvalue = s.substr(dollar + 1);
                 if (!label.empty() || (!hvalue.empty()))
                 {
-                    const auto key = std::strtol(hvalue.c_str(), nullptr, 16);
-                    add(prefix, key, label);
+                    append(ns, static_cast<uint16_t>(parse_hex_prefix(hvalue)), label);
                 }
             }
         }
     }
 
+    void SymbolTable::load(std::span<const Label> labels, std::string_view prefix)
+    {
+        const auto ns = intern_prefix(prefix);
+        for (const auto& label : labels)
+        {
+            append(ns, label.address, label.name);
+        }
+    }
+
     void SymbolTable::add(std::string_view prefix, uint16_t a, std::string_view label)
     {
-        m_symbols.insert({ a, { std::string(prefix), std::string(label) } });
+        append(intern_prefix(prefix), a, label);
+    }
+
+    void SymbolTable::remove(std::string_view prefix)
+    {
+        const auto it = std::find(m_prefixes.begin(), m_prefixes.end(), prefix);
+        if (it == m_prefixes.end())
+        {
+            return;
+        }
+        const auto ns = static_cast<uint16_t>(it - m_prefixes.begin());
+        std::erase_if(m_symbols, [ns](const Symbol& symbol) { return symbol.prefix == ns; });
+        m_stale = true;
     }
 
     bool SymbolTable::empty() const
@@ -57,22 +173,63 @@ namespace zcpm
         return m_symbols.empty();
     }
 
-    std::string SymbolTable::describe(uint16_t a) const
+    std::vector<uint8_t> SymbolTable::save() const
+    {
+        reindex();
+        std::vector<uint8_t> result;
+        append_count(result, m_prefixes.size());
+        for (const auto& prefix : m_prefixes)
+        {
+            append_array(result, prefix.data(), prefix.size());
+        }
+        append_array(result, m_labels.data(), m_labels.size());
+        append_array(result, m_symbols.data(), m_symbols.size());
+        return result;
+    }
+
+    void SymbolTable::restore(std::span<const uint8_t> data)
     {
-        // We rely on the map being keyed by address of each symbol, and the keys are in ascending order.
-        // So search backwards until we reach the address of interest (or the closest one just before),
-        // and use that symbol as the return string.
+        const auto prefix_count = take_count(data);
+        if (prefix_count > data.size())
+        {
+            throw std::runtime_error("Invalid symbol table");
+        }
+        std::vector<std::string> prefixes(prefix_count);
+        for (auto& prefix : prefixes)
+        {
+            const auto name = take_array<char>(data);
+            prefix.assign(name.begin(), name.end());
+        }
+        auto labels = take_array<char>(data);
+        auto symbols = take_array<Symbol>(data);
 
-        for (auto it = m_symbols.rbegin(); it != m_symbols.rend(); it++)
+        // Check that each symbol refers to something which exists, so that nothing else needs to
+        for (const auto& symbol : symbols)
         {
-            if (it->first <= a)
+            if ((symbol.prefix >= prefixes.size()) || (symbol.label_offset > labels.size()) ||
+                (symbol.label_length > labels.size() - symbol.label_offset))
             {
-                const auto offset = a - it->first;
-                return fmt::format("{}:{}+{:04X}", std::get<0>(it->second), std::get<1>(it->second), offset);
+                throw std::runtime_error("Invalid symbol table");
             }
         }
 
-        return "?";
+        m_prefixes = std::move(prefixes);
+        m_labels.assign(labels.begin(), labels.end());
+        m_symbols = std::move(symbols);
+        m_stale = true;
+    }
+
+    std::string SymbolTable::describe(uint16_t a) const
+    {
+        reindex();
+        const auto index = m_nearest.empty() ? NoSymbol : m_nearest[a];
+        if (index == NoSymbol)
+        {
+            return "?";
+        }
+
+        const auto& symbol = m_symbols[index];
+        return fmt::format("{}:{}+{:04X}", m_prefixes[symbol.prefix], label(symbol), a - symbol.address);
     }
 
     std::tuple<bool, uint16_t> SymbolTable::evaluate_address_expression(std::string_view s) const
@@ -81,101 +238,84 @@ namespace zcpm
         // and 17a is a hex offset from that symbol. Or it could be "foo2" where we use the unmodified
         // value of the 'foo2' symbol.
 
-        // So we'll use this regex: ([A-Za-z0-9]+)(?:([+-])([A-Fa-f0-9]+))?
-        // Given 'lab1+17a', group1 is 'lab1' and group2 is '+' and group3 is '17a'
-        // Given 'lab1', group1 is 'lab1' other groups are empty
+        // So we look for the first run of letters and digits as the base, optionally followed directly by
+        // '+' or '-' and a run of hex digits as the offset; anything else around those is ignored.
 
-        const std::regex expression_regex("([A-Za-z0-9]+)(?:([+-])([A-Fa-f0-9]+))?");
-        std::smatch expression_match;
-        std::string const ss(s);
-        if (!std::regex_search(ss, expression_match, expression_regex))
+        const auto base_start = std::find_if(s.begin(), s.end(), is_alphanumeric);
+        if (base_start == s.end())
         {
-            BOOST_LOG_TRIVIAL(trace) << "Can't parse '" << s << "' (1)";
+            ZCPM_LOG(trace) << "Can't parse '" << s << "' (1)";
             return { false, 0 };
         }
+        const auto base_end = std::find_if_not(base_start, s.end(), is_alphanumeric);
 
-        // From the first regex match, try to make sense of the base
-        const auto& base_string(expression_match[1].str());
-        const auto [base_ok, base] = evaluate_symbol(base_string);
+        // Try to make sense of the base
+        const auto [base_ok, base] = evaluate_symbol(std::string_view(base_start, base_end));
         if (!base_ok)
         {
-            BOOST_LOG_TRIVIAL(trace) << "Can't parse base in '" << s << "'";
+            ZCPM_LOG(trace) << "Can't parse base in '" << s << "'";
             return { false, 0 };
         }
 
-        // From the second and third regex matches (if present), get the operator and offset
-        const auto& opr(expression_match[2].str());
-        const auto& offset_string(expression_match[3].str());
-
         // Do we have an operator & offset? (these are optional)
-        if ((opr.empty() && !offset_string.empty()) || (!opr.empty() && offset_string.empty()))
+        if ((base_end == s.end()) || ((*base_end != '+') && (*base_end != '-')))
         {
-            BOOST_LOG_TRIVIAL(trace) << "Can't parse '" << s << "' (2)";
-            return { false, 0 };
+            return { true, base };
         }
-
-        if (opr.empty() || offset_string.empty())
+        const auto opr = *base_end;
+        const auto offset_start = std::next(base_end);
+        const auto offset_end = std::find_if_not(offset_start, s.end(), is_hex_digit);
+        if (offset_start == offset_end)
         {
-            // At least one of the operator or offset are missing, so treat this as just a base value.
-            // Which means we're done, can now return the base as the result.
+            // An operator without an offset isn't part of the expression, so treat this as just a base value
             return { true, base };
         }
 
         // We have an operator and offset.  Try to convert the offset into a number
-
-        const auto [offset_ok, offset] = evaluate_symbol(offset_string);
+        const auto [offset_ok, offset] = evaluate_symbol(std::string_view(offset_start, offset_end));
         if (!offset_ok)
         {
-            BOOST_LOG_TRIVIAL(trace) << "Can't parse offset in '" << s << "'";
+            ZCPM_LOG(trace) << "Can't parse offset in '" << s << "'";
             return { false, 0 };
         }
 
         // We now have the base and the offset, apply the operator and return
-        if (opr == "+")
-        {
-            return { true, base + offset };
-        }
-        else if (opr == "-")
-        {
-            return { true, base - offset };
-        }
-        else
-        {
-            BOOST_LOG_TRIVIAL(trace) << "Unknown operator in '" << s << "'";
-            return { false, 0 };
-        }
+        return { true, (opr == '+') ? base + offset : base - offset };
     }
 
     void SymbolTable::dump() const
     {
+        reindex();
         std::cout << m_symbols.size() << " entries in symbol table:" << std::endl;
-        for (const auto& [key, value] : m_symbols)
+        for (const auto& symbol : m_symbols)
         {
-            const auto& [ns, name] = value;
-            std::cout << fmt::format("  {:04X} {}:{}", key, ns, name) << std::endl;
+            std::cout << fmt::format("  {:04X} {}:{}", symbol.address, m_prefixes[symbol.prefix], label(symbol))
+                      << std::endl;
         }
     }
 
-    std::tuple<bool, uint16_t> SymbolTable::evaluate_symbol(const std::string& s) const
+    std::tuple<bool, uint16_t> SymbolTable::evaluate_symbol(std::string_view s) const
     {
-        // First see if it is a known symbol.  This involves a brute-force map search, yuk.
-        const auto us = boost::to_upper_copy(s);
-        for (const auto& [key, value] : m_symbols)
+        // First see if it is a known symbol; if the same label is at several addresses, use the lowest
+        reindex();
+        const auto it = std::lower_bound(m_by_name.begin(),
+                                         m_by_name.end(),
+                                         s,
+                                         [this](uint32_t index, std::string_view name)
+                                         { return compare_labels(label(m_symbols[index]), name) < 0; });
+        if ((it != m_by_name.end()) && (compare_labels(label(m_symbols[*it]), s) == 0))
         {
-            if (boost::to_upper_copy(std::get<1>(value)) == us)
-            {
-                // Found it, return a success indication with the result being the symbol value
-                return { true, key };
-            }
+            // Found it, return a success indication with the result being the symbol value
+            return { true, m_symbols[*it].address };
         }
 
         // Not a symbol, hopefully it's a valid hex string
-        char* endptr = nullptr;
-        const auto value = std::strtoul(s.c_str(), &endptr, 16);
-        if (*endptr == '\0')
+        unsigned long value = 0;
+        const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), value, 16);
+        if ((error == std::errc()) && (end == s.data() + s.size()))
         {
             // Looks to be a complete valid hex string, good!
-            return { true, value };
+            return { true, static_cast<uint16_t>(value) };
         }
         else
         {
@@ -184,4 +324,58 @@ namespace zcpm
         }
     }
 
+    void SymbolTable::append(uint16_t prefix, uint16_t a, std::string_view label)
+    {
+        m_symbols.push_back({ a, prefix, static_cast<uint32_t>(m_labels.size()), static_cast<uint32_t>(label.size()) });
+        m_labels += label;
+        m_stale = true;
+    }
+
+    void SymbolTable::reindex() const
+    {
+        if (!m_stale)
+        {
+            return;
+        }
+        m_stale = false;
+
+        std::stable_sort(m_symbols.begin(),
+                         m_symbols.end(),
+                         [](const Symbol& a, const Symbol& b) { return a.address < b.address; });
+
+        m_by_name.resize(m_symbols.size());
+        for (uint32_t i = 0; i < m_by_name.size(); ++i)
+        {
+            m_by_name[i] = i;
+        }
+        std::stable_sort(m_by_name.begin(),
+                         m_by_name.end(),
+                         [this](uint32_t a, uint32_t b)
+                         { return compare_labels(label(m_symbols[a]), label(m_symbols[b])) < 0; });
+
+        // Where several symbols share an address, the one added last describes it
+        m_nearest.assign(0x10000, NoSymbol);
+        for (uint32_t i = 0; i < m_symbols.size(); ++i)
+        {
+            const auto next = (i + 1 < m_symbols.size()) ? m_symbols[i + 1].address : 0x10000;
+            std::fill(m_nearest.begin() + m_symbols[i].address, m_nearest.begin() + next, i);
+        }
+    }
+
+    uint16_t SymbolTable::intern_prefix(std::string_view prefix)
+    {
+        const auto it = std::find(m_prefixes.begin(), m_prefixes.end(), prefix);
+        if (it != m_prefixes.end())
+        {
+            return static_cast<uint16_t>(it - m_prefixes.begin());
+        }
+        m_prefixes.emplace_back(prefix);
+        return static_cast<uint16_t>(m_prefixes.size() - 1);
+    }
+
+    std::string_view SymbolTable::label(const Symbol& symbol) const
+    {
+        return std::string_view(m_labels).substr(symbol.label_offset, symbol.label_length);
+    }
+
 } // namespace zcpm
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <cstdint>
-#include <map>
+#include <span>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
 
 namespace zcpm
 {
@@ -10,15 +13,34 @@ namespace zcpm
     class SymbolTable final
     {
     public:
+        // A symbol as it appears in a label file
+        struct Label
+        {
+            uint16_t address;
+            std::string_view name;
+        };
+
         // Load symbols from the specified label file, and store them in the specified namespace
         void load(std::string_view filename, std::string_view prefix);
 
+        // Likewise, but from labels which are already in memory (ideally in ascending order of address)
+        void load(std::span<const Label> labels, std::string_view prefix);
+
         // Add one-off symbols
         void add(std::string_view prefix, uint16_t a, std::string_view label);
 
+        // Remove all of the symbols in the specified namespace
+        void remove(std::string_view prefix);
+
         // Do we have any entries?
         bool empty() const;
 
+        // Return the whole table in binary form, which restore() (in this build) can turn back into the same table
+        std::vector<uint8_t> save() const;
+
+        // Replace the whole table with one from save()
+        void restore(std::span<const uint8_t> data);
+
         // Using the symbol table content, return a string that describes the supplied address in
         // terms of known symbols.
         std::string describe(uint16_t a) const;
@@ -33,10 +55,45 @@ namespace zcpm
         void dump() const;
 
     private:
-        std::tuple<bool, uint16_t> evaluate_symbol(const std::string& s) const;
+        struct Symbol
+        {
+            uint16_t address;
+            uint16_t prefix;       // Index into m_prefixes
+            uint32_t label_offset; // Offset of the label in m_labels
+            uint32_t label_length;
+        };
+
+        std::tuple<bool, uint16_t> evaluate_symbol(std::string_view s) const;
+
+        // Append a symbol without updating the indexes
+        void append(uint16_t prefix, uint16_t a, std::string_view label);
+
+        // Put the symbols in order of address, and rebuild both indexes to match, if symbols have been added or removed
+        // since this was last done; so adding many symbols one at a time costs no more than adding them all at once
+        void reindex() const;
+
+        uint16_t intern_prefix(std::string_view prefix);
+
+        std::string_view label(const Symbol& symbol) const;
+
+        // In ascending order of address, and otherwise in the order they were added (once reindexed)
+        mutable std::vector<Symbol> m_symbols;
+
+        // Namespaces (e.g. 'BIOS') are few, so each is kept just once
+        std::vector<std::string> m_prefixes;
+
+        // All of the labels, one after another
+        std::string m_labels;
+
+        // Indexes into m_symbols, in case-insensitive order of label and then ascending order of address
+        mutable std::vector<uint32_t> m_by_name;
+
+        // For each possible address, the index into m_symbols of the closest symbol at or below that address (or
+        // NoSymbol); empty if there are no symbols
+        mutable std::vector<uint32_t> m_nearest;
 
-        // Keyed by address, and the corresponding value is (namespace,label), e.g. ('BIOS','BLAH2')
-        std::multimap<uint16_t, std::tuple<std::string, std::string>> m_symbols;
+        // Do m_symbols and the indexes need to be brought up to date by reindex() before they are next used?
+        mutable bool m_stale{ false };
     };
 
 } // namespace zcpm
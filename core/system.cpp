@@ -1,22 +1,29 @@
 #include "system.hpp"
 
+#include "embeddedbdos.hpp"
 #include "fcb.hpp"
 #include "hardware.hpp"
+#include "log.hpp"
 #include "processor.hpp"
+#include "snapshot.hpp"
 
 #include <zcpm/terminal/terminal.hpp>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/log/trivial.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
-#include <cstdio>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace zcpm
 {
 
@@ -43,44 +50,116 @@ namespace zcpm
 
         // Call BDOS:RSTDSK so that disk data structures are initialised
         const auto rstdsk = 13;
-        BOOST_LOG_TRIVIAL(trace) << "Directly calling BDOS fn#" << rstdsk;
+        ZCPM_LOG(trace) << "Directly calling BDOS fn#" << rstdsk;
         m_hardware.call_bdos(rstdsk);
 
         m_hardware.check_memory_accesses(true);
     }
 
+    void System::save_snapshot(std::string_view filename) const
+    {
+        m_hardware.save_snapshot().save(filename);
+        ZCPM_LOG(trace) << "Saved snapshot to " << filename;
+    }
+
+    void System::load_snapshot(std::string_view filename)
+    {
+        m_hardware.restore_snapshot(Snapshot::load(filename));
+        ZCPM_LOG(trace) << "Loaded snapshot from " << filename;
+    }
+
+    void System::forget_disk_login()
+    {
+        // Clearing the BDOS's login vector has the same effect as the start of a warm boot; without the BDOS symbols,
+        // do the whole of the BDOS initialisation again instead
+        const auto [ok, login] = m_hardware.evaluate_address_expression("LOGIN");
+        if (ok)
+        {
+            m_hardware.write_word(login, 0x0000);
+        }
+        else
+        {
+            setup_bdos();
+        }
+    }
+
     bool System::load_binary(uint16_t base, std::string_view filename)
     {
-        std::FILE* fp = std::fopen(filename.data(), "r");
-        if (!fp)
+        const auto fd = ::open(std::string(filename).c_str(), O_RDONLY);
+        struct stat status{};
+        if ((fd < 0) || (::fstat(fd, &status) != 0))
         {
             std::cerr << "Can't open '" << filename << "'" << std::endl;
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
             return false;
         }
 
-        std::fseek(fp, 0, SEEK_END);
-        const auto filesize = std::ftell(fp);
-        std::fseek(fp, 0, SEEK_SET);
-
-        BOOST_LOG_TRIVIAL(trace) << fmt::format(
+        const auto filesize = static_cast<size_t>(status.st_size);
+        ZCPM_LOG(trace) << fmt::format(
             "Reading {:d} bytes into memory at {:04X} from {}", filesize, base, filename);
 
-        // Ideally we'd fread() directly into the memory buffer, but to do that means having more coupling
-        // than is safe, so instead a temporary buffer is used here, which increases the peak RAM of this
-        // process.
-        std::vector<uint8_t> buf(filesize, 0);
+        // Read straight into emulated RAM, having checked that the whole image fits
+        const auto area = m_hardware.load_area(base, filesize);
+        if (area.empty())
+        {
+            std::cerr << fmt::format("'{}' ({:d} bytes) doesn't fit in memory at {:04X}", filename, filesize, base)
+                      << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        size_t done = 0;
+        while (done < area.size())
+        {
+            const auto n = ::pread(fd, area.data() + done, area.size() - done, static_cast<off_t>(done));
+            if ((n < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(n);
+        }
+        ::close(fd);
+
+        if (done < area.size())
+        {
+            std::cerr << "Can't read '" << filename << "'" << std::endl;
+            return false;
+        }
 
-        std::fread(buf.data(), 1, buf.size(), fp);
+        return true;
+    }
+
+    bool System::load_embedded_bdos(uint16_t base)
+    {
+        const auto image = embedded_bdos::binary();
+        ZCPM_LOG(trace) << fmt::format("Copying {:d} bytes of built in BDOS into memory at {:04X}", image.size(), base);
 
-        m_hardware.copy_to_ram(buf.data(), buf.size(), base);
+        const auto area = m_hardware.load_area(base, image.size());
+        if (area.empty())
+        {
+            std::cerr << fmt::format("The built in BDOS doesn't fit in memory at {:04X}", base) << std::endl;
+            return false;
+        }
+        std::copy(image.begin(), image.end(), area.begin());
 
-        std::fclose(fp);
+        m_hardware.use_embedded_bdos_symbols();
 
         return true;
     }
 
     bool System::load_fcb(const std::vector<std::string>& args)
     {
+        // These writes are the loader's rather than the program's, so they aren't checked; reset() turns the checks
+        // back on
+        m_hardware.check_memory_accesses(false);
+
         const uint16_t fcb_base = 0x005C; // Base of the FCB
 
         Fcb fcb;
@@ -142,15 +221,112 @@ namespace zcpm
         m_hardware.set_finished(false);
         for (size_t i = 0; i < instruction_count; i++)
         {
-            m_hardware.m_processor->emulate_instruction();
+            m_hardware.step();
         }
     }
 
     void System::run()
     {
         m_hardware.set_finished(false);
-        BOOST_LOG_TRIVIAL(trace) << "Starting execution of user code";
-        m_hardware.m_processor->emulate();
+        ZCPM_LOG(trace) << "Starting execution of user code";
+        m_hardware.run();
+
+        const auto polls = m_hardware.get_poll_statistics();
+        ZCPM_LOG(trace) << fmt::format("Console status polls: {:d}, idle waits: {:d}, woken by input: {:d}",
+                                                polls.polls,
+                                                polls.idle_waits,
+                                                polls.wakeups);
+    }
+
+    bool System::reverse_step(size_t instruction_count)
+    {
+        if (instruction_count == 0)
+        {
+            return true;
+        }
+
+        auto remaining = instruction_count;
+        return go_back(
+            [&remaining](const std::vector<Boundary>& boundaries) -> std::optional<size_t>
+            {
+                if (remaining <= boundaries.size())
+                {
+                    return boundaries.size() - remaining;
+                }
+                remaining -= boundaries.size();
+                return std::nullopt;
+            });
+    }
+
+    bool System::reverse_go()
+    {
+        return go_back(
+            [this](const std::vector<Boundary>& boundaries) -> std::optional<size_t>
+            {
+                for (auto index = boundaries.size(); index > 0; --index)
+                {
+                    if (m_hardware.m_processor->has_debug_action(boundaries[index - 1].pc))
+                    {
+                        return index - 1;
+                    }
+                }
+                return std::nullopt;
+            });
+    }
+
+    std::vector<System::Boundary> System::replay_until(uint64_t end)
+    {
+        std::vector<Boundary> boundaries;
+        auto& processor = *m_hardware.m_processor;
+        while (processor.get_cycle_count() < end)
+        {
+            const uint64_t cycles = processor.get_cycle_count();
+            boundaries.push_back({ cycles, processor.reg_pc() });
+            step();
+            if (processor.get_cycle_count() == cycles)
+            {
+                // Not getting anywhere (which a replay of a run that did get here shouldn't do)
+                break;
+            }
+        }
+        return boundaries;
+    }
+
+    bool System::go_back(const Chooser& choose)
+    {
+        // Console output during replays has all been seen before
+        m_hardware.set_replaying(true);
+
+        auto end = m_hardware.m_processor->get_cycle_count();
+        auto found = false;
+        auto moved = false;
+        while (m_hardware.restore_checkpoint(end))
+        {
+            moved = true;
+            const auto start = m_hardware.m_processor->get_cycle_count();
+            const auto boundaries = replay_until(end);
+            if (const auto chosen = choose(boundaries))
+            {
+                // Back to the same checkpoint, and this time only as far as the chosen instruction
+                m_hardware.restore_checkpoint(start + 1);
+                replay_until(boundaries[*chosen].cycles);
+                found = true;
+                break;
+            }
+            end = start;
+        }
+
+        if (!found && moved)
+        {
+            // Stop at the earliest checkpoint, which the last replay started from
+            m_hardware.restore_checkpoint(end + 1);
+        }
+
+        m_hardware.set_replaying(false);
+        ZCPM_LOG(trace) << fmt::format("Went back to cycle {:d}, PC={:04X}",
+                                       m_hardware.m_processor->get_cycle_count(),
+                                       m_hardware.m_processor->reg_pc());
+        return found;
     }
 
     void System::set_input_handler(const InputHandler& handler)
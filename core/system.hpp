@@ -4,7 +4,9 @@
 #include "hardware.hpp"
 
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -36,21 +38,42 @@ namespace zcpm
         // Perform necessary BDOS initialisation
         void setup_bdos();
 
+        // Write the state of the whole machine to the specified file, or replace it with the state from such a file
+        // (see Snapshot)
+        void save_snapshot(std::string_view filename) const;
+        void load_snapshot(std::string_view filename);
+
+        // Have the BDOS log in the disk again on its next access, rather than keep what it found when a snapshot was
+        // taken (since the host files may have changed since then)
+        void forget_disk_login();
+
         // Load a binary file into memory at the specified base address, not worrying about cmdline args
         bool load_binary(uint16_t base, std::string_view filename);
 
+        // Load the BDOS binary that is built in into memory at the specified base address, along with its symbols
+        // (unless BDOS symbols were loaded from a file)
+        bool load_embedded_bdos(uint16_t base);
+
         // Set up the FCB in page zero based on the specified command line arguments
         bool load_fcb(const std::vector<std::string>& args);
 
         // Set PC to 0x0100 in readiness for running
         void reset();
 
-        // Execute the system for instruction_count instructions
+        // Execute the system for instruction_count instructions, handling events and interrupts as a run would (see
+        // Hardware::step)
         void step(size_t instruction_count = 1);
 
         // Run the system until termination or a breakpoint
         void run();
 
+        // Go back the specified number of instructions, or to the most recent point at which execution reached a
+        // breakpoint or passpoint, by restoring a checkpoint (see Hardware::enable_checkpoints) and replaying from
+        // there. If the checkpoints don't go back that far, this goes back to the earliest one and returns false (or,
+        // if the machine is already there, returns false without changing anything).
+        bool reverse_step(size_t instruction_count = 1);
+        bool reverse_go();
+
         void set_input_handler(const InputHandler& handler);
         void set_output_handler(const OutputHandler& handler);
 
@@ -59,6 +82,22 @@ namespace zcpm
         // TODO: more thought needed on this issue.
 
         Hardware m_hardware;
+
+    private:
+        // Where an instruction starts, in a replay
+        struct Boundary
+        {
+            uint64_t cycles;
+            uint16_t pc;
+        };
+
+        // Step until the cycle count reaches 'end', returning where each instruction started
+        std::vector<Boundary> replay_until(uint64_t end);
+
+        // Go back through the checkpoints, from the latest one, replaying each in turn until 'choose' picks where to
+        // stop from the instructions executed between there and wherever the previous replay started
+        using Chooser = std::function<std::optional<size_t>(const std::vector<Boundary>&)>;
+        bool go_back(const Chooser& choose);
     };
 
 } // namespace zcpm
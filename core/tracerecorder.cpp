@@ -0,0 +1,58 @@
+#include "tracerecorder.hpp"
+
+#include "imemory.hpp"
+
+#include <algorithm>
+
+namespace zcpm
+{
+
+    TraceRecorder::TraceRecorder(size_t capacity) : m_records(std::max<size_t>(capacity, 1))
+    {
+    }
+
+    void TraceRecorder::record(uint16_t address, const Registers& registers, const IMemory& memory)
+    {
+        auto& record = m_records[m_next];
+        record.m_registers = registers;
+        record.m_address = address;
+
+        // Reading via copy_from_ram() rather than read_byte() means that watched addresses don't notice
+        const auto first_part = std::min<size_t>(record.m_bytes.size(), 0x10000 - address);
+        memory.copy_from_ram(record.m_bytes.data(), first_part, address);
+        if (first_part < record.m_bytes.size())
+        {
+            memory.copy_from_ram(record.m_bytes.data() + first_part, record.m_bytes.size() - first_part, 0x0000);
+        }
+
+        record.m_write_count = static_cast<uint16_t>(std::min<size_t>(m_write_count, 0xFFFF));
+        for (size_t i = 0; i < std::min(m_write_count, MaxWrites); ++i)
+        {
+            record.m_write_addresses[i] = m_write_addresses[i];
+            memory.copy_from_ram(&record.m_write_values[i], 1, m_write_addresses[i]);
+        }
+        m_write_count = 0;
+
+        if (++m_next == m_records.size())
+        {
+            m_next = 0;
+            m_full = true;
+        }
+        ++m_total;
+    }
+
+    std::vector<TraceRecorder::Record> TraceRecorder::latest(size_t count) const
+    {
+        const auto held = m_full ? m_records.size() : m_next;
+        count = std::min(count, held);
+
+        std::vector<Record> result;
+        result.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            result.push_back(m_records[(m_next + m_records.size() - count + i) % m_records.size()]);
+        }
+        return result;
+    }
+
+} // namespace zcpm
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "registers.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace zcpm
+{
+
+    class IMemory;
+
+    // A record of the most recently executed instructions, kept in binary form in a ring buffer so that recording
+    // them costs little more than copying the registers: each has the instruction's address and opcode bytes, the
+    // registers as it left them, and what it wrote to memory. Once the buffer is full, each instruction replaces the
+    // oldest one. The records are only turned into text when they are wanted (see Writer::history).
+    class TraceRecorder final
+    {
+    public:
+        // Only the first few bytes written by an instruction are kept; anything more (e.g. from a block move done all
+        // at once, or a sector read into memory by the BIOS) is just counted
+        inline static const size_t MaxWrites{ 2 };
+
+        struct Record
+        {
+            Registers m_registers;          // As the instruction left them, so PC is the address of the next one
+            uint16_t m_address;             // Of the instruction
+            std::array<uint8_t, 4> m_bytes; // Starting at that address, which is enough for any instruction
+            uint16_t m_write_count;         // Bytes written (up to 0xFFFF), including any beyond those kept
+            std::array<uint16_t, MaxWrites> m_write_addresses;
+            std::array<uint8_t, MaxWrites> m_write_values;
+        };
+
+        explicit TraceRecorder(size_t capacity);
+
+        TraceRecorder(const TraceRecorder&) = delete;
+        TraceRecorder& operator=(const TraceRecorder&) = delete;
+        TraceRecorder(TraceRecorder&&) = delete;
+        TraceRecorder& operator=(TraceRecorder&&) = delete;
+
+        ~TraceRecorder() = default;
+
+        // Note that memory is being written by the current instruction; what was written is read back once it is
+        // complete
+        void add_write(uint16_t address, size_t count)
+        {
+            for (size_t i = 0; (i < count) && (m_write_count + i < MaxWrites); ++i)
+            {
+                m_write_addresses[m_write_count + i] = static_cast<uint16_t>(address + i);
+            }
+            m_write_count += count;
+        }
+
+        // Forget any writes noted since the last instruction was recorded, which weren't made by an instruction (e.g.
+        // by a loader, before the processor started running)
+        void discard_writes()
+        {
+            m_write_count = 0;
+        }
+
+        // Record the instruction at 'address' as complete, along with the writes noted since the previous one
+        void record(uint16_t address, const Registers& registers, const IMemory& memory);
+
+        // How many instructions have been recorded altogether, including those which have since been replaced
+        [[nodiscard]] uint64_t total() const
+        {
+            return m_total;
+        }
+
+        // The most recent 'count' records (or all of them, if there are fewer), oldest first
+        [[nodiscard]] std::vector<Record> latest(size_t count) const;
+
+    private:
+        std::vector<Record> m_records;
+        size_t m_next{ 0 };   // Where the next record goes
+        bool m_full{ false }; // Has the buffer wrapped around yet?
+        uint64_t m_total{ 0 };
+
+        // Writes by the instruction which is being executed
+        size_t m_write_count{ 0 };
+        std::array<uint16_t, MaxWrites> m_write_addresses{};
+    };
+
+} // namespace zcpm
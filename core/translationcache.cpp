@@ -0,0 +1,104 @@
+#include "translationcache.hpp"
+
+#include "log.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+
+namespace zcpm
+{
+
+    TranslationCache::TranslationCache() : m_index(0x10000, nullptr), m_counts(0x10000, 0)
+    {
+    }
+
+    TranslationCache::~TranslationCache() = default;
+
+    const Translation* TranslationCache::add(std::unique_ptr<Translation> p_translation)
+    {
+        // The processor only adds a translation when none is executing, so nothing retired is still in use
+        m_retired.clear();
+
+        ZCPM_LOG(trace) << fmt::format("Translated {:04X}-{:04X} ({} instructions)",
+                                                p_translation->start,
+                                                p_translation->end - 1,
+                                                p_translation->ops.size());
+
+        m_index[p_translation->start] = p_translation.get();
+        for (auto page = p_translation->start >> 8; page <= ((p_translation->end - 1) >> 8); ++page)
+        {
+            ++m_code_pages[page];
+        }
+        mark_code(*p_translation);
+
+        m_translations.push_back(std::move(p_translation));
+
+        return m_translations.back().get();
+    }
+
+    void TranslationCache::clear()
+    {
+        std::fill(m_index.begin(), m_index.end(), nullptr);
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+        m_code_pages.fill(0);
+        m_code_bytes.reset();
+        std::move(m_translations.begin(), m_translations.end(), std::back_inserter(m_retired));
+        m_translations.clear();
+        ++m_generation;
+    }
+
+    size_t TranslationCache::size() const
+    {
+        return m_translations.size();
+    }
+
+    void TranslationCache::invalidate_range(size_t start, size_t end)
+    {
+        end = std::min<size_t>(end, 0x10000);
+
+        const auto overlaps = [start, end](const auto& p) { return (p->start < end) && (start < p->end); };
+        const auto it = std::stable_partition(
+            m_translations.begin(), m_translations.end(), [&overlaps](const auto& p) { return !overlaps(p); });
+        if (it == m_translations.end())
+        {
+            return;
+        }
+
+        for (auto discard = it; discard != m_translations.end(); ++discard)
+        {
+            const auto& t = **discard;
+            ZCPM_LOG(trace) << fmt::format("Discarding translation {:04X}-{:04X}", t.start, t.end - 1);
+
+            m_index[t.start] = nullptr;
+            m_counts[t.start] = 0; // Allow the new code to be translated once it becomes hot
+            for (auto a = t.start; a < t.end; ++a)
+            {
+                m_code_bytes.reset(a);
+            }
+            for (auto page = t.start >> 8; page <= ((t.end - 1) >> 8); ++page)
+            {
+                --m_code_pages[page];
+            }
+        }
+        std::move(it, m_translations.end(), std::back_inserter(m_retired));
+        m_translations.erase(it, m_translations.end());
+        ++m_generation;
+
+        // Translations can overlap (e.g. when one starts part way through another), so make sure that the survivors
+        // remain marked
+        for (const auto& p : m_translations)
+        {
+            mark_code(*p);
+        }
+    }
+
+    void TranslationCache::mark_code(const Translation& translation)
+    {
+        for (auto a = translation.start; a < translation.end; ++a)
+        {
+            m_code_bytes.set(a);
+        }
+    }
+
+} // namespace zcpm
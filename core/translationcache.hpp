@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace zcpm
+{
+
+    class Processor;
+    struct TranslatedOp;
+
+    // Executes a single translated instruction. 'pc' has already been set to the address of the following instruction
+    // (so only branches need to change it), and 'elapsed_cycles' already includes the instruction's fixed cycles.
+    using TranslatedHandler = void (*)(Processor& processor,
+                                       const TranslatedOp& op,
+                                       uint16_t& pc,
+                                       size_t& elapsed_cycles);
+
+    // A single Z80 instruction which has been bound to a handler specific to that kind of instruction, with its
+    // register operands and any immediate operand already resolved
+    struct TranslatedOp
+    {
+        TranslatedHandler handler;
+        void (Processor::*p_alu)(uint8_t); // The 8-bit arithmetic or logical operation, if there is one
+        uint8_t* p_r1;                     // 8-bit registers; p_r1 is the destination where there is one
+        uint8_t* p_r2;
+        uint16_t* p_rr;   // 16-bit register
+        uint16_t operand; // Immediate operand or branch target
+        uint16_t address; // Address of the instruction
+        uint16_t next;    // Address of the following instruction
+        uint8_t cycles;   // Cycles which don't depend on the outcome of the instruction
+        uint8_t cc;       // Condition code, for conditional branches
+    };
+
+    // A run of translated straight-line code, starting at an address that has been executed frequently, and finishing
+    // with either a branch or the last instruction before one which can't be translated
+    struct Translation
+    {
+        size_t start; // Address of the first byte
+        size_t end;   // Address after the last byte
+        std::vector<TranslatedOp> ops;
+    };
+
+    // Translations of frequently executed code, keyed by start address. As with the block cache, any modification of
+    // memory holding translated code discards the translations which include it.
+    class TranslationCache final
+    {
+    public:
+        // Number of times that the interpreter has to arrive at an address before the code there is translated
+        inline static const uint16_t HotThreshold{ 32 };
+
+        // Upper limit on the length of a translation
+        inline static const size_t MaxInstructions{ 64 };
+
+        TranslationCache();
+
+        TranslationCache(const TranslationCache&) = delete;
+        TranslationCache& operator=(const TranslationCache&) = delete;
+        TranslationCache(TranslationCache&&) = delete;
+        TranslationCache& operator=(TranslationCache&&) = delete;
+
+        ~TranslationCache();
+
+        // Return the translation which starts at the specified address, or nullptr if there isn't one
+        const Translation* find(uint16_t address) const
+        {
+            return m_index[address];
+        }
+
+        // Count another arrival at an untranslated address, returning true when that makes it worth translating. This
+        // only happens once per address, so an address that can't be translated isn't retried.
+        bool is_hot(uint16_t address)
+        {
+            auto& count = m_counts[address];
+            return (count < HotThreshold) && (++count == HotThreshold);
+        }
+
+        // Take ownership of a new translation, returning it
+        const Translation* add(std::unique_ptr<Translation> p_translation);
+
+        // Discard any translations which include any of the specified bytes. As with BlockCache::invalidate(), the
+        // common case (a page with no translated code in it) needs to be quick.
+        void invalidate(uint16_t address, size_t count = 1)
+        {
+            if ((count == 1) && !(m_code_pages[address >> 8] && m_code_bytes[address]))
+            {
+                return;
+            }
+            invalidate_range(address, address + count);
+        }
+
+        // Discard everything
+        void clear();
+
+        // Number of translations currently held
+        [[nodiscard]] size_t size() const;
+
+        // Changes whenever a translation is discarded, so that the code executing a translation can tell that the
+        // translation might no longer be valid
+        [[nodiscard]] uint32_t generation() const
+        {
+            return m_generation;
+        }
+
+    private:
+        void invalidate_range(size_t start, size_t end);
+
+        void mark_code(const Translation& translation);
+
+        // For each address, the translation starting there (if any)
+        std::vector<const Translation*> m_index;
+
+        // For each address, how many times the interpreter has arrived there
+        std::vector<uint16_t> m_counts;
+
+        // All currently valid translations
+        std::vector<std::unique_ptr<Translation>> m_translations;
+
+        // Translations which have been discarded, but which might still be executing; these are released the next
+        // time that a translation is added, at which point the processor has finished with them
+        std::vector<std::unique_ptr<Translation>> m_retired;
+
+        // Quick checks to determine if a write might modify translated code
+        std::array<uint16_t, 256> m_code_pages{};
+        std::bitset<0x10000> m_code_bytes;
+
+        uint32_t m_generation{ 0 };
+    };
+
+} // namespace zcpm
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+namespace zcpm
+{
+    // Stands in for a counter (of cycles, or the refresh register) in code which is instantiated both with and without
+    // counting. Every update is discarded and it always reads as zero, so that the compiler can drop the counting.
+    struct Uncounted
+    {
+        constexpr Uncounted(size_t /*value*/ = 0) // NOLINT: implicit, so that it can be assigned as a counter is
+        {
+        }
+
+        constexpr Uncounted& operator+=(size_t /*n*/)
+        {
+            return *this;
+        }
+        constexpr Uncounted& operator-=(size_t /*n*/)
+        {
+            return *this;
+        }
+        constexpr Uncounted operator++(int)
+        {
+            return *this;
+        }
+        constexpr Uncounted operator--(int)
+        {
+            return *this;
+        }
+
+        constexpr operator size_t() const // NOLINT: implicit, so that it can be read as a counter is
+        {
+            return 0;
+        }
+    };
+
+} // namespace zcpm
@@ -0,0 +1,66 @@
+#include "watchmap.hpp"
+
+#include <algorithm>
+
+namespace zcpm
+{
+
+    void WatchMap::add(uint16_t base, size_t count)
+    {
+        const auto end = std::min<size_t>(base + count, 0x10000);
+        for (size_t a = base; a < end; ++a)
+        {
+            if (!m_addresses[a])
+            {
+                m_addresses.set(a);
+                ++m_page_counts[a >> 8];
+            }
+        }
+    }
+
+    void WatchMap::remove(uint16_t base, size_t count)
+    {
+        const auto end = std::min<size_t>(base + count, 0x10000);
+        for (size_t a = base; a < end; ++a)
+        {
+            if (m_addresses[a])
+            {
+                m_addresses.reset(a);
+                --m_page_counts[a >> 8];
+            }
+        }
+    }
+
+    bool WatchMap::contains_any(uint16_t base, size_t count) const
+    {
+        const auto end = std::min<size_t>(base + count, 0x10000);
+        for (size_t a = base; a < end;)
+        {
+            const auto page_end = std::min<size_t>((a | 0xFF) + 1, end);
+            if (m_page_counts[a >> 8])
+            {
+                for (; a < page_end; ++a)
+                {
+                    if (m_addresses[a])
+                    {
+                        return true;
+                    }
+                }
+            }
+            a = page_end;
+        }
+        return false;
+    }
+
+    void WatchMap::clear()
+    {
+        m_addresses.reset();
+        m_page_counts.fill(0);
+    }
+
+    bool WatchMap::empty() const
+    {
+        return m_addresses.none();
+    }
+
+} // namespace zcpm
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+namespace zcpm
+{
+
+    // The set of memory addresses being watched for some kind of access. This is consulted on every memory access
+    // while memory checks are enabled, so the common case (an address in a page without any watches) only needs to
+    // look at a small per-page summary.
+    class WatchMap final
+    {
+    public:
+        WatchMap() = default;
+
+        WatchMap(const WatchMap&) = delete;
+        WatchMap& operator=(const WatchMap&) = delete;
+        WatchMap(WatchMap&&) = delete;
+        WatchMap& operator=(WatchMap&&) = delete;
+
+        ~WatchMap() = default;
+
+        // Start/stop watching 'count' addresses from 'base'; a range which extends beyond 0xFFFF is truncated there
+        void add(uint16_t base, size_t count = 1);
+        void remove(uint16_t base, size_t count = 1);
+
+        void clear();
+
+        // Returns true if the specified address is being watched
+        [[nodiscard]] bool contains(uint16_t address) const
+        {
+            return m_page_counts[address >> 8] && m_addresses[address];
+        }
+
+        // Returns true if either byte of the word at the specified address is being watched
+        [[nodiscard]] bool contains_word(uint16_t address) const
+        {
+            return contains(address) || contains(static_cast<uint16_t>(address + 1));
+        }
+
+        // Returns true if any of 'count' addresses from 'base' is being watched (considering no more than 0xFFFF)
+        [[nodiscard]] bool contains_any(uint16_t base, size_t count) const;
+
+        // Returns true if nothing is being watched
+        [[nodiscard]] bool empty() const;
+
+    private:
+        std::bitset<0x10000> m_addresses;
+
+        // For each 256 byte page, how many of its addresses are being watched
+        std::array<uint16_t, 256> m_page_counts{};
+    };
+
+} // namespace zcpm
@@ -4,6 +4,7 @@
 #include <zcpm/core/debugaction.hpp>
 #include <zcpm/core/hardware.hpp>
 #include <zcpm/core/idebuggable.hpp>
+#include <zcpm/core/processor.hpp>
 #include <zcpm/core/system.hpp>
 
 #include <boost/algorithm/string.hpp>
@@ -257,6 +258,47 @@ namespace
     auto run(Writer& writer, zcpm::System* p_machine, zcpm::IDebuggable* p_debuggable)
     {
         const std::vector<Command> commands{
+            Command{ { "checkpoint" },
+                     { "on", "off" },
+                     1,
+                     3,
+                     "Start (every N cycles, keeping up to M) or stop taking checkpoints for going back",
+                     replxx::Replxx::Color::DEFAULT,
+                     [&p_machine](const TokenVector& input)
+                     {
+                         if (input[1] == "on")
+                         {
+                             auto interval = 0x1000000UL; // Default to every 16M cycles
+                             auto limit = 0x400UL;        // Default to keeping 1K checkpoints
+                             if (input.size() >= 3)
+                             {
+                                 interval = std::strtoul(input[2].c_str(), nullptr, 16);
+                                 if (input.size() >= 4)
+                                 {
+                                     limit = std::strtoul(input[3].c_str(), nullptr, 16);
+                                 }
+                             }
+                             try
+                             {
+                                 p_machine->m_hardware.enable_checkpoints(interval, limit);
+                                 std::cout << "Taking checkpoints." << std::endl;
+                             }
+                             catch (const std::exception& e)
+                             {
+                                 std::cout << e.what() << std::endl;
+                             }
+                         }
+                         else if (input[1] == "off")
+                         {
+                             p_machine->m_hardware.disable_checkpoints();
+                             std::cout << "Stopped taking checkpoints." << std::endl;
+                         }
+                         else
+                         {
+                             std::cout << "Unknown option" << std::endl;
+                         }
+                         return false;
+                     } },
             Command{ { "clear" },
                      {},
                      1,
@@ -331,6 +373,28 @@ namespace
                          }
                          return false;
                      } },
+            Command{ { "history" },
+                     {},
+                     0,
+                     1,
+                     "Show the last N recorded instructions",
+                     replxx::Replxx::Color::DEFAULT,
+                     [&p_machine, &writer](const TokenVector& input)
+                     {
+                         const auto* p_recorder = p_machine->m_hardware.m_processor->recorder();
+                         if (!p_recorder)
+                         {
+                             std::cout << "Nothing recorded; use 'record on' first" << std::endl;
+                             return false;
+                         }
+                         auto count = 20; // Default to showing 20 instructions
+                         if (input.size() >= 2)
+                         {
+                             count = std::strtoul(input[1].c_str(), nullptr, 16);
+                         }
+                         writer.history(*p_recorder, count);
+                         return false;
+                     } },
             Command{ { "list" },
                      {},
                      0,
@@ -376,6 +440,81 @@ namespace
                      "Exit from ZCPM",
                      replxx::Replxx::Color::RED,
                      [](const TokenVector& /*input*/) { return true; } },
+            Command{ { "record" },
+                     { "on", "off" },
+                     1,
+                     2,
+                     "Start (keeping the last N instructions) or stop recording execution history",
+                     replxx::Replxx::Color::DEFAULT,
+                     [&p_machine](const TokenVector& input)
+                     {
+                         auto& processor = *p_machine->m_hardware.m_processor;
+                         if (input[1] == "on")
+                         {
+                             auto capacity = 0x10000UL; // Default to keeping 64K instructions
+                             if (input.size() >= 3)
+                             {
+                                 capacity = std::strtoul(input[2].c_str(), nullptr, 16);
+                             }
+                             processor.start_recording(capacity);
+                             std::cout << "Recording." << std::endl;
+                         }
+                         else if (input[1] == "off")
+                         {
+                             processor.stop_recording();
+                             std::cout << "Stopped recording." << std::endl;
+                         }
+                         else
+                         {
+                             std::cout << "Unknown option" << std::endl;
+                         }
+                         return false;
+                     } },
+            Command{ { "reverse-go" },
+                     {},
+                     0,
+                     0,
+                     "Go back to where execution last reached a breakpoint or passpoint",
+                     replxx::Replxx::Color::DEFAULT,
+                     [&p_machine, &writer](const TokenVector& /*input*/)
+                     {
+                         if (p_machine->m_hardware.checkpoint_count() == 0)
+                         {
+                             std::cout << "No checkpoints; use 'checkpoint on' first" << std::endl;
+                             return false;
+                         }
+                         if (!p_machine->reverse_go())
+                         {
+                             std::cout << "Not found; at the earliest checkpoint" << std::endl;
+                         }
+                         writer.examine();
+                         return false;
+                     } },
+            Command{ { "reverse-step" },
+                     {},
+                     0,
+                     1,
+                     "Go back N instructions",
+                     replxx::Replxx::Color::RED,
+                     [&p_machine, &writer](const TokenVector& input)
+                     {
+                         if (p_machine->m_hardware.checkpoint_count() == 0)
+                         {
+                             std::cout << "No checkpoints; use 'checkpoint on' first" << std::endl;
+                             return false;
+                         }
+                         auto count = 1UL; // Default to going back one instruction
+                         if (input.size() >= 2)
+                         {
+                             count = std::strtoul(input[1].c_str(), nullptr, 16);
+                         }
+                         if (!p_machine->reverse_step(count))
+                         {
+                             std::cout << "At the earliest checkpoint" << std::endl;
+                         }
+                         writer.examine();
+                         return false;
+                     } },
             Command{ { "set" },
                      { "breakpoint", "passpoint", "watchpoint" },
                      2,
@@ -395,7 +534,7 @@ namespace
                          return false;
                      } },
             Command{ { "show" },
-                     { "symbols", "actions", "registers" },
+                     { "symbols", "actions", "registers", "calls", "stats" },
                      1,
                      1,
                      "Show state information",
@@ -416,12 +555,54 @@ namespace
                          {
                              writer.examine();
                          }
+                         else if (noun == "calls")
+                         {
+                             p_machine->m_hardware.show_call_trace([](const std::string& line)
+                                                                   { std::cout << line << std::endl; });
+                         }
+                         else if (noun == "stats")
+                         {
+                             p_machine->m_hardware.show_statistics([](const std::string& line)
+                                                                   { std::cout << line << std::endl; });
+                         }
                          else
                          {
                              std::cout << "Unknown option" << std::endl;
                          }
                          return false;
                      } },
+            Command{ { "snapshot" },
+                     { "save", "load" },
+                     2,
+                     2,
+                     "Save the machine state to a file, or load it from one",
+                     replxx::Replxx::Color::DEFAULT,
+                     [&p_machine, &writer](const TokenVector& input)
+                     {
+                         BOOST_ASSERT(input.size() == 3);
+                         try
+                         {
+                             if (input[1] == "save")
+                             {
+                                 p_machine->save_snapshot(input[2]);
+                                 std::cout << "Saved." << std::endl;
+                             }
+                             else if (input[1] == "load")
+                             {
+                                 p_machine->load_snapshot(input[2]);
+                                 writer.examine();
+                             }
+                             else
+                             {
+                                 std::cout << "Unknown option" << std::endl;
+                             }
+                         }
+                         catch (const std::exception& e)
+                         {
+                             std::cout << e.what() << std::endl;
+                         }
+                         return false;
+                     } },
             Command{ { "trace" },
                      {},
                      0,
@@ -516,6 +697,9 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    // The debugger shows cycle counts and registers, so always needs them to be accurate
+    p_machine->m_hardware.m_processor->set_fast(false);
+
     // And we'll need a Debuggable to help us query the system
     auto p_debuggable = p_machine->m_hardware.get_idebuggable(); // Yuk.  TODO.
 
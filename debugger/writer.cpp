@@ -1,16 +1,23 @@
 #include "writer.hpp"
 
+#include <zcpm/core/imemory.hpp>
 #include <zcpm/core/processor.hpp>
 #include <zcpm/core/registers.hpp>
+#include <zcpm/core/tracerecorder.hpp>
 
 #include <boost/assert.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
+#include <iterator>
+#include <map>
 #include <ostream>
+#include <stdexcept>
 #include <string>
-#include <vector>
+#include <tuple>
+#include <utility>
 
 namespace
 {
@@ -38,16 +45,17 @@ namespace
         return fmt::format("{:04X}", high << 8 | low);
     }
 
-    std::string byte_array_to_string(const std::vector<uint8_t>& bytes)
+    // The 'count' bytes at 'address' as a bracketed list of hex values
+    std::string bytes_to_string(const zcpm::IMemory& memory, uint16_t address, size_t count)
     {
         std::string result;
-        for (const auto& b : bytes)
+        for (size_t i = 0; i < count; ++i)
         {
             if (!result.empty())
             {
                 result += " ";
             }
-            result += byte(b);
+            result += byte(memory.read_byte(address + i));
         }
         return "[" + result + "]";
     }
@@ -598,6 +606,34 @@ namespace
         // Unhandled instruction
         return { 0, fmt::format("?TODO({:02X},{:02X},{:02X})", op1, op2, op3), "" };
     }
+    // Describe those registers (other than PC) which differ between 'before' and 'after', or all of them if there is
+    // nothing to compare with
+    std::string changed_registers(const zcpm::Registers* before, const zcpm::Registers& after)
+    {
+        const std::array<std::pair<const char*, uint16_t zcpm::Registers::*>, 11> registers{ {
+            { "AF", &zcpm::Registers::AF },
+            { "BC", &zcpm::Registers::BC },
+            { "DE", &zcpm::Registers::DE },
+            { "HL", &zcpm::Registers::HL },
+            { "IX", &zcpm::Registers::IX },
+            { "IY", &zcpm::Registers::IY },
+            { "SP", &zcpm::Registers::SP },
+            { "AF'", &zcpm::Registers::altAF },
+            { "BC'", &zcpm::Registers::altBC },
+            { "DE'", &zcpm::Registers::altDE },
+            { "HL'", &zcpm::Registers::altHL },
+        } };
+
+        std::string result;
+        for (const auto& [name, member] : registers)
+        {
+            if (!before || (before->*member != after.*member))
+            {
+                result += fmt::format(" {}={:04X}", name, after.*member);
+            }
+        }
+        return result;
+    }
 } // namespace
 
 Writer::Writer(const zcpm::IDebuggable* p_debuggable, zcpm::IMemory& memory, std::ostream& os)
@@ -611,18 +647,19 @@ void Writer::examine() const
     m_memory.check_memory_accesses(false);
 
     const auto registers = m_pdebuggable->get_registers();
-    const auto [op1, op2, op3, op4, skipped] = m_pdebuggable->get_opcodes_at(registers.PC, 0);
-    if (!skipped.empty())
+    const auto [bytes, skipped] = m_pdebuggable->get_opcodes_at(registers.PC);
+    std::string out;
+    if (skipped)
     {
-        display(registers, byte_array_to_string(skipped) + " SKIPPED", "");
+        display(out, registers, bytes_to_string(m_memory, registers.PC, skipped) + " SKIPPED", "");
     }
-    const auto num_skipped = skipped.size();
 
     try
     {
-        const auto [_, s1, s2] = disassemble(op1, op2, op3, op4, registers.PC + num_skipped);
+        const auto& instruction = disassemble_at(registers.PC + skipped, bytes);
 
-        display(registers, s1, s2, num_skipped);
+        display(out, registers, instruction.m_s1, instruction.m_s2, skipped);
+        write(out);
 
         m_memory.check_memory_accesses(true);
     }
@@ -630,6 +667,7 @@ void Writer::examine() const
     {
         // A failure to parse; display enough information to help the maintainer:
         // Memory content around the offending area, aligned on 16's
+        write(out);
         dump((registers.PC - 16) & 0xFFF0, 64);
         throw;
     }
@@ -640,20 +678,21 @@ void Writer::list(int start, size_t instructions) const
     const auto registers = m_pdebuggable->get_registers();
     const uint16_t base = (start < 0) ? registers.PC : start;
 
+    std::string out;
     size_t offset = 0;
     for (size_t i = 0; i < instructions; ++i)
     {
-        const auto [op1, op2, op3, op4, skipped] = m_pdebuggable->get_opcodes_at(base, offset);
-        if (!skipped.empty())
+        const uint16_t address = base + offset;
+        const auto [bytes, skipped] = m_pdebuggable->get_opcodes_at(address);
+        if (skipped)
         {
-            display(registers, byte_array_to_string(skipped) + " SKIPPED", "");
-            offset += skipped.size();
+            display(out, address, bytes_to_string(m_memory, address, skipped) + " SKIPPED", "");
         }
-        const auto num_skipped = skipped.size();
-        const auto [nbytes, s1, s2] = disassemble(op1, op2, op3, op4, registers.PC + num_skipped);
-        display(base + offset + num_skipped, s1, s2);
-        offset += nbytes + num_skipped;
+        const auto& instruction = disassemble_at(address + skipped, bytes);
+        display(out, address + skipped, instruction.m_s1, instruction.m_s2);
+        offset += skipped + std::max<size_t>(instruction.m_nbytes, 1);
     }
+    write(out);
 }
 
 void Writer::dump(int start, size_t bytes) const
@@ -666,19 +705,19 @@ void Writer::dump(int start, size_t bytes) const
     const auto registers = m_pdebuggable->get_registers();
     const uint16_t base = (start < 0) ? registers.PC : start;
 
-    std::string hex_bytes, ascii_bytes;
+    std::string out, hex_bytes, ascii_bytes;
     for (size_t offset = 0; offset < bytes; ++offset)
     {
         if ((offset % 16) == 0)
         {
-            m_os << fmt::format("{:04X}:", base + offset);
+            fmt::format_to(std::back_inserter(out), "{:04X}:", base + offset);
         }
         const auto b = m_memory.read_byte(base + offset);
-        hex_bytes += fmt::format(" {:02X}", b);
-        ascii_bytes += std::string(1, ((b < 0x20) || (b > 0x7f)) ? '.' : b);
+        fmt::format_to(std::back_inserter(hex_bytes), " {:02X}", b);
+        ascii_bytes += ((b < 0x20) || (b > 0x7f)) ? '.' : static_cast<char>(b);
         if (((offset + 1) % 16) == 0)
         {
-            m_os << hex_bytes << ' ' << ascii_bytes << std::endl;
+            out += hex_bytes + ' ' + ascii_bytes + '\n';
             hex_bytes.clear();
             ascii_bytes.clear();
         }
@@ -687,41 +726,121 @@ void Writer::dump(int start, size_t bytes) const
     {
         const auto nbytes = ascii_bytes.length();
         const auto padding = std::string((16 - nbytes) * 3, ' ');
-        m_os << hex_bytes << padding << ' ' << ascii_bytes << std::endl;
+        out += hex_bytes + padding + ' ' + ascii_bytes + '\n';
     }
+    write(out);
 }
 
-void Writer::display(uint16_t address, std::string_view s1, std::string_view s2) const
+void Writer::history(const zcpm::TraceRecorder& recorder, size_t instructions) const
 {
-    m_os << fmt::format("{:04X}     {:<5}{}", address, s1, s2) << std::endl;
+    // One more record than is to be displayed is fetched where possible, so that even the first one displayed can show
+    // just the registers that it changed
+    const auto records = recorder.latest(instructions + 1);
+    const auto first = (records.size() > instructions) ? size_t{ 1 } : size_t{ 0 };
+
+    std::string out;
+    fmt::format_to(std::back_inserter(out),
+                   "Last {:d} of {:d} instructions recorded:\n",
+                   records.size() - first,
+                   recorder.total());
+    for (auto i = first; i < records.size(); ++i)
+    {
+        const auto& record = records[i];
+        const auto& bytes = record.m_bytes;
+
+        // An instruction which has been executed but which the disassembler doesn't know shouldn't hide the rest
+        size_t nbytes = 1;
+        std::string_view s1 = "?", s2;
+        try
+        {
+            const auto& instruction = disassemble_at(record.m_address, bytes);
+            nbytes = std::clamp<size_t>(instruction.m_nbytes, 1, bytes.size());
+            s1 = instruction.m_s1;
+            s2 = instruction.m_s2;
+        }
+        catch (const std::logic_error&)
+        {
+        }
+        std::string hex_bytes;
+        for (size_t b = 0; b < nbytes; ++b)
+        {
+            fmt::format_to(std::back_inserter(hex_bytes), "{:02X}", bytes[b]);
+        }
+
+        std::string writes;
+        for (size_t w = 0; w < std::min<size_t>(record.m_write_count, zcpm::TraceRecorder::MaxWrites); ++w)
+        {
+            fmt::format_to(
+                std::back_inserter(writes), " ({:04X})={:02X}", record.m_write_addresses[w], record.m_write_values[w]);
+        }
+        if (record.m_write_count > zcpm::TraceRecorder::MaxWrites)
+        {
+            fmt::format_to(
+                std::back_inserter(writes), " +{:d} more", record.m_write_count - zcpm::TraceRecorder::MaxWrites);
+        }
+
+        fmt::format_to(std::back_inserter(out),
+                       "{:04X}  {:<9}{:<5}{:<16}{}{}\n",
+                       record.m_address,
+                       hex_bytes,
+                       s1,
+                       s2,
+                       changed_registers((i > 0) ? &records[i - 1].m_registers : nullptr, record.m_registers),
+                       writes);
+    }
+    write(out);
 }
 
-void Writer::display(const zcpm::Registers& registers,
+const Writer::Disassembly& Writer::disassemble_at(uint16_t address, const std::array<uint8_t, 4>& bytes) const
+{
+    if (const auto it = m_disassembly.find(address); (it != m_disassembly.end()) && (it->second.m_bytes == bytes))
+    {
+        return it->second;
+    }
+
+    auto [nbytes, s1, s2] = disassemble(bytes[0], bytes[1], bytes[2], bytes[3], address);
+    auto& instruction = m_disassembly[address];
+    instruction = { bytes, nbytes, std::move(s1), std::move(s2) };
+    return instruction;
+}
+
+void Writer::display(std::string& out, uint16_t address, std::string_view s1, std::string_view s2) const
+{
+    fmt::format_to(std::back_inserter(out), "{:04X}     {:<5}{}\n", address, s1, s2);
+}
+
+void Writer::display(std::string& out,
+                     const zcpm::Registers& registers,
                      std::string_view s1,
                      std::string_view s2,
                      const uint16_t offset) const
 {
-    m_os << fmt::format("{} A={:02X} B={:04X} D={:04X} H={:04X} S={:04X} P={:04X}  {:<5}{}",
-                        flags_to_string(registers.AF & 0xFF),
-                        registers.AF >> 8,
-                        registers.BC,
-                        registers.DE,
-                        registers.HL,
-                        registers.SP,
-                        (registers.PC + offset) & 0xFFFF,
-                        s1,
-                        s2);
-
-    m_os << std::endl;
-    m_os << fmt::format("{} '={:02X} '={:04X} '={:04X} '={:04X} X={:04X} Y={:04X}",
-                        flags_to_string(registers.altAF & 0xFF),
-                        registers.altAF >> 8,
-                        registers.altBC,
-                        registers.altDE,
-                        registers.altHL,
-                        registers.IX,
-                        registers.IY)
-         << std::endl;
+    fmt::format_to(std::back_inserter(out),
+                   "{} A={:02X} B={:04X} D={:04X} H={:04X} S={:04X} P={:04X}  {:<5}{}\n",
+                   flags_to_string(registers.AF & 0xFF),
+                   registers.AF >> 8,
+                   registers.BC,
+                   registers.DE,
+                   registers.HL,
+                   registers.SP,
+                   (registers.PC + offset) & 0xFFFF,
+                   s1,
+                   s2);
+    fmt::format_to(std::back_inserter(out),
+                   "{} '={:02X} '={:04X} '={:04X} '={:04X} X={:04X} Y={:04X}\n",
+                   flags_to_string(registers.altAF & 0xFF),
+                   registers.altAF >> 8,
+                   registers.altBC,
+                   registers.altDE,
+                   registers.altHL,
+                   registers.IX,
+                   registers.IY);
+}
+
+void Writer::write(const std::string& out) const
+{
+    m_os.write(out.data(), static_cast<std::streamsize>(out.size()));
+    m_os.flush();
 }
 
 std::string Writer::flags_to_string(uint8_t f) const
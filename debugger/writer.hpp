@@ -1,9 +1,12 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 namespace zcpm
 {
@@ -11,6 +14,7 @@ namespace zcpm
     class IMemory;
     class Registers;
     class System;
+    class TraceRecorder;
 } // namespace zcpm
 
 // A class which encapsulates the knowledge of how to display information for our machine, without having that
@@ -36,19 +40,46 @@ public:
     // start < 0 means to use PC, otherwise to use that actual address value
     void dump(int start, size_t bytes) const;
 
+    // Display the most recently recorded instructions, oldest first, each with the registers it changed and the memory
+    // it wrote
+    void history(const zcpm::TraceRecorder& recorder, size_t instructions) const;
+
 private:
+    // An instruction as disassembled, along with the opcode bytes it was disassembled from
+    struct Disassembly
+    {
+        std::array<uint8_t, 4> m_bytes;
+        size_t m_nbytes;
+        std::string m_s1;
+        std::string m_s2;
+    };
+
+    // Disassemble the instruction at the specified address, which starts with the specified bytes, reusing an earlier
+    // disassembly of it if the bytes there are still the same
+    const Disassembly& disassemble_at(uint16_t address, const std::array<uint8_t, 4>& bytes) const;
+
+    // Each of these appends its output to 'out', so that a whole listing can be written to the stream at once
+
     // For displaying a line in a 'list' output
-    void display(uint16_t address, std::string_view s1, std::string_view s2) const;
+    void display(std::string& out, uint16_t address, std::string_view s1, std::string_view s2) const;
 
     // For displaying a line in an 'examine' output
-    void display(const zcpm::Registers& registers,
+    void display(std::string& out,
+                 const zcpm::Registers& registers,
                  std::string_view s1,
                  std::string_view s2,
                  const uint16_t offset = 0) const;
 
+    // Write (and flush) some accumulated output
+    void write(const std::string& out) const;
+
     std::string flags_to_string(uint8_t f) const;
 
     const zcpm::IDebuggable* m_pdebuggable;
     zcpm::IMemory& m_memory;
     std::ostream& m_os;
+
+    // Instructions disassembled so far, by address. Rather than being told about every write to memory, each entry is
+    // checked against the bytes now at its address before being used, and is replaced if they have been changed.
+    mutable std::unordered_map<uint16_t, Disassembly> m_disassembly;
 };
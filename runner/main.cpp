@@ -2,20 +2,33 @@
 
 #include <zcpm/builder/builder.hpp>
 #include <zcpm/core/system.hpp>
+#include <zcpm/terminal/terminal.hpp>
 
 #include <boost/log/trivial.hpp>
 
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <stdexcept>
+#include <string>
 
 int main(int argc, char* argv[])
 {
+    std::optional<zcpm::MachineOptions> options;
     std::unique_ptr<zcpm::System> p_machine;
     try
     {
-        p_machine = zcpm::build_machine(argc, argv);
+        options = zcpm::parse_command_line(argc, argv);
+        if (options)
+        {
+            p_machine = zcpm::boot_machine(*options, zcpm::make_terminal(*options));
+            if (p_machine && !zcpm::load_program(*p_machine, options->binary, options->arguments))
+            {
+                p_machine.reset();
+            }
+        }
     }
     catch (const std::exception& e)
     {
@@ -45,5 +58,24 @@ int main(int argc, char* argv[])
         BOOST_LOG_TRIVIAL(trace) << "Exception.";
     }
 
+    // Statistics go to stderr, so as not to be mixed up with the program's output
+    if (options->stats)
+    {
+        p_machine->m_hardware.show_statistics([](const std::string& line) { std::cerr << line << std::endl; });
+    }
+    if (!options->stats_json.empty())
+    {
+        std::ofstream file(options->stats_json, std::ios::trunc);
+        if (file)
+        {
+            p_machine->m_hardware.write_statistics_json(file);
+        }
+        else
+        {
+            std::cerr << "Can't write statistics to " << options->stats_json << std::endl;
+            ok = false;
+        }
+    }
+
     return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
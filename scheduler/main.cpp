@@ -0,0 +1,179 @@
+// A program which runs a list of CP/M jobs, several at a time, each on a machine of its own on a thread of its own. The
+// machine is booted just once, and each job starts from a copy of that. The jobs file has a line per job such as:
+//
+//   /home/someone/cpm/project1 M80.COM =MAIN
+//
+// which names the host directory that is the job's disk, the binary (relative to that directory unless it is an
+// absolute path), and its arguments. Blank lines and lines starting with '#' are ignored. Job N (counting from 1)
+// writes its console output to jobN.out and its log to jobN.log in the current directory, and has no console input.
+
+#include <zcpm/builder/builder.hpp>
+#include <zcpm/core/log.hpp>
+#include <zcpm/core/snapshot.hpp>
+#include <zcpm/core/system.hpp>
+#include <zcpm/terminal/batch.hpp>
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Job
+    {
+        std::string directory;
+        std::string binary;
+        std::vector<std::string> arguments;
+    };
+
+    std::vector<Job> read_jobs(const std::string& filename)
+    {
+        std::ifstream file(filename);
+        if (!file.is_open())
+        {
+            throw std::runtime_error("Can't open " + filename);
+        }
+
+        std::vector<Job> result;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream words(line);
+            Job job;
+            if (!(words >> job.directory) || (job.directory[0] == '#'))
+            {
+                continue;
+            }
+            if (!(words >> job.binary))
+            {
+                throw std::runtime_error("No binary for the job in " + job.directory);
+            }
+            job.arguments.assign(std::istream_iterator<std::string>(words), std::istream_iterator<std::string>());
+            result.push_back(job);
+        }
+        return result;
+    }
+
+    // Runs on a worker thread, with a machine which is used by nothing else
+    bool run_job(size_t number, const Job& job, const zcpm::MachineOptions& options, const zcpm::Snapshot& snapshot)
+    {
+        const auto name = "job" + std::to_string(number);
+        std::optional<zcpm::log::ThreadLog> thread_log;
+        if (zcpm::log::runtime_level != zcpm::log::Level::none)
+        {
+            thread_log.emplace(name + ".log");
+        }
+
+        try
+        {
+            // The machine is set up from the snapshot rather than from the BDOS files
+            auto config = options.config;
+            config.bdos_sym.clear();
+            config.disk_root = job.directory;
+            zcpm::System machine(
+                std::make_unique<zcpm::terminal::Batch>(
+                    options.rows, options.columns, "/dev/null", name + ".out", options.batch_end),
+                config);
+            machine.m_hardware.restore_snapshot(snapshot);
+            machine.forget_disk_login();
+
+            const auto binary = std::filesystem::path(job.directory) / job.binary;
+            if (!zcpm::load_program(machine, binary.string(), job.arguments))
+            {
+                return false;
+            }
+            machine.run();
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Exception in " << name << ": " << e.what() << std::endl;
+            BOOST_LOG_TRIVIAL(trace) << "Exception: " << e.what();
+            return false;
+        }
+    }
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const auto options = zcpm::parse_command_line(argc, argv, false);
+    if (!options)
+    {
+        return EXIT_FAILURE;
+    }
+    if (options->jobs_file.empty())
+    {
+        std::cerr << "A jobs file must be specified" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Boot just once, and keep the result to start each job from
+    std::vector<Job> jobs;
+    zcpm::Snapshot snapshot;
+    try
+    {
+        jobs = read_jobs(options->jobs_file);
+
+        auto p_machine = zcpm::boot_machine(
+            *options, std::make_unique<zcpm::terminal::Batch>(options->rows, options->columns, "/dev/null", "/dev/null"));
+        if (!p_machine)
+        {
+            return EXIT_FAILURE;
+        }
+        snapshot = p_machine->m_hardware.save_snapshot();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        BOOST_LOG_TRIVIAL(trace) << "Exception: " << e.what();
+        return EXIT_FAILURE;
+    }
+
+    // Each worker takes the next job that nobody has started yet, until there are none left
+    const auto thread_count = static_cast<size_t>(
+        (options->threads > 0) ? options->threads : std::max(std::thread::hardware_concurrency(), 1u));
+    std::atomic<size_t> next_job{ 0 };
+    std::vector<char> succeeded(jobs.size(), false); // Not vector<bool>, since workers set elements concurrently
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(thread_count, jobs.size()); ++i)
+    {
+        workers.emplace_back([&]() {
+            for (auto index = next_job++; index < jobs.size(); index = next_job++)
+            {
+                succeeded[index] = run_job(index + 1, jobs[index], *options, snapshot);
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    auto failures = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (!succeeded[i])
+        {
+            std::cout << "job" << (i + 1) << " (" << jobs[i].binary << " in " << jobs[i].directory << ") failed"
+                      << std::endl;
+            ++failures;
+        }
+    }
+    std::cout << jobs.size() << " jobs run, " << failures << " failed" << std::endl;
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
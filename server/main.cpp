@@ -0,0 +1,235 @@
+// A program which boots the machine once, and then runs any number of CP/M binaries from that booted state, each one
+// in a forked copy of the server process. A job arrives as a connection on a Unix socket, and starts with a header of
+// lines such as:
+//
+//   cwd /home/someone/cpm
+//   binary PIP.COM
+//   arg B:=A:*.*
+//   arg [V]
+//
+// followed by an empty line. Anything after that (until the client shuts down its side of the connection) is the
+// console input for the job, and the job's console output is sent back over the same connection before it is closed.
+// Neither is streamed: the input is all read before the job starts, and the output is buffered as for the BATCH
+// terminal (which the job uses), so a job can't interact with its client.
+
+#include <zcpm/builder/builder.hpp>
+#include <zcpm/core/snapshot.hpp>
+#include <zcpm/core/system.hpp>
+#include <zcpm/terminal/batch.hpp>
+
+#include <boost/log/trivial.hpp>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    struct Job
+    {
+        std::string cwd;
+        std::string binary;
+        std::vector<std::string> arguments;
+    };
+
+    // Read the job header from the connection, a byte at a time so as to leave the console input unread
+    std::optional<Job> read_job(int fd)
+    {
+        Job job;
+        std::string line;
+        char ch = 0;
+        while (::read(fd, &ch, 1) == 1)
+        {
+            if (ch != '\n')
+            {
+                line += ch;
+                continue;
+            }
+            if (line.empty())
+            {
+                return job;
+            }
+
+            const auto space = line.find(' ');
+            const auto keyword = line.substr(0, space);
+            const auto value = (space == std::string::npos) ? std::string() : line.substr(space + 1);
+            if (keyword == "cwd")
+            {
+                job.cwd = value;
+            }
+            else if (keyword == "binary")
+            {
+                job.binary = value;
+            }
+            else if (keyword == "arg")
+            {
+                job.arguments.push_back(value);
+            }
+            else
+            {
+                BOOST_LOG_TRIVIAL(info) << "Unknown job header line '" << line << "'";
+            }
+            line.clear();
+        }
+
+        return std::nullopt;
+    }
+
+    void send(int fd, std::string_view text)
+    {
+        (void)::write(fd, text.data(), text.size());
+    }
+
+    // Runs in the forked child, with the console on the connection
+    int run_job(int fd, const zcpm::MachineOptions& options, const zcpm::Snapshot& snapshot)
+    {
+        const auto job = read_job(fd);
+        if (!job || job->binary.empty())
+        {
+            send(fd, "Incomplete job header\n");
+            return EXIT_FAILURE;
+        }
+        if (!job->cwd.empty() && (::chdir(job->cwd.c_str()) != 0))
+        {
+            send(fd, "Can't change directory to " + job->cwd + ": " + std::strerror(errno) + "\n");
+            return EXIT_FAILURE;
+        }
+        if ((::dup2(fd, STDIN_FILENO) < 0) || (::dup2(fd, STDOUT_FILENO) < 0) || (::dup2(fd, STDERR_FILENO) < 0))
+        {
+            return EXIT_FAILURE;
+        }
+        ::close(fd);
+
+        auto ok = false;
+        try
+        {
+            // The machine is set up from the snapshot rather than from the BDOS files, but its disk is the job's
+            // current directory since that is where it is constructed
+            auto config = options.config;
+            config.bdos_sym.clear();
+            auto p_machine = std::make_unique<zcpm::System>(
+                std::make_unique<zcpm::terminal::Batch>(options.rows, options.columns, "", "", options.batch_end),
+                config);
+            p_machine->m_hardware.restore_snapshot(snapshot);
+            p_machine->forget_disk_login();
+            if (zcpm::load_program(*p_machine, job->binary, job->arguments))
+            {
+                p_machine->run();
+                ok = true;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Exception: " << e.what() << std::endl;
+            BOOST_LOG_TRIVIAL(trace) << "Exception: " << e.what();
+        }
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int listen_on(const std::string& path)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            throw std::runtime_error("Socket name is too long: " + path);
+        }
+        path.copy(address.sun_path, path.size());
+
+        const auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            throw std::runtime_error(std::string("Can't create socket: ") + std::strerror(errno));
+        }
+        ::unlink(path.c_str());
+        if ((::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) || (::listen(fd, 16) != 0))
+        {
+            const auto error = errno;
+            ::close(fd);
+            throw std::runtime_error("Can't listen on " + path + ": " + std::strerror(error));
+        }
+        return fd;
+    }
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const auto options = zcpm::parse_command_line(argc, argv, false);
+    if (!options)
+    {
+        return EXIT_FAILURE;
+    }
+    if (options->socket.empty())
+    {
+        std::cerr << "A socket must be specified" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Boot just once, and keep the result to start each job from. The machine itself is gone before any job is
+    // forked, so that nothing (such as a thread) is left half-copied into the children.
+    zcpm::Snapshot snapshot;
+    int listener = -1;
+    try
+    {
+        auto p_machine = zcpm::boot_machine(
+            *options, std::make_unique<zcpm::terminal::Batch>(options->rows, options->columns, "/dev/null", "/dev/null"));
+        if (!p_machine)
+        {
+            return EXIT_FAILURE;
+        }
+        snapshot = p_machine->m_hardware.save_snapshot();
+        p_machine.reset();
+
+        listener = listen_on(options->socket);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        BOOST_LOG_TRIVIAL(trace) << "Exception: " << e.what();
+        return EXIT_FAILURE;
+    }
+
+    // Nothing waits for the children, so have them reaped automatically
+    std::signal(SIGCHLD, SIG_IGN);
+
+    while (true)
+    {
+        const auto fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "Accept failed: " << std::strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        const auto pid = ::fork();
+        if (pid == 0)
+        {
+            ::close(listener);
+            std::_Exit(run_job(fd, *options, snapshot));
+        }
+        if (pid < 0)
+        {
+            BOOST_LOG_TRIVIAL(info) << "Fork failed: " << std::strerror(errno);
+            send(fd, "Can't start job\n");
+        }
+        ::close(fd);
+    }
+}
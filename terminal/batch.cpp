@@ -0,0 +1,160 @@
+#include "batch.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    // Translate host text into the keystrokes that a CP/M user would type
+    std::string to_keystrokes(const std::string& text)
+    {
+        std::string result;
+        result.reserve(text.size());
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            const auto ch = text[i];
+            if ((ch == '\r') && (i + 1 < text.size()) && (text[i + 1] == '\n'))
+            {
+                // A CR LF pair is a single Enter
+                continue;
+            }
+            if (ch == '\n')
+            {
+                result += '\r';
+            }
+            else if (ch == 0x7F)
+            {
+                result += '\b';
+            }
+            else
+            {
+                result += ch;
+            }
+        }
+        return result;
+    }
+} // namespace
+
+namespace zcpm::terminal
+{
+
+    Batch::Batch(int rows,
+                 int columns,
+                 const std::string& input_filename,
+                 const std::string& output_filename,
+                 bool end_at_input_end)
+        : Terminal(rows, columns), m_end_at_input_end(end_at_input_end), m_output_fd(STDOUT_FILENO)
+    {
+        if (input_filename.empty())
+        {
+            m_input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        }
+        else
+        {
+            std::ifstream file(input_filename, std::ios::binary);
+            if (!file.is_open())
+            {
+                throw std::runtime_error("Can't open batch input file: " + input_filename);
+            }
+            m_input.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        m_input = to_keystrokes(m_input);
+
+        if (!output_filename.empty())
+        {
+            m_output_fd = ::open(output_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (m_output_fd < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "Batch output file open failed");
+            }
+            m_close_output = true;
+        }
+
+        m_output.reserve(BufferSize);
+    }
+
+    Batch::~Batch()
+    {
+        flush();
+        if (m_close_output)
+        {
+            ::close(m_output_fd);
+        }
+    }
+
+    void Batch::print(char ch)
+    {
+        m_output += ch;
+        if (m_output.size() >= BufferSize)
+        {
+            flush();
+        }
+    }
+
+    void Batch::write(std::string_view text)
+    {
+        m_output += text;
+        if (m_output.size() >= BufferSize)
+        {
+            flush();
+        }
+    }
+
+    bool Batch::is_character_ready() const
+    {
+        return m_next_input < m_input.size();
+    }
+
+    bool Batch::wait_for_character(int timeout_ms) const
+    {
+        // Nothing more can arrive, so there's no point in waiting
+        return is_character_ready();
+    }
+
+    char Batch::get_char()
+    {
+        if (m_next_input < m_input.size())
+        {
+            return m_input[m_next_input++];
+        }
+        return static_cast<char>(0xFF);
+    }
+
+    bool Batch::is_input_exhausted() const
+    {
+        return m_end_at_input_end && !is_character_ready();
+    }
+
+    void Batch::flush()
+    {
+        auto p_data = m_output.data();
+        auto remaining = m_output.size();
+        while (remaining > 0)
+        {
+            const auto written = ::write(m_output_fd, p_data, remaining);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                BOOST_LOG_TRIVIAL(trace) << "Warning: batch output failed: " << std::strerror(errno);
+                break;
+            }
+            p_data += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        m_output.clear();
+    }
+
+} // namespace zcpm::terminal
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "terminal.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace zcpm::terminal
+{
+
+    // A terminal for unattended runs. All of the keystrokes are read up front from a file (or from stdin), with
+    // newlines translated to CP/M style CRs, and output is passed through untranslated to a file (or to stdout) via a
+    // large buffer. Nothing is interactive: neither ncurses nor the host terminal settings are touched, and nothing
+    // ever waits for input. Once the input is used up, the run can be ended as soon as the program waits for more.
+    class Batch final : public Terminal
+    {
+    public:
+        Batch(int rows,
+              int columns,
+              const std::string& input_filename = "",
+              const std::string& output_filename = "",
+              bool end_at_input_end = true);
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+        Batch(Batch&&) = delete;
+        Batch& operator=(Batch&&) = delete;
+
+        ~Batch() override;
+
+        // Send a single character to the console
+        void print(char ch) override;
+        void write(std::string_view text) override;
+
+        // Check to see if a character remains to be read
+        [[nodiscard]] bool is_character_ready() const override;
+        [[nodiscard]] bool wait_for_character(int timeout_ms) const override;
+
+        // Get the next character, or 0xFF if there is none (as for the other terminals at the end of their input)
+        char get_char() override;
+
+        [[nodiscard]] bool is_input_exhausted() const override;
+
+    private:
+        // Write any buffered output
+        void flush();
+
+        inline static const size_t BufferSize{ 0x100000 };
+
+        const bool m_end_at_input_end;
+
+        std::string m_input;
+        size_t m_next_input{ 0 };
+
+        int m_output_fd;
+        bool m_close_output{ false };
+        std::string m_output;
+    };
+
+} // namespace zcpm::terminal
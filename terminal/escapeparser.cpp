@@ -0,0 +1,108 @@
+#include "escapeparser.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    using Table = std::array<uint8_t, 0x80>;
+
+    // VT100 sequences (see http://ascii-table.com/ansi-escape-sequences-vt-100.php) are mostly either a single
+    // character or a control sequence, apart from the character set and line size selections
+    const Table Vt100Table = [] {
+        Table table{};
+        table['['] = zcpm::terminal::EscapeParser::ControlSequence;
+        table['('] = 1;
+        table[')'] = 1;
+        table['#'] = 1;
+        return table;
+    }();
+
+    // Televideo sequences are a single character apart from cursor addressing (row and column) and attribute
+    // selection (see https://archive.org/details/bitsavers_televideo9deo925UsersGuideJan1983_5637627)
+    const Table TelevideoTable = [] {
+        Table table{};
+        table['='] = 2;
+        table['G'] = 1;
+        return table;
+    }();
+
+    // Parameter values are limited to this, so that they can't overflow
+    const int MaxParameterValue = 9999;
+
+} // namespace
+
+namespace zcpm::terminal
+{
+
+    EscapeParser::EscapeParser(Dialect dialect)
+        : m_table((dialect == Dialect::TELEVIDEO) ? TelevideoTable : Vt100Table)
+    {
+    }
+
+    void EscapeParser::start()
+    {
+        m_text[0] = '\033';
+        m_length = 1;
+        m_num_parameters = 0;
+        m_private = false;
+    }
+
+    EscapeParser::Status EscapeParser::add(char ch)
+    {
+        if (!active() || (m_length == MaxLength))
+        {
+            return Status::INVALID;
+        }
+        m_text[m_length++] = ch;
+
+        const auto intro = static_cast<uint8_t>(m_text[1]);
+        if (intro >= m_table.size())
+        {
+            return Status::INVALID;
+        }
+        if (m_table[intro] == ControlSequence)
+        {
+            return (m_length == 2) ? Status::INCOMPLETE : add_to_control_sequence(ch);
+        }
+        return (m_length == 2 + size_t(m_table[intro])) ? Status::COMPLETE : Status::INCOMPLETE;
+    }
+
+    EscapeParser::Status EscapeParser::add_to_control_sequence(char ch)
+    {
+        // As per ECMA-48: parameter characters, then intermediate characters, and then a final character
+        if ((ch >= '0') && (ch <= '9'))
+        {
+            if (m_num_parameters == 0)
+            {
+                m_parameters[m_num_parameters++] = 0;
+            }
+            auto& value = m_parameters[m_num_parameters - 1];
+            value = std::min(value * 10 + (ch - '0'), MaxParameterValue);
+            return Status::INCOMPLETE;
+        }
+        if (ch == ';')
+        {
+            if (m_num_parameters == 0)
+            {
+                m_parameters[m_num_parameters++] = 0;
+            }
+            if (m_num_parameters == MaxParameters)
+            {
+                return Status::INVALID;
+            }
+            m_parameters[m_num_parameters++] = 0;
+            return Status::INCOMPLETE;
+        }
+        if ((ch >= '<') && (ch <= '?'))
+        {
+            m_private = true;
+            return Status::INCOMPLETE;
+        }
+        if ((ch >= ' ') && (ch <= '/'))
+        {
+            return Status::INCOMPLETE;
+        }
+        return ((ch >= '@') && (ch <= '~')) ? Status::COMPLETE : Status::INVALID;
+    }
+
+} // namespace zcpm::terminal
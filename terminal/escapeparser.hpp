@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace zcpm::terminal
+{
+
+    // Collects the characters of an escape sequence as they are output, one at a time, and recognises when the
+    // sequence is complete. The shape of a sequence is determined by the character which follows the ESC, as looked up
+    // in a table for the terminal's dialect: either a fixed number of further characters (e.g. a Televideo cursor
+    // address is ESC = row col), or an ANSI control sequence (ESC [ parameters final) whose numeric parameters are
+    // parsed as they arrive. Nothing is allocated.
+    class EscapeParser final
+    {
+    public:
+        enum class Dialect
+        {
+            VT100,
+            TELEVIDEO
+        };
+
+        enum class Status
+        {
+            INCOMPLETE, // More characters are needed
+            COMPLETE,   // The sequence is complete, and can be examined until the next call to start()
+            INVALID     // The sequence can't be valid (e.g. it is too long), and should be dropped
+        };
+
+        explicit EscapeParser(Dialect dialect);
+
+        EscapeParser(const EscapeParser&) = delete;
+        EscapeParser& operator=(const EscapeParser&) = delete;
+        EscapeParser(EscapeParser&&) = delete;
+        EscapeParser& operator=(EscapeParser&&) = delete;
+
+        ~EscapeParser() = default;
+
+        // Begin a new sequence (the caller has just output an ESC), abandoning any sequence in progress
+        void start();
+
+        // Add the next character of the sequence in progress
+        Status add(char ch);
+
+        // Finish with the current sequence
+        void reset()
+        {
+            m_length = 0;
+        }
+
+        // Is a sequence in progress?
+        [[nodiscard]] bool active() const
+        {
+            return m_length > 0;
+        }
+
+        // The character after the ESC, e.g. '[' for an ANSI control sequence
+        [[nodiscard]] char intro() const
+        {
+            return (m_length > 1) ? m_text[1] : '\0';
+        }
+
+        // The last character, which for an ANSI control sequence identifies what it does
+        [[nodiscard]] char final() const
+        {
+            return m_text[m_length - 1];
+        }
+
+        // The nth character after the intro (e.g. the row of a Televideo cursor address)
+        [[nodiscard]] char argument(size_t n) const
+        {
+            return m_text[2 + n];
+        }
+
+        // The numeric parameters of an ANSI control sequence, e.g. {3,14} for ESC [ 3 ; 1 4 H, where an omitted
+        // parameter is zero
+        [[nodiscard]] std::span<const int> parameters() const
+        {
+            return { m_parameters.data(), m_num_parameters };
+        }
+
+        // Does an ANSI control sequence have a private parameter string (e.g. ESC [ ? 2 5 h)?
+        [[nodiscard]] bool is_private() const
+        {
+            return m_private;
+        }
+
+        // The whole sequence so far, including the ESC
+        [[nodiscard]] std::string_view text() const
+        {
+            return { m_text.data(), m_length };
+        }
+
+        inline static const size_t MaxLength{ 32 };
+        inline static const size_t MaxParameters{ 16 };
+
+        // Table entries, for each character which can follow the ESC; any other value is the number of characters
+        // which follow that one
+        inline static const uint8_t ControlSequence{ 0xFF };
+
+    private:
+        Status add_to_control_sequence(char ch);
+
+        const std::array<uint8_t, 0x80>& m_table;
+
+        std::array<char, MaxLength> m_text{};
+        size_t m_length{ 0 };
+
+        std::array<int, MaxParameters> m_parameters{};
+        size_t m_num_parameters{ 0 };
+        bool m_private{ false };
+    };
+
+} // namespace zcpm::terminal
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+
+namespace zcpm::terminal
+{
+
+    // A fixed size queue of keystrokes, which is written by one thread (the one reading the host's input) and read by
+    // another (the emulation), without either of them having to take a lock
+    class KeyBuffer final
+    {
+    public:
+        KeyBuffer() = default;
+
+        KeyBuffer(const KeyBuffer&) = delete;
+        KeyBuffer& operator=(const KeyBuffer&) = delete;
+        KeyBuffer(KeyBuffer&&) = delete;
+        KeyBuffer& operator=(KeyBuffer&&) = delete;
+
+        ~KeyBuffer() = default;
+
+        // Only called by the writer; returns false if there is no room
+        bool push(char ch)
+        {
+            const auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head.load(std::memory_order_acquire) == Size)
+            {
+                return false;
+            }
+            m_keys[tail % Size] = ch;
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Only called by the reader; returns std::nullopt if there is nothing to read
+        std::optional<char> pop()
+        {
+            const auto head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire))
+            {
+                return std::nullopt;
+            }
+            const auto ch = m_keys[head % Size];
+            m_head.store(head + 1, std::memory_order_release);
+            return ch;
+        }
+
+        [[nodiscard]] bool empty() const
+        {
+            return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+        }
+
+        inline static const size_t Size{ 256 };
+
+    private:
+        std::array<char, Size> m_keys{};
+
+        // Counts of keystrokes read and written; only the reader changes m_head, and only the writer changes m_tail
+        std::atomic<size_t> m_head{ 0 };
+        std::atomic<size_t> m_tail{ 0 };
+    };
+
+} // namespace zcpm::terminal
@@ -3,9 +3,13 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/log/trivial.hpp>
 
+#include <algorithm>
+#include <cctype>
 #include <fstream>
+#include <map>
 #include <ncurses.h>
 #include <optional>
+#include <stdexcept>
 #include <string>
 
 namespace zcpm
@@ -29,15 +33,15 @@ namespace zcpm
         }
 
         // Convert a string such as "^KD" to a control-K (ASCII 11) and D (ascii 4)
-        std::list<char> parse_sequence(std::string_view sequence)
+        std::string parse_sequence(std::string_view sequence)
         {
-            std::list<char> result;
+            std::string result;
             for (auto i = 0U; i < sequence.length(); ++i)
             {
                 char key;
                 if ((sequence[i] == '^') && (i < sequence.length() - 1))
                 {
-                    key = sequence[++i] - 'A' + 1;
+                    key = static_cast<char>(std::toupper(sequence[++i]) - 'A' + 1);
                 }
                 else
                 {
@@ -49,7 +53,7 @@ namespace zcpm
         }
     } // namespace
 
-    Keymap::Keymap(std::string_view filename)
+    Keymap::Keymap(std::string_view filename) : m_root(KEY_MAX + 1)
     {
         if (filename.empty())
         {
@@ -71,39 +75,182 @@ namespace zcpm
                 s = s.substr(0, hash);
             }
 
-            // Assume that each line is in the format 'KEY_RIGHT ^KC'.
+            // Assume that each line is in the format 'KEY_RIGHT ^KC' (or '^[[1;5C ^F' for a host sequence)
             std::vector<std::string> fields;
-            const auto input(boost::to_upper_copy(s));
-            boost::split(fields, input, boost::is_any_of("\t "), boost::token_compress_on);
+            boost::split(fields, s, boost::is_any_of("\t "), boost::token_compress_on);
             if (fields.size() == 2)
             {
-                if (const auto key = ncurses_index_of(fields[0]))
+                const auto name(boost::to_upper_copy(fields[0]));
+                std::vector<int> keys;
+                if (name.starts_with("KEY_"))
                 {
-                    m_keymap.emplace(*key, parse_sequence(fields[1]));
+                    if (const auto key = ncurses_index_of(name))
+                    {
+                        keys.push_back(*key);
+                    }
+                    else
+                    {
+                        throw std::runtime_error("Unknown ncurses key " + name + " in " + std::string(filename));
+                    }
                 }
                 else
                 {
-                    throw std::runtime_error("Unknown ncurses key " + fields[0] + " in " + std::string(filename));
+                    for (const auto ch : parse_sequence(fields[0]))
+                    {
+                        keys.push_back(static_cast<uint8_t>(ch));
+                    }
                 }
+
+                const auto output = parse_sequence(boost::to_upper_copy(fields[1]));
+                if ((keys.size() > MaxSequence) || (output.length() > MaxOutput))
+                {
+                    throw std::runtime_error("Mapping of " + fields[0] + " is too long in " + std::string(filename));
+                }
+                add(keys, output);
             }
         }
     }
 
-    std::list<char> Keymap::translate(int key) const
+    std::string_view Keymap::translate(int key)
+    {
+        m_result_length = 0;
+
+        m_pending[m_num_pending++] = key;
+        while ((m_num_pending > 0) && !is_incomplete())
+        {
+            translate_longest();
+        }
+
+        return { m_result.data(), m_result_length };
+    }
+
+    std::string_view Keymap::flush()
+    {
+        m_result_length = 0;
+
+        while (m_num_pending > 0)
+        {
+            translate_longest();
+        }
+
+        return { m_result.data(), m_result_length };
+    }
+
+    void Keymap::add(const std::vector<int>& keys, std::string_view output)
     {
-        const auto iter = m_keymap.find(key);
-        if (iter != m_keymap.end())
+        if (keys.empty())
         {
-            return iter->second;
+            return;
+        }
+        if ((m_outputs.length() + output.length() > 0xFFFF) || (m_nodes.size() + keys.size() > 0xFFFF))
+        {
+            throw std::runtime_error("Too many key mappings");
         }
 
-        if (key >= KEY_MIN)
+        auto* p_entry = &m_root[keys[0]];
+        for (size_t i = 1; i < keys.size(); ++i)
         {
-            // The key is one that should be mapped but isn't.
-            BOOST_LOG_TRIVIAL(trace) << "Warning: unmapped curses key #" << key;
+            if (p_entry->m_child == 0)
+            {
+                // Note that adding a node can move the others
+                p_entry->m_child = static_cast<uint16_t>(m_nodes.size() + 1);
+                const auto child = p_entry->m_child;
+                m_nodes.emplace_back();
+                p_entry = &m_nodes[child - 1][keys[i]];
+            }
+            else
+            {
+                p_entry = &m_nodes[p_entry->m_child - 1][keys[i]];
+            }
         }
 
-        // Return just the key, so it is in effect an unmapped sequence
-        return { static_cast<char>(key) };
+        // As before, only the first mapping of a given key counts
+        if (!p_entry->m_mapped)
+        {
+            p_entry->m_first = static_cast<uint16_t>(m_outputs.length());
+            p_entry->m_length = static_cast<uint8_t>(output.length());
+            p_entry->m_mapped = true;
+            m_outputs += output;
+        }
+    }
+
+    const Keymap::Entry* Keymap::find(size_t n) const
+    {
+        if ((m_pending[0] < 0) || (static_cast<size_t>(m_pending[0]) >= m_root.size()))
+        {
+            return nullptr;
+        }
+
+        const auto* p_entry = &m_root[m_pending[0]];
+        for (size_t i = 1; i < n; ++i)
+        {
+            if ((p_entry->m_child == 0) || (m_pending[i] < 0) || (m_pending[i] >= 0x100))
+            {
+                return nullptr;
+            }
+            p_entry = &m_nodes[p_entry->m_child - 1][m_pending[i]];
+        }
+
+        return (p_entry->m_mapped || p_entry->m_child) ? p_entry : nullptr;
+    }
+
+    bool Keymap::is_incomplete() const
+    {
+        if (m_num_pending == MaxSequence)
+        {
+            return false;
+        }
+        const auto* p_entry = find(m_num_pending);
+        return p_entry && p_entry->m_child;
+    }
+
+    void Keymap::translate_longest()
+    {
+        size_t length = 0;
+        const Entry* p_match = nullptr;
+        for (size_t n = 1; n <= m_num_pending; ++n)
+        {
+            const auto* p_entry = find(n);
+            if (!p_entry)
+            {
+                break;
+            }
+            if (p_entry->m_mapped)
+            {
+                p_match = p_entry;
+                length = n;
+            }
+        }
+
+        if (p_match)
+        {
+            for (const auto ch : std::string_view(m_outputs).substr(p_match->m_first, p_match->m_length))
+            {
+                append(ch);
+            }
+        }
+        else
+        {
+            if (m_pending[0] >= KEY_MIN)
+            {
+                // The key is one that should be mapped but isn't.
+                BOOST_LOG_TRIVIAL(trace) << "Warning: unmapped curses key #" << m_pending[0];
+            }
+
+            // Return just the key, so it is in effect an unmapped sequence
+            append(static_cast<char>(m_pending[0]));
+            length = 1;
+        }
+
+        std::copy(m_pending.begin() + length, m_pending.begin() + m_num_pending, m_pending.begin());
+        m_num_pending -= length;
+    }
+
+    void Keymap::append(char ch)
+    {
+        if (m_result_length < m_result.size())
+        {
+            m_result[m_result_length++] = ch;
+        }
     }
-} // namespace zcpm
\ No newline at end of file
+} // namespace zcpm
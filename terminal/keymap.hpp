@@ -1,8 +1,11 @@
 #pragma once
 
-#include <list>
-#include <map>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace zcpm
 {
@@ -15,14 +18,73 @@ namespace zcpm
         // which means that if a right-arrow key is pressed, then a control-K is generated and then a C is generated.
         // The key naming (e.g. KEY_RIGHT) is as per 'man getch' from ncurses. Each key (e.g. KEY_RIGHT) should appear
         // no more than once. If an entry for given key doesn't exist, then the key is returned untranslated. Note that
-        // curses doesn't define a type for keystrokes such as these, they are simply 'int'.
+        // curses doesn't define a type for keystrokes such as these, they are simply 'int'. Instead of an ncurses key
+        // name, the first column can be a sequence of characters that the host sends (e.g. ^[[1;5C for control-right
+        // on an xterm), written in the same way as the second column.
+        //
+        // The mappings are compiled into a trie: a table indexed by the first key, and then a table of 256 entries for
+        // each further character of a multi-character sequence, with all of the generated characters held back to
+        // back in a single string. Translation therefore needs no lookups other than indexing, and allocates nothing.
         explicit Keymap(std::string_view filename);
 
-        // Return the mapping for a given key. If not known, then returns a single-element list with the same key.
-        std::list<char> translate(int key) const;
+        Keymap(const Keymap&) = delete;
+        Keymap& operator=(const Keymap&) = delete;
+        Keymap(Keymap&&) = delete;
+        Keymap& operator=(Keymap&&) = delete;
+
+        ~Keymap() = default;
+
+        // Translate the next key from the host, returning the characters that this generates. That might be nothing
+        // (if the key could be the start of a mapped sequence), just the key itself (if it isn't mapped), or several
+        // characters. The result remains valid until the next call.
+        std::string_view translate(int key);
+
+        // Translate any keys that are being held back as the possible start of a mapped sequence as they stand, as is
+        // needed when no more keys are about to arrive; otherwise as above.
+        std::string_view flush();
+
+        inline static const size_t MaxSequence{ 8 }; // Keys in a sequence which is mapped
+        inline static const size_t MaxOutput{ 32 };  // Characters generated by a single mapping
 
     private:
-        std::map<int, std::list<char>> m_keymap;
+        struct Entry
+        {
+            uint16_t m_first{ 0 };  // Position within m_outputs of the characters generated
+            uint8_t m_length{ 0 };  // Number of characters generated
+            bool m_mapped{ false }; // Does the sequence ending here generate anything?
+            uint16_t m_child{ 0 };  // 1 + the index in m_nodes of the table for the next key, or 0 if there is none
+        };
+
+        using Node = std::array<Entry, 0x100>;
+
+        void add(const std::vector<int>& keys, std::string_view output);
+
+        // The entry for the first n pending keys, or nullptr if they aren't (the start of) a mapped sequence
+        [[nodiscard]] const Entry* find(size_t n) const;
+
+        // Could the pending keys yet turn out to be a longer mapped sequence?
+        [[nodiscard]] bool is_incomplete() const;
+
+        // Generate the output for the longest mapped sequence at the start of the pending keys (or the first pending
+        // key as it is, if there is no such sequence), and remove those keys
+        void translate_longest();
+
+        void append(char ch);
+
+        // Indexed by the first key (an ncurses key code)
+        std::vector<Entry> m_root;
+
+        // Indexed by the subsequent characters of multi-character sequences
+        std::vector<Node> m_nodes;
+
+        std::string m_outputs;
+
+        // Keys which might be the start of a mapped sequence
+        std::array<int, MaxSequence> m_pending{};
+        size_t m_num_pending{ 0 };
+
+        std::array<char, MaxSequence * MaxOutput> m_result{};
+        size_t m_result_length{ 0 };
     };
 
 } // namespace zcpm
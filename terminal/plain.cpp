@@ -1,63 +1,105 @@
 #include "plain.hpp"
 
 #include <iostream>
-#include <poll.h>
-#include <termios.h>
 #include <vector>
 
+#include <unistd.h>
+
 namespace zcpm::terminal
 {
 
-    Plain::Plain(int rows, int columns) : Terminal(rows, columns)
+    Plain::Plain(int rows, int columns, bool flush_at_newline)
+        : Terminal(rows, columns), m_interactive(::isatty(STDOUT_FILENO)), m_flush_at_newline(flush_at_newline)
     {
+        m_output.reserve(BufferSize);
+
+        // So that e.g. ^C, ^S and ^Q reach CP/M (rather than ^C ending the program and leaving the terminal without
+        // echo); Enter still gives a newline, which is read as a CR
+        set_raw_input_mode(true);
+
+        start_input();
     }
 
     Plain::~Plain()
     {
+        stop_input();
+
         // Make sure we don't leave an unfinished output line
+        flush();
         std::cout << std::endl;
     }
 
     void Plain::print(char ch)
     {
-        std::cout << ch;
-        std::cout.flush();
+        if (m_output.empty())
+        {
+            m_output_since = std::chrono::steady_clock::now();
+        }
+        m_output += ch;
+
+        if ((m_output.size() >= BufferSize) || (m_interactive && m_flush_at_newline && (ch == '\n')))
+        {
+            flush();
+        }
+    }
+
+    void Plain::write(std::string_view text)
+    {
+        if (text.empty())
+        {
+            return;
+        }
+        if (m_output.empty())
+        {
+            m_output_since = std::chrono::steady_clock::now();
+        }
+        m_output += text;
+
+        if ((m_output.size() >= BufferSize) ||
+            (m_interactive && m_flush_at_newline && (text.find('\n') != std::string_view::npos)))
+        {
+            flush();
+        }
     }
 
     bool Plain::is_character_ready() const
     {
-        struct pollfd fd[1] = { { 0, POLLIN, 0 } };
-        return poll(fd, 1, 0) > 0;
+        // BDOS polls the keyboard before every character that it outputs, so this isn't a good time to flush unless
+        // the output has been waiting for a while (e.g. a prompt, or progress without newlines)
+        if (m_interactive && !m_output.empty() &&
+            (std::chrono::steady_clock::now() - m_output_since >= std::chrono::milliseconds(RefreshIntervalMs)))
+        {
+            flush();
+        }
+
+        return is_key_ready();
     }
 
-    char Plain::get_char()
+    bool Plain::wait_for_character(int timeout_ms) const
     {
-        // Temporarily disable both canonicalised input and echo on stdin
-        struct termios original_flags;
-        tcgetattr(fileno(stdin), &original_flags);
-        auto modified_flags = original_flags;
-        modified_flags.c_lflag &= ~(ICANON | ECHO);
-        tcsetattr(fileno(stdin), TCSANOW, &modified_flags);
+        flush();
+        return wait_for_key(timeout_ms);
+    }
 
-        // Using the modified settings, read a single character
-        auto ch = std::fgetc(stdin);
+    char Plain::get_char()
+    {
+        flush();
+        return next_key();
+    }
 
-        // Restore original settings on stdin
-        tcsetattr(fileno(stdin), TCSANOW, &original_flags);
+    bool Plain::read_host_input(std::vector<int>& keys)
+    {
+        return read_stdin(keys);
+    }
 
-        // Translate if needed
-        if (ch == 0x7F) // BACKSPACE/DELETE
-        {
-            // Backspace was pressed; Map a linux terminal 7F to a CP/M style 08
-            ch = 0x08;
-        }
-        else if (ch == 0x0A)
+    void Plain::flush() const
+    {
+        if (!m_output.empty())
         {
-            // Enter was pressed, but that needs to be mapped to a CP/M style 0D
-            ch = 0x0D;
+            std::cout.write(m_output.data(), static_cast<std::streamsize>(m_output.size()));
+            std::cout.flush();
+            m_output.clear();
         }
-
-        return static_cast<char>(ch);
     }
 
 } // namespace zcpm::terminal
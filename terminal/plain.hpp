@@ -2,17 +2,24 @@
 
 #include "terminal.hpp"
 
+#include <chrono>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace zcpm::terminal
 {
 
     // This is a "pass-through" terminal emulation; it doesn't attempt to interpret any specific escape sequences, just
-    // letting the host terminal program do the work.
+    // letting the host terminal program do the work. Output is buffered, and is written when the buffer fills, before
+    // waiting for input, and at exit. When stdout is a terminal it is also written at each newline (unless that is
+    // disabled), and when the keyboard is polled once output has been waiting for a while. When stdin is a terminal, it
+    // is switched to non-canonical mode without echo or signals for as long as this exists, so that keystrokes
+    // (including control characters such as ^C) arrive as they are typed.
     class Plain final : public Terminal
     {
     public:
-        Plain(int rows, int columns);
+        Plain(int rows, int columns, bool flush_at_newline = true);
 
         Plain(const Plain&) = delete;
         Plain& operator=(const Plain&) = delete;
@@ -24,12 +31,28 @@ namespace zcpm::terminal
         // Send a single character to the console; also handles tabs, start/stop
         // scroll, etc
         void print(char ch) override;
+        void write(std::string_view text) override;
 
         // Check to see if a character has been typed at the console
         [[nodiscard]] bool is_character_ready() const override;
+        [[nodiscard]] bool wait_for_character(int timeout_ms) const override;
 
         // Get a pending character (blocking read)
         char get_char() override;
+
+    private:
+        bool read_host_input(std::vector<int>& keys) override;
+
+        // Write any buffered output
+        void flush() const;
+
+        inline static const size_t BufferSize{ 0x10000 };
+
+        const bool m_interactive;      // Is stdout a terminal?
+        const bool m_flush_at_newline; // Only if interactive
+
+        mutable std::string m_output;
+        mutable std::chrono::steady_clock::time_point m_output_since; // When the oldest buffered output was buffered
     };
 
 } // namespace zcpm::terminal
@@ -0,0 +1,162 @@
+#include "screen.hpp"
+
+#include <algorithm>
+
+namespace zcpm::terminal
+{
+
+    Screen::Screen(int rows, int columns)
+        : m_rows(std::max(rows, 1)),
+          m_columns(std::max(columns, 1)),
+          m_cells(static_cast<size_t>(m_rows) * m_columns),
+          m_dirty(m_rows, 0)
+    {
+    }
+
+    void Screen::set_cursor(int row, int column)
+    {
+        if ((row >= 0) && (row < m_rows) && (column >= 0) && (column < m_columns))
+        {
+            m_row = row;
+            m_column = column;
+        }
+    }
+
+    void Screen::put(char ch)
+    {
+        const auto c = static_cast<unsigned char>(ch);
+        if (ch == '\t')
+        {
+            const auto stop = (m_column / TabSize + 1) * TabSize;
+            if (stop < m_columns)
+            {
+                while (m_column < stop)
+                {
+                    put_cell(' ');
+                }
+            }
+            else
+            {
+                clear_to_end_of_row();
+                m_column = m_columns - 1;
+            }
+        }
+        else if (ch == '\b')
+        {
+            if (m_column > 0)
+            {
+                --m_column;
+            }
+        }
+        else if ((c < 0x20) || (c == 0x7F))
+        {
+            put_cell('^');
+            put_cell(static_cast<char>(c ^ 0x40));
+        }
+        else
+        {
+            put_cell(ch);
+        }
+    }
+
+    void Screen::scroll_up()
+    {
+        for (auto row = 0; row < m_rows - 1; ++row)
+        {
+            copy_row(row + 1, row);
+        }
+        blank(m_rows - 1, 0, m_columns);
+    }
+
+    void Screen::clear_screen()
+    {
+        for (auto row = 0; row < m_rows; ++row)
+        {
+            blank(row, 0, m_columns);
+        }
+        m_row = 0;
+        m_column = 0;
+    }
+
+    void Screen::clear_to_bottom()
+    {
+        blank(m_row, m_column, m_columns);
+        for (auto row = m_row + 1; row < m_rows; ++row)
+        {
+            blank(row, 0, m_columns);
+        }
+    }
+
+    void Screen::clear_to_end_of_row()
+    {
+        blank(m_row, m_column, m_columns);
+    }
+
+    void Screen::insert_row()
+    {
+        for (auto row = m_rows - 1; row > m_row; --row)
+        {
+            copy_row(row - 1, row);
+        }
+        blank(m_row, 0, m_columns);
+    }
+
+    void Screen::delete_row()
+    {
+        for (auto row = m_row; row < m_rows - 1; ++row)
+        {
+            copy_row(row + 1, row);
+        }
+        blank(m_rows - 1, 0, m_columns);
+    }
+
+    void Screen::set_attributes(uint8_t attributes)
+    {
+        m_attributes = attributes;
+    }
+
+    void Screen::add_attributes(uint8_t attributes)
+    {
+        m_attributes |= attributes;
+    }
+
+    void Screen::remove_attributes(uint8_t attributes)
+    {
+        m_attributes &= ~attributes;
+    }
+
+    std::span<const Screen::Cell> Screen::cells(int row) const
+    {
+        return { m_cells.data() + static_cast<size_t>(row) * m_columns, static_cast<size_t>(m_columns) };
+    }
+
+    void Screen::mark_clean() const
+    {
+        std::fill(m_dirty.begin(), m_dirty.end(), 0);
+    }
+
+    void Screen::put_cell(char ch)
+    {
+        m_cells[static_cast<size_t>(m_row) * m_columns + m_column] = { ch, m_attributes };
+        m_dirty[m_row] = 1;
+        if (m_column + 1 < m_columns)
+        {
+            ++m_column;
+        }
+    }
+
+    void Screen::blank(int row, int from_column, int to_column)
+    {
+        const auto start = m_cells.begin() + static_cast<ptrdiff_t>(row) * m_columns;
+        std::fill(start + from_column, start + to_column, Cell{});
+        m_dirty[row] = 1;
+    }
+
+    void Screen::copy_row(int from, int to)
+    {
+        const auto source = m_cells.begin() + static_cast<ptrdiff_t>(from) * m_columns;
+        std::copy(source, source + m_columns, m_cells.begin() + static_cast<ptrdiff_t>(to) * m_columns);
+        m_dirty[to] = 1;
+    }
+
+} // namespace zcpm::terminal
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace zcpm::terminal
+{
+
+    // The emulator's own model of what is on the display: a grid of characters with their attributes, plus the
+    // cursor. Terminal emulations change this as output arrives (much as they would an ncurses window, whose
+    // operations these follow), and each row which changes is marked as dirty. When the display is brought up to date,
+    // only the dirty rows need to be sent to it, and output which has since been overwritten is never sent at all.
+    class Screen final
+    {
+    public:
+        // Character attributes, which can be combined
+        inline static const uint8_t Normal{ 0x00 };
+        inline static const uint8_t Bold{ 0x01 };
+        inline static const uint8_t Blink{ 0x02 };
+        inline static const uint8_t Reverse{ 0x04 };
+
+        struct Cell
+        {
+            char m_ch{ ' ' };
+            uint8_t m_attributes{ Normal };
+        };
+
+        Screen(int rows, int columns);
+
+        Screen(const Screen&) = delete;
+        Screen& operator=(const Screen&) = delete;
+        Screen(Screen&&) = delete;
+        Screen& operator=(Screen&&) = delete;
+
+        ~Screen() = default;
+
+        [[nodiscard]] int rows() const
+        {
+            return m_rows;
+        }
+
+        [[nodiscard]] int columns() const
+        {
+            return m_columns;
+        }
+
+        // The cursor position, counting from 0
+        [[nodiscard]] int row() const
+        {
+            return m_row;
+        }
+
+        [[nodiscard]] int column() const
+        {
+            return m_column;
+        }
+
+        // Move the cursor; as for ncurses, a position which is off the screen is ignored
+        void set_cursor(int row, int column);
+
+        // Write a character at the cursor with the current attributes, and move the cursor on; but not beyond the last
+        // column, since what happens there is up to the terminal being emulated. As for ncurses' addch(), a tab moves
+        // on to the next tab stop, a backspace moves back one column, and any other control character is shown as
+        // e.g. ^A.
+        void put(char ch);
+
+        // Move everything up one row, leaving a blank row at the bottom; the cursor doesn't move
+        void scroll_up();
+
+        // Blank everything, and home the cursor
+        void clear_screen();
+
+        // Blank from the cursor to the end of the screen
+        void clear_to_bottom();
+
+        // Blank from the cursor to the end of the row
+        void clear_to_end_of_row();
+
+        // Insert a blank row at the cursor, moving the rows below it down (and losing the bottom row)
+        void insert_row();
+
+        // Delete the row at the cursor, moving the rows below it up (and adding a blank row at the bottom)
+        void delete_row();
+
+        // Set, add or remove attributes for subsequent output
+        void set_attributes(uint8_t attributes);
+        void add_attributes(uint8_t attributes);
+        void remove_attributes(uint8_t attributes);
+
+        [[nodiscard]] std::span<const Cell> cells(int row) const;
+
+        // Has the specified row changed since mark_clean() was last called?
+        [[nodiscard]] bool is_dirty(int row) const
+        {
+            return m_dirty[row];
+        }
+
+        // Called once the display has been brought up to date, which doesn't change what is on the screen
+        void mark_clean() const;
+
+    private:
+        void put_cell(char ch);
+
+        void blank(int row, int from_column, int to_column);
+
+        // Copy the 'from' row over the 'to' row
+        void copy_row(int from, int to);
+
+        const int m_rows;
+        const int m_columns;
+
+        std::vector<Cell> m_cells; // Row by row
+        mutable std::vector<uint8_t> m_dirty;
+
+        int m_row{ 0 };
+        int m_column{ 0 };
+        uint8_t m_attributes{ Normal };
+
+        inline static const int TabSize{ 8 };
+    };
+
+} // namespace zcpm::terminal
@@ -7,17 +7,6 @@
 #include <ncurses.h>
 #include <string>
 
-namespace
-{
-    void move_to_column(int column)
-    {
-        [[maybe_unused]] auto current_column = 0;
-        auto current_row = 0;
-        getsyx(current_row, current_column);
-        move(current_row, column);
-    }
-} // namespace
-
 namespace zcpm::terminal
 {
 
@@ -26,33 +15,21 @@ namespace zcpm::terminal
     // - Not yet worrying about "protected areas", e.g. a ^Z should be "Clear unprotected to insert character"
     // - Character addressing is 80x24; the docs use "from 1" counting, so valid row numbers are 1..24, etc.
 
-    Televideo::Televideo(int rows, int columns, const std::string& keymap_filename)
+    Televideo::Televideo(int rows, int columns, const std::string& keymap_filename, bool use_curses)
         : Terminal(rows, columns, keymap_filename)
     {
-        ::initscr();
-
-        ::raw(); // Make sure that we receive control sequences (e.g. ^C) verbatim
-
-        ::timeout(KeyboardDelayMs); // Enables a 1ms timeout on non-blocking keyboard read
-
-        ::noecho(); // We want to display characters ourselves, not have them automatically echoed
-
-        ::idlok(stdscr, true);    // Allow insert/delete row
-        ::scrollok(stdscr, true); // Allow scrolling
-        ::keypad(stdscr, true);   // Ask curses to give us e.g. KEY_LEFT instead of <ESC>[D
+        start_display(use_curses);
+        start_input();
     }
 
     Televideo::~Televideo()
     {
-        // If there's been no user *input* and we don't block here, the user will
-        // not see anything displayed at all, so we need to do this before teardown.
-        ::getch();
-
-        ::endwin();
+        stop_input();
+        finish_display();
 
-        if (!m_pending.empty())
+        if (m_escape.active())
         {
-            std::cerr << "Warning: incomplete escape sequence <ESC>" << m_pending.substr(1) << " at termination"
+            std::cerr << "Warning: incomplete escape sequence <ESC>" << m_escape.text().substr(1) << " at termination"
                       << std::endl;
         }
     }
@@ -60,26 +37,33 @@ namespace zcpm::terminal
     void Televideo::print(char ch)
     {
         outch(ch);
-        ::refresh();
+
+        // Don't show part of the effect of an escape sequence
+        if (!m_escape.active())
+        {
+            refresh_screen_if_due();
+        }
     }
 
-    bool Televideo::is_character_ready() const
+    void Televideo::write(std::string_view text)
     {
-        // Is there a character available?
-        const auto ch = ::getch();
-        if (ch == ERR)
+        for (const auto ch : text)
         {
-            // No
-            return false;
+            outch(ch);
         }
-        else
+
+        if (!m_escape.active())
         {
-            // Yes.  Make sure we don't lose it, so that :getch() returns it later as needed
-            ::ungetch(ch);
-            return true;
+            refresh_screen_if_due();
         }
     }
 
+    bool Televideo::is_character_ready() const
+    {
+        refresh_screen_if_due();
+        return is_key_ready();
+    }
+
     char Televideo::get_char()
     {
         return get_translated_char();
@@ -87,33 +71,41 @@ namespace zcpm::terminal
 
     void Televideo::outch(char ch)
     {
-        // If we've already got an escape sequence in progress, add this character to it.  process_pending()
-        // will then consider the collected data, and if it can deal with it then it will do so
-        // and erase the pending data.
-        if (!m_pending.empty())
+        // If we've already got an escape sequence in progress, add this character to it.  Once the sequence is
+        // complete, process_pending() deals with it.
+        if (m_escape.active())
         {
             // If it appears that we're starting a *new* escape sequence with one already in progress, warn
-            // the maintainer via the log file and drop the unhandled one.
+            // the maintainer via the log file and drop the unfinished one.
             if (ch == '\033') // ESC
             {
-                BOOST_LOG_TRIVIAL(trace) << "Warning: unimplemented escape sequence '<ESC>" << m_pending.substr(1)
-                                         << "' (" << m_pending.size() << " chars) dropped";
-                m_pending.erase();
+                BOOST_LOG_TRIVIAL(trace) << "Warning: incomplete escape sequence '<ESC>" << m_escape.text().substr(1)
+                                         << "' (" << m_escape.text().size() << " chars) dropped";
+                m_escape.start();
+                return;
             }
-            else
+
+            switch (m_escape.add(ch))
             {
-                m_pending += std::string(1, ch);
+            case EscapeParser::Status::INCOMPLETE: break;
+            case EscapeParser::Status::COMPLETE:
                 process_pending();
+                m_escape.reset();
+                break;
+            case EscapeParser::Status::INVALID:
+                BOOST_LOG_TRIVIAL(trace) << "Warning: invalid escape sequence '<ESC>" << m_escape.text().substr(1)
+                                         << "' dropped";
+                m_escape.reset();
+                break;
             }
             return;
         }
 
-        auto col = 0, row = 0;
-        getsyx(row, col);
+        auto col = m_screen.column(), row = m_screen.row();
 
         if (ch == '\015') // CR
         {
-            ::move(row, 0);
+            m_screen.set_cursor(row, 0);
         }
         else if (ch == '\012') // LF
         {
@@ -124,28 +116,28 @@ namespace zcpm::terminal
             if (row + 1 < m_rows)
             {
                 // Not yet at last row, so move down one row
-                ::move(row + 1, col);
+                m_screen.set_cursor(row + 1, col);
             }
             else
             {
                 // Already at last row, so force a scroll
-                ::scrl(1);
+                m_screen.scroll_up();
             }
         }
         else if (ch == '\010') // Control-H (Backspace?)
         {
             if (col > 0)
             {
-                ::move(row, col - 1);
+                m_screen.set_cursor(row, col - 1);
             }
             else if (row > 0)
             {
-                ::move(row - 1, m_columns - 1);
+                m_screen.set_cursor(row - 1, m_columns - 1);
             }
             else
             {
                 // Unsure about this situation, needs experiments...
-                ::move(0, 0);
+                m_screen.set_cursor(0, 0);
             }
         }
         else if (ch == '\011') // Control-I (TAB?)
@@ -154,18 +146,18 @@ namespace zcpm::terminal
             if (col < m_columns)
             {
                 const auto new_column = ((col + 1) / 8) * 8;
-                ::move(row, new_column);
+                m_screen.set_cursor(row, new_column);
             }
         }
         else if (ch == '\033') // ESC
         {
-            m_pending += std::string(1, ch);
+            m_escape.start();
         }
         else if (ch == '\032') // Control-Z
         {
             BOOST_LOG_TRIVIAL(trace) << "CURSES clear all";
-            ::clear();         // Note that this also homes the cursor
-            ::attrset(A_BOLD); // Televideo uses half/full intensity, default is full
+            m_screen.clear_screen();               // Note that this also homes the cursor
+            m_screen.set_attributes(Screen::Bold); // Televideo uses half/full intensity, default is full
         }
         else if (ch == '\016') // Control-N
         {
@@ -173,7 +165,7 @@ namespace zcpm::terminal
         }
         else if (ch == '\007') // Control-G aka Bell
         {
-            ::beep();
+            ring_bell();
         }
         else // Anything else
         {
@@ -188,7 +180,7 @@ namespace zcpm::terminal
                 ch = ' ';
             }
 
-            ::addch(ch);
+            m_screen.put(ch);
 
             // If we were already at the maximum column, force a 'wrap' to the start of the next row so that the next
             // character output is in the right place. And if we're at the maximum row as well, force a scroll.
@@ -201,9 +193,9 @@ namespace zcpm::terminal
                 }
                 else
                 {
-                    ::scrl(1);
+                    m_screen.scroll_up();
                 }
-                ::move(row, col);
+                m_screen.set_cursor(row, col);
             }
         }
     }
@@ -211,111 +203,111 @@ namespace zcpm::terminal
     void Televideo::process_pending()
     {
         // Map Televideo sequences (see
-        // https://archive.org/details/bitsavers_televideo9deo925UsersGuideJan1983_5637627/page/n23/mode/2up) to ncurses
-        // commands. Sequences are added only as needed, not all of them upfront.
-
-        // Sanity checks
-        BOOST_ASSERT(m_pending.size() > 1);
-        BOOST_ASSERT(m_pending[0] == '\033');
+        // https://archive.org/details/bitsavers_televideo9deo925UsersGuideJan1983_5637627/page/n23/mode/2up) to changes
+        // to the screen. Sequences are added only as needed, not all of them upfront.
 
-        const auto& first = m_pending[1]; // First pending character *after* the ESC
-
-        if ((first == ':') || (first == ';') || (first == '+') || (first == '*'))
+        switch (m_escape.intro()) // First character *after* the ESC
         {
+        case ':':
+        case ';':
+        case '+':
+        case '*':
             // Refer Televideo doc at 4.9.2.4; zcpm treats all 4 flavours the same, although in theory there should be
             // subtle differences with the way that spaces/nulls/protected fields are handled.
             BOOST_LOG_TRIVIAL(trace) << "CURSES clear all";
-            ::clear();         // Note that this also homes the cursor
-            ::attrset(A_BOLD); // Televideo uses half/full intensity, default is full
-            m_pending.erase();
-            return;
-        }
-        if (first == 'T')
-        {
+            m_screen.clear_screen();               // Note that this also homes the cursor
+            m_screen.set_attributes(Screen::Bold); // Televideo uses half/full intensity, default is full
+            break;
+
+        case 'T':
             BOOST_LOG_TRIVIAL(trace) << "CURSES erase EOL with spaces";
-            ::clrtoeol();
-            m_pending.erase();
-            return;
-        }
-        if (first == 'R')
-        {
+            m_screen.clear_to_end_of_row();
+            break;
+
+        case 'R':
             BOOST_LOG_TRIVIAL(trace) << "CURSES line delete";
-            ::deleteln();
-            m_pending.erase();
-            return;
-        }
-        if (first == 'E')
-        {
+            m_screen.delete_row();
+            break;
+
+        case 'E':
             // According to 4.9.2.3 in the Televideo reference, this "inserts a line consisting of fill characters at
             // the cursor position. This causes the cursor to move to the start of the new line and all following lines
             // to move down one line"
             BOOST_LOG_TRIVIAL(trace) << "CURSES line insert";
-            ::insertln();
-            move_to_column(0);
-            m_pending.erase();
-            return;
-        }
-        if ((first == '=') && (m_pending.size() == 4))
+            m_screen.insert_row();
+            m_screen.set_cursor(m_screen.row(), 0);
+            break;
+
+        case '=':
         {
             // According to 4.5.1 in the Televideo reference, the row/col pair are offset by +31
-            auto row = static_cast<int>(m_pending[2]);
-            auto col = static_cast<int>(m_pending[3]);
+            const auto row = static_cast<int>(m_escape.argument(0));
+            const auto col = static_cast<int>(m_escape.argument(1));
             BOOST_ASSERT(row > 31);
             BOOST_ASSERT(col > 31);
             BOOST_LOG_TRIVIAL(trace) << fmt::format("CURSES address (row={:d} col={:d})", row - 31, col - 31);
-            ::move(row - 32, col - 32);
-            m_pending.erase();
-            return;
+            m_screen.set_cursor(row - 32, col - 32);
         }
-        if (first == '(')
-        {
+        break;
+
+        case '(':
             // Half intensity off (which zcpm interprets as 'bold on')
             BOOST_LOG_TRIVIAL(trace) << "CURSES half intensity off";
-            m_pending.erase();
-            ::attron(A_BOLD);
-            return;
-        }
-        if (first == ')')
-        {
+            m_screen.add_attributes(Screen::Bold);
+            break;
+
+        case ')':
             // Half intensity on (which zcpm interprets as 'bold off')
             BOOST_LOG_TRIVIAL(trace) << "CURSES half intensity on";
-            m_pending.erase();
-            ::attroff(A_BOLD);
-            return;
-        }
-        if (first == '>')
-        {
+            m_screen.remove_attributes(Screen::Bold);
+            break;
+
+        case '>':
             // Keyclick on [NOT IMPLEMENTED]
             BOOST_LOG_TRIVIAL(trace) << "CURSES keyclick on";
-            m_pending.erase();
-            return;
-        }
-        if (first == '<')
-        {
+            break;
+
+        case '<':
             // Keyclick off [NOT IMPLEMENTED]
             BOOST_LOG_TRIVIAL(trace) << "CURSES keyclick off";
-            m_pending.erase();
-            return;
-        }
-        if ((first == 'j') || (m_pending == "\x1BG4"))
-        {
-            // End of reverse video
+            break;
+
+        case 'j':
+            // Start of reverse video
             BOOST_LOG_TRIVIAL(trace) << "CURSES reverse video";
-            m_pending.erase();
-            ::attron(A_REVERSE);
-            return;
-        }
-        if ((first == 'k') || (m_pending == "\x1BG0"))
-        {
+            m_screen.add_attributes(Screen::Reverse);
+            break;
+
+        case 'k':
             // End of reverse video
             BOOST_LOG_TRIVIAL(trace) << "CURSES reverse video end";
-            m_pending.erase();
-            ::attroff(A_REVERSE);
-            return;
-        }
+            m_screen.remove_attributes(Screen::Reverse);
+            break;
 
-        // If we get here, that means that we appear to have an incomplete pending escape sequence, and the intent is
-        // that another character will get appended to the buffer before this method is called again.
+        case 'G':
+            // Set attribute; only those for reverse video and normal are implemented
+            if (m_escape.argument(0) == '4')
+            {
+                BOOST_LOG_TRIVIAL(trace) << "CURSES reverse video";
+                m_screen.add_attributes(Screen::Reverse);
+            }
+            else if (m_escape.argument(0) == '0')
+            {
+                BOOST_LOG_TRIVIAL(trace) << "CURSES reverse video end";
+                m_screen.remove_attributes(Screen::Reverse);
+            }
+            else
+            {
+                BOOST_LOG_TRIVIAL(trace) << "Warning: unimplemented escape sequence '<ESC>"
+                                         << m_escape.text().substr(1) << "'";
+            }
+            break;
+
+        default:
+            BOOST_LOG_TRIVIAL(trace) << "Warning: unimplemented escape sequence '<ESC>" << m_escape.text().substr(1)
+                                     << "'";
+            break;
+        }
     }
 
 } // namespace zcpm::terminal
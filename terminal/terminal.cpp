@@ -1,50 +1,436 @@
 #include "terminal.hpp"
 
+#include <boost/log/trivial.hpp>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
 #include <ncurses.h>
+#include <system_error>
+#include <utility>
+
+#include <poll.h>
+#include <unistd.h>
 
 namespace zcpm::terminal
 {
     Terminal::Terminal(int rows, int columns, const std::string& keymap_filename)
-        : m_keymap(keymap_filename), m_rows(rows), m_columns(columns)
+        : m_keymap(keymap_filename), m_rows(rows), m_columns(columns), m_screen(rows, columns)
     {
     }
 
-    char Terminal::get_translated_char() const
+    Terminal::~Terminal()
+    {
+        stop_input();
+
+        if (m_original_input_mode)
+        {
+            ::tcsetattr(STDIN_FILENO, TCSANOW, &*m_original_input_mode);
+        }
+    }
+
+    void Terminal::start_input()
+    {
+        if (::pipe(m_wakeup_fds.data()) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "Input thread pipe creation failed");
+        }
+        m_input_thread = std::thread(&Terminal::run_input, this);
+    }
+
+    void Terminal::stop_input()
+    {
+        if (m_input_thread.joinable())
+        {
+            m_stopping = true;
+            const char wakeup = 0;
+            (void)::write(m_wakeup_fds[1], &wakeup, 1);
+            m_input_thread.join();
+        }
+        for (auto& fd : m_wakeup_fds)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    void Terminal::write(std::string_view text)
     {
-        // If we have yet to return all of a previous mapped (expanded?) key, return the next character
-        if (!m_pending_keystrokes.empty())
+        for (const auto ch : text)
+        {
+            print(ch);
+        }
+    }
+
+    bool Terminal::read_host_input(std::vector<int>& keys)
+    {
+        if (!m_use_curses)
+        {
+            return read_stdin(keys);
+        }
+
+        std::lock_guard lock(m_curses_mutex);
+        for (auto key = read_key(0); key != ERR; key = read_key(0))
         {
-            const auto result = m_pending_keystrokes.front();
-            m_pending_keystrokes.pop_front();
-            return result;
+            keys.push_back(key);
         }
 
-        // This method might be called after is_character_ready() which told the caller that
-        // data is now ready to be returned, in which case we should read and return it immediately.
-        // Or, it may be called without knowing if anything's ready, in which case we should
-        // block until something is ready and then return that.  But either way, we're in "timeout"
-        // mode currently which means we will quickly timeout if nothing is ready, so we need to
-        // temporarily go back to blocking mode for this operation.  Yuk.
+        // Standard input was readable, so if nothing could be read then there is nothing more to come
+        return !keys.empty();
+    }
 
-        ::timeout(-1);              // Temporarily back to blocking reads
-        const int ch = ::getch();   // Read the character, blocking if needed
-        ::timeout(KeyboardDelayMs); // And then back to 1ms timeout mode
+    bool Terminal::read_stdin(std::vector<int>& keys)
+    {
+        std::array<unsigned char, 64> buffer{};
+        const auto n = ::read(STDIN_FILENO, buffer.data(), buffer.size());
+        if (n < 0)
+        {
+            return (errno == EINTR) || (errno == EAGAIN);
+        }
+        keys.insert(keys.end(), buffer.begin(), buffer.begin() + n);
+        return n > 0;
+    }
 
-        if (ch == 0x7F) // BACKSPACE/DELETE
+    void Terminal::run_input()
+    {
+        std::vector<int> keys;
+        try
+        {
+            while (!m_stopping)
+            {
+                struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { m_wakeup_fds[0], POLLIN, 0 } };
+                if (::poll(fds, 2, -1) < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::generic_category(), "Input poll failed");
+                }
+                if (m_stopping)
+                {
+                    break;
+                }
+                if (fds[0].revents == 0)
+                {
+                    continue;
+                }
+
+                keys.clear();
+                const auto more = read_host_input(keys);
+                for (const auto key : keys)
+                {
+                    queue_key(key);
+                }
+
+                // A host sequence is sent all at once, so one that is still incomplete won't now be completed
+                queue(m_keymap.flush());
+                if (!more)
+                {
+                    break;
+                }
+
+                // Use the lock so that a waiter can't miss the new keystrokes between checking and waiting
+                {
+                    std::lock_guard lock(m_input_mutex);
+                }
+                m_input_ready.notify_one();
+            }
+        }
+        catch (const std::exception& e)
+        {
+            BOOST_LOG_TRIVIAL(trace) << "Exception in input thread: " << e.what();
+        }
+
+        {
+            std::lock_guard lock(m_input_mutex);
+            m_end_of_input = true;
+        }
+        m_input_ready.notify_one();
+    }
+
+    void Terminal::queue_key(int key)
+    {
+        if (key == 0x7F) // BACKSPACE/DELETE
         {
             // Backspace was pressed; Map a linux terminal 7F to a CP/M style 08
-            return static_cast<char>(0x08);
+            queue(m_keymap.flush());
+            queue("\x08");
         }
-        if (ch == 0x0A)
+        else if (key == 0x0A)
         {
             // Enter was pressed, but that needs to be mapped to a CP/M style 0D
-            return static_cast<char>(0x0D);
+            queue(m_keymap.flush());
+            queue("\x0D");
+        }
+        else
+        {
+            queue(m_keymap.translate(key));
+        }
+    }
+
+    void Terminal::queue(std::string_view characters)
+    {
+        for (const auto ch : characters)
+        {
+            while (!m_keys.push(ch) && !m_stopping)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(InputRetryMs));
+            }
+        }
+    }
+
+    bool Terminal::wait_for_key(int timeout_ms) const
+    {
+        std::unique_lock lock(m_input_mutex);
+        if (timeout_ms < 0)
+        {
+            m_input_ready.wait(lock, [this] { return is_key_ready(); });
+            return true;
+        }
+        return m_input_ready.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return is_key_ready(); });
+    }
+
+    char Terminal::next_key() const
+    {
+        (void)wait_for_key(-1);
+
+        // Once the input has finished, this is what reading standard input used to give
+        return m_keys.pop().value_or(static_cast<char>(0xFF));
+    }
+
+    void Terminal::start_display(bool use_curses)
+    {
+        m_use_curses = use_curses;
+
+        if (!m_use_curses)
+        {
+            set_raw_input_mode(false);
+
+            // Start with a blank screen, as ncurses does
+            m_ansi_output = "\033[0m\033[H\033[2J";
+            m_shown_row = 0;
+            m_shown_column = 0;
+            return;
         }
 
-        auto mapped_keys = m_keymap.translate(ch);
-        const auto next = mapped_keys.front();
-        mapped_keys.pop_front();
-        m_pending_keystrokes = mapped_keys; // Might now be empty
-        return static_cast<char>(next);
+        ::initscr();
+
+        ::raw(); // Make sure that we receive control sequences (e.g. ^C) verbatim
+
+        ::noecho(); // We want to display characters ourselves, not have them automatically echoed
+
+        ::idlok(stdscr, true);    // Allow insert/delete row
+        ::scrollok(stdscr, true); // Allow scrolling
+
+        m_pinput = ::newpad(1, 1);
+        ::keypad(m_pinput, true); // Ask curses to give us e.g. KEY_LEFT instead of <ESC>[D
+    }
+
+    void Terminal::set_raw_input_mode(bool translate_cr)
+    {
+        if (struct termios flags; ::isatty(STDIN_FILENO) && (::tcgetattr(STDIN_FILENO, &flags) == 0))
+        {
+            if (!m_original_input_mode)
+            {
+                m_original_input_mode = flags;
+            }
+            flags.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+            flags.c_iflag &= ~IXON;
+            if (translate_cr)
+            {
+                flags.c_iflag |= ICRNL;
+            }
+            else
+            {
+                flags.c_iflag &= ~ICRNL;
+            }
+            flags.c_cc[VMIN] = 1;
+            flags.c_cc[VTIME] = 0;
+            ::tcsetattr(STDIN_FILENO, TCSANOW, &flags);
+        }
+    }
+
+    void Terminal::finish_display()
+    {
+        // If there's been no user *input* and we don't refresh here, the user will not see anything displayed at all,
+        // so we need to do this before teardown.
+        refresh_screen();
+
+        if (!m_use_curses)
+        {
+            // Leave the host's cursor below everything that has been shown
+            m_ansi_output = fmt::format("\033[{:d};1H\r\n", m_screen.rows());
+            (void)::write(STDOUT_FILENO, m_ansi_output.data(), m_ansi_output.size());
+            m_ansi_output.clear();
+            return;
+        }
+
+        ::delwin(m_pinput);
+        m_pinput = nullptr;
+
+        ::endwin();
+    }
+
+    int Terminal::read_key(int timeout_ms) const
+    {
+        ::wtimeout(m_pinput, timeout_ms);
+        return ::wgetch(m_pinput);
+    }
+
+    void Terminal::refresh_screen() const
+    {
+        if (m_use_curses)
+        {
+            render_curses();
+        }
+        else
+        {
+            render_ansi();
+        }
+        m_last_refresh = std::chrono::steady_clock::now();
+        ++m_refreshes;
+    }
+
+    void Terminal::render_curses() const
+    {
+        std::lock_guard lock(m_curses_mutex);
+
+        std::vector<chtype> line(m_screen.columns());
+        for (auto row = 0; row < m_screen.rows(); ++row)
+        {
+            if (m_screen.is_dirty(row))
+            {
+                const auto cells = m_screen.cells(row);
+                std::transform(cells.begin(), cells.end(), line.begin(), [](const Screen::Cell& cell) {
+                    return static_cast<chtype>(static_cast<unsigned char>(cell.m_ch)) |
+                           ((cell.m_attributes & Screen::Bold) ? A_BOLD : 0) |
+                           ((cell.m_attributes & Screen::Blink) ? A_BLINK : 0) |
+                           ((cell.m_attributes & Screen::Reverse) ? A_REVERSE : 0);
+                });
+                mvwaddchnstr(stdscr, row, 0, line.data(), static_cast<int>(line.size()));
+            }
+        }
+        m_screen.mark_clean();
+        ::wmove(stdscr, m_screen.row(), m_screen.column());
+
+        ::refresh();
+    }
+
+    void Terminal::render_ansi() const
+    {
+        const auto output = take_ansi_output();
+
+        // Write it all, retrying as need be
+        size_t written = 0;
+        while (written < output.size())
+        {
+            const auto n = ::write(STDOUT_FILENO, output.data() + written, output.size() - written);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+    }
+
+    std::string Terminal::take_ansi_output() const
+    {
+        // Each changed row is rewritten in full, except that trailing blanks are erased with a single EL instead.
+        // Attributes are only changed as needed, and start off unknown.
+        std::optional<uint8_t> attributes;
+        for (auto row = 0; row < m_screen.rows(); ++row)
+        {
+            if (!m_screen.is_dirty(row))
+            {
+                continue;
+            }
+
+            const auto cells = m_screen.cells(row);
+            const auto end = std::find_if(cells.rbegin(), cells.rend(), [](const Screen::Cell& cell) {
+                                 return (cell.m_ch != ' ') || (cell.m_attributes != Screen::Normal);
+                             }).base();
+
+            m_ansi_output += fmt::format("\033[{:d};1H", row + 1);
+            for (auto it = cells.begin(); it != end; ++it)
+            {
+                if (it->m_attributes != attributes)
+                {
+                    attributes = it->m_attributes;
+                    m_ansi_output += "\033[0";
+                    m_ansi_output += (*attributes & Screen::Bold) ? ";1" : "";
+                    m_ansi_output += (*attributes & Screen::Blink) ? ";5" : "";
+                    m_ansi_output += (*attributes & Screen::Reverse) ? ";7" : "";
+                    m_ansi_output += 'm';
+                }
+                m_ansi_output += it->m_ch;
+            }
+            if (end != cells.end())
+            {
+                if (attributes != Screen::Normal)
+                {
+                    attributes = Screen::Normal;
+                    m_ansi_output += "\033[0m";
+                }
+                m_ansi_output += "\033[K";
+            }
+
+            // The cursor is somewhere along this row now
+            m_shown_row = -1;
+        }
+        m_screen.mark_clean();
+
+        if ((m_screen.row() != m_shown_row) || (m_screen.column() != m_shown_column))
+        {
+            m_shown_row = m_screen.row();
+            m_shown_column = m_screen.column();
+            m_ansi_output += fmt::format("\033[{:d};{:d}H", m_shown_row + 1, m_shown_column + 1);
+        }
+
+        return std::exchange(m_ansi_output, {});
+    }
+
+    void Terminal::refresh_screen_if_due() const
+    {
+        if (std::chrono::steady_clock::now() - m_last_refresh >= std::chrono::milliseconds(RefreshIntervalMs))
+        {
+            refresh_screen();
+        }
+    }
+
+    void Terminal::ring_bell() const
+    {
+        if (m_use_curses)
+        {
+            std::lock_guard lock(m_curses_mutex);
+            ::beep();
+        }
+        else
+        {
+            m_ansi_output += '\007';
+        }
+    }
+
+    bool Terminal::wait_for_character(int timeout_ms) const
+    {
+        // Much as for a non-blocking check, but waiting a while; the program is waiting for input, so make sure that
+        // the user can see everything that it has output
+        refresh_screen();
+        return wait_for_key(timeout_ms);
+    }
+
+    char Terminal::get_translated_char() const
+    {
+        // Either way the user needs to see what they're responding to
+        refresh_screen();
+        return next_key();
     }
 } // namespace zcpm::terminal
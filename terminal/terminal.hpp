@@ -1,8 +1,24 @@
 #pragma once
 
+#include "keybuffer.hpp"
 #include "keymap.hpp"
+#include "screen.hpp"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <termios.h>
+
+struct _win_st; // ncurses' WINDOW
 
 namespace zcpm::terminal
 {
@@ -17,31 +33,137 @@ namespace zcpm::terminal
         Terminal(Terminal&&) = delete;
         Terminal& operator=(Terminal&&) = delete;
 
-        virtual ~Terminal() = default;
+        virtual ~Terminal();
 
         // Send a single character to the console; also handles tabs, start/stop
         // scroll, etc
         virtual void print(char ch) = 0;
 
+        // Send a run of characters to the console, as if by print() for each of them in turn
+        virtual void write(std::string_view text);
+
         // Check to see if a character has been typed at the console
         [[nodiscard]] virtual bool is_character_ready() const = 0;
 
+        // As above, but if nothing has been typed yet then wait up to the specified time for something to be typed
+        [[nodiscard]] virtual bool wait_for_character(int timeout_ms) const;
+
         // Get a pending character (blocking read)
         virtual char get_char() = 0;
 
         // Get a pending character (blocking read) via a keymap
         virtual char get_translated_char() const;
 
+        // Has all of the input been read, such that a program which waits for more should be ended instead? Only a
+        // batch terminal which has been asked to do so says that.
+        [[nodiscard]] virtual bool is_input_exhausted() const
+        {
+            return false;
+        }
+
+        // How many times the display has been brought up to date with the screen (only screen-based terminals do so)
+        [[nodiscard]] uint64_t refresh_count() const
+        {
+            return m_refreshes;
+        }
+
     protected:
-        const Keymap m_keymap;
+        // Keystrokes are read from the host by a separate thread, which translates them via the keymap and queues them,
+        // so that checking for a keystroke never has to wait for the host. A derived class starts this once it is
+        // ready for read_host_input() to be called, and stops it before it starts to go away.
+        void start_input();
+        void stop_input();
+
+        // Called by the input thread when the host's standard input is readable; appends whatever keys can now be
+        // read, returning false at the end of the input. The default reads via ncurses.
+        virtual bool read_host_input(std::vector<int>& keys);
+
+        // Has a keystroke been queued (or has the input finished, in which case reading returns 0xFF)?
+        [[nodiscard]] bool is_key_ready() const
+        {
+            return !m_keys.empty() || m_end_of_input;
+        }
+
+        // Wait up to the specified time (-1=forever) for a keystroke to be queued, returning false if none was
+        [[nodiscard]] bool wait_for_key(int timeout_ms) const;
+
+        // Return the next queued keystroke, waiting for one if need be
+        char next_key() const;
+
+        // Used by the screen-based terminals (VT100 and Televideo), which draw the screen either via ncurses or by
+        // writing ANSI sequences directly to the host terminal. For ncurses, keystrokes are read via an off-screen pad
+        // rather than via stdscr, because reading from stdscr refreshes the screen first, and BDOS polls the keyboard
+        // before every character that it outputs. Instead, output accumulates until the program waits for input, or
+        // until RefreshIntervalMs has passed since the screen was last refreshed. Output goes to m_screen rather than
+        // directly to the display, and a refresh passes on just the rows which have changed. Since ncurses isn't
+        // thread safe, anything which uses it once the input thread has started needs to hold m_curses_mutex (which
+        // refresh_screen() takes for itself).
+        void start_display(bool use_curses);
+        void finish_display();
+        void refresh_screen() const;
+        void refresh_screen_if_due() const;
+        void ring_bell() const;
+
+        // Append whatever keys can now be read from the host's standard input, as for read_host_input()
+        static bool read_stdin(std::vector<int>& keys);
+
+        // If the host's standard input is a terminal, switch it to raw mode much as ncurses' raw() and noecho() do, so
+        // that keystrokes (including e.g. ^C, ^S and ^Q) arrive verbatim as they are typed, and aren't echoed; CR is
+        // only translated to newline if so specified. The original mode is restored when the terminal goes away.
+        void set_raw_input_mode(bool translate_cr);
+
+        // Without ncurses, return what is to be written to bring the display up to date with m_screen (along with
+        // anything else that is still to be written), as if it had been; render_ansi() writes it
+        [[nodiscard]] std::string take_ansi_output() const;
+
+        Keymap m_keymap; // Only used by the input thread, once that has started
         const int m_rows;
         const int m_columns;
 
-        const int KeyboardDelayMs{ 1 };
+        Screen m_screen;
+
+        const int RefreshIntervalMs{ 16 };
+
+        mutable std::mutex m_curses_mutex;
 
     private:
-        // Keystrokes that are yet to be returned after a mapping
-        mutable std::list<char> m_pending_keystrokes;
+        // Bring the display up to date with m_screen
+        void render_curses() const;
+        void render_ansi() const;
+
+        [[nodiscard]] int read_key(int timeout_ms) const; // As per ncurses' getch(), but with a timeout (-1=none)
+
+        // The body of the input thread
+        void run_input();
+
+        // Queue the translation of a single key, waiting for room if need be
+        void queue_key(int key);
+
+        // Queue characters, waiting for room if need be
+        void queue(std::string_view characters);
+
+        bool m_use_curses{ true };
+        _win_st* m_pinput{ nullptr };
+        std::optional<struct termios> m_original_input_mode; // To be restored, if it was changed
+        mutable std::string m_ansi_output;                    // Without ncurses, what is still to be written
+        mutable int m_shown_row{ -1 };                        // Where the display's cursor was left, if known
+        mutable int m_shown_column{ -1 };
+        mutable std::chrono::steady_clock::time_point m_last_refresh;
+        mutable uint64_t m_refreshes{ 0 };
+
+        // Keystrokes which have been read and translated, but not yet returned
+        mutable KeyBuffer m_keys;
+        std::atomic<bool> m_end_of_input{ false };
+
+        // Only used for waiting for a keystroke; the queue itself doesn't need a lock
+        mutable std::mutex m_input_mutex;
+        mutable std::condition_variable m_input_ready;
+
+        std::thread m_input_thread;
+        std::atomic<bool> m_stopping{ false };
+        std::array<int, 2> m_wakeup_fds{ -1, -1 }; // A pipe, written by stop_input() to wake up the input thread
+
+        inline static const int InputRetryMs{ 1 }; // While waiting for room in the queue
     };
 
 } // namespace zcpm::terminal
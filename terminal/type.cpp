@@ -26,6 +26,10 @@ namespace zcpm::terminal
         {
             terminal = Type::TELEVIDEO;
         }
+        else if (token == "BATCH")
+        {
+            terminal = Type::BATCH;
+        }
         else
         {
             throw boost::program_options::validation_error(
@@ -8,7 +8,8 @@ namespace zcpm::terminal
     {
         PLAIN,    // Terminal type which relies on the host terminal doing any needed translation; usually supports ANSI
         VT100,    // Full-featured VT100 emulation translates CP/M VT100 directives to portable ncurses commands
-        TELEVIDEO // Televideo 920/925
+        TELEVIDEO, // Televideo 920/925
+        BATCH      // Unattended runs, with scripted input and captured output
     };
 
     std::istream& operator>>(std::istream& in, Type& terminal);
@@ -3,156 +3,95 @@
 #include <boost/log/trivial.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
 #include <iostream>
 #include <ncurses.h>
-#include <optional>
-#include <regex>
 #include <string>
 
 namespace
 {
-    // Parses an escape sequence (which may yet be incomplete) and returns <count, values, ch> where:
-    // - count is the number of characters parsed that can now be erased,
-    // - values is a vector of semicolon-separated numbers
-    // - ch is the terminating character.
-    // So given "<ESC>[0;4;5m" count=8 values=[0,4,5] ch='m'
-    // Or       "<ESC>[m" count=3 values=[] ch='m'
-    // Returns nullopt if nothing can (yet) be parsed
-    using ParsedSequence = std::tuple<size_t, std::vector<int>, char>;
-    std::optional<ParsedSequence> parse_sequence(const std::string& s)
-    {
-        const auto len = s.length();
-
-        // Check for a minimum usable length and that it starts with "<ESC>["
-        if ((len < 3) || !s.starts_with("\x1B["))
-        {
-            // Can't be a complete sequence yet
-            return std::nullopt;
-        }
-
-        const auto last = s[len - 1];
-        const auto terminators = std::string("rHfABCDmJKLM");
-
-        // Check for a valid sequence with *no* numeric values (common occurrence, so optimise for this path)
-        if ((len == 3) && terminators.find(last) != std::string::npos)
-        {
-            // Empty value list
-            return ParsedSequence{ len, {}, last };
-        }
-
-        if (terminators.find(last) == std::string::npos)
-        {
-            // It isn't something we yet recognise, most like a sequence which hasn't yet been fully collated
-            return std::nullopt;
-        }
-
-        // Is all the intervening content digits or semicolons only?
-        if (s.find_first_not_of("0123456789;", 3) != len - 1)
-        {
-            BOOST_LOG_TRIVIAL(trace) << "Warning: not just a numeric sequence in '" << s << "'";
-            return std::nullopt;
-        }
-
-        // Looks good; extract what we need
-
-        std::vector<int> values;
-
-        // payload could be e.g. '3;14'.  Use a regular expression to extract what we need
-        const auto payload = s.substr(2, len - 3);
-
-        std::regex regex("(\\d+)");
-        for (auto i = std::sregex_iterator(payload.begin(), payload.end(), regex); i != std::sregex_iterator(); ++i)
-        {
-            const auto match = (*i).str();
-            const auto value = std::atoi(match.c_str()); // NOLINT(cert-err34-c)
-            values.push_back(value);
-        }
-
-        return ParsedSequence{ len, values, last };
-    }
+    using zcpm::terminal::Screen;
 
     // VT100 sequences as per http://ascii-table.com/ansi-escape-sequences-vt-100.php
 
     // Move cursor left n lines
-    void ansi_cub()
+    void ansi_cub(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES CUB";
-        auto x = 0, y = 0;
-        getsyx(y, x);
-        ::move(y, x - 1);
+        screen.set_cursor(screen.row(), screen.column() - 1);
     }
 
     // Move cursor to screen location v,h
-    void ansi_cup(int v, int h)
+    void ansi_cup(Screen& screen, int v, int h)
     {
         BOOST_LOG_TRIVIAL(trace) << fmt::format("CURSES cup (v={:d} h={:d})", v, h);
-        ::move(v - 1, h - 1);
+        screen.set_cursor(v - 1, h - 1);
     }
 
     // Clear screen from cursor down
-    void ansi_ed0()
+    void ansi_ed0(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES ED0";
-        ::clrtobot();
+        screen.clear_to_bottom();
     }
 
     // Clear entire screen
-    void ansi_ed2()
+    void ansi_ed2(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES ED2";
-        // Note that ncurses ::clear() seems to home the cursor which is NOT what we want, so we need to manually work
+        // Note that clearing the screen homes the cursor which is NOT what we want, so we need to manually work
         // around that
-        auto x = 0, y = 0;
-        getsyx(y, x);
-        ::clear();
-        ::move(y, x);
+        const auto y = screen.row();
+        const auto x = screen.column();
+        screen.clear_screen();
+        screen.set_cursor(y, x);
     }
 
     // Clear line from cursor right
-    void ansi_el0()
+    void ansi_el0(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES EL0";
-        ::clrtoeol();
+        screen.clear_to_end_of_row();
     }
 
     // Clear entire line
-    void ansi_el2()
+    void ansi_el2(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES EL2";
-        // There is no direct ncurses equivalent, so we need to do this in a few steps
-        auto x = 0, y = 0;
-        getsyx(y, x);
-        ::move(y, 0);
-        ::clrtoeol();
-        ::move(y, x);
+        // There is no direct equivalent, so we need to do this in a few steps
+        const auto y = screen.row();
+        const auto x = screen.column();
+        screen.set_cursor(y, 0);
+        screen.clear_to_end_of_row();
+        screen.set_cursor(y, x);
     }
 
     // Turn off character attributes
-    void ansi_sgr0()
+    void ansi_sgr0(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES SGR0";
-        ::attrset(A_NORMAL);
+        screen.set_attributes(Screen::Normal);
     }
 
     // Turn bold mode on
-    void ansi_sgr1()
+    void ansi_sgr1(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES SGR1";
-        ::attron(A_BOLD);
+        screen.add_attributes(Screen::Bold);
     }
 
     // Turn blinking mode on
-    void ansi_sgr5()
+    void ansi_sgr5(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES SGR5";
-        ::attron(A_BLINK);
+        screen.add_attributes(Screen::Blink);
     }
 
     // Turn reverse video on
-    void ansi_sgr7()
+    void ansi_sgr7(Screen& screen)
     {
         BOOST_LOG_TRIVIAL(trace) << "CURSES SGR7";
-        ::attron(A_REVERSE);
+        screen.add_attributes(Screen::Reverse);
     }
 
     // Set alternate keypad mode
@@ -174,32 +113,21 @@ namespace
 namespace zcpm::terminal
 {
 
-    Vt100::Vt100(int rows, int columns, const std::string& keymap_filename) : Terminal(rows, columns, keymap_filename)
+    Vt100::Vt100(int rows, int columns, const std::string& keymap_filename, bool use_curses)
+        : Terminal(rows, columns, keymap_filename)
     {
-        ::initscr();
-
-        ::raw(); // Make sure that we receive control sequences (e.g. ^C) verbatim
-
-        ::timeout(KeyboardDelayMs); // Enables a 1ms timeout on non-blocking keyboard read
-
-        ::noecho(); // We want to display characters ourselves, not have them automatically echoed
-
-        ::idlok(stdscr, true);    // Allow insert/delete row
-        ::scrollok(stdscr, true); // Allow scrolling
-        ::keypad(stdscr, true);   // Ask curses to give us e.g. KEY_LEFT instead of <ESC>[D
+        start_display(use_curses);
+        start_input();
     }
 
     Vt100::~Vt100()
     {
-        // If there's been no user *input* and we don't block here, the user will
-        // not see anything displayed at all, so we need to do this before teardown.
-        ::getch();
+        stop_input();
+        finish_display();
 
-        ::endwin();
-
-        if (!m_pending.empty())
+        if (m_escape.active())
         {
-            std::cerr << "Warning: incomplete escape sequence <ESC>" << m_pending.substr(1) << " at termination"
+            std::cerr << "Warning: incomplete escape sequence <ESC>" << m_escape.text().substr(1) << " at termination"
                       << std::endl;
         }
     }
@@ -207,26 +135,33 @@ namespace zcpm::terminal
     void Vt100::print(char ch)
     {
         outch(ch);
-        ::refresh();
+
+        // Don't show part of the effect of an escape sequence
+        if (!m_escape.active())
+        {
+            refresh_screen_if_due();
+        }
     }
 
-    bool Vt100::is_character_ready() const
+    void Vt100::write(std::string_view text)
     {
-        // Is there a character available?
-        const auto ch = ::getch();
-        if (ch == ERR)
+        for (const auto ch : text)
         {
-            // No
-            return false;
+            outch(ch);
         }
-        else
+
+        if (!m_escape.active())
         {
-            // Yes.  Make sure we don't lose it, so that :getch() returns it later as needed
-            ::ungetch(ch);
-            return true;
+            refresh_screen_if_due();
         }
     }
 
+    bool Vt100::is_character_ready() const
+    {
+        refresh_screen_if_due();
+        return is_key_ready();
+    }
+
     char Vt100::get_char()
     {
         return get_translated_char();
@@ -234,33 +169,41 @@ namespace zcpm::terminal
 
     void Vt100::outch(char ch)
     {
-        // If we've already got an escape sequence in progress, add this character to it.  process_pending()
-        // will then consider the collected data, and if it can deal with it then it will do so
-        // and erase the pending data.
-        if (!m_pending.empty())
+        // If we've already got an escape sequence in progress, add this character to it.  Once the sequence is
+        // complete, process_pending() deals with it.
+        if (m_escape.active())
         {
             // If it appears that we're starting a *new* escape sequence with one already in progress, warn
-            // the maintainer via the log file and drop the unhandled one.
+            // the maintainer via the log file and drop the unfinished one.
             if (ch == '\033') // ESC
             {
-                BOOST_LOG_TRIVIAL(trace) << "Warning: unimplemented escape sequence <ESC>" << m_pending.substr(1)
+                BOOST_LOG_TRIVIAL(trace) << "Warning: incomplete escape sequence <ESC>" << m_escape.text().substr(1)
                                          << " dropped";
-                m_pending.erase();
+                m_escape.start();
+                return;
             }
-            else
+
+            switch (m_escape.add(ch))
             {
-                m_pending += std::string(1, ch);
+            case EscapeParser::Status::INCOMPLETE: break;
+            case EscapeParser::Status::COMPLETE:
                 process_pending();
+                m_escape.reset();
+                break;
+            case EscapeParser::Status::INVALID:
+                BOOST_LOG_TRIVIAL(trace) << "Warning: invalid escape sequence <ESC>" << m_escape.text().substr(1)
+                                         << " dropped";
+                m_escape.reset();
+                break;
             }
             return;
         }
 
-        auto col = 0, row = 0;
-        getsyx(row, col);
+        auto col = m_screen.column(), row = m_screen.row();
 
         if (ch == '\015') // CR
         {
-            ::move(row, 0);
+            m_screen.set_cursor(row, 0);
         }
         else if (ch == '\012') // LF
         {
@@ -271,21 +214,21 @@ namespace zcpm::terminal
             if (row + 1 < m_rows)
             {
                 // Not yet at last row, so move down one row
-                ::move(row + 1, col);
+                m_screen.set_cursor(row + 1, col);
             }
             else
             {
                 // Already at last row, so force a scroll
-                ::scrl(1);
+                m_screen.scroll_up();
             }
         }
         else if (ch == '\033') // ESC
         {
-            m_pending += std::string(1, ch);
+            m_escape.start();
         }
         else if (ch == '\007') // Control-G aka Bell
         {
-            ::beep();
+            ring_bell();
         }
         else // Anything else
         {
@@ -295,7 +238,7 @@ namespace zcpm::terminal
                 ch = ' ';
             }
 
-            ::addch(ch);
+            m_screen.put(ch);
 
             // If we were already at the maximum column, force a 'wrap' to the start of the next row so that the next
             // character output is in the right place
@@ -307,7 +250,7 @@ namespace zcpm::terminal
                     // TODO: Unsure of correct behaviour here; simply stick with the bottom row, or should we scroll?
                     ++row;
                 }
-                ::move(row, col);
+                m_screen.set_cursor(row, col);
             }
         }
     }
@@ -315,26 +258,26 @@ namespace zcpm::terminal
     void Vt100::process_pending()
     {
         // Map VT100 sequences (see http://ascii-table.com/ansi-escape-sequences-vt-100.php)
-        // to ncurses commands. Sequences are added only as needed, not all of them upfront.
+        // to changes to the screen. Sequences are added only as needed, not all of them upfront.
 
-        if (auto parsed = parse_sequence(m_pending); parsed) // Handle e.g. "<ESC>[fooH" here
+        if ((m_escape.intro() == '[') && !m_escape.is_private()) // Handle e.g. "<ESC>[fooH" here
         {
-            const auto [num_parsed, values, ch] = *parsed;
+            const auto values = m_escape.parameters();
 
-            switch (ch)
+            switch (m_escape.final())
             {
-            case 'D': ansi_cub(); break;
+            case 'D': ansi_cub(m_screen); break;
 
             case 'H':
             {
                 if (values.size() == 2)
                 {
-                    ansi_cup(values[0], values[1]);
+                    ansi_cup(m_screen, std::max(values[0], 1), std::max(values[1], 1));
                 }
                 else if (values.empty())
                 {
                     BOOST_LOG_TRIVIAL(trace) << "CURSES cursorhome";
-                    ::move(0, 0);
+                    m_screen.set_cursor(0, 0);
                 }
                 else
                 {
@@ -347,7 +290,7 @@ namespace zcpm::terminal
             {
                 if (values.empty())
                 {
-                    ansi_ed0();
+                    ansi_ed0(m_screen);
                 }
                 else
                 {
@@ -357,8 +300,8 @@ namespace zcpm::terminal
                     }
                     switch (values[0])
                     {
-                    case 0: ansi_ed0(); break;
-                    case 2: ansi_ed2(); break;
+                    case 0: ansi_ed0(m_screen); break;
+                    case 2: ansi_ed2(m_screen); break;
                     default: BOOST_LOG_TRIVIAL(trace) << "Warning: n=" << values[0] << " unhandled for EDn";
                     }
                 }
@@ -369,7 +312,7 @@ namespace zcpm::terminal
             {
                 if (values.empty())
                 {
-                    ansi_el0();
+                    ansi_el0(m_screen);
                 }
                 else
                 {
@@ -379,8 +322,8 @@ namespace zcpm::terminal
                     }
                     switch (values[0])
                     {
-                    case 0: ansi_el0(); break;
-                    case 2: ansi_el2(); break;
+                    case 0: ansi_el0(m_screen); break;
+                    case 2: ansi_el2(m_screen); break;
                     default: BOOST_LOG_TRIVIAL(trace) << "Warning: n=" << values[0] << " unhandled for ELn";
                     }
                 }
@@ -389,12 +332,12 @@ namespace zcpm::terminal
 
             case 'L': // WS.COM uses this; seems to be insert line
                 BOOST_LOG_TRIVIAL(trace) << "CURSES INSERTLINE";
-                ::insertln();
+                m_screen.insert_row();
                 break;
 
             case 'M': // WS.COM uses this; seems to be delete line
                 BOOST_LOG_TRIVIAL(trace) << "CURSES DELETELINE";
-                ::deleteln();
+                m_screen.delete_row();
                 break;
 
             case 'f':
@@ -406,7 +349,7 @@ namespace zcpm::terminal
             {
                 if (values.empty())
                 {
-                    ansi_sgr0();
+                    ansi_sgr0(m_screen);
                 }
                 else
                 {
@@ -414,10 +357,10 @@ namespace zcpm::terminal
                     {
                         switch (value)
                         {
-                        case 0: ansi_sgr0(); break;
-                        case 1: ansi_sgr1(); break;
-                        case 5: ansi_sgr5(); break;
-                        case 7: ansi_sgr7(); break;
+                        case 0: ansi_sgr0(m_screen); break;
+                        case 1: ansi_sgr1(m_screen); break;
+                        case 5: ansi_sgr5(m_screen); break;
+                        case 7: ansi_sgr7(m_screen); break;
                         default: BOOST_LOG_TRIVIAL(trace) << "Warning: n=" << value << " unhandled for SGRn";
                         }
                     }
@@ -430,19 +373,22 @@ namespace zcpm::terminal
                 // TODO (Set top and bottom lines of a window)
                 break;
 
-            default: BOOST_LOG_TRIVIAL(trace) << "Warning: Unimplemented escape sequence, TODO!"; break;
+            default:
+                BOOST_LOG_TRIVIAL(trace) << "Warning: unimplemented escape sequence <ESC>" << m_escape.text().substr(1);
+                break;
             }
-            m_pending.erase(0, num_parsed);
         }
-        else if (m_pending == "\x1B=")
+        else if (m_escape.intro() == '=')
         {
             ansi_deckpam();
-            m_pending.erase();
         }
-        else if (m_pending == "\x1B<")
+        else if (m_escape.intro() == '<')
         {
             ansi_setansi();
-            m_pending.erase();
+        }
+        else
+        {
+            BOOST_LOG_TRIVIAL(trace) << "Warning: unimplemented escape sequence <ESC>" << m_escape.text().substr(1);
         }
     }
 
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "escapeparser.hpp"
 #include "terminal.hpp"
 
 #include <string>
+#include <string_view>
 
 namespace zcpm::terminal
 {
@@ -10,7 +12,7 @@ namespace zcpm::terminal
     class Vt100 final : public Terminal
     {
     public:
-        Vt100(int rows, int columns, const std::string& keymap_filename = "");
+        Vt100(int rows, int columns, const std::string& keymap_filename = "", bool use_curses = true);
 
         Vt100(const Vt100&) = delete;
         Vt100& operator=(const Vt100&) = delete;
@@ -22,6 +24,7 @@ namespace zcpm::terminal
         // Send a single character to the console; also handles tabs, start/stop
         // scroll, etc
         void print(char ch) override;
+        void write(std::string_view text) override;
 
         // Check to see if a character has been typed at the console
         [[nodiscard]] bool is_character_ready() const override;
@@ -34,14 +37,13 @@ namespace zcpm::terminal
         // is deliberately left to the caller
         void outch(char ch);
 
-        // Check the 'pending' output characters; if we have sufficient info then handle them
-        // and erase them.
+        // Handle the escape sequence which has just been completed
         void process_pending();
 
         // When we get character-by-character output, it can include escape sequences.  We
-        // save these incomplete sequences here until we have enough info to do something
+        // collect these incomplete sequences here until we have enough info to do something
         // with them.
-        std::string m_pending;
+        EscapeParser m_escape{ EscapeParser::Dialect::VT100 };
     };
 
 } // namespace zcpm::terminal
@@ -0,0 +1,863 @@
+#include <zcpm/builder/builder.hpp>
+#include <zcpm/core/disk.hpp>
+#include <zcpm/core/hardware.hpp>
+#include <zcpm/core/nativebdos.hpp>
+#include <zcpm/terminal/batch.hpp>
+
+#include <boost/test/unit_test.hpp>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// This module tests the disk which is synthesised from a host directory, by reading and writing its sectors much as the
+// BDOS does, and checking what ends up in the host files. It also tests which sectors the native BDOS reads and writes
+// file records from and to.
+
+namespace
+{
+
+    namespace fs = std::filesystem;
+
+    // A host directory for a disk to be made from, which is removed afterwards
+    class HostDirectory final
+    {
+    public:
+        HostDirectory() : m_path(fs::temp_directory_path() / fmt::format("zcpm-test-{:d}-{:d}", ::getpid(), ++m_count))
+        {
+            fs::remove_all(m_path);
+            fs::create_directory(m_path);
+        }
+
+        HostDirectory(const HostDirectory&) = delete;
+        HostDirectory& operator=(const HostDirectory&) = delete;
+        HostDirectory(HostDirectory&&) = delete;
+        HostDirectory& operator=(HostDirectory&&) = delete;
+
+        ~HostDirectory()
+        {
+            std::error_code ec;
+            fs::remove_all(m_path, ec);
+        }
+
+        // A configuration for a disk made from this directory
+        [[nodiscard]] zcpm::Config config() const
+        {
+            auto result = zcpm::MachineOptions().config;
+            result.disk_root = m_path.string();
+            return result;
+        }
+
+        void write(const std::string& name, const std::vector<uint8_t>& contents) const
+        {
+            std::ofstream out(m_path / name, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+        }
+
+        // The contents of a host file, or nothing if it doesn't exist
+        [[nodiscard]] std::vector<uint8_t> read(const std::string& name) const
+        {
+            std::ifstream in(m_path / name, std::ios::binary);
+            return { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+        }
+
+        [[nodiscard]] bool exists(const std::string& name) const
+        {
+            return fs::exists(m_path / name);
+        }
+
+        void remove(const std::string& name) const
+        {
+            fs::remove(m_path / name);
+        }
+
+        [[nodiscard]] std::string path(const std::string& name) const
+        {
+            return (m_path / name).string();
+        }
+
+    private:
+        inline static int m_count{ 0 };
+        const fs::path m_path;
+    };
+
+    // Contents which differ from sector to sector, and from one file to another
+    std::vector<uint8_t> pattern(size_t size, uint8_t seed)
+    {
+        std::vector<uint8_t> result(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            result[i] = static_cast<uint8_t>(seed * 0x1D + i / zcpm::Disk::SectorSize * 7 + i);
+        }
+        return result;
+    }
+
+    struct Location
+    {
+        uint16_t track;
+        uint16_t sector;
+    };
+
+    // A directory entry, as the BDOS sees it
+    struct DirectoryEntry
+    {
+        Location location;    // Of the directory sector which holds it
+        size_t offset;        // Within that sector
+        std::vector<uint8_t> bytes;
+    };
+
+    Location sector_location(const zcpm::DiskGeometry& geometry, size_t n)
+    {
+        return { static_cast<uint16_t>(n / geometry.spt), static_cast<uint16_t>(n % geometry.spt) };
+    }
+
+    // The directory entries (i.e. extents) of the file with the specified CP/M name (e.g. "FOO     TXT"), in order
+    std::vector<DirectoryEntry> find_entries(const zcpm::Disk& disk, const std::string& name)
+    {
+        const auto& geometry = disk.get_geometry();
+        const auto first = size_t(geometry.off) * geometry.spt;
+        std::vector<DirectoryEntry> result;
+        for (size_t n = 0; n < (size_t(geometry.directory_blocks()) << geometry.bsh); ++n)
+        {
+            const auto location = sector_location(geometry, first + n);
+            zcpm::Disk::SectorData data;
+            disk.read(data, location.track, location.sector);
+            for (size_t offset = 0; offset < data.size(); offset += 0x20)
+            {
+                if ((data[offset] != 0xE5) && std::equal(name.begin(), name.end(), data.begin() + offset + 1))
+                {
+                    result.push_back({ location, offset, { data.begin() + offset, data.begin() + offset + 0x20 } });
+                }
+            }
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            return (a.bytes[0x0E] << 5 | a.bytes[0x0C]) < (b.bytes[0x0E] << 5 | b.bytes[0x0C]);
+        });
+        return result;
+    }
+
+    // The blocks listed in a directory entry's disk map (including any zeroes after the last one), which are 8-bit
+    // numbers on a disk of fewer than 256 blocks
+    std::vector<uint16_t> disk_map(const zcpm::DiskGeometry& geometry, const std::vector<uint8_t>& bytes)
+    {
+        std::vector<uint16_t> result;
+        for (size_t i = 0x10; i < 0x20; i += (geometry.dsm < 0x0100) ? 1 : 2)
+        {
+            result.push_back((geometry.dsm < 0x0100) ? bytes[i] : (bytes[i] | (bytes[i + 1] << 8)));
+        }
+        return result;
+    }
+
+    // Where the data described by a directory entry is, sector by sector
+    std::vector<Location> data_sectors(const zcpm::Disk& disk, const DirectoryEntry& entry)
+    {
+        const auto& geometry = disk.get_geometry();
+        const auto records = (entry.bytes[0x0C] & geometry.exm()) * 0x80 + entry.bytes[0x0F];
+        const auto blocks = disk_map(geometry, entry.bytes);
+        std::vector<Location> result;
+        for (size_t record = 0; record < size_t(records); ++record)
+        {
+            const auto block = blocks.at(record >> geometry.bsh);
+            const auto n =
+                size_t(geometry.off) * geometry.spt + (size_t(block) << geometry.bsh) + (record & geometry.blm());
+            result.push_back(sector_location(geometry, n));
+        }
+        return result;
+    }
+
+    // The contents of a file, as the BDOS would read it
+    std::vector<uint8_t> read_file(const zcpm::Disk& disk, const std::string& name)
+    {
+        std::vector<uint8_t> result;
+        for (const auto& entry : find_entries(disk, name))
+        {
+            for (const auto& [track, sector] : data_sectors(disk, entry))
+            {
+                zcpm::Disk::SectorData data;
+                disk.read(data, track, sector);
+                result.insert(result.end(), data.begin(), data.end());
+            }
+        }
+        return result;
+    }
+
+    // The blocks that a file's data occupies
+    std::vector<uint16_t> file_blocks(const zcpm::Disk& disk, const std::string& name)
+    {
+        std::vector<uint16_t> result;
+        for (const auto& entry : find_entries(disk, name))
+        {
+            for (const auto block : disk_map(disk.get_geometry(), entry.bytes))
+            {
+                if (block != 0)
+                {
+                    result.push_back(block);
+                }
+            }
+        }
+        return result;
+    }
+
+    // Change a directory entry as the BDOS would, by rewriting the sector that holds it
+    void write_entry(zcpm::Disk& disk, const DirectoryEntry& entry)
+    {
+        zcpm::Disk::SectorData data;
+        disk.read(data, entry.location.track, entry.location.sector);
+        std::copy(entry.bytes.begin(), entry.bytes.end(), data.begin() + entry.offset);
+        disk.write(data, entry.location.track, entry.location.sector);
+    }
+
+    // Rename each extent of a file, as the BDOS does
+    void rename_file(zcpm::Disk& disk, const std::string& from, const std::string& to)
+    {
+        for (auto entry : find_entries(disk, from))
+        {
+            std::copy(to.begin(), to.end(), entry.bytes.begin() + 1);
+            write_entry(disk, entry);
+        }
+    }
+
+    // Delete each extent of a file, as the BDOS does
+    void delete_file(zcpm::Disk& disk, const std::string& name)
+    {
+        for (auto entry : find_entries(disk, name))
+        {
+            entry.bytes[0] = 0xE5;
+            write_entry(disk, entry);
+        }
+    }
+
+    // Overwrite one sector of a file's data, as a random write does
+    void write_record(zcpm::Disk& disk, const std::string& name, size_t record, const std::vector<uint8_t>& data)
+    {
+        const auto entries = find_entries(disk, name);
+        const auto sectors = data_sectors(disk, entries.at(0));
+        const auto [track, sector] = sectors.at(record);
+        disk.write(zcpm::Disk::ConstSectorView(data.data(), zcpm::Disk::SectorSize), track, sector);
+    }
+
+    // Create a file (whose size must be a whole number of sectors) as the BDOS does: each entry's data is written to
+    // free blocks, and then the entry to the first free directory slot
+    void create_file(zcpm::Disk& disk, const std::string& name, const std::vector<uint8_t>& contents)
+    {
+        const auto& geometry = disk.get_geometry();
+        const auto first = size_t(geometry.off) * geometry.spt;
+        const size_t records_per_entry = 0x80 * (geometry.exm() + 1);
+        const size_t sectors_per_block = size_t(1) << geometry.bsh;
+
+        // Find out which blocks are in use, and which directory slots are free
+        std::vector<bool> used(geometry.dsm + 1, false);
+        std::fill_n(used.begin(), geometry.directory_blocks(), true);
+        std::vector<DirectoryEntry> free_slots;
+        for (size_t n = 0; n < (size_t(geometry.directory_blocks()) << geometry.bsh); ++n)
+        {
+            const auto location = sector_location(geometry, first + n);
+            zcpm::Disk::SectorData data;
+            disk.read(data, location.track, location.sector);
+            for (size_t offset = 0; offset < data.size(); offset += 0x20)
+            {
+                if (data[offset] == 0xE5)
+                {
+                    free_slots.push_back({ location, offset, std::vector<uint8_t>(0x20, 0x00) });
+                    continue;
+                }
+                for (const auto block : disk_map(geometry, { data.begin() + offset, data.begin() + offset + 0x20 }))
+                {
+                    used.at(block) = true;
+                }
+            }
+        }
+
+        const auto records = contents.size() / zcpm::Disk::SectorSize;
+        size_t next_block = 0;
+        for (size_t entry_number = 0; entry_number * records_per_entry < records; ++entry_number)
+        {
+            auto& entry = free_slots.at(entry_number);
+            const auto first_record = entry_number * records_per_entry;
+            const auto records_this_entry = std::min(records - first_record, records_per_entry);
+            for (size_t i = 0; i * sectors_per_block < records_this_entry; ++i)
+            {
+                while (used.at(next_block))
+                {
+                    ++next_block;
+                }
+                used[next_block] = true;
+                if (geometry.dsm < 0x0100)
+                {
+                    entry.bytes[0x10 + i] = static_cast<uint8_t>(next_block);
+                }
+                else
+                {
+                    entry.bytes[0x10 + i * 2] = next_block & 0xFF;
+                    entry.bytes[0x11 + i * 2] = next_block >> 8;
+                }
+                for (size_t j = 0; (j < sectors_per_block) && (i * sectors_per_block + j < records_this_entry); ++j)
+                {
+                    const auto [track, sector] = sector_location(geometry, first + (next_block << geometry.bsh) + j);
+                    const auto p_data = contents.data() + (first_record + i * sectors_per_block + j) * 0x80;
+                    disk.write(zcpm::Disk::ConstSectorView(p_data, zcpm::Disk::SectorSize), track, sector);
+                }
+            }
+
+            // The entry holds its last logical extent, and the number of records in that
+            const auto last_extent = entry_number * (geometry.exm() + 1) + (records_this_entry - 1) / 0x80;
+            std::copy(name.begin(), name.end(), entry.bytes.begin() + 1);
+            entry.bytes[0x0C] = last_extent & 0x1F;
+            entry.bytes[0x0E] = static_cast<uint8_t>(last_extent >> 5);
+            entry.bytes[0x0F] = static_cast<uint8_t>(records_this_entry - (records_this_entry - 1) / 0x80 * 0x80);
+            write_entry(disk, entry);
+        }
+    }
+
+    // Geometries for tests which should work the same whatever the disk looks like: the default; one whose disk map
+    // holds 8-bit block numbers; and one with reserved tracks, and two logical extents per directory entry
+    const std::vector<zcpm::DiskGeometry> geometries{ {},
+                                                      { 0x20, 3, 0x009F, 0x003F, 0 },
+                                                      { 0x48, 5, 0x015E, 0x007F, 2 } };
+
+    // A geometry as the diskgeometry option gives it
+    std::string describe(const zcpm::DiskGeometry& geometry)
+    {
+        return fmt::format(
+            "{:d},{:d},{:d},{:d},{:d}", geometry.spt, geometry.bsh, geometry.dsm, geometry.drm, geometry.off);
+    }
+
+    // A file's modification time in nanoseconds, as a directory index records it
+    int64_t modification_time(const std::string& path)
+    {
+        struct stat status{};
+        BOOST_REQUIRE(::stat(path.c_str(), &status) == 0);
+        return int64_t(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+    }
+
+    // The first line of a directory index, for a directory with the specified modification time
+    std::string index_header(int64_t dir_mtime, const zcpm::DiskGeometry& geometry)
+    {
+        return fmt::format("zcpm-directory-index-2 {:d} {}\n", dir_mtime, describe(geometry));
+    }
+
+    // What a disk image made by make_image() holds in the specified sector (counting from the start of the disk)
+    std::vector<uint8_t> image_sector(size_t n)
+    {
+        std::vector<uint8_t> result(zcpm::Disk::SectorSize);
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            result[i] = static_cast<uint8_t>((i & 1) ? (n >> 8) : n) ^ static_cast<uint8_t>(i);
+        }
+        return result;
+    }
+
+    // A disk image of the specified geometry, in which each sector holds its own number
+    zcpm::Config make_image(const HostDirectory& directory, const zcpm::DiskGeometry& geometry)
+    {
+        std::vector<uint8_t> contents;
+        for (size_t n = 0; n < geometry.sectors(); ++n)
+        {
+            const auto sector = image_sector(n);
+            contents.insert(contents.end(), sector.begin(), sector.end());
+        }
+        directory.write("disk.img", contents);
+
+        auto result = directory.config();
+        result.disk_image = directory.path("disk.img");
+        result.disk_geometry = geometry;
+        return result;
+    }
+
+    // A native BDOS, along with the memory that holds its FCB, DMA buffer and BDOS variables
+    class NativeBdosFixture final
+    {
+    public:
+        static const uint16_t Fcb = 0x005C;
+        static const uint16_t Dma = 0x2000;
+
+        explicit NativeBdosFixture(const zcpm::Config& config)
+            : m_memory(std::make_unique<zcpm::terminal::Batch>(24, 80, "/dev/null", "/dev/null"), config),
+              m_disk(config),
+              m_bdos(m_memory, m_disk, zcpm::NativeBdos::Variables{ UserDma, Active, WrtPrt })
+        {
+            m_memory.write_word(UserDma, Dma);
+        }
+
+        // Set up an FCB for the specified extent, with the specified disk map
+        void set_fcb(uint8_t extent, uint8_t record_count, const std::vector<uint8_t>& map)
+        {
+            std::vector<uint8_t> fcb(36, 0x00);
+            const std::string name = "FOO     DAT";
+            std::copy(name.begin(), name.end(), fcb.begin() + 1);
+            fcb[0x0C] = extent;
+            fcb[0x0F] = record_count;
+            std::copy(map.begin(), map.end(), fcb.begin() + 0x10);
+            m_memory.copy_to_ram(fcb.data(), fcb.size(), Fcb);
+        }
+
+        // Set the FCB's random record number
+        void set_random(uint32_t record)
+        {
+            m_memory.write_word(Fcb + 0x21, record & 0xFFFF);
+            m_memory.write_byte(Fcb + 0x23, static_cast<uint8_t>(record >> 16));
+        }
+
+        [[nodiscard]] std::vector<uint8_t> read_ram(uint16_t address, size_t count) const
+        {
+            std::vector<uint8_t> result(count);
+            m_memory.copy_from_ram(result.data(), result.size(), address);
+            return result;
+        }
+
+        [[nodiscard]] std::vector<uint8_t> read_sector(size_t n) const
+        {
+            const auto& geometry = m_disk.get_geometry();
+            zcpm::Disk::SectorData data;
+            m_disk.read(data, static_cast<uint16_t>(n / geometry.spt), static_cast<uint16_t>(n % geometry.spt));
+            return { data.begin(), data.end() };
+        }
+
+        // Where the BDOS keeps the variables which the native BDOS reads
+        static const uint16_t UserDma = 0xF000;
+        static const uint16_t Active = 0xF002;
+        static const uint16_t WrtPrt = 0xF003;
+
+        zcpm::Hardware m_memory;
+        zcpm::Disk m_disk;
+        zcpm::NativeBdos m_bdos;
+    };
+
+} // namespace
+
+// A renamed file's host file keeps its old name, so the renamed file's data can't be fetched from the host filesystem
+// again. Renaming a file and then giving its old name to another one (as an editor does with its backup and
+// temporary files) must not leave either of them reading the wrong data, even if the sector cache is small enough that
+// sectors have to be evicted from it.
+BOOST_AUTO_TEST_CASE(test_rename_with_eviction)
+{
+    HostDirectory directory;
+    const auto original = pattern(0x1000, 1);
+    const auto replacement = pattern(0x0C00, 2);
+    const auto filler = pattern(0x8000, 3);
+    directory.write("foo.txt", original);
+    directory.write("foo.$$$", replacement);
+    directory.write("filler.dat", filler);
+
+    auto config = directory.config();
+    config.sector_cache_kb = 1;
+    {
+        zcpm::Disk disk(config);
+        BOOST_CHECK(read_file(disk, "FOO     TXT") == original);
+
+        rename_file(disk, "FOO     TXT", "FOO     BAK");
+        rename_file(disk, "FOO     $$$", "FOO     TXT");
+        BOOST_CHECK(read_file(disk, "FILLER  DAT") == filler);
+        BOOST_CHECK(disk.get_statistics().evictions > 0);
+
+        BOOST_CHECK(read_file(disk, "FOO     BAK") == original);
+        BOOST_CHECK(read_file(disk, "FOO     TXT") == replacement);
+    }
+
+    BOOST_CHECK(directory.read("foo.bak") == original);
+    BOOST_CHECK(directory.read("foo.txt") == replacement);
+    BOOST_CHECK(directory.read("filler.dat") == filler);
+}
+
+// Copying over an existing file deletes it and then creates a new file of the same name, usually in the directory slot
+// which the old one has just given up
+BOOST_AUTO_TEST_CASE(test_overwrite_file)
+{
+    for (const auto& geometry : geometries)
+    {
+        BOOST_TEST_CONTEXT(describe(geometry))
+        {
+            HostDirectory directory;
+            directory.write("foo.txt", pattern(0x0800, 1));
+            auto config = directory.config();
+            config.disk_geometry = geometry;
+            const auto replacement = pattern(0x1800, 2);
+            {
+                zcpm::Disk disk(config);
+                delete_file(disk, "FOO     TXT");
+                create_file(disk, "FOO     TXT", replacement);
+                BOOST_CHECK(read_file(disk, "FOO     TXT") == replacement);
+            }
+            BOOST_CHECK(directory.read("foo.txt") == replacement);
+        }
+    }
+}
+
+// A file of several extents, both new and rewritten over one which was already there
+BOOST_AUTO_TEST_CASE(test_multi_extent_file)
+{
+    for (const auto& geometry : geometries)
+    {
+        BOOST_TEST_CONTEXT(describe(geometry))
+        {
+            HostDirectory directory;
+            directory.write("old.dat", pattern(0x9000, 1));
+            auto config = directory.config();
+            config.disk_geometry = geometry;
+            const auto contents = pattern(0xA080, 2);
+            const auto replacement = pattern(0xC000, 3);
+            {
+                zcpm::Disk disk(config);
+                BOOST_CHECK(read_file(disk, "OLD     DAT") == pattern(0x9000, 1));
+                create_file(disk, "NEW     DAT", contents);
+                const size_t entry_size = 0x4000 * (geometry.exm() + 1);
+                BOOST_CHECK_EQUAL(find_entries(disk, "NEW     DAT").size(),
+                                  (contents.size() + entry_size - 1) / entry_size);
+                BOOST_CHECK(read_file(disk, "NEW     DAT") == contents);
+                delete_file(disk, "OLD     DAT");
+                create_file(disk, "OLD     DAT", replacement);
+                BOOST_CHECK(read_file(disk, "OLD     DAT") == replacement);
+            }
+            BOOST_CHECK(directory.read("new.dat") == contents);
+            BOOST_CHECK(directory.read("old.dat") == replacement);
+        }
+    }
+}
+
+// Changes reach the host filesystem when the disk goes away, and before then as the flush options say
+BOOST_AUTO_TEST_CASE(test_flush_policies)
+{
+    const auto original = pattern(0x1000, 1);
+    const auto record = pattern(0x0080, 2);
+    auto changed = original;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        std::copy(record.begin(), record.end(), changed.begin() + i * 0x80);
+    }
+    const auto contents = pattern(0x2000, 3);
+
+    // Without any flush options
+    {
+        HostDirectory directory;
+        directory.write("foo.txt", original);
+        {
+            zcpm::Disk disk(directory.config());
+            create_file(disk, "NEW     DAT", contents);
+            for (size_t i = 0; i < 4; ++i)
+            {
+                write_record(disk, "FOO     TXT", i, record);
+            }
+            BOOST_CHECK(!directory.exists("new.dat"));
+            BOOST_CHECK(directory.read("foo.txt") == original);
+        }
+        BOOST_CHECK(directory.read("new.dat") == contents);
+        BOOST_CHECK(directory.read("foo.txt") == changed);
+    }
+
+    // When a file's directory entry is updated, with and without waiting for the data to reach the storage device
+    for (const auto sync : { false, true })
+    {
+        HostDirectory directory;
+        auto config = directory.config();
+        config.flush_on_close = true;
+        config.flush_sync = sync;
+        zcpm::Disk disk(config);
+        create_file(disk, "NEW     DAT", contents);
+        BOOST_CHECK(directory.read("new.dat") == contents);
+
+        // Replacing a file with a shorter one leaves the host file no longer than the new one
+        delete_file(disk, "NEW     DAT");
+        create_file(disk, "NEW     DAT", original);
+        BOOST_CHECK(directory.read("new.dat") == original);
+    }
+
+    // After a number of sector writes
+    {
+        HostDirectory directory;
+        directory.write("foo.txt", original);
+        auto config = directory.config();
+        config.flush_sectors = 4;
+        zcpm::Disk disk(config);
+        for (size_t i = 0; i < 3; ++i)
+        {
+            write_record(disk, "FOO     TXT", i, record);
+        }
+        BOOST_CHECK(directory.read("foo.txt") == original);
+        write_record(disk, "FOO     TXT", 3, record);
+        BOOST_CHECK(directory.read("foo.txt") == changed);
+    }
+
+    // Every so often, in the background
+    {
+        HostDirectory directory;
+        directory.write("foo.txt", original);
+        auto config = directory.config();
+        config.flush_interval_ms = 10;
+        zcpm::Disk disk(config);
+        for (size_t i = 0; i < 4; ++i)
+        {
+            write_record(disk, "FOO     TXT", i, record);
+        }
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((directory.read("foo.txt") != changed) && (std::chrono::steady_clock::now() < deadline))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        BOOST_CHECK(directory.read("foo.txt") == changed);
+        BOOST_CHECK(disk.get_statistics().flushes > 0);
+    }
+}
+
+// With a directory index, files which haven't changed since the last run stay where they were, whatever else has
+// changed; and however the files were placed, no two of them ever share a block
+BOOST_AUTO_TEST_CASE(test_directory_index)
+{
+    struct File
+    {
+        std::string host_name;
+        std::string cpm_name;
+        std::vector<uint8_t> contents;
+    };
+
+    // Each file which is on the disk (or all of them, if 'all') reads back as it should, with no block used twice
+    const auto check = [](const zcpm::Config& config, const std::vector<File>& files, bool all)
+    {
+        zcpm::Disk disk(config);
+        std::vector<uint16_t> used;
+        for (const auto& f : files)
+        {
+            BOOST_TEST_CONTEXT(f.host_name)
+            {
+                const auto blocks = file_blocks(disk, f.cpm_name);
+                BOOST_CHECK(!all || !blocks.empty());
+                if (!blocks.empty())
+                {
+                    BOOST_CHECK(read_file(disk, f.cpm_name) == f.contents);
+                }
+                used.insert(used.end(), blocks.begin(), blocks.end());
+            }
+        }
+        std::sort(used.begin(), used.end());
+        BOOST_CHECK(std::adjacent_find(used.begin(), used.end()) == used.end());
+    };
+    const auto blocks_of = [](const zcpm::Config& config, const std::string& name)
+    {
+        const zcpm::Disk disk(config);
+        return file_blocks(disk, name);
+    };
+
+    // An unchanged directory, then one with a file which has grown (so has to move, while the others stay where they
+    // were), and then one with a file deleted
+    {
+        HostDirectory directory;
+        auto config = directory.config();
+        config.directory_index = directory.path("zcpm.idx");
+        std::vector<File> files{ { "a.dat", "A       DAT", pattern(0x3000, 1) },
+                                 { "b.dat", "B       DAT", pattern(0x5000, 2) },
+                                 { "c.dat", "C       DAT", pattern(0x4000, 3) } };
+        for (const auto& f : files)
+        {
+            directory.write(f.host_name, f.contents);
+        }
+        check(config, files, true);
+        BOOST_CHECK(directory.exists("zcpm.idx"));
+        const auto a = blocks_of(config, "A       DAT");
+        const auto c = blocks_of(config, "C       DAT");
+        check(config, files, true);
+        BOOST_CHECK(blocks_of(config, "A       DAT") == a);
+
+        files[1].contents = pattern(0x9000, 4);
+        directory.write(files[1].host_name, files[1].contents);
+        check(config, files, true);
+        BOOST_CHECK(blocks_of(config, "A       DAT") == a);
+        BOOST_CHECK(blocks_of(config, "C       DAT") == c);
+
+        directory.remove("a.dat");
+        files.erase(files.begin());
+        check(config, files, true);
+        BOOST_CHECK(blocks_of(config, "C       DAT") == c);
+        BOOST_CHECK(blocks_of(config, "A       DAT").empty());
+    }
+
+    // A file which doesn't fit in the directory is left off the disk without being given any blocks, so that it doesn't
+    // end up sharing them with a later file once there is room for it. The files are placed in the order that they
+    // are listed in the index (as long as the directory hasn't changed since), so one is made which lists them in
+    // the order wanted, and is kept elsewhere so as not to change the directory.
+    {
+        HostDirectory directory;
+        HostDirectory elsewhere;
+        auto config = directory.config();
+        config.directory_index = elsewhere.path("zcpm.idx");
+        config.disk_geometry = { 0x20, 4, 0x100, 3, 0 }; // Only four directory entries, of 16K each
+        std::vector<File> files{ { "s1.dat", "S1      DAT", pattern(0x0800, 1) },
+                                 { "s2.dat", "S2      DAT", pattern(0x0800, 2) },
+                                 { "large.dat", "LARGE   DAT", pattern(0xC000, 3) }, // Three entries
+                                 { "s3.dat", "S3      DAT", pattern(0x0800, 4) } };
+        for (const auto& f : files)
+        {
+            directory.write(f.host_name, f.contents);
+        }
+        auto index = index_header(modification_time(directory.path("")), config.disk_geometry);
+        for (const auto& f : files)
+        {
+            index += fmt::format("0 0 0 {}\n", f.host_name);
+        }
+        elsewhere.write("zcpm.idx", { index.begin(), index.end() });
+        check(config, files, false);
+        BOOST_CHECK(blocks_of(config, "LARGE   DAT").empty());
+        BOOST_CHECK(!blocks_of(config, "S3      DAT").empty());
+
+        directory.remove("s1.dat");
+        directory.remove("s2.dat");
+        files.erase(files.begin(), files.begin() + 2);
+        check(config, files, true);
+    }
+
+    // An index which has two files in the same place (as one saved by an earlier version could) has one of them moved
+    {
+        HostDirectory directory;
+        auto config = directory.config();
+        config.directory_index = directory.path("zcpm.idx");
+        const std::vector<File> files{ { "a.dat", "A       DAT", pattern(0x1000, 1) },
+                                       { "b.dat", "B       DAT", pattern(0x1000, 2) } };
+        const auto& geometry = config.disk_geometry;
+        auto index = index_header(-1, geometry);
+        for (const auto& f : files)
+        {
+            directory.write(f.host_name, f.contents);
+            index += fmt::format("{:d} {:d} {:d} {}\n",
+                                 f.contents.size(),
+                                 modification_time(directory.path(f.host_name)),
+                                 geometry.directory_blocks(),
+                                 f.host_name);
+        }
+        directory.write("zcpm.idx", { index.begin(), index.end() });
+        check(config, files, true);
+    }
+}
+
+// Sequential and random reads and writes go to the sector that the FCB's extent, disk map and record number say, with
+// anything which needs another extent (or a block which hasn't been allocated) left to the BDOS. The DMA address,
+// current drive and write protection are those which the BDOS holds at the time.
+BOOST_AUTO_TEST_CASE(test_native_bdos_records)
+{
+    const uint8_t ReadSequential = 20;
+    const uint8_t WriteSequential = 21;
+    const uint8_t ReadRandom = 33;
+    const uint8_t WriteRandom = 34;
+
+    // 2K blocks and 8-bit block numbers, so each directory entry covers two 128-record extents (EXM=1)
+    {
+        HostDirectory directory;
+        const zcpm::DiskGeometry geometry{ 0x0020, 0x04, 0x00FF, 0x001F, 0x0001 };
+        BOOST_REQUIRE_EQUAL(geometry.exm(), 1);
+        NativeBdosFixture f(make_image(directory, geometry));
+
+        // Blocks 20..2F, except that the last one hasn't been allocated yet
+        std::vector<uint8_t> map;
+        for (uint8_t i = 0; i < 16; ++i)
+        {
+            map.push_back(static_cast<uint8_t>((i < 15) ? 0x20 + i : 0x00));
+        }
+
+        // Sequential reads of the first extent, with the DMA address changed part way
+        f.set_fcb(0, 0x80, map);
+        f.m_memory.write_byte(NativeBdosFixture::Fcb + 0x20, 0x11);
+        BOOST_CHECK(f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_ram(NativeBdosFixture::Dma, 0x80) == image_sector(0x20 + 0x21 * 0x10 + 0x01));
+        f.m_memory.write_word(NativeBdosFixture::UserDma, 0x3000);
+        BOOST_CHECK(f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_ram(0x3000, 0x80) == image_sector(0x20 + 0x21 * 0x10 + 0x02));
+        BOOST_CHECK_EQUAL(f.m_memory.read_byte(NativeBdosFixture::Fcb + 0x20), 0x13);
+        f.m_memory.write_word(NativeBdosFixture::UserDma, NativeBdosFixture::Dma);
+
+        // The end of the extent needs the next one, which the BDOS finds
+        f.m_memory.write_byte(NativeBdosFixture::Fcb + 0x20, 0x80);
+        BOOST_CHECK(!f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb));
+
+        // Record 5 of the second extent in the same entry is in the ninth block
+        f.set_fcb(1, 0x40, map);
+        f.m_memory.write_byte(NativeBdosFixture::Fcb + 0x20, 0x05);
+        BOOST_CHECK(f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_ram(NativeBdosFixture::Dma, 0x80) == image_sector(0x20 + 0x28 * 0x10 + 0x05));
+
+        // Reading beyond the record count is the end of the file
+        f.m_memory.write_byte(NativeBdosFixture::Fcb + 0x20, 0x40);
+        BOOST_CHECK(!f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb));
+
+        // Random records in the current extent set the current record, but don't advance it
+        f.set_random(0x00A3);
+        BOOST_CHECK(f.m_bdos.call(ReadRandom, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_ram(NativeBdosFixture::Dma, 0x80) == image_sector(0x20 + 0x2A * 0x10 + 0x03));
+        BOOST_CHECK_EQUAL(f.m_memory.read_byte(NativeBdosFixture::Fcb + 0x20), 0x23);
+
+        // ...while those in other extents, or beyond the 64K records of the 16 modules, are left to the BDOS
+        for (const auto record : { 0x0023, 0x0123, 0x40A3, 0x100A3 })
+        {
+            f.set_random(record);
+            BOOST_CHECK(!f.m_bdos.call(ReadRandom, NativeBdosFixture::Fcb));
+        }
+
+        // A random write beyond the record count extends it, and marks the FCB as changed
+        const std::vector<uint8_t> data(0x80, 0x5A);
+        f.m_memory.copy_to_ram(data.data(), data.size(), NativeBdosFixture::Dma);
+        f.m_memory.write_byte(NativeBdosFixture::Fcb + 0x0E, 0x80);
+        f.set_random(0x00E0);
+        BOOST_CHECK(f.m_bdos.call(WriteRandom, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_sector(0x20 + 0x2E * 0x10) == data);
+        BOOST_CHECK_EQUAL(f.m_memory.read_byte(NativeBdosFixture::Fcb + 0x0F), 0x61);
+        BOOST_CHECK_EQUAL(f.m_memory.read_byte(NativeBdosFixture::Fcb + 0x0E), 0x00);
+
+        // A block which hasn't been allocated is left to the BDOS
+        f.set_random(0x00F0);
+        BOOST_CHECK(!f.m_bdos.call(WriteRandom, NativeBdosFixture::Fcb));
+
+        // Writing the last record of an extent sequentially needs the next extent
+        f.set_fcb(0, 0x80, map);
+        f.m_memory.write_byte(NativeBdosFixture::Fcb + 0x20, 0x7E);
+        BOOST_CHECK(f.m_bdos.call(WriteSequential, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_sector(0x20 + 0x27 * 0x10 + 0x0E) == data);
+        BOOST_CHECK(!f.m_bdos.call(WriteSequential, NativeBdosFixture::Fcb));
+
+        // Nothing is written while drive A is write protected
+        f.m_memory.write_byte(NativeBdosFixture::WrtPrt, 0x01);
+        f.m_memory.write_byte(NativeBdosFixture::Fcb + 0x20, 0x00);
+        BOOST_CHECK(!f.m_bdos.call(WriteSequential, NativeBdosFixture::Fcb));
+        f.m_memory.write_byte(NativeBdosFixture::WrtPrt, 0x00);
+
+        // Nor is anything read or written on another drive, whether selected or named by the FCB
+        f.m_memory.write_byte(NativeBdosFixture::Active, 0x01);
+        BOOST_CHECK(!f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb));
+        f.m_memory.write_byte(NativeBdosFixture::Fcb, 0x01);
+        BOOST_CHECK(f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb) == 0);
+        f.m_memory.write_byte(NativeBdosFixture::Active, 0x00);
+        f.m_memory.write_byte(NativeBdosFixture::Fcb, 0x02);
+        BOOST_CHECK(!f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb));
+    }
+
+    // 2K blocks and 16-bit block numbers, so each directory entry covers one extent (EXM=0)
+    {
+        HostDirectory directory;
+        const zcpm::DiskGeometry geometry{ 0x0020, 0x04, 0x01FF, 0x001F, 0x0001 };
+        BOOST_REQUIRE_EQUAL(geometry.exm(), 0);
+        NativeBdosFixture f(make_image(directory, geometry));
+
+        // Blocks 120..127
+        std::vector<uint8_t> map;
+        for (uint8_t i = 0; i < 8; ++i)
+        {
+            map.push_back(static_cast<uint8_t>(0x20 + i));
+            map.push_back(0x01);
+        }
+
+        f.set_fcb(3, 0x80, map);
+        f.set_random(0x01C5);
+        BOOST_CHECK(f.m_bdos.call(ReadRandom, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_ram(NativeBdosFixture::Dma, 0x80) == image_sector(0x20 + 0x124 * 0x10 + 0x05));
+        BOOST_CHECK(f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.m_bdos.call(ReadSequential, NativeBdosFixture::Fcb) == 0);
+        BOOST_CHECK(f.read_ram(NativeBdosFixture::Dma, 0x80) == image_sector(0x20 + 0x124 * 0x10 + 0x06));
+        BOOST_CHECK_EQUAL(f.m_memory.read_byte(NativeBdosFixture::Fcb + 0x20), 0x47);
+    }
+}
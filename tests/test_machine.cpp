@@ -0,0 +1,421 @@
+#include <zcpm/builder/builder.hpp>
+#include <zcpm/core/hardware.hpp>
+#include <zcpm/core/log.hpp>
+#include <zcpm/core/processor.hpp>
+#include <zcpm/core/snapshot.hpp>
+#include <zcpm/core/system.hpp>
+#include <zcpm/terminal/batch.hpp>
+
+#include <boost/test/unit_test.hpp>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+// This module tests whole machines, running programs which are assembled here through the built in BDOS, and checking
+// what they output.
+
+namespace
+{
+
+    namespace fs = std::filesystem;
+
+    // A CP/M program which makes a series of BDOS calls and then ends, with any strings that it needs after the code
+    class Program final
+    {
+    public:
+        // Call the BDOS with the specified function and parameter
+        void bdos(uint8_t function, uint16_t de)
+        {
+            m_code.insert(m_code.end(), { 0x0E, function });                                               // LD C,fn
+            m_code.insert(m_code.end(), { 0x11, static_cast<uint8_t>(de), static_cast<uint8_t>(de >> 8) }); // LD DE,de
+            m_code.insert(m_code.end(), { 0xCD, 0x05, 0x00 });                                             // CALL 0005
+        }
+
+        // Append code of the caller's own
+        void code(const std::vector<uint8_t>& bytes)
+        {
+            m_code.insert(m_code.end(), bytes.begin(), bytes.end());
+        }
+
+        // Where the next code will go
+        [[nodiscard]] uint16_t address() const
+        {
+            return static_cast<uint16_t>(0x0100 + m_code.size());
+        }
+
+        // Output a '$'-terminated string with BDOS function 9
+        void print(std::string_view text)
+        {
+            bdos(9, static_cast<uint16_t>(DataBase + m_data.size()));
+            m_data.insert(m_data.end(), text.begin(), text.end());
+            m_data.push_back('$');
+        }
+
+        // Output each character in turn with BDOS function 2
+        void output(std::string_view text)
+        {
+            for (const auto ch : text)
+            {
+                bdos(2, static_cast<uint8_t>(ch));
+            }
+        }
+
+        // The whole program, which finishes with a warm boot
+        [[nodiscard]] std::vector<uint8_t> bytes() const
+        {
+            auto result = m_code;
+            result.insert(result.end(), { 0xC3, 0x00, 0x00 }); // JP 0000
+            BOOST_REQUIRE(0x0100 + result.size() <= DataBase);
+            result.resize(DataBase - 0x0100, 0x00);
+            result.insert(result.end(), m_data.begin(), m_data.end());
+            return result;
+        }
+
+    private:
+        inline static const uint16_t DataBase{ 0x4000 };
+
+        std::vector<uint8_t> m_code;
+        std::vector<uint8_t> m_data;
+    };
+
+    // A machine booted in a directory of its own (which is removed afterwards), with the batch terminal reading
+    // keystrokes from one file there and writing output to another
+    class Machine final
+    {
+    public:
+        Machine(const zcpm::Config& config, const Program& program, std::string_view input = "")
+            : m_path(fs::temp_directory_path() / fmt::format("zcpm-test-{:d}-{:d}", ::getpid(), ++m_count))
+        {
+            zcpm::log::set_level(zcpm::log::Level::none);
+
+            fs::remove_all(m_path);
+            fs::create_directory(m_path);
+            write("test.com", program.bytes());
+            write("input.txt", { input.begin(), input.end() });
+
+            zcpm::MachineOptions options;
+            options.config = config;
+            options.config.disk_root = m_path.string();
+            m_pmachine = zcpm::boot_machine(
+                options,
+                std::make_unique<zcpm::terminal::Batch>(
+                    options.rows, options.columns, (m_path / "input.txt").string(), (m_path / "output.txt").string()));
+            BOOST_REQUIRE(m_pmachine);
+            BOOST_REQUIRE(zcpm::load_program(*m_pmachine, (m_path / "test.com").string(), {}));
+        }
+
+        Machine(const Machine&) = delete;
+        Machine& operator=(const Machine&) = delete;
+        Machine(Machine&&) = delete;
+        Machine& operator=(Machine&&) = delete;
+
+        ~Machine()
+        {
+            m_pmachine.reset();
+            std::error_code ec;
+            fs::remove_all(m_path, ec);
+        }
+
+        // Run the program to the end, and return everything that it output
+        std::string run()
+        {
+            m_pmachine->run();
+
+            // The terminal's output is only complete once it's gone
+            m_curpos = read_variable("CURPOS");
+            m_pmachine.reset();
+            std::ifstream in(m_path / "output.txt", std::ios::binary);
+            return { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+        }
+
+        [[nodiscard]] zcpm::System& system()
+        {
+            return *m_pmachine;
+        }
+
+        // The BDOS' cursor column when the program ended
+        [[nodiscard]] uint8_t curpos() const
+        {
+            return m_curpos;
+        }
+
+    private:
+        void write(const std::string& name, const std::vector<uint8_t>& contents) const
+        {
+            std::ofstream out(m_path / name, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+        }
+
+        [[nodiscard]] uint8_t read_variable(std::string_view name) const
+        {
+            const auto [ok, address] = m_pmachine->m_hardware.evaluate_address_expression(name);
+            BOOST_REQUIRE(ok);
+            return m_pmachine->m_hardware.read_byte(address);
+        }
+
+        inline static int m_count{ 0 };
+        const fs::path m_path;
+        std::unique_ptr<zcpm::System> m_pmachine;
+        uint8_t m_curpos{ 0 };
+    };
+
+} // namespace
+
+// Console output which is handled natively must look the same as when the BDOS outputs each character via the BIOS:
+// tabs expand to the same tab stops, and the cursor column (which the BDOS relies on for line editing) ends up the same
+BOOST_AUTO_TEST_CASE(test_native_console)
+{
+    Program program;
+    program.print("ab\tc\td\t\t|\r\n");                   // Tabs from various columns
+    program.output("xyz\tw\r\n");                         // ...and one at a time
+    program.print("abc\b\b\tX\b\b\b\b\b\b\b\b\b\b\tY\n"); // Backspaces, including at the start of the line
+    program.print("\tZ\nQ\r\t|");                         // A line feed goes back to column 0, but a CR doesn't
+    program.output("\x7F\x07\x01\t|\n");                  // Nor do other control characters, or a rubout
+    program.print("\x80\xFF\t|\n");                       // Characters with the top bit set take a column
+    program.print(std::string(300, '.'));                 // The column wraps around after 255
+    program.output("\t|");
+
+    const auto config = zcpm::MachineOptions().config;
+    auto native_config = config;
+    native_config.native_console = true;
+
+    Machine bdos(config, program);
+    Machine native(native_config, program);
+    const auto expected = bdos.run();
+    BOOST_CHECK_EQUAL(native.run(), expected);
+    BOOST_CHECK_EQUAL(native.curpos(), bdos.curpos());
+
+    // And the BDOS does what it's expected to
+    BOOST_CHECK(expected.starts_with("ab      c       d               |\r\nxyz     w\r\n"));
+    BOOST_CHECK_EQUAL(bdos.curpos(), 300 % 256 + 4 + 1);
+}
+
+// A binary is loaded directly into RAM, as long as it fits below the BDOS
+BOOST_AUTO_TEST_CASE(test_load_area)
+{
+    const zcpm::MachineOptions options;
+    Machine machine(options.config, Program());
+    auto& hardware = machine.system().m_hardware;
+
+    const size_t tpa = options.fbase - 0x0100;
+    BOOST_CHECK_EQUAL(hardware.load_area(0x0100, tpa).size(), tpa);
+    BOOST_CHECK(hardware.load_area(0x0100, tpa + 1).empty());
+    BOOST_CHECK(hardware.load_area(0x0100, 0).empty());
+    BOOST_CHECK(hardware.load_area(options.fbase - 1, 2).empty());
+    BOOST_CHECK(hardware.load_area(options.fbase, 1).empty());
+    BOOST_CHECK(hardware.load_area(0xFF00, 0x10).empty());
+
+    // Before the BDOS is set up, all of memory is available
+    zcpm::Hardware fresh(std::make_unique<zcpm::terminal::Batch>(24, 80, "/dev/null", "/dev/null"), options.config);
+    BOOST_CHECK_EQUAL(fresh.load_area(0xFF00, 0x100).size(), 0x100);
+    BOOST_CHECK(fresh.load_area(0xFF00, 0x101).empty());
+}
+
+// Checking for a keystroke now and then while doing some real work isn't being idle, so once the batch terminal's input
+// is used up, the run goes on; that must also be so in fast mode, where no cycles are counted. But polling over and
+// over again is being idle, which ends the run (where cycles are counted, so that this can be told apart).
+BOOST_AUTO_TEST_CASE(test_idle_polls)
+{
+    const auto low = [](uint16_t address) { return static_cast<uint8_t>(address); };
+    const auto high = [](uint16_t address) { return static_cast<uint8_t>(address >> 8); };
+
+    // 200 polls (twice the default number before being idle), each followed by a loop of about 26000 cycles
+    Program working;
+    working.code({ 0x16, 200 }); // LD D,200
+    const auto loop = working.address();
+    working.code({ 0xD5 }); // PUSH DE
+    working.bdos(11, 0);
+    working.code({ 0x01, 0x3B, 0x04 }); // LD BC,043B
+    const auto work = working.address();
+    working.code({ 0x0B, 0x78, 0xB1, 0xC2, low(work), high(work) }); // DEC BC; LD A,B; OR C; JP NZ,work
+    working.code({ 0xD1, 0x15, 0xC2, low(loop), high(loop) });       // POP DE; DEC D; JP NZ,loop
+    working.print("DONE");
+
+    // The same polls, one straight after another
+    Program polling;
+    polling.code({ 0x16, 200 }); // LD D,200
+    const auto poll = polling.address();
+    polling.code({ 0xD5 }); // PUSH DE
+    polling.bdos(11, 0);
+    polling.code({ 0xD1, 0x15, 0xC2, low(poll), high(poll) }); // POP DE; DEC D; JP NZ,poll
+    polling.print("DONE");
+
+    for (const auto fast : { false, true })
+    {
+        BOOST_TEST_CONTEXT("fast=" << fast)
+        {
+            auto config = zcpm::MachineOptions().config;
+            config.fast = fast;
+            Machine machine(config, working);
+            BOOST_CHECK_EQUAL(machine.run(), "DONE");
+        }
+    }
+
+    Machine machine(zcpm::MachineOptions().config, polling);
+    BOOST_CHECK_EQUAL(machine.run(), "");
+}
+
+// Going back to a checkpoint and replaying from there (as reverse stepping does) must have timer interrupts arrive at
+// the same points as in the run that is being replayed: between the same instructions, partway through the same block
+// moves, not until after the instruction which follows an EI, and as soon as a HALT is reached
+BOOST_AUTO_TEST_CASE(test_replay_events)
+{
+    const auto low = [](uint16_t address) { return static_cast<uint8_t>(address); };
+    const auto high = [](uint16_t address) { return static_cast<uint8_t>(address >> 8); };
+
+    // An interrupt handler which counts the interrupts at 3000H
+    const std::vector<uint8_t> handler{
+        0xE5, 0x2A, 0x00, 0x30, 0x23, 0x22, 0x00, 0x30, 0xE1, 0xFB, 0xC9 // PUSH HL; LD HL,(3000); INC HL; ... EI; RET
+    };
+    const auto size = static_cast<uint8_t>(handler.size());
+
+    Program program;
+    program.code({ 0x18, size }); // JR over the handler
+    const auto source = program.address();
+    program.code(handler);
+    program.code({ 0x21, low(source), high(source), 0x11, 0x38, 0x00, 0x01, size, 0x00, 0xED, 0xB0 }); // To RST 38H
+    program.code({ 0xED, 0x56, 0xFB, 0x3E, 20 }); // IM 1; EI; LD A,20
+    const auto loop = program.address();
+    program.code({ 0x21, 0x00, 0x10, 0x11, 0x00, 0x20, 0x01, 0x00, 0x01, 0xED, 0xB0 }); // LDIR of 100H bytes
+    program.code({ 0x76 });                                                             // HALT
+    program.code({ 0xF3, 0x06, 0x60, 0x10, 0xFE, 0xFB });                               // DI; LD B,60; DJNZ $; EI
+    program.code({ 0x3D, 0xC2, low(loop), high(loop) });                                // DEC A; JP NZ,loop
+
+    auto config = zcpm::MachineOptions().config;
+    config.timer_hz = 4000;         // Every 1000 cycles, at the default clock rate
+    const uint64_t interval = 2999; // Checkpoints come between the timer's ticks
+    const size_t limit = 1000;
+
+    // Where each step of the run leaves the machine
+    struct Point
+    {
+        uint64_t cycles;
+        uint16_t pc;
+        uint16_t count;
+    };
+    const auto point = [](const zcpm::Hardware& hardware)
+    {
+        const auto& processor = *hardware.m_processor;
+        return Point{ processor.get_cycle_count(), processor.get_pc(), hardware.read_word(0x3000) };
+    };
+
+    // Going through the whole run one instruction at a time
+    Machine stepped(config, program);
+    auto& stepped_hardware = stepped.system().m_hardware;
+    stepped_hardware.enable_checkpoints(interval, limit);
+    stepped_hardware.set_finished(false);
+    std::vector<Point> points{ point(stepped_hardware) };
+    while (stepped_hardware.running())
+    {
+        stepped_hardware.step();
+        points.push_back(point(stepped_hardware));
+    }
+
+    // ...ends up just as the run does
+    Machine ran(config, program);
+    auto& system = ran.system();
+    system.m_hardware.enable_checkpoints(interval, limit);
+    system.run();
+    const auto end = point(system.m_hardware);
+    BOOST_CHECK_GT(end.count, 100);
+    BOOST_CHECK_EQUAL(end.cycles, points.back().cycles);
+    BOOST_CHECK_EQUAL(end.count, points.back().count);
+
+    auto expected = std::find_if(
+        points.begin(), points.end(), [&end](const Point& candidate) { return candidate.cycles == end.cycles; });
+    BOOST_REQUIRE(expected != points.end());
+    for (const size_t count : { 1, 10, 500 })
+    {
+        BOOST_TEST_CONTEXT("count=" << count)
+        {
+            BOOST_REQUIRE(system.reverse_step(count));
+            BOOST_REQUIRE(expected - points.begin() >= static_cast<std::ptrdiff_t>(count));
+            expected -= static_cast<std::ptrdiff_t>(count);
+            const auto actual = point(system.m_hardware);
+            BOOST_CHECK_EQUAL(actual.cycles, expected->cycles);
+            BOOST_CHECK_EQUAL(actual.pc, expected->pc);
+            BOOST_CHECK_EQUAL(actual.count, expected->count);
+        }
+    }
+    BOOST_CHECK_GT(system.m_hardware.checkpoint_count(), 1);
+}
+
+// A snapshot of a machine which has booted and started a program, once saved and loaded again, brings a machine which
+// has only just been made to the same state; and a file which isn't a snapshot from this build is rejected
+BOOST_AUTO_TEST_CASE(test_snapshot)
+{
+    Program program;
+    program.code({ 0x01, 0x34, 0x12, 0x11, 0x78, 0x56, 0x21, 0xBC, 0x9A }); // LD BC,1234; LD DE,5678; LD HL,9ABC
+    program.code({ 0xD9, 0x22, 0x00, 0x30, 0x3E, 0x5A, 0xED, 0x47 });       // EXX; LD (3000),HL; LD A,5A; LD I,A
+
+    const auto config = zcpm::MachineOptions().config;
+    Machine machine(config, program);
+    auto& hardware = machine.system().m_hardware;
+    hardware.set_finished(false);
+    for (size_t i = 0; i < 7; ++i)
+    {
+        hardware.step();
+    }
+    const auto original = hardware.save_snapshot();
+    BOOST_REQUIRE_EQUAL(original.processor.pc, 0x0111);
+
+    const auto path = (fs::temp_directory_path() / fmt::format("zcpm-test-{:d}.snapshot", ::getpid())).string();
+    original.save(path);
+    std::string content;
+    {
+        std::ifstream in(path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    zcpm::Hardware fresh(std::make_unique<zcpm::terminal::Batch>(24, 80, "/dev/null", "/dev/null"), config);
+    fresh.restore_snapshot(zcpm::Snapshot::load(path));
+    const auto restored = fresh.save_snapshot();
+    BOOST_CHECK(restored.processor.registers == original.processor.registers);
+    BOOST_CHECK(restored.processor.alternates == original.processor.alternates);
+    BOOST_CHECK_EQUAL(restored.processor.i, 0x5A);
+    BOOST_CHECK_EQUAL(restored.processor.r, original.processor.r);
+    BOOST_CHECK_EQUAL(restored.processor.pc, original.processor.pc);
+    BOOST_CHECK_EQUAL(restored.processor.iff1, original.processor.iff1);
+    BOOST_CHECK_EQUAL(restored.processor.im, original.processor.im);
+    BOOST_CHECK_EQUAL(restored.processor.cycle_count, original.processor.cycle_count);
+    BOOST_CHECK_EQUAL(restored.bios.dma, original.bios.dma);
+    BOOST_CHECK_EQUAL(restored.fbase, original.fbase);
+    BOOST_CHECK(restored.memory == original.memory);
+    BOOST_CHECK_EQUAL(fresh.read_word(0x3000), 0x0000); // HL was swapped out by the EXX
+    BOOST_CHECK(fresh.evaluate_address_expression("CURPOS") == hardware.evaluate_address_expression("CURPOS"));
+
+    // Changing any of these header fields makes the file one which this build can't read: the magic number, the
+    // version, and the sizes of the header, processor state and BIOS state
+    const auto rejected = [&path](const std::string& altered)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << altered;
+        BOOST_CHECK_THROW(zcpm::Snapshot::load(path), std::runtime_error);
+    };
+    for (const size_t offset : { 0, 8, 12, 16, 20 })
+    {
+        BOOST_TEST_CONTEXT("offset=" << offset)
+        {
+            auto altered = content;
+            altered[offset] ^= 0x01;
+            rejected(altered);
+        }
+    }
+    rejected(content.substr(0, 20));                 // Truncated in the header
+    rejected(content.substr(0, content.size() - 1)); // ...or in the symbols
+    rejected(content + '\0');
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << content;
+    BOOST_CHECK(zcpm::Snapshot::load(path).memory == original.memory);
+    fs::remove(path);
+}
@@ -1,9 +1,31 @@
 // #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MAIN // in only one cpp file
+#include <zcpm/builder/builder.hpp>
+#include <zcpm/core/calllatency.hpp>
+#include <zcpm/core/calltrace.hpp>
+#include <zcpm/core/checkpoints.hpp>
+#include <zcpm/core/debugaction.hpp>
+#include <zcpm/core/diskgeometry.hpp>
+#include <zcpm/core/eventscheduler.hpp>
+#include <zcpm/core/hardware.hpp>
 #include <zcpm/core/processor.hpp>
+#include <zcpm/core/registers.hpp>
+#include <zcpm/core/symboltable.hpp>
+#include <zcpm/core/tracerecorder.hpp>
+#include <zcpm/core/watchmap.hpp>
+#include <zcpm/terminal/batch.hpp>
 
+#include <boost/program_options/errors.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
 // This module tests some CPU/register functionality. Note that it's not practical to test all combinations, this
 // test code aims to cover a useful sample to test for breakage. If a *full* test is needed, execute the 'zexall.com'
 // binary via the 'runner' tool, and be patient...
@@ -60,6 +82,7 @@ namespace
         void write_byte(uint16_t address, uint8_t x) override
         {
             m_memory[address] = x;
+            m_processor->invalidate_code(address);
         }
 
         void write_byte(uint16_t address, uint8_t x, size_t& elapsed_cycles) override
@@ -72,6 +95,8 @@ namespace
         {
             m_memory[address] = x;
             m_memory[(address + 1) & 0xffff] = x >> 8;
+            m_processor->invalidate_code(address);
+            m_processor->invalidate_code((address + 1) & 0xffff);
         }
 
         void write_word(uint16_t address, uint16_t x, size_t& elapsed_cycles) override
@@ -132,6 +157,7 @@ namespace
 
             // TODO: This is exceedingly ugly, find a cleaner (but efficient!) solution
             std::memcpy(m_memory.data() + base, buffer, count);
+            m_processor->invalidate_code(base, count);
         }
 
         void copy_from_ram(uint8_t* buffer, size_t count, uint16_t base) const override
@@ -148,6 +174,25 @@ namespace
             std::memcpy(buffer, m_memory.data() + base, count);
         }
 
+        std::span<const uint8_t> ram_view(uint16_t base, size_t count) const override
+        {
+            if (base + count > m_memory.size())
+            {
+                return {};
+            }
+            return { m_memory.data() + base, count };
+        }
+
+        std::span<uint8_t> writable_ram_view(uint16_t base, size_t count) override
+        {
+            if (base + count > m_memory.size())
+            {
+                return {};
+            }
+            m_processor->invalidate_code(base, count);
+            return { m_memory.data() + base, count };
+        }
+
         void dump(uint16_t base, size_t count) const override
         {
             // TODO
@@ -158,24 +203,38 @@ namespace
             // TODO
         }
 
-        // Implements IProcessorObserver
+        void add_watchpoint(uint16_t address) override
+        {
+            // TODO
+        }
 
-        void set_finished(bool) override
+        void remove_watchpoint(uint16_t address) override
         {
+            // TODO
         }
 
-        [[nodiscard]] bool running() const override
+        // Implements IProcessorObserver
+
+        void set_finished(bool) override
         {
-            return true;
         }
 
         bool check_and_handle_bdos_and_bios(uint16_t address) const override
         {
+            // Behave like a native implementation of a subroutine at the selected address, which returns 42 in A
+            if (m_return_from && (address == m_return_from))
+            {
+                m_processor->reg_a() = 0x42;
+                m_processor->return_from_trap();
+                return true;
+            }
             return false; // TODO
         }
 
         std::unique_ptr<zcpm::Processor> m_processor;
 
+        uint16_t m_return_from{ 0 };
+
         std::array<uint8_t, 0x10000> m_memory{};
     };
 
@@ -337,3 +396,839 @@ BOOST_AUTO_TEST_CASE(test_branching)
 
     // TODO: load RAM with a slightly longer sequence involving branching, execute it, etc.
 }
+
+BOOST_AUTO_TEST_CASE(test_index_registers)
+{
+    const std::vector<uint8_t> program = {
+        0xDD, 0x21, 0x34, 0x12, // 0100 LD IX,1234
+        0xDD, 0x26, 0x56,       // 0104 LD IXH,56
+        0xFD, 0x2E, 0x78,       // 0107 LD IYL,78
+        0xDD, 0x7D,             // 010A LD A,IXL
+        0xDD, 0x66, 0x02,       // 010C LD H,(IX+2)
+        0xFD, 0xE5,             // 010F PUSH IY
+        0xC1,                   // 0111 POP BC
+    };
+
+    Hardware hardware;
+    hardware.m_memory[0x5636] = 0x9A;
+    hardware.m_processor->reg_sp() = 0x8000;
+    hardware.load_memory_and_set_pc(0x0100, program);
+    for (int i = 0; i < 7; ++i)
+    {
+        hardware.m_processor->emulate_instruction();
+    }
+
+    const auto registers = hardware.m_processor->get_registers();
+    BOOST_CHECK_EQUAL(registers.IX, 0x5634);
+    BOOST_CHECK_EQUAL(registers.IY & 0xFF, 0x78);
+    BOOST_CHECK_EQUAL(registers.BC, registers.IY);
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_a(), 0x34);
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_h(), 0x9A); // (IX+d) forms use H and L rather than IXH and IXL
+}
+
+// Run the same code with and without the block cache, and make sure that the results are identical
+BOOST_AUTO_TEST_CASE(test_block_cache)
+{
+    // clang-format off
+    const std::vector<uint8_t> program = {
+        0x31, 0x00, 0xF0,       // 0100 LD SP,F000
+        0xDD, 0x21, 0x00, 0x20, // 0103 LD IX,2000
+        0x06, 0x10,             // 0107 LD B,10
+        0xAF,                   // 0109 XOR A
+        0xDD, 0x86, 0x00,       // 010A ADD A,(IX+0)
+        0xDD, 0x23,             // 010D INC IX
+        0xCD, 0x20, 0x01,       // 010F CALL 0120
+        0x10, 0xF6,             // 0112 DJNZ 010A
+        0x32, 0x00, 0x30,       // 0114 LD (3000),A
+        0xC3, 0x30, 0x01,       // 0117 JP 0130
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xCB, 0x27,             // 0120 SLA A
+        0xDD, 0xCB, 0x00, 0x06, // 0122 RLC (IX+0)
+        0xC9,                   // 0126 RET
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x06, 0x05,             // 0130 LD B,5
+        0x3E, 0x00,             // 0132 LD A,00 (the operand is modified by the following code)
+        0x3C,                   // 0134 INC A
+        0x32, 0x33, 0x01,       // 0135 LD (0133),A
+        0x10, 0xF8,             // 0138 DJNZ 0132
+        0xC3, 0x08, 0x00,       // 013A JP 0008
+    };
+    // clang-format on
+
+    Hardware interpreted;
+    Hardware cached;
+    cached.m_processor->set_engine(zcpm::Engine::BLOCK_CACHE);
+
+    size_t cycles[2];
+    size_t i = 0;
+    for (auto hardware : { &interpreted, &cached })
+    {
+        for (uint8_t n = 0; n < 0x10; ++n)
+        {
+            hardware->m_memory[0x2000 + n] = n * 0x11 + 3;
+        }
+        hardware->load_memory_and_set_pc(0x0100, program);
+        cycles[i++] = hardware->m_processor->emulate();
+        BOOST_CHECK_EQUAL(hardware->m_processor->reg_pc(), 0x0009);
+        BOOST_CHECK_EQUAL(hardware->m_processor->reg_a(), 0x05); // Only correct if the modified operand was seen
+    }
+
+    BOOST_CHECK_EQUAL(cycles[0], cycles[1]);
+    const auto r1 = interpreted.m_processor->get_registers();
+    const auto r2 = cached.m_processor->get_registers();
+    BOOST_CHECK_EQUAL(r1.AF, r2.AF);
+    BOOST_CHECK_EQUAL(r1.BC, r2.BC);
+    BOOST_CHECK_EQUAL(r1.DE, r2.DE);
+    BOOST_CHECK_EQUAL(r1.HL, r2.HL);
+    BOOST_CHECK_EQUAL(r1.IX, r2.IX);
+    BOOST_CHECK_EQUAL(r1.SP, r2.SP);
+    BOOST_CHECK(interpreted.m_memory == cached.m_memory);
+}
+
+// Run each block instruction on the real hardware, where a whole repeat is done at once where possible, and on the
+// mock, where each repetition is executed in turn, and make sure that the results are identical
+BOOST_AUTO_TEST_CASE(test_block_instructions)
+{
+    struct Case
+    {
+        const char* name;
+        std::vector<uint8_t> program; // At 0100, followed by a breakpoint
+        std::vector<uint8_t> data;    // At 2000
+    };
+
+    // clang-format off
+    const std::vector<Case> cases = {
+        { "LDIR fill",
+          { 0x21, 0x00, 0x20, 0x11, 0x01, 0x20, 0x01, 0x00, 0x01, 0xED, 0xB0 }, // HL=2000 DE=2001 BC=0100 LDIR
+          { 0xAA } },
+        { "LDIR pattern",
+          { 0x21, 0x00, 0x20, 0x11, 0x03, 0x20, 0x01, 0x40, 0x00, 0xED, 0xB0 }, // HL=2000 DE=2003 BC=0040 LDIR
+          { 0x01, 0x02, 0x03 } },
+        { "LDIR all of memory",
+          { 0x21, 0x00, 0x00, 0x11, 0x00, 0x00, 0x01, 0x00, 0x00, 0xED, 0xB0 }, // HL=0000 DE=0000 BC=0000 LDIR
+          { 0x12, 0x34 } },
+        { "LDDR",
+          { 0x21, 0x07, 0x20, 0x11, 0x07, 0x30, 0x01, 0x08, 0x00, 0xED, 0xB8 }, // HL=2007 DE=3007 BC=0008 LDDR
+          { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80 } },
+        { "LDDR overlapping",
+          { 0x21, 0x07, 0x20, 0x11, 0x05, 0x20, 0x01, 0x08, 0x00, 0xED, 0xB8 }, // HL=2007 DE=2005 BC=0008 LDDR
+          { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80 } },
+        { "CPIR match",
+          { 0x21, 0x00, 0x20, 0x01, 0x00, 0x01, 0x3E, 0x55, 0xED, 0xB1 },       // HL=2000 BC=0100 A=55 CPIR
+          { 0x01, 0x02, 0x03, 0x04, 0x55, 0x06 } },
+        { "CPIR no match",
+          { 0x21, 0x00, 0x20, 0x01, 0x10, 0x00, 0x3E, 0x77, 0xED, 0xB1 },       // HL=2000 BC=0010 A=77 CPIR
+          { 0x01, 0x02, 0x03, 0x04, 0x55, 0x06 } },
+        { "CPIR wrapping BC",
+          { 0x21, 0x00, 0x00, 0x01, 0x00, 0x00, 0x3E, 0x99, 0xED, 0xB1 },       // HL=0000 BC=0000 A=99 CPIR
+          { 0x01, 0x02 } },
+        { "CPDR match",
+          { 0x21, 0x05, 0x20, 0x01, 0x06, 0x00, 0x3E, 0x02, 0xED, 0xB9 },       // HL=2005 BC=0006 A=02 CPDR
+          { 0x01, 0x02, 0x03, 0x04, 0x55, 0x06 } },
+        { "CPDR no match",
+          { 0x21, 0x05, 0x20, 0x01, 0x06, 0x00, 0x3E, 0x77, 0xED, 0xB9 },       // HL=2005 BC=0006 A=77 CPDR
+          { 0x01, 0x02, 0x03, 0x04, 0x55, 0x06 } },
+    };
+    // clang-format on
+
+    // Memory checks would stop the whole of memory from being accessed at once
+    auto config = zcpm::MachineOptions().config;
+    config.memcheck = false;
+
+    for (const auto& c : cases)
+    {
+        BOOST_TEST_CONTEXT(c.name)
+        {
+            Hardware mock;
+            zcpm::Hardware real(std::make_unique<zcpm::terminal::Batch>(24, 80, "/dev/null", "/dev/null"), config);
+            const auto end = static_cast<uint16_t>(0x0100 + c.program.size());
+
+            mock.copy_to_ram(c.data.data(), c.data.size(), 0x2000);
+            mock.load_memory_and_set_pc(0x0100, c.program);
+            mock.m_processor->add_action(zcpm::DebugAction::create(zcpm::DebugAction::Type::BREAKPOINT, end, ""));
+            real.copy_to_ram(c.data.data(), c.data.size(), 0x2000);
+            real.copy_to_ram(c.program.data(), c.program.size(), 0x0100);
+            real.m_processor->reg_pc() = 0x0100;
+            real.m_processor->add_action(zcpm::DebugAction::create(zcpm::DebugAction::Type::BREAKPOINT, end, ""));
+
+            BOOST_CHECK_EQUAL(mock.m_processor->emulate(), real.m_processor->emulate());
+
+            const auto expected = mock.m_processor->get_registers();
+            const auto actual = real.m_processor->get_registers();
+            BOOST_CHECK_EQUAL(expected.AF, actual.AF);
+            BOOST_CHECK_EQUAL(expected.BC, actual.BC);
+            BOOST_CHECK_EQUAL(expected.DE, actual.DE);
+            BOOST_CHECK_EQUAL(expected.HL, actual.HL);
+            BOOST_CHECK_EQUAL(expected.PC, actual.PC);
+
+            std::vector<uint8_t> memory(0x10000);
+            real.copy_from_ram(memory.data(), memory.size(), 0x0000);
+            BOOST_CHECK(std::equal(memory.begin(), memory.end(), mock.m_memory.begin()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_return_from_trap)
+{
+    // clang-format off
+    const std::vector<uint8_t> program = {
+        0x31, 0x00, 0xF0,       // 0100 LD SP,F000
+        0x06, 0x28,             // 0103 LD B,28
+        0xCD, 0x20, 0x01,       // 0105 CALL 0120
+        0x10, 0xFB,             // 0108 DJNZ 0105
+        0x32, 0x00, 0x30,       // 010A LD (3000),A
+        0xC3, 0x08, 0x00,       // 010D JP 0008
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xDD, 0x21, 0x00, 0x20, // 0120 LD IX,2000 (a prefixed instruction, which the trap replaces)
+        0x3E, 0x11,             // 0124 LD A,11
+        0xC9,                   // 0126 RET
+    };
+    // clang-format on
+
+    for (const auto engine : { zcpm::Engine::INTERPRETER, zcpm::Engine::BLOCK_CACHE, zcpm::Engine::TRANSLATE })
+    {
+        Hardware hardware;
+        hardware.m_processor->set_engine(engine);
+        hardware.m_processor->add_trap(0x0120);
+        hardware.m_return_from = 0x0120;
+        hardware.load_memory_and_set_pc(0x0100, program);
+        hardware.m_processor->emulate();
+        BOOST_CHECK_EQUAL(hardware.m_processor->reg_pc(), 0x0009);
+        BOOST_CHECK_EQUAL(hardware.m_processor->reg_a(), 0x42);
+        BOOST_CHECK_EQUAL(hardware.m_processor->get_registers().IX, 0x0000);
+        BOOST_CHECK_EQUAL(hardware.m_processor->reg_sp(), 0xF000);
+        BOOST_CHECK_EQUAL(hardware.m_memory[0x3000], 0x42);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_translation)
+{
+    // clang-format off
+    const std::vector<uint8_t> program = {
+        0x31, 0x00, 0xF0,       // 0100 LD SP,F000
+        0x21, 0x00, 0x20,       // 0103 LD HL,2000
+        0x01, 0x40, 0x00,       // 0106 LD BC,0040
+        0x16, 0x00,             // 0109 LD D,00
+        0x7A,                   // 010B LD A,D
+        0x86,                   // 010C ADD A,(HL)
+        0x77,                   // 010D LD (HL),A
+        0x23,                   // 010E INC HL
+        0xF5,                   // 010F PUSH AF
+        0xDC, 0x30, 0x01,       // 0110 CALL C,0130
+        0xF1,                   // 0113 POP AF
+        0xCE, 0x07,             // 0114 ADC A,07
+        0x57,                   // 0116 LD D,A
+        0x0B,                   // 0117 DEC BC
+        0x78,                   // 0118 LD A,B
+        0xB1,                   // 0119 OR C
+        0x20, 0xEF,             // 011A JR NZ,010B
+        0x7A,                   // 011C LD A,D
+        0x32, 0x00, 0x30,       // 011D LD (3000),A
+        0x06, 0x50,             // 0120 LD B,50
+        0x3E, 0x00,             // 0122 LD A,00 (the operand is modified by the following code)
+        0x3C,                   // 0124 INC A
+        0x32, 0x23, 0x01,       // 0125 LD (0123),A
+        0x10, 0xF8,             // 0128 DJNZ 0122
+        0xC3, 0x08, 0x00,       // 012A JP 0008
+        0x00, 0x00, 0x00,
+        0xE5,                   // 0130 PUSH HL
+        0x2A, 0x00, 0x30,       // 0131 LD HL,(3000)
+        0x29,                   // 0134 ADD HL,HL
+        0x22, 0x02, 0x30,       // 0135 LD (3002),HL
+        0xE1,                   // 0138 POP HL
+        0x1C,                   // 0139 INC E
+        0xD8,                   // 013A RET C
+        0xC9,                   // 013B RET
+    };
+    // clang-format on
+
+    // Loops run often enough for their code to be translated, which must make no difference at all to the results
+    Hardware interpreted;
+    Hardware translated;
+    translated.m_processor->set_engine(zcpm::Engine::TRANSLATE);
+
+    size_t cycles[2];
+    size_t i = 0;
+    for (auto hardware : { &interpreted, &translated })
+    {
+        for (uint8_t n = 0; n < 0x40; ++n)
+        {
+            hardware->m_memory[0x2000 + n] = n * 0x13 + 5;
+        }
+        hardware->load_memory_and_set_pc(0x0100, program);
+        cycles[i++] = hardware->m_processor->emulate();
+        BOOST_CHECK_EQUAL(hardware->m_processor->reg_a(), 0x50); // Only correct if the modified operand was seen
+    }
+
+    BOOST_CHECK_EQUAL(cycles[0], cycles[1]);
+    const auto r1 = interpreted.m_processor->get_registers();
+    const auto r2 = translated.m_processor->get_registers();
+    BOOST_CHECK_EQUAL(r1.AF, r2.AF);
+    BOOST_CHECK_EQUAL(r1.BC, r2.BC);
+    BOOST_CHECK_EQUAL(r1.DE, r2.DE);
+    BOOST_CHECK_EQUAL(r1.HL, r2.HL);
+    BOOST_CHECK_EQUAL(r1.SP, r2.SP);
+    BOOST_CHECK_EQUAL(r1.PC, r2.PC);
+    BOOST_CHECK(interpreted.m_memory == translated.m_memory);
+}
+
+BOOST_AUTO_TEST_CASE(test_debug_actions)
+{
+    const std::vector<uint8_t> program = {
+        0x06, 0x03,      // 0100: LD B,3
+        0x10, 0xFE,      // 0102: DJNZ 0102
+        0xC3, 0x08, 0x00 // 0104: JP 0008
+    };
+
+    Hardware hardware;
+    hardware.load_memory_and_set_pc(0x0100, program);
+
+    // Actions are listed in address order, so the passpoint becomes action #1
+    hardware.m_processor->add_action(zcpm::DebugAction::create(zcpm::DebugAction::Type::BREAKPOINT, 0x0104, "0104"));
+    hardware.m_processor->add_action(
+        zcpm::DebugAction::create(zcpm::DebugAction::Type::PASSPOINT, 0x0102, "0102", "2"));
+
+    hardware.m_processor->emulate();
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_pc(), 0x0102);
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_b(), 0x02);
+
+    BOOST_CHECK(hardware.m_processor->remove_action(1));
+    hardware.m_processor->emulate();
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_pc(), 0x0104);
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_b(), 0x00);
+
+    BOOST_CHECK(hardware.m_processor->remove_action(1));
+    BOOST_CHECK(!hardware.m_processor->remove_action(1));
+    BOOST_CHECK_EQUAL(hardware.m_processor->emulate(), 10); // Just the JP, and then termination
+}
+
+BOOST_AUTO_TEST_CASE(test_opcodes_at)
+{
+    const std::vector<uint8_t> program = {
+        0xDD, 0xFD, 0x00,      // 0100: Redundant prefixes, then NOP
+        0xDD, 0x21, 0x34, 0x12 // 0103: LD IX,1234
+    };
+
+    Hardware hardware;
+    hardware.load_memory_and_set_pc(0x0100, program);
+
+    const auto [skipped_bytes, skipped] = hardware.m_processor->get_opcodes_at(0x0100);
+    BOOST_CHECK_EQUAL(skipped, 2);
+    BOOST_CHECK_EQUAL(skipped_bytes[0], 0x00);
+    BOOST_CHECK_EQUAL(skipped_bytes[1], 0xDD);
+
+    // A prefix which the opcode needs isn't skipped
+    const auto [bytes, none] = hardware.m_processor->get_opcodes_at(0x0103);
+    BOOST_CHECK_EQUAL(none, 0);
+    BOOST_CHECK_EQUAL(bytes[0], 0xDD);
+    BOOST_CHECK_EQUAL(bytes[3], 0x12);
+}
+
+BOOST_AUTO_TEST_CASE(test_watch_map)
+{
+    zcpm::WatchMap watches;
+    BOOST_CHECK(watches.empty());
+
+    watches.add(0x00FE, 4); // Spans a page boundary
+    BOOST_CHECK(!watches.contains(0x00FD));
+    BOOST_CHECK(watches.contains(0x00FE));
+    BOOST_CHECK(watches.contains(0x0101));
+    BOOST_CHECK(!watches.contains(0x0102));
+    BOOST_CHECK(watches.contains_word(0x00FD));
+
+    watches.remove(0x00FF, 2);
+    BOOST_CHECK(watches.contains(0x00FE));
+    BOOST_CHECK(!watches.contains(0x00FF));
+    BOOST_CHECK(!watches.contains(0x0100));
+    BOOST_CHECK(watches.contains(0x0101));
+
+    watches.add(0xFFFF, 8); // Truncated rather than wrapping
+    BOOST_CHECK(watches.contains_word(0xFFFF));
+    BOOST_CHECK(!watches.contains(0x0000));
+
+    watches.clear();
+    BOOST_CHECK(watches.empty());
+    BOOST_CHECK(!watches.contains(0x00FE));
+}
+
+BOOST_AUTO_TEST_CASE(test_symbol_table)
+{
+    zcpm::SymbolTable symbols;
+    BOOST_CHECK(symbols.empty());
+    BOOST_CHECK_EQUAL(symbols.describe(0x1234), "?");
+
+    const std::vector<zcpm::SymbolTable::Label> labels{ { 0x1000, "start" }, { 0x3000, "dup" }, { 0x2000, "Loop" } };
+    symbols.load(labels, "BIOS");
+    symbols.add("ZCPM", 0x2000, "dup"); // The same label at a lower address, added later
+    BOOST_CHECK(!symbols.empty());
+
+    // Labels (whatever their case), optionally with a hex offset; or a hex value
+    using Result = std::tuple<bool, uint16_t>;
+    BOOST_CHECK((symbols.evaluate_address_expression("start") == Result{ true, 0x1000 }));
+    BOOST_CHECK((symbols.evaluate_address_expression("START+1a") == Result{ true, 0x101A }));
+    BOOST_CHECK((symbols.evaluate_address_expression("loop-10") == Result{ true, 0x1FF0 }));
+    BOOST_CHECK((symbols.evaluate_address_expression("start-") == Result{ true, 0x1000 }));
+    BOOST_CHECK((symbols.evaluate_address_expression("dup") == Result{ true, 0x2000 }));
+    BOOST_CHECK((symbols.evaluate_address_expression("fe00") == Result{ true, 0xFE00 }));
+    BOOST_CHECK(!std::get<0>(symbols.evaluate_address_expression("nowhere")));
+
+    // Addresses are described by the closest symbol at or below them (the one added last, if several share an address)
+    BOOST_CHECK_EQUAL(symbols.describe(0x0FFF), "?");
+    BOOST_CHECK_EQUAL(symbols.describe(0x1000), "BIOS:start+0000");
+    BOOST_CHECK_EQUAL(symbols.describe(0x2001), "ZCPM:dup+0001");
+    BOOST_CHECK_EQUAL(symbols.describe(0xFFFF), "BIOS:dup+CFFF");
+
+    // Symbols added or removed after a lookup are seen by the next one
+    symbols.add("ZCPM", 0x0800, "early");
+    BOOST_CHECK_EQUAL(symbols.describe(0x0FFF), "ZCPM:early+07FF");
+    symbols.remove("ZCPM");
+    BOOST_CHECK_EQUAL(symbols.describe(0x0FFF), "?");
+    BOOST_CHECK((symbols.evaluate_address_expression("dup") == Result{ true, 0x3000 }));
+
+    // The binary form makes the same table
+    zcpm::SymbolTable restored;
+    restored.restore(symbols.save());
+    BOOST_CHECK_EQUAL(restored.describe(0x2001), "BIOS:Loop+0001");
+    BOOST_CHECK((restored.evaluate_address_expression("LOOP") == Result{ true, 0x2000 }));
+}
+
+BOOST_AUTO_TEST_CASE(test_event_scheduler)
+{
+    zcpm::EventScheduler events;
+    BOOST_CHECK_EQUAL(events.next_deadline(), zcpm::EventScheduler::Never);
+
+    std::vector<int> handled;
+    events.schedule(100, [&handled]() { handled.push_back(1); });
+    const auto recurring = events.schedule(50, [&handled]() { handled.push_back(2); }, 40);
+    events.schedule(100, [&handled]() { handled.push_back(3); });
+    BOOST_CHECK_EQUAL(events.next_deadline(), 50);
+
+    events.run_due(49);
+    BOOST_CHECK(handled.empty());
+
+    // The recurrence due at 90 is already in the past, so is skipped; events due together keep their order
+    events.run_due(100);
+    BOOST_CHECK((handled == std::vector<int>{ 2, 1, 3 }));
+    BOOST_CHECK_EQUAL(events.next_deadline(), 140);
+
+    events.run_due(150);
+    BOOST_CHECK_EQUAL(handled.size(), 4);
+    BOOST_CHECK_EQUAL(events.next_deadline(), 180);
+
+    events.cancel(recurring);
+    BOOST_CHECK(events.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_halt_and_interrupt)
+{
+    Hardware hardware;
+    hardware.m_processor->reg_sp() = 0x8000;
+    hardware.load_memory_and_set_pc(0x0100, { 0xED, 0x56, 0xFB, 0x76, 0x00 }); // IM 1; EI; HALT; NOP
+
+    // A slice ends at the HALT, having used up all of its cycles (plus the 4 by which EI extends it)
+    BOOST_CHECK_EQUAL(hardware.m_processor->emulate_for(100), 104);
+    BOOST_CHECK(hardware.m_processor->is_halted());
+    BOOST_CHECK(hardware.m_processor->interrupts_enabled());
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_pc(), 0x0104);
+
+    // Accepting an interrupt resumes execution at the handler, which returns to the instruction after the HALT
+    BOOST_CHECK_EQUAL(hardware.m_processor->interrupt(0xFF), 13);
+    BOOST_CHECK(!hardware.m_processor->is_halted());
+    BOOST_CHECK(!hardware.m_processor->interrupts_enabled());
+    BOOST_CHECK_EQUAL(hardware.m_processor->reg_pc(), 0x0038);
+    BOOST_CHECK_EQUAL(hardware.read_word(0x7FFE), 0x0104);
+    BOOST_CHECK_EQUAL(hardware.m_processor->get_cycle_count(), 117);
+
+    // Further interrupts wait until they are enabled again
+    BOOST_CHECK_EQUAL(hardware.m_processor->interrupt(0xFF), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_call_latency)
+{
+    using namespace std::chrono_literals;
+
+    zcpm::CallLatency latency;
+    latency.add_call(); // Never returns, so isn't timed
+    const std::vector<zcpm::CallLatency::Duration> durations{ 500ns, 3us, 3us, 3us, 40us, 10s };
+    for (const auto duration : durations)
+    {
+        latency.add_call();
+        latency.add_time(duration);
+    }
+    BOOST_CHECK_EQUAL(latency.calls(), 7);
+    BOOST_CHECK_EQUAL(latency.timed(), 6);
+    BOOST_CHECK(latency.max() == 10s);
+
+    // Under 1us, then 2-4us, then 32-64us; anything beyond the last bucket's lower limit is kept there
+    const auto& buckets = latency.buckets();
+    BOOST_CHECK_EQUAL(buckets[0], 1);
+    BOOST_CHECK_EQUAL(buckets[2], 3);
+    BOOST_CHECK_EQUAL(buckets[6], 1);
+    BOOST_CHECK_EQUAL(buckets[zcpm::CallLatency::Buckets - 1], 1);
+    BOOST_CHECK_EQUAL(latency.percentile_us(0.5), 4);
+    BOOST_CHECK_EQUAL(latency.percentile_us(0.75), 64);
+}
+
+BOOST_AUTO_TEST_CASE(test_disk_geometry)
+{
+    // The default is the disk synthesised from the current directory
+    const zcpm::DiskGeometry host;
+    BOOST_CHECK_EQUAL(host.blm(), 0x0F);
+    BOOST_CHECK_EQUAL(host.exm(), 0x00);
+    BOOST_CHECK_EQUAL(host.directory_blocks(), 16);
+    BOOST_CHECK_EQUAL(host.allocation(), 0xFFFF);
+
+    // An 8" single density floppy disk; 1KB blocks, 64 directory entries & 2 reserved tracks
+    zcpm::DiskGeometry floppy;
+    std::istringstream("26,3,242,63,2") >> floppy;
+    BOOST_CHECK_EQUAL(floppy.spt, 26);
+    BOOST_CHECK_EQUAL(floppy.exm(), 0x00);
+    BOOST_CHECK_EQUAL(floppy.allocation(), 0xC000);
+    BOOST_CHECK_EQUAL(floppy.sectors(), 2 * 26 + 243 * 8);
+
+    // 16KB blocks with 8-bit block numbers means that a directory entry covers 16 extents
+    zcpm::DiskGeometry large;
+    std::istringstream("0x20,7,0xC8,0x7F,0") >> large;
+    BOOST_CHECK_EQUAL(large.exm(), 0x0F);
+    BOOST_CHECK_EQUAL(large.directory_blocks(), 1);
+
+    for (const auto* s : { "26,3,242,63", "26,2,242,63,2", "26,3,300,63,2", "26,4,4096,63,2", "26,3,242,1023,2" })
+    {
+        zcpm::DiskGeometry invalid;
+        std::istringstream in(s);
+        BOOST_CHECK_THROW(in >> invalid, boost::program_options::validation_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_lazy_flags)
+{
+    const std::vector<std::vector<uint8_t>> operations = {
+        { 0x80 },       { 0x88 },       { 0x90 },       { 0x98 },       { 0xA0 },       { 0xA8 },
+        { 0xB0 },       { 0xB8 },       { 0x04 },       { 0x05 },       { 0xCB, 0x00 }, { 0xCB, 0x08 },
+        { 0xCB, 0x10 }, { 0xCB, 0x18 }, { 0xCB, 0x20 }, { 0xCB, 0x28 }, { 0xCB, 0x30 }, { 0xCB, 0x38 },
+    };
+    const std::vector<uint8_t> operands = { 0x00, 0x01, 0x0F, 0x10, 0x55, 0x7F, 0x80, 0xFF };
+
+    Hardware eager;
+    Hardware lazy;
+    lazy.m_processor->set_lazy_flags(true);
+
+    // Each operation is followed by INC C (which needs just the carry) and PUSH AF (which needs all of F)
+    for (const auto& operation : operations)
+    {
+        auto program = operation;
+        program.push_back(0x0C);
+        program.push_back(0xF5);
+
+        for (int a = 0; a < 0x100; ++a)
+        {
+            for (const auto b : operands)
+            {
+                for (const uint8_t f : { 0x00, 0x01, 0xFE })
+                {
+                    for (auto hardware : { &eager, &lazy })
+                    {
+                        hardware->load_memory_and_set_pc(0x0100, program);
+                        hardware->m_processor->reg_af() = (a << 8) | f;
+                        hardware->m_processor->reg_bc() = (b << 8) | 0x7F;
+                        hardware->m_processor->reg_sp() = 0x8000;
+                    }
+                    for (int step = 0; step < 3; ++step)
+                    {
+                        eager.m_processor->emulate_instruction();
+                        lazy.m_processor->emulate_instruction();
+                        BOOST_REQUIRE_EQUAL(eager.m_processor->get_af(), lazy.m_processor->get_af());
+                    }
+                    BOOST_REQUIRE_EQUAL(eager.m_memory[0x7FFE], lazy.m_memory[0x7FFE]);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_8080_mode)
+{
+    Hardware eager;
+    Hardware lazy;
+    lazy.m_processor->set_lazy_flags(true);
+
+    // ADD B, SUB B, ANA B from the same starting A and B, each giving the 8080's flags (bit 1 set, no X/Y, P always
+    // parity, and the auxiliary carry differing from the Z80's H for subtraction and AND)
+    struct Case
+    {
+        uint8_t opcode;
+        uint8_t a;
+        uint8_t b;
+        uint8_t result;
+        uint8_t flags;
+    };
+    for (const auto& c : { Case{ 0x80, 0x7F, 0x01, 0x80, 0x92 },
+                           Case{ 0x90, 0x10, 0x01, 0x0F, 0x06 },
+                           Case{ 0xA0, 0x08, 0x01, 0x00, 0x56 },
+                           Case{ 0x3D, 0x10, 0x00, 0x0F, 0x06 } })
+    {
+        for (auto hardware : { &eager, &lazy })
+        {
+            hardware->m_processor->set_cpu(zcpm::Cpu::I8080);
+            hardware->load_memory_and_set_pc(0x0100, { c.opcode, 0xF5 }); // op; PUSH PSW
+            hardware->m_processor->reg_af() = (c.a << 8) | 0x02;
+            hardware->m_processor->reg_b() = c.b;
+            hardware->m_processor->reg_sp() = 0x8000;
+            hardware->m_processor->emulate_instruction();
+            hardware->m_processor->emulate_instruction();
+            BOOST_CHECK_EQUAL(hardware->read_word(0x7FFE), (c.result << 8) | c.flags);
+        }
+    }
+
+    // POP PSW can't set the bits which are fixed on an 8080
+    Hardware hardware;
+    hardware.m_processor->set_cpu(zcpm::Cpu::I8080);
+    hardware.load_memory_and_set_pc(0x0100, { 0x01, 0xFF, 0x12, 0xC5, 0xF1 }); // LXI B,12FFH; PUSH B; POP PSW
+    hardware.m_processor->reg_sp() = 0x8000;
+    for (int step = 0; step < 3; ++step)
+    {
+        hardware.m_processor->emulate_instruction();
+    }
+    BOOST_CHECK_EQUAL(hardware.m_processor->get_af(), 0x12D7);
+
+    // Z80-only instructions are an error
+    const std::vector<std::vector<uint8_t>> z80_only = { { 0x18, 0x00 }, { 0xDD, 0x21, 0x00, 0x00 }, { 0xD9 } };
+    for (const auto& program : z80_only)
+    {
+        hardware.load_memory_and_set_pc(0x0100, program);
+        BOOST_CHECK_THROW(hardware.m_processor->emulate_instruction(), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_profiler)
+{
+    // clang-format off
+    const std::vector<uint8_t> program = {
+        0x31, 0x00, 0xF0,       // 0100 LD SP,F000
+        0xCD, 0x10, 0x01,       // 0103 CALL 0110
+        0xCD, 0x10, 0x01,       // 0106 CALL 0110
+        0xC3, 0x08, 0x00,       // 0109 JP 0008
+        0x00, 0x00, 0x00, 0x00,
+        0xCD, 0x18, 0x01,       // 0110 CALL 0118
+        0xC9,                   // 0113 RET
+        0x00, 0x00, 0x00, 0x00,
+        0x00,                   // 0118 NOP
+        0xC9,                   // 0119 RET
+    };
+    // clang-format on
+
+    // Translated code would skip the recording, so every engine gives the same profile
+    for (const auto engine : { zcpm::Engine::INTERPRETER, zcpm::Engine::BLOCK_CACHE, zcpm::Engine::TRANSLATE })
+    {
+        Hardware hardware;
+        BOOST_CHECK(hardware.m_processor->profiler() == nullptr);
+        hardware.m_processor->set_engine(engine);
+        hardware.m_processor->enable_profiler();
+        hardware.load_memory_and_set_pc(0x0100, program);
+        const auto cycles = hardware.m_processor->emulate();
+
+        const auto* p_profiler = hardware.m_processor->profiler();
+        BOOST_REQUIRE(p_profiler != nullptr);
+        BOOST_CHECK_EQUAL(p_profiler->count(0x0103), 1);
+        BOOST_CHECK_EQUAL(p_profiler->count(0x0110), 2);
+        BOOST_CHECK_EQUAL(p_profiler->count(0x0118), 2);
+        BOOST_CHECK_EQUAL(p_profiler->count(0x0008), 0);
+        BOOST_CHECK_EQUAL(p_profiler->cycles(0x0110), 2 * p_profiler->cycles(0x0103));
+
+        // Each CALL is charged to the caller and each RET to the callee, so the top level has everything up to the
+        // first CALL, both CALLs and the JP; and every cycle appears in exactly one stack
+        const auto top_level = p_profiler->cycles(0x0100) + 2 * p_profiler->cycles(0x0103) + p_profiler->cycles(0x0109);
+        const auto outer = p_profiler->cycles(0x0110) + p_profiler->cycles(0x0113);
+        const auto inner = p_profiler->cycles(0x0118) + p_profiler->cycles(0x0119);
+        BOOST_CHECK_EQUAL(top_level + outer + inner, cycles);
+
+        std::ostringstream stacks;
+        p_profiler->write_collapsed_stacks(stacks, [](uint16_t address) { return std::to_string(address); });
+        BOOST_CHECK_EQUAL(stacks.str(),
+                          "[top] " + std::to_string(top_level) + "\n[top];272 " + std::to_string(outer) +
+                              "\n[top];272;280 " + std::to_string(inner) + "\n");
+
+        std::ostringstream report;
+        p_profiler->write_report(report, [](uint16_t) { return "?"; }, { .bdos = 0x0110, .bios = 0x0118 });
+        BOOST_CHECK(report.str().starts_with("Profile of 12 instructions, " + std::to_string(cycles) + " cycles\n"));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_trace_recorder)
+{
+    // clang-format off
+    const std::vector<uint8_t> program = {
+        0x31, 0x00, 0xF0,       // 0100 LD SP,F000
+        0x21, 0x34, 0x12,       // 0103 LD HL,1234
+        0xE5,                   // 0106 PUSH HL
+        0x22, 0x00, 0x30,       // 0107 LD (3000),HL
+        0xC3, 0x08, 0x00,       // 010A JP 0008
+    };
+    // clang-format on
+
+    // As with profiling, translated code would skip the recording, so every engine gives the same history
+    for (const auto engine : { zcpm::Engine::INTERPRETER, zcpm::Engine::BLOCK_CACHE, zcpm::Engine::TRANSLATE })
+    {
+        Hardware hardware;
+        BOOST_CHECK(hardware.m_processor->recorder() == nullptr);
+        hardware.m_processor->set_engine(engine);
+        hardware.m_processor->start_recording(3);
+        hardware.load_memory_and_set_pc(0x0100, program);
+        hardware.m_processor->emulate();
+        hardware.m_processor->stop_recording();
+
+        // Only the last 3 instructions are kept, and the loading of the program isn't taken as a write by any of them
+        const auto* p_recorder = hardware.m_processor->recorder();
+        BOOST_REQUIRE(p_recorder != nullptr);
+        BOOST_CHECK_EQUAL(p_recorder->total(), 5);
+        const auto records = p_recorder->latest(10);
+        BOOST_REQUIRE_EQUAL(records.size(), 3);
+
+        const auto& push = records[0];
+        BOOST_CHECK_EQUAL(push.m_address, 0x0106);
+        BOOST_CHECK_EQUAL(push.m_bytes[0], 0xE5);
+        BOOST_CHECK_EQUAL(push.m_registers.SP, 0xEFFE);
+        BOOST_CHECK_EQUAL(push.m_registers.PC, 0x0107);
+        BOOST_REQUIRE_EQUAL(push.m_write_count, 2);
+        for (size_t i = 0; i < 2; ++i)
+        {
+            const auto address = push.m_write_addresses[i];
+            BOOST_CHECK(address == 0xEFFE || address == 0xEFFF);
+            BOOST_CHECK_EQUAL(push.m_write_values[i], (address == 0xEFFE) ? 0x34 : 0x12);
+        }
+
+        const auto& store = records[1];
+        BOOST_CHECK_EQUAL(store.m_address, 0x0107);
+        BOOST_CHECK_EQUAL(store.m_bytes[0], 0x22);
+        BOOST_CHECK_EQUAL(store.m_bytes[1], 0x00);
+        BOOST_CHECK_EQUAL(store.m_bytes[2], 0x30);
+        BOOST_CHECK_EQUAL(store.m_registers.HL, 0x1234);
+        BOOST_REQUIRE_EQUAL(store.m_write_count, 2);
+        BOOST_CHECK_EQUAL(store.m_write_addresses[0], 0x3000);
+        BOOST_CHECK_EQUAL(store.m_write_values[0], 0x34);
+        BOOST_CHECK_EQUAL(store.m_write_addresses[1], 0x3001);
+        BOOST_CHECK_EQUAL(store.m_write_values[1], 0x12);
+
+        const auto& jump = records[2];
+        BOOST_CHECK_EQUAL(jump.m_address, 0x010A);
+        BOOST_CHECK_EQUAL(jump.m_registers.PC, 0x0008);
+        BOOST_CHECK_EQUAL(jump.m_write_count, 0);
+
+        // Once stopped, running again adds nothing
+        hardware.load_memory_and_set_pc(0x0100, program);
+        hardware.m_processor->emulate();
+        BOOST_CHECK_EQUAL(p_recorder->total(), 5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_call_trace)
+{
+    using zcpm::CallTrace;
+
+    const auto decode = [](const CallTrace& trace)
+    {
+        std::vector<std::string> lines;
+        trace.decode([](uint16_t address) { return std::to_string(address); },
+                     [](const CallTrace::Record& record) { return std::to_string(record.m_bc & 0xFF); },
+                     [&lines](const std::string& line) { lines.push_back(line); });
+        return lines;
+    };
+    const auto record = [](uint64_t n)
+    {
+        const auto kind = (n % 2) ? CallTrace::Kind::BDOS : CallTrace::Kind::BIOS;
+        return CallTrace::Record{ n * 100,
+                                  static_cast<uint16_t>(n),
+                                  static_cast<uint16_t>(n + 10),
+                                  0x1234,
+                                  0xABCD,
+                                  0x5A,
+                                  kind,
+                                  static_cast<uint8_t>(n) };
+    };
+
+    // Until the buffer fills up, every call is there
+    CallTrace trace(3);
+    trace.add(record(1));
+    trace.add(record(2));
+    BOOST_CHECK((decode(trace) == std::vector<std::string>{
+                     "Call trace: the last 2 of 2 calls",
+                     "         100 BDOS 11                  A=5A BC=000B DE=1234 HL=ABCD << 1",
+                     "         200 BIOS fn#2 CONST          A=5A BC=000C DE=1234 HL=ABCD << 2" }));
+
+    // After that, the oldest are replaced, and the rest still come out oldest first
+    trace.add(record(3));
+    trace.add(record(4));
+    trace.add(record(5));
+    BOOST_CHECK_EQUAL(trace.total(), 5);
+    BOOST_CHECK((decode(trace) == std::vector<std::string>{
+                     "Call trace: the last 3 of 5 calls",
+                     "         300 BDOS 13                  A=5A BC=000D DE=1234 HL=ABCD << 3",
+                     "         400 BIOS fn#4 CONOUT         A=5A BC=000E DE=1234 HL=ABCD << 4",
+                     "         500 BDOS 15                  A=5A BC=000F DE=1234 HL=ABCD << 5" }));
+}
+
+BOOST_AUTO_TEST_CASE(test_checkpoints)
+{
+    using zcpm::Checkpoints;
+
+    std::vector<uint8_t> memory(0x10000, 0x00);
+    Checkpoints::DirtyPages dirty{};
+    zcpm::Processor::State processor{};
+    const zcpm::Bios::State bios{ 0, 0, 0x0080 };
+
+    // The first checkpoint keeps all of memory, and later ones only the dirty pages
+    Checkpoints checkpoints(3);
+    processor.cycle_count = 100;
+    checkpoints.add(processor, bios, 0, {}, memory, dirty);
+    BOOST_CHECK_EQUAL(checkpoints.at(0).pages.size(), Checkpoints::PageCount);
+
+    memory[0x1234] = 0x11;
+    dirty[0x12] = true;
+    processor.cycle_count = 200;
+    checkpoints.add(processor, bios, 1, {}, memory, dirty);
+    BOOST_CHECK_EQUAL(checkpoints.at(1).pages.size(), 1);
+    dirty.fill(false);
+
+    memory[0x1234] = 0x22;
+    memory[0x5678] = 0x33;
+    dirty[0x12] = dirty[0x56] = true;
+    processor.cycle_count = 300;
+    checkpoints.add(processor, bios, 2, {}, memory, dirty);
+    dirty.fill(false);
+
+    BOOST_CHECK(!checkpoints.latest_before(100).has_value());
+    BOOST_CHECK_EQUAL(checkpoints.latest_before(101).value(), 0);
+    BOOST_CHECK_EQUAL(checkpoints.latest_before(300).value(), 1);
+    BOOST_CHECK_EQUAL(checkpoints.latest_before(1000).value(), 2);
+
+    // Each page is found as it was at the requested checkpoint
+    BOOST_CHECK_EQUAL(checkpoints.page_at(0, 0x12)[0x34], 0x00);
+    BOOST_CHECK_EQUAL(checkpoints.page_at(1, 0x12)[0x34], 0x11);
+    BOOST_CHECK_EQUAL(checkpoints.page_at(2, 0x12)[0x34], 0x22);
+    BOOST_CHECK_EQUAL(checkpoints.page_at(1, 0x56)[0x78], 0x00);
+    BOOST_CHECK_EQUAL(checkpoints.page_at(2, 0x56)[0x78], 0x33);
+
+    // Going back to the first checkpoint means restoring whatever any later one kept, and anything dirty since
+    dirty[0x9A] = true;
+    const auto changed = checkpoints.changed_since(0, dirty);
+    for (size_t number = 0; number < Checkpoints::PageCount; ++number)
+    {
+        BOOST_CHECK_EQUAL(changed[number], (number == 0x12) || (number == 0x56) || (number == 0x9A));
+    }
+
+    // Beyond the limit, the oldest checkpoint is merged into the next
+    processor.cycle_count = 400;
+    checkpoints.add(processor, bios, 3, {}, memory, dirty);
+    BOOST_CHECK_EQUAL(checkpoints.size(), 3);
+    BOOST_CHECK_EQUAL(checkpoints.at(0).processor.cycle_count, 200);
+    BOOST_CHECK_EQUAL(checkpoints.at(0).pages.size(), Checkpoints::PageCount);
+    BOOST_CHECK_EQUAL(checkpoints.page_at(0, 0x12)[0x34], 0x11);
+    BOOST_CHECK_EQUAL(checkpoints.page_at(0, 0x56)[0x78], 0x00);
+
+    // Sectors written since the checkpoint which is gone back to are forgotten, along with any later checkpoints
+    checkpoints.latest().sectors.push_back({ 1, 2, {} });
+    checkpoints.truncate(1);
+    BOOST_CHECK_EQUAL(checkpoints.size(), 2);
+    BOOST_CHECK(checkpoints.latest().sectors.empty());
+    BOOST_CHECK_EQUAL(checkpoints.latest().input_position, 2);
+}
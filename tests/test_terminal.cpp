@@ -0,0 +1,423 @@
+#include <zcpm/terminal/batch.hpp>
+#include <zcpm/terminal/escapeparser.hpp>
+#include <zcpm/terminal/keymap.hpp>
+#include <zcpm/terminal/screen.hpp>
+#include <zcpm/terminal/terminal.hpp>
+
+#include <boost/test/unit_test.hpp>
+#include <fmt/core.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <ncurses.h>
+#include <unistd.h>
+
+// This module tests the parts of the terminals which deal with the characters passing through them, without needing
+// a host terminal.
+
+namespace
+{
+
+    using zcpm::terminal::EscapeParser;
+
+    // Start a sequence and then add the characters which follow the ESC, all but the last of which must leave it
+    // incomplete; returns the status after the last one
+    EscapeParser::Status parse(EscapeParser& parser, std::string_view sequence)
+    {
+        parser.start();
+        for (size_t i = 0; i + 1 < sequence.size(); ++i)
+        {
+            BOOST_CHECK(parser.add(sequence[i]) == EscapeParser::Status::INCOMPLETE);
+        }
+        return parser.add(sequence.back());
+    }
+
+    std::vector<int> parameters(const EscapeParser& parser)
+    {
+        return { parser.parameters().begin(), parser.parameters().end() };
+    }
+
+    // A temporary file, which starts with the specified contents and is removed afterwards
+    class TemporaryFile final
+    {
+    public:
+        TemporaryFile(std::string_view suffix, std::string_view contents)
+            : m_path(std::filesystem::temp_directory_path() / fmt::format("zcpm-test-{:d}.{}", ::getpid(), suffix))
+        {
+            std::ofstream(m_path, std::ios::binary) << contents;
+        }
+
+        TemporaryFile(const TemporaryFile&) = delete;
+        TemporaryFile& operator=(const TemporaryFile&) = delete;
+        TemporaryFile(TemporaryFile&&) = delete;
+        TemporaryFile& operator=(TemporaryFile&&) = delete;
+
+        ~TemporaryFile()
+        {
+            std::error_code ec;
+            std::filesystem::remove(m_path, ec);
+        }
+
+        [[nodiscard]] std::string name() const
+        {
+            return m_path.string();
+        }
+
+        [[nodiscard]] std::string read() const
+        {
+            std::ifstream in(m_path, std::ios::binary);
+            return { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+        }
+
+    private:
+        const std::filesystem::path m_path;
+    };
+
+    // Translate each of the keys in turn, returning everything that they generate
+    std::string translate(zcpm::Keymap& keymap, std::string_view keys)
+    {
+        std::string result;
+        for (const auto key : keys)
+        {
+            result += keymap.translate(static_cast<uint8_t>(key));
+        }
+        return result;
+    }
+
+    // A terminal with a screen but no display, so that what would be written to one can be checked
+    class ScreenTerminal final : public zcpm::terminal::Terminal
+    {
+    public:
+        ScreenTerminal(int rows, int columns) : Terminal(rows, columns)
+        {
+        }
+
+        ScreenTerminal(const ScreenTerminal&) = delete;
+        ScreenTerminal& operator=(const ScreenTerminal&) = delete;
+        ScreenTerminal(ScreenTerminal&&) = delete;
+        ScreenTerminal& operator=(ScreenTerminal&&) = delete;
+
+        ~ScreenTerminal() override = default;
+
+        void print(char ch) override
+        {
+            m_screen.put(ch);
+        }
+
+        [[nodiscard]] bool is_character_ready() const override
+        {
+            return false;
+        }
+
+        char get_char() override
+        {
+            return 0;
+        }
+
+        [[nodiscard]] zcpm::terminal::Screen& screen()
+        {
+            return m_screen;
+        }
+
+        // What the display would be sent to bring it up to date with the screen
+        [[nodiscard]] std::string update() const
+        {
+            return take_ansi_output();
+        }
+    };
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_escape_vt100)
+{
+    EscapeParser parser(EscapeParser::Dialect::VT100);
+
+    // Parameters which are present, omitted or empty (an omitted parameter is zero)
+    BOOST_CHECK(parse(parser, "[12;34H") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.intro(), '[');
+    BOOST_CHECK_EQUAL(parser.final(), 'H');
+    BOOST_CHECK(parameters(parser) == std::vector<int>({ 12, 34 }));
+    BOOST_CHECK(!parser.is_private());
+    BOOST_CHECK_EQUAL(parser.text(), "\033[12;34H");
+
+    BOOST_CHECK(parse(parser, "[H") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parameters(parser).empty());
+
+    BOOST_CHECK(parse(parser, "[;5H") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parameters(parser) == std::vector<int>({ 0, 5 }));
+
+    BOOST_CHECK(parse(parser, "[7;H") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parameters(parser) == std::vector<int>({ 7, 0 }));
+
+    BOOST_CHECK(parse(parser, "[;;m") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parameters(parser) == std::vector<int>({ 0, 0, 0 }));
+
+    // A value which is too large is limited, rather than overflowing
+    BOOST_CHECK(parse(parser, "[99999999999999999999;2H") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parameters(parser) == std::vector<int>({ 9999, 2 }));
+
+    // As many parameters as there is room for, and then one too many
+    BOOST_CHECK(parse(parser, "[;;;;;;;;;;;;;;;m") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.parameters().size(), EscapeParser::MaxParameters);
+    BOOST_CHECK(parse(parser, "[;;;;;;;;;;;;;;;;") == EscapeParser::Status::INVALID);
+
+    // Private parameters, and intermediate characters
+    BOOST_CHECK(parse(parser, "[?25l") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parser.is_private());
+    BOOST_CHECK_EQUAL(parser.final(), 'l');
+    BOOST_CHECK(parameters(parser) == std::vector<int>({ 25 }));
+    BOOST_CHECK(parse(parser, "[2 q") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(!parser.is_private());
+    BOOST_CHECK_EQUAL(parser.final(), 'q');
+
+    // A control character can't be part of a control sequence
+    BOOST_CHECK(parse(parser, "[1\r") == EscapeParser::Status::INVALID);
+
+    // Sequences which aren't control sequences, of one character or (for character set selection) two
+    BOOST_CHECK(parse(parser, "7") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.intro(), '7');
+    BOOST_CHECK(parse(parser, "(B") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.argument(0), 'B');
+    BOOST_CHECK(parse(parser, "\x80") == EscapeParser::Status::INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(test_escape_televideo)
+{
+    EscapeParser parser(EscapeParser::Dialect::TELEVIDEO);
+
+    // Cursor addressing, with the row and column offset by a space
+    BOOST_CHECK(parse(parser, "= )") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.intro(), '=');
+    BOOST_CHECK_EQUAL(parser.argument(0) - ' ', 0);
+    BOOST_CHECK_EQUAL(parser.argument(1) - ' ', 9);
+
+    // Attribute selection
+    BOOST_CHECK(parse(parser, "G4") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.intro(), 'G');
+    BOOST_CHECK_EQUAL(parser.argument(0), '4');
+
+    // Anything else is a single character, including what would start an ANSI control sequence
+    BOOST_CHECK(parse(parser, "*") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parse(parser, "[") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parameters(parser).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_escape_limits)
+{
+    EscapeParser parser(EscapeParser::Dialect::VT100);
+
+    // Nothing can be added without a sequence in progress
+    BOOST_CHECK(!parser.active());
+    BOOST_CHECK(parser.add('[') == EscapeParser::Status::INVALID);
+
+    // A sequence can be as long as there is room for, including the ESC
+    const std::string digits(EscapeParser::MaxLength - 3, '1');
+    BOOST_CHECK(parse(parser, "[" + digits + "m") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.text().size(), EscapeParser::MaxLength);
+    BOOST_CHECK(parse(parser, "[" + digits + "1m") == EscapeParser::Status::INVALID);
+
+    // Starting again abandons a sequence in progress, and reset() finishes with it
+    parser.start();
+    BOOST_CHECK(parser.add('[') == EscapeParser::Status::INCOMPLETE);
+    BOOST_CHECK(parser.add('3') == EscapeParser::Status::INCOMPLETE);
+    BOOST_CHECK(parse(parser, "[m") == EscapeParser::Status::COMPLETE);
+    BOOST_CHECK(parameters(parser).empty());
+    BOOST_CHECK(parser.active());
+    parser.reset();
+    BOOST_CHECK(!parser.active());
+}
+
+BOOST_AUTO_TEST_CASE(test_keymap)
+{
+    const TemporaryFile file("keymap",
+                             "KEY_RIGHT ^D\n"
+                             "# Control-right and control-left on an xterm\n"
+                             "^[[1;5C ^F\n"
+                             "^[[1;5D ^A\n"
+                             "^[[A ^E\n"
+                             "^[[A ^R\n"
+                             "^[O ^X\n"
+                             "^[OP ^KD\n"
+                             "# ^[[B ^Z\n");
+    zcpm::Keymap keymap(file.name());
+
+    // Single keys, whether mapped or not
+    BOOST_CHECK_EQUAL(keymap.translate(KEY_RIGHT), "\x04");
+    BOOST_CHECK_EQUAL(keymap.translate('a'), "a");
+
+    // Nothing is generated until a sequence is complete, and only the first mapping of a sequence counts
+    for (const auto ch : std::string_view("\033[1;5"))
+    {
+        BOOST_CHECK(keymap.translate(ch).empty());
+    }
+    BOOST_CHECK_EQUAL(keymap.translate('C'), "\x06");
+    BOOST_CHECK_EQUAL(translate(keymap, "\033[1;5D"), "\x01");
+    BOOST_CHECK_EQUAL(translate(keymap, "\033[A"), "\x05");
+    BOOST_CHECK_EQUAL(translate(keymap, "\033[B"), "\033[B");
+
+    // A sequence which turns out not to be mapped is passed through as it is
+    BOOST_CHECK_EQUAL(translate(keymap, "\033[1;5X"), "\033[1;5X");
+
+    // The longest mapped sequence wins, even when a shorter one is mapped too
+    BOOST_CHECK_EQUAL(translate(keymap, "\033OP"), "\x0B" "D");
+    BOOST_CHECK_EQUAL(translate(keymap, "\033OQ"), "\x18Q");
+
+    // Keys which are held back as the possible start of a sequence are translated as they stand when flushed
+    BOOST_CHECK(translate(keymap, "\033O").empty());
+    BOOST_CHECK_EQUAL(keymap.flush(), "\x18");
+    BOOST_CHECK(translate(keymap, "\033[1;").empty());
+    BOOST_CHECK_EQUAL(keymap.flush(), "\033[1;");
+    BOOST_CHECK(keymap.flush().empty());
+    BOOST_CHECK_EQUAL(translate(keymap, "\033OP"), "\x0B" "D");
+}
+
+BOOST_AUTO_TEST_CASE(test_keymap_errors)
+{
+    // Without a keymap, everything passes through
+    zcpm::Keymap keymap("");
+    BOOST_CHECK_EQUAL(translate(keymap, "\033[A"), "\033[A");
+
+    BOOST_CHECK_THROW(zcpm::Keymap("/nonexistent/zcpm.keymap"), std::runtime_error);
+    {
+        const TemporaryFile file("keymap", "KEY_NONSUCH ^D\n");
+        BOOST_CHECK_THROW(zcpm::Keymap(file.name()), std::runtime_error);
+    }
+    {
+        const TemporaryFile file("keymap", "^[[1;2;3;4;5C ^D\n");
+        BOOST_CHECK_THROW(zcpm::Keymap(file.name()), std::runtime_error);
+    }
+}
+
+// Only the rows which something has changed are marked as dirty, until they have been shown
+BOOST_AUTO_TEST_CASE(test_screen_dirty_rows)
+{
+    using zcpm::terminal::Screen;
+
+    Screen screen(4, 10);
+    const auto dirty = [&screen]()
+    {
+        std::vector<int> rows;
+        for (auto row = 0; row < screen.rows(); ++row)
+        {
+            if (screen.is_dirty(row))
+            {
+                rows.push_back(row);
+            }
+        }
+        screen.mark_clean();
+        return rows;
+    };
+    BOOST_CHECK(dirty().empty());
+
+    screen.set_cursor(1, 8);
+    BOOST_CHECK(dirty().empty());
+    screen.put('a');
+    screen.put('b');
+    screen.put('c'); // Overwrites the 'b', since the cursor stays in the last column
+    BOOST_CHECK((dirty() == std::vector<int>{ 1 }));
+    BOOST_CHECK_EQUAL(screen.cells(1)[9].m_ch, 'c');
+    BOOST_CHECK_EQUAL(screen.column(), 9);
+
+    screen.set_cursor(2, 3);
+    screen.clear_to_end_of_row();
+    BOOST_CHECK((dirty() == std::vector<int>{ 2 }));
+    screen.clear_to_bottom();
+    BOOST_CHECK((dirty() == std::vector<int>{ 2, 3 }));
+    screen.insert_row();
+    BOOST_CHECK((dirty() == std::vector<int>{ 2, 3 }));
+    screen.set_cursor(0, 0);
+    screen.delete_row();
+    BOOST_CHECK((dirty() == std::vector<int>{ 0, 1, 2, 3 }));
+    screen.scroll_up();
+    BOOST_CHECK((dirty() == std::vector<int>{ 0, 1, 2, 3 }));
+    BOOST_CHECK_EQUAL(screen.row(), 0);
+}
+
+// The ANSI display is sent just the changed rows, each in full up to its trailing blanks which are erased instead, with
+// attributes changed only where they need to be; and then the cursor, if it has moved
+BOOST_AUTO_TEST_CASE(test_ansi_rendering)
+{
+    using zcpm::terminal::Screen;
+
+    ScreenTerminal terminal(3, 10);
+    auto& screen = terminal.screen();
+    screen.set_cursor(1, 0);
+    terminal.write("a");
+    screen.add_attributes(Screen::Bold | Screen::Blink);
+    terminal.write("bc");
+    screen.set_cursor(2, 0);
+    screen.set_attributes(Screen::Reverse);
+    terminal.write("x");
+    screen.set_attributes(Screen::Normal);
+    terminal.write("y");
+    BOOST_CHECK_EQUAL(terminal.update(),
+                      "\033[2;1H\033[0ma\033[0;1;5mbc\033[0m\033[K"
+                      "\033[3;1H\033[0;7mx\033[0my\033[K"
+                      "\033[3;3H");
+
+    // Nothing has changed since
+    BOOST_CHECK_EQUAL(terminal.update(), "");
+    screen.set_cursor(0, 4);
+    BOOST_CHECK_EQUAL(terminal.update(), "\033[1;5H");
+
+    // A row which is full to the end has nothing to erase
+    screen.set_cursor(0, 0);
+    terminal.write("0123456789");
+    BOOST_CHECK_EQUAL(terminal.update(), "\033[1;1H\033[0m0123456789\033[1;10H");
+}
+
+BOOST_AUTO_TEST_CASE(test_batch_terminal)
+{
+    // Host newlines (LF or CR LF) become the CR of the Enter key, and DEL becomes backspace
+    const TemporaryFile input("input", "dir\r\ntype foo\n\r\rab\x7F\x01");
+    const TemporaryFile output("output", "");
+    {
+        zcpm::terminal::Batch batch(24, 80, input.name(), output.name());
+
+        std::string keystrokes;
+        while (batch.is_character_ready())
+        {
+            BOOST_CHECK(!batch.is_input_exhausted());
+            BOOST_CHECK(batch.wait_for_character(100));
+            keystrokes += batch.get_char();
+        }
+        BOOST_CHECK_EQUAL(keystrokes, "dir\rtype foo\r\r\rab\b\x01");
+
+        // Once the input is used up, reading gives 0xFF and doesn't wait
+        BOOST_CHECK(!batch.wait_for_character(60000));
+        BOOST_CHECK_EQUAL(batch.get_char(), static_cast<char>(0xFF));
+        BOOST_CHECK(batch.is_input_exhausted());
+
+        // Output is passed through as it is, when the terminal is finished with
+        batch.print('A');
+        batch.write("\r\nB\tC\033[H");
+        BOOST_CHECK(output.read().empty());
+    }
+    BOOST_CHECK_EQUAL(output.read(), "A\r\nB\tC\033[H");
+
+    // The end of the input needn't end the run
+    {
+        zcpm::terminal::Batch batch(24, 80, input.name(), output.name(), false);
+        while (batch.is_character_ready())
+        {
+            (void)batch.get_char();
+        }
+        BOOST_CHECK(!batch.is_input_exhausted());
+    }
+
+    // Empty input is used up from the start
+    {
+        const TemporaryFile empty("empty", "");
+        zcpm::terminal::Batch batch(24, 80, empty.name(), output.name());
+        BOOST_CHECK(!batch.is_character_ready());
+        BOOST_CHECK(batch.is_input_exhausted());
+    }
+
+    BOOST_CHECK_THROW(zcpm::terminal::Batch(24, 80, "/nonexistent/zcpm.input", output.name()), std::runtime_error);
+}